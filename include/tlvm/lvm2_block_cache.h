@@ -0,0 +1,100 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_block_cache.h - LRU cache of device blocks.
+ *
+ * A block cache holds a fixed number of fixed-size blocks, keyed by device and
+ * block aligned offset, and evicts the least recently used block when it is
+ * full. It is attached to a device with lvm2_device_set_block_cache, after
+ * which lvm2_device_read serves reads from the cache where it can, so that
+ * sectors that are read more than once during a scan (labels, mda_headers)
+ * only hit the device once.
+ *
+ * The cache is not thread safe. Callers that share a cache between threads
+ * must serialize all calls into it with a lock of their own. The fill function
+ * is called with that lock held and may release it while it reads, as long as
+ * it takes it again before returning; the cache sets the block being filled
+ * aside so that other threads can use it in the meantime.
+ */
+
+#if !defined(_LIBTLVM_LVM2_BLOCK_CACHE_H)
+#define _LIBTLVM_LVM2_BLOCK_CACHE_H
+
+#include "lvm2_device.h"
+#include "lvm2_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default size of a cached block. */
+#define LVM2_BLOCK_CACHE_BLOCK_SIZE 4096
+
+struct lvm2_block_cache;
+
+struct lvm2_block_cache_stats {
+	u64 hits;		/**< Blocks served from the cache. */
+	u64 misses;		/**< Blocks read from the device. */
+	u64 bypassed;		/**< Reads that didn't go through the cache. */
+	size_t blocks;		/**< Blocks currently cached. */
+};
+
+/**
+ * Reads the aligned range [pos, pos + count) of 'dev' into 'buf' without going
+ * through the cache. Supplied by the device layer.
+ */
+typedef int (*lvm2_block_cache_fill_func)(struct lvm2_device *dev, u64 pos,
+		size_t count, struct lvm2_io_buffer *buf);
+
+/**
+ * Create a cache holding up to 'blocks_len' blocks of 'block_size' bytes.
+ * 'block_size' must be a power of two.
+ */
+int lvm2_block_cache_create(u32 block_size, size_t blocks_len,
+		struct lvm2_block_cache **out_cache);
+
+void lvm2_block_cache_destroy(struct lvm2_block_cache **cache);
+
+/**
+ * Read [pos, pos + count) of 'dev' into 'out_data', filling missing blocks
+ * with 'fill'. Returns ENOTSUP if the request can't be cached (the block size
+ * isn't a multiple of the device's alignment, the request is too large to be
+ * worth caching, or every block is being filled by other threads), in which
+ * case the caller should read from the device directly.
+ */
+int lvm2_block_cache_read(struct lvm2_block_cache *cache,
+		struct lvm2_device *dev, u64 pos, size_t count, void *out_data,
+		lvm2_block_cache_fill_func fill);
+
+/**
+ * Drop all cached blocks of 'dev'. Must be called when the contents of the
+ * device may have changed and before the device is destroyed, since devices
+ * are identified by address.
+ */
+void lvm2_block_cache_invalidate(struct lvm2_block_cache *cache,
+		const struct lvm2_device *dev);
+
+void lvm2_block_cache_get_stats(const struct lvm2_block_cache *cache,
+		struct lvm2_block_cache_stats *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined(_LIBTLVM_LVM2_BLOCK_CACHE_H) */
@@ -31,6 +31,8 @@ int lvm2_io_buffer_create(size_t size, struct lvm2_io_buffer **out_buf);
 
 const void* lvm2_io_buffer_get_bytes(struct lvm2_io_buffer *buf);
 
+size_t lvm2_io_buffer_get_size(struct lvm2_io_buffer *buf);
+
 void lvm2_io_buffer_destroy(struct lvm2_io_buffer **buf);
 
 struct lvm2_device;
@@ -40,6 +42,169 @@ int lvm2_device_read(struct lvm2_device *dev, u64 pos, size_t count,
 
 u32 lvm2_device_get_alignment(struct lvm2_device *dev);
 
+/** Number of buckets of the read latency histogram. */
+#define LVM2_DEVICE_LATENCY_BUCKETS 24
+
+/**
+ * I/O statistics of a device. Reads served from a block cache or through
+ * lvm2_device_map don't reach the device and aren't counted.
+ */
+struct lvm2_device_stats {
+	u64 reads;		/**< Requests issued to the device. */
+	u64 bytes;		/**< Bytes transferred, alignment included. */
+	u64 unaligned_reads;	/**< Requests that had to be aligned. */
+	u64 wasted_bytes;	/**< Bytes read only to align requests. */
+	u64 total_latency_us;
+	/** latency[i] counts the requests that took [2^i, 2^(i+1))
+	 * microseconds. The first and last buckets are open ended. */
+	u64 latency[LVM2_DEVICE_LATENCY_BUCKETS];
+};
+
+/**
+ * Get the I/O statistics of a device. Returns ENOTSUP if statistics aren't
+ * being collected for it.
+ */
+int lvm2_device_get_stats(struct lvm2_device *dev,
+		struct lvm2_device_stats *out_stats);
+
+/** One range of a vectored read. */
+struct lvm2_read_range {
+	u64 pos;
+	size_t count;
+	struct lvm2_io_buffer *buf;	/**< Receives the bytes at offset 0. */
+};
+
+/**
+ * Read several, possibly unaligned and unordered, ranges of a device. The
+ * device layer may merge ranges that are adjacent once aligned into a single
+ * request (e.g. a preadv), aligning each merged request only once. Either all
+ * ranges are read or an error is returned.
+ */
+int lvm2_device_readv(struct lvm2_device *dev,
+		const struct lvm2_read_range *ranges, size_t ranges_len);
+
+/**
+ * Get a pointer straight to the bytes [pos, pos + count) of the device, for
+ * devices that are backed by memory (e.g. a memory mapped disk image), so that
+ * they can be parsed without being copied. Returns ENOTSUP if the device
+ * doesn't support this. The bytes stay valid until the device is destroyed.
+ */
+int lvm2_device_map_range(struct lvm2_device *dev, u64 pos, size_t count,
+		const void **out_bytes);
+
+/**
+ * Called when an asynchronous read has finished, with 0 or the error of the
+ * read.
+ */
+typedef void (*lvm2_device_read_callback)(void *context, int err);
+
+/**
+ * Queue through which the completions of asynchronous reads are delivered.
+ * Completion callbacks only ever run inside lvm2_io_queue_poll, on the thread
+ * calling it, so they don't need any locking of their own.
+ */
+struct lvm2_io_queue;
+
+int lvm2_io_queue_create(struct lvm2_io_queue **out_queue);
+
+/**
+ * Destroy the queue. Reads that are still in flight are waited for, but their
+ * completion callbacks are not called.
+ */
+void lvm2_io_queue_destroy(struct lvm2_io_queue **queue);
+
+/**
+ * Start reading [pos, pos + count) of 'dev' into 'buf'. Once the read has
+ * finished, 'completion' is called from lvm2_io_queue_poll. 'buf' must not be
+ * touched until then. Returns an error, and never calls 'completion', if the
+ * read couldn't be started.
+ */
+int lvm2_device_read_async(struct lvm2_io_queue *queue,
+		struct lvm2_device *dev, u64 pos, size_t count,
+		struct lvm2_io_buffer *buf, lvm2_device_read_callback completion,
+		void *context);
+
+/**
+ * Run the completion callbacks of all finished reads. If 'wait' is true and no
+ * read has finished yet but some are in flight, block until one finishes.
+ * Returns the number of callbacks run, so a queue is drained with
+ *
+ *	while(lvm2_io_queue_poll(queue, LVM2_TRUE));
+ *
+ * Callbacks may start new reads.
+ */
+size_t lvm2_io_queue_poll(struct lvm2_io_queue *queue, lvm2_bool wait);
+
+/** Access pattern hints for lvm2_device_advise. */
+typedef enum {
+	LVM2_DEVICE_ADVICE_WILLNEED,	/**< The range will be read soon. */
+	LVM2_DEVICE_ADVICE_DONTNEED,	/**< Won't be read again soon. */
+} lvm2_device_advice;
+
+/**
+ * Tell the device how a range of it is going to be accessed, so that e.g. it
+ * can start reading it ahead while the caller is busy parsing. This is only a
+ * hint: it may be ignored, and errors are not reported.
+ */
+void lvm2_device_advise(struct lvm2_device *dev, u64 pos, u64 count,
+		lvm2_device_advice advice);
+
+struct lvm2_block_cache;
+
+/**
+ * Attach 'cache' (or NULL to detach) to the device, so that reads are served
+ * through it. See lvm2_block_cache.h.
+ */
+void lvm2_device_set_block_cache(struct lvm2_device *dev,
+		struct lvm2_block_cache *cache);
+
+/**
+ * Destroy a device, whichever backend created it. The backend specific
+ * destroy functions (lvm2_unix_device_destroy, lvm2_iokit_device_destroy) are
+ * equivalent.
+ */
+void lvm2_device_destroy(struct lvm2_device **dev);
+
+/*
+ * Device backends.
+ *
+ * The lvm2_device_* functions above dispatch through the ops table of the
+ * device, so devices of different backends (and layers stacked on top of other
+ * devices) can be used side by side. A backend embeds struct lvm2_device as the
+ * first member of its own device structure and sets 'ops' in its constructor.
+ * Range checks are left to the backend.
+ */
+
+struct lvm2_device_ops {
+	/** Required. */
+	int (*read)(struct lvm2_device *dev, u64 pos, size_t count,
+			struct lvm2_io_buffer *buf);
+	/** Optional. If NULL, the ranges are read one at a time. */
+	int (*readv)(struct lvm2_device *dev,
+			const struct lvm2_read_range *ranges,
+			size_t ranges_len);
+	/** Required. */
+	u32 (*get_alignment)(struct lvm2_device *dev);
+	/** Optional. If NULL, lvm2_device_map_range returns ENOTSUP. */
+	int (*map_range)(struct lvm2_device *dev, u64 pos, size_t count,
+			const void **out_bytes);
+	/** Optional. If NULL, lvm2_device_get_stats returns ENOTSUP. */
+	int (*get_stats)(struct lvm2_device *dev,
+			struct lvm2_device_stats *out_stats);
+	/** Optional. If NULL, block caches are not used by the device. */
+	void (*set_block_cache)(struct lvm2_device *dev,
+			struct lvm2_block_cache *cache);
+	/** Required. Releases the device and everything it holds. */
+	void (*destroy)(struct lvm2_device *dev);
+	/** Optional. If NULL, hints are ignored. */
+	void (*advise)(struct lvm2_device *dev, u64 pos, u64 count,
+			lvm2_device_advice advice);
+};
+
+struct lvm2_device {
+	const struct lvm2_device_ops *ops;
+};
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,218 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_frozen.h - Frozen (flattened, read-only) form of struct lvm2_layout.
+ *
+ * A frozen layout is a single contiguous block of memory containing a header
+ * followed by the PV, LV, segment and PV location arrays and a packed string
+ * table. All references inside the block are 32-bit offsets (strings) or
+ * indices (everything else) relative to the start of the block, so the block
+ * can be copied with memcpy, moved around freely and is freed in one call.
+ */
+
+#if !defined(_LIBTLVM_LVM2_FROZEN_H)
+#define _LIBTLVM_LVM2_FROZEN_H
+
+#include "lvm2_text.h"
+#include "lvm2_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Value of an index or string offset that doesn't refer to anything. */
+#define LVM2_FROZEN_NONE U32_MAX
+
+struct lvm2_frozen_pv_location {
+	u32 pv_name;		/**< String offset. */
+	u32 pv_index;		/**< PV index, LVM2_FROZEN_NONE if unknown. */
+	u64 extent_start;
+};
+
+struct lvm2_frozen_segment {
+	u64 start_extent;
+	u64 extent_count;
+	u32 type;		/**< String offset. */
+	u8 kind;		/**< lvm2_segment_kind */
+	u8 defined;		/**< lvm2_segment_defined_flags */
+	u16 reserved;
+	u32 count;		/**< stripe_count or mirror_count. */
+	u32 size;		/**< stripe_size or region_size. */
+	u32 mirror_log;		/**< String offset. Optional. */
+	u32 first_location;
+	u32 locations_len;
+	u32 reserved2;
+};
+
+struct lvm2_frozen_logical_volume {
+	u32 name;		/**< String offset. */
+	u32 id;			/**< String offset. */
+	u32 status;		/**< lvm2_logical_volume_status */
+	u32 flags;		/**< lvm2_logical_volume_flags */
+	u32 creation_host;	/**< String offset. Optional. */
+	u32 creation_time;	/**< String offset. Optional. */
+	u32 allocation_policy;	/**< String offset. Optional. */
+	u32 first_segment;
+	u32 segments_len;
+	u8 flags_defined;
+	u8 reserved[3];
+};
+
+struct lvm2_frozen_physical_volume {
+	u32 name;		/**< String offset. */
+	u32 id;			/**< String offset. */
+	u32 device;		/**< String offset. */
+	u32 status;		/**< lvm2_physical_volume_status */
+	u32 flags;		/**< lvm2_physical_volume_flags */
+	u8 flags_defined;
+	u8 dev_size_defined;
+	u8 reserved[2];
+	u64 dev_size;
+	u64 pe_start;
+	u64 pe_count;
+};
+
+/**
+ * Header of a frozen layout. The arrays follow the header in the order they
+ * are declared here, each located by its byte offset from the start of the
+ * header. Each string in the string table is stored as a u32 length followed
+ * by the characters and a terminating NUL, and is referenced by the offset of
+ * its first character.
+ */
+struct lvm2_frozen_layout {
+	u32 size;		/**< Total size of the block in bytes. */
+
+	/* Volume group. */
+	u32 vg_name;		/**< String offset. */
+	u32 vg_id;		/**< String offset. */
+	u32 vg_format;		/**< String offset. Optional. */
+	u32 vg_status;		/**< lvm2_volume_group_status */
+	u32 vg_flags;		/**< lvm2_volume_group_flags */
+	u8 vg_flags_defined;
+	u8 reserved[3];
+	u64 vg_seqno;
+	u64 vg_extent_size;
+	u64 vg_max_lv;
+	u64 vg_max_pv;
+	u64 vg_metadata_copies;
+
+	/* Metadata about the metadata. */
+	u32 contents;		/**< String offset. */
+	u32 description;	/**< String offset. */
+	u32 creation_host;	/**< String offset. */
+	u32 reserved2;
+	u64 version;
+	u64 creation_time;
+
+	u32 physical_volumes_offset;
+	u32 physical_volumes_len;
+	u32 logical_volumes_offset;
+	u32 logical_volumes_len;
+	u32 segments_offset;
+	u32 segments_len;
+	u32 locations_offset;
+	u32 locations_len;
+	u32 strings_offset;
+	u32 strings_size;
+};
+
+int lvm2_layout_freeze(const struct lvm2_layout *layout,
+		struct lvm2_frozen_layout **out_frozen);
+
+int lvm2_frozen_layout_copy(const struct lvm2_frozen_layout *frozen,
+		struct lvm2_frozen_layout **out_copy);
+
+void lvm2_frozen_layout_destroy(struct lvm2_frozen_layout **frozen);
+
+/**
+ * Check that the 'size' bytes at 'data' are a well-formed frozen layout, i.e.
+ * that all offsets and indices stay within the block and all strings are
+ * terminated. This must be done before using a frozen layout that comes from
+ * an untrusted source, such as a file.
+ */
+lvm2_bool lvm2_frozen_layout_validate(const void *data, size_t size);
+
+/**
+ * Frozen counterpart of lvm2_layout_report_volumes.
+ */
+lvm2_bool lvm2_frozen_layout_report_volumes(
+		const struct lvm2_frozen_layout *frozen,
+		const struct lvm2_pv_info *pv_info,
+		lvm2_volume_callback volume_callback, void *private_data);
+
+static inline const struct lvm2_frozen_physical_volume*
+		lvm2_frozen_layout_get_physical_volumes(
+		const struct lvm2_frozen_layout *const frozen)
+{
+	return (const struct lvm2_frozen_physical_volume*)
+		((const char*) frozen + frozen->physical_volumes_offset);
+}
+
+static inline const struct lvm2_frozen_logical_volume*
+		lvm2_frozen_layout_get_logical_volumes(
+		const struct lvm2_frozen_layout *const frozen)
+{
+	return (const struct lvm2_frozen_logical_volume*)
+		((const char*) frozen + frozen->logical_volumes_offset);
+}
+
+static inline const struct lvm2_frozen_segment*
+		lvm2_frozen_layout_get_segments(
+		const struct lvm2_frozen_layout *const frozen)
+{
+	return (const struct lvm2_frozen_segment*)
+		((const char*) frozen + frozen->segments_offset);
+}
+
+static inline const struct lvm2_frozen_pv_location*
+		lvm2_frozen_layout_get_locations(
+		const struct lvm2_frozen_layout *const frozen)
+{
+	return (const struct lvm2_frozen_pv_location*)
+		((const char*) frozen + frozen->locations_offset);
+}
+
+/**
+ * Returns the NUL-terminated string at 'offset', or NULL if 'offset' is
+ * LVM2_FROZEN_NONE. The length of the string is stored in '*out_length' if
+ * 'out_length' is non-NULL.
+ */
+static inline const char* lvm2_frozen_layout_get_string(
+		const struct lvm2_frozen_layout *const frozen,
+		const u32 offset,
+		u32 *const out_length)
+{
+	const char *string;
+
+	if(offset == LVM2_FROZEN_NONE)
+		return NULL;
+
+	string = (const char*) frozen + offset;
+
+	if(out_length)
+		*out_length = *(const u32*) (string - sizeof(u32));
+
+	return string;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined(_LIBTLVM_LVM2_FROZEN_H) */
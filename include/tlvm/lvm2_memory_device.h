@@ -0,0 +1,71 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_memory_device.h - Devices backed by caller supplied memory.
+ *
+ * A memory device serves reads straight from buffers owned by the caller,
+ * without any system calls, so that the cost of parsing and scan planning can
+ * be measured separately from the cost of I/O. A device is described by a list
+ * of extents, each mapping a buffer to a range of the device; ranges not
+ * covered by any extent read as zeros. A PV image can therefore be supplied
+ * whole, or as just the regions holding its label and metadata areas. Each PV
+ * of a multi-PV VG is a device of its own.
+ *
+ * The buffers must stay valid and unchanged until the device is destroyed.
+ */
+
+#if !defined(_LIBTLVM_LVM2_MEMORY_DEVICE_H)
+#define _LIBTLVM_LVM2_MEMORY_DEVICE_H
+
+#include "lvm2_device.h"
+#include "lvm2_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lvm2_memory_extent {
+	u64 pos;		/**< Offset of the extent in the device. */
+	const void *data;
+	size_t size;
+};
+
+/**
+ * Create a device of 'size' bytes whose contents are the bytes at 'data'.
+ * 'alignment' is what lvm2_device_get_alignment reports, so that benchmarks
+ * can plan reads as they would be planned for real media. Reads don't need to
+ * be aligned.
+ */
+int lvm2_memory_device_create(const void *data, u64 size, u32 alignment,
+		struct lvm2_device **out_dev);
+
+/**
+ * Create a device of 'size' bytes from 'extents', which must be sorted by
+ * position, must not overlap and must lie within the device. The extent list
+ * is copied.
+ */
+int lvm2_memory_device_create_ex(const struct lvm2_memory_extent *extents,
+		size_t extents_len, u64 size, u32 alignment,
+		struct lvm2_device **out_dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined(_LIBTLVM_LVM2_MEMORY_DEVICE_H) */
@@ -66,34 +66,71 @@ struct lvm2_dom_array {
 };
 
 struct lvm2_pv_location {
-	struct lvm2_bounded_string *pv_name;
+	const struct lvm2_bounded_string *pv_name;
 	u64 extent_start;
 };
 
+typedef enum {
+	LVM2_SEGMENT_KIND_NONE = 0x0,		/**< No stripes or mirrors. */
+	LVM2_SEGMENT_KIND_STRIPED = 0x1,	/**< Striped or plain volume. */
+	LVM2_SEGMENT_KIND_MIRRORED = 0x2,	/**< Mirrored volume. */
+} lvm2_segment_kind;
+
+typedef enum {
+	LVM2_SEGMENT_COUNT_DEFINED = 0x1,	/**< stripe/mirror_count. */
+	LVM2_SEGMENT_SIZE_DEFINED = 0x2,	/**< stripe/region_size. */
+	LVM2_SEGMENT_LOCATIONS_DEFINED = 0x4,	/**< stripes/mirrors array. */
+} lvm2_segment_defined_flags;
+
+/** Number of PV locations that are stored inside struct lvm2_segment. */
+#define LVM2_SEGMENT_INLINE_LOCATIONS 1
+
+/**
+ * A segment of a logical volume. Members that only exist for one kind of
+ * segment share storage in a union selected by 'kind', and the PV locations
+ * (stripes or mirror legs) are stored inside the segment when there are no more
+ * than LVM2_SEGMENT_INLINE_LOCATIONS of them, which is by far the most common
+ * case. Use lvm2_segment_get_locations() to access the locations.
+ */
 struct lvm2_segment {
 	u64 start_extent;
 	u64 extent_count;
-	struct lvm2_bounded_string *type;
-
-	/* Variables only existing in striped or plain (stripe_count=1)
-	 * volumes. */
-	lvm2_bool stripe_count_defined;
-	u64 stripe_count;
-	lvm2_bool stripe_size_defined;
-	u64 stripe_size;
-	size_t stripes_len;
-	struct lvm2_pv_location **stripes;
-
-	/* Variables only existing in mirrored volumes. */
-	lvm2_bool mirror_count_defined;
-	u64 mirror_count;
-	struct lvm2_bounded_string *mirror_log;
-	lvm2_bool region_size_defined;
-	u64 region_size;
-	size_t mirrors_len;
-	struct lvm2_pv_location **mirrors;
+	const struct lvm2_bounded_string *type;
+	u8 kind;		/**< lvm2_segment_kind */
+	u8 defined;		/**< lvm2_segment_defined_flags */
+	u32 locations_len;
+
+	union {
+		/* Variables only existing in striped or plain (stripe_count=1)
+		 * volumes. */
+		struct {
+			u32 stripe_count;
+			u32 stripe_size;
+		} striped;
+
+		/* Variables only existing in mirrored volumes. */
+		struct {
+			u32 mirror_count;
+			u32 region_size;
+			const struct lvm2_bounded_string *mirror_log;
+		} mirrored;
+	} u;
+
+	union {
+		struct lvm2_pv_location
+			inline_locations[LVM2_SEGMENT_INLINE_LOCATIONS];
+		struct lvm2_pv_location *external;
+	} locations;
 };
 
+static inline const struct lvm2_pv_location* lvm2_segment_get_locations(
+		const struct lvm2_segment *const segment)
+{
+	return (segment->locations_len <= LVM2_SEGMENT_INLINE_LOCATIONS) ?
+		segment->locations.inline_locations :
+		segment->locations.external;
+}
+
 typedef enum {
 	LVM2_LOGICAL_VOLUME_STATUS_NONE = 0x0,
 	LVM2_LOGICAL_VOLUME_STATUS_READ = 0x1,
@@ -106,17 +143,17 @@ typedef enum {
 } lvm2_logical_volume_flags;
 
 struct lvm2_logical_volume {
-	struct lvm2_bounded_string *name;
-	struct lvm2_bounded_string *id;
+	const struct lvm2_bounded_string *name;
+	const struct lvm2_bounded_string *id;
 	lvm2_logical_volume_status status;
 	lvm2_bool flags_defined;
 	lvm2_logical_volume_flags flags;
-	struct lvm2_bounded_string *creation_host;	/**< Optional. */
-	struct lvm2_bounded_string *creation_time;	/**< Optional. */
-	struct lvm2_bounded_string *allocation_policy;	/**< Optional. */
+	const struct lvm2_bounded_string *creation_host;	/**< Optional. */
+	const struct lvm2_bounded_string *creation_time;	/**< Optional. */
+	const struct lvm2_bounded_string *allocation_policy;	/**< Optional. */
 	u64 segment_count;
 	size_t segments_len;
-	struct lvm2_segment **segments;
+	struct lvm2_segment *segments;
 };
 
 typedef enum {
@@ -129,9 +166,9 @@ typedef enum {
 } lvm2_physical_volume_flags;
 
 struct lvm2_physical_volume {
-	struct lvm2_bounded_string *name;
-	struct lvm2_bounded_string *id;
-	struct lvm2_bounded_string *device;
+	const struct lvm2_bounded_string *name;
+	const struct lvm2_bounded_string *id;
+	const struct lvm2_bounded_string *device;
 	lvm2_physical_volume_status status;
 	lvm2_bool flags_defined;
 	lvm2_physical_volume_flags flags;
@@ -153,9 +190,9 @@ typedef enum {
 } lvm2_volume_group_flags;
 
 struct lvm2_volume_group {
-	struct lvm2_bounded_string *id;
+	const struct lvm2_bounded_string *id;
 	u64 seqno;
-	struct lvm2_bounded_string *format;		/**< Optional. */
+	const struct lvm2_bounded_string *format;	/**< Optional. */
 	lvm2_volume_group_status status;
 	lvm2_bool flags_defined;
 	lvm2_volume_group_flags flags;
@@ -169,13 +206,28 @@ struct lvm2_volume_group {
 	struct lvm2_logical_volume **logical_volumes;
 };
 
+struct lvm2_string_table;
+
+/**
+ * Parsed LVM2 metadata. All strings referenced from the layout are interned in
+ * the layout's string table: they are immutable, shared between all users
+ * within the layout and live exactly as long as the layout itself. Two strings
+ * from the same layout are equal if and only if they are the same object.
+ *
+ * A layout is immutable once created and is reference counted so that it can
+ * be shared, e.g. between the PVs of a VG through an lvm2_layout_cache. The
+ * reference count is not atomic; sharing across threads requires external
+ * locking.
+ */
 struct lvm2_layout {
-	struct lvm2_bounded_string *vg_name;
+	u32 refcount;
+	struct lvm2_string_table *strings;
+	const struct lvm2_bounded_string *vg_name;
 	struct lvm2_volume_group *vg;
-	struct lvm2_bounded_string *contents;
+	const struct lvm2_bounded_string *contents;
 	u64 version;
-	struct lvm2_bounded_string *description;
-	struct lvm2_bounded_string *creation_host;
+	const struct lvm2_bounded_string *description;
+	const struct lvm2_bounded_string *creation_host;
 	u64 creation_time;
 };
 
@@ -204,10 +256,192 @@ int lvm2_layout_create(const struct lvm2_dom_section *root_section,
 
 void lvm2_layout_destroy(struct lvm2_layout **parsed_text);
 
+/**
+ * Take an additional reference to 'layout'. Returns 'layout'.
+ */
+struct lvm2_layout* lvm2_layout_retain(struct lvm2_layout *layout);
+
+/**
+ * Drop a reference to '*layout', destroying it when the last reference goes
+ * away. '*layout' is set to NULL.
+ */
+void lvm2_layout_release(struct lvm2_layout **layout);
+
+struct lvm2_string_stats {
+	u64 unique_strings;	/**< Number of distinct strings stored. */
+	u64 references;		/**< Number of strings referenced by layout. */
+	u64 referenced_bytes;	/**< Bytes needed without interning. */
+	u64 stored_bytes;	/**< Bytes used by the interned strings. */
+	u64 table_bytes;	/**< Overhead of the intern table itself. */
+};
+
+void lvm2_layout_get_string_stats(const struct lvm2_layout *layout,
+		struct lvm2_string_stats *out_stats);
+
+/**
+ * Read and parse the metadata text described by 'locn'. Returns EIO if the
+ * text doesn't match the checksum in 'locn'.
+ */
 int lvm2_read_text(struct lvm2_device *dev, u64 metadata_offset,
 		u64 metadata_size, const struct raw_locn *locn,
 		struct lvm2_layout **out_layout);
 
+/** Parse metadata text that has already been read into a layout. */
+int lvm2_parse_layout_text(const char *text, size_t text_len,
+		struct lvm2_layout **out_layout);
+
+/**
+ * Returns LVM2_TRUE if the checksum of the metadata text matches the one
+ * recorded in its raw_locn.
+ */
+lvm2_bool lvm2_text_checksum_matches(const char *text, size_t text_len,
+		const struct raw_locn *locn);
+
+/** Maximum number of metadata areas on a PV that we can handle. */
+#define LVM2_PV_INFO_MAX_METADATA_AREAS 8
+
+/** An area on a PV, as listed in the pv_header (host byte order). */
+struct lvm2_disk_area {
+	u64 offset;
+	u64 size;
+};
+
+/** The contents of the LVM2 label and pv_header of a PV. */
+struct lvm2_pv_info {
+	char pv_uuid[LVM_ID_LEN];	/**< Not NUL-terminated. */
+	u64 device_size;
+	u32 label_sector;
+	size_t data_areas_len;
+	size_t metadata_areas_len;
+	struct lvm2_disk_area metadata_areas[LVM2_PV_INFO_MAX_METADATA_AREAS];
+};
+
+/** The mda_header of a metadata area. */
+struct lvm2_mda_info {
+	u64 offset;
+	u64 size;
+	lvm2_bool valid;	/**< False if the mda_header didn't verify. */
+	u32 checksum;		/**< The mda_header's own checksum. */
+	struct raw_locn locn;	/**< First raw_locn (on-disk byte order). */
+};
+
+typedef lvm2_bool (*lvm2_volume_callback)(void *private_data,
+		u64 device_size, const char *volume_name, u64 volume_start,
+		u64 volume_length, lvm2_bool is_incomplete);
+
+lvm2_bool lvm2_pv_id_matches_uuid(const char *id, size_t id_length,
+		const char *pv_uuid);
+
+/**
+ * Locate and read the LVM2 label and pv_header of a device.
+ */
+int lvm2_read_pv_info(struct lvm2_device *dev, struct lvm2_pv_info *out_info);
+
+/**
+ * Locate and decode the LVM2 label and pv_header in the first 'bytes_len'
+ * bytes of a device, which must cover the label scan sectors.
+ */
+int lvm2_parse_pv_info(const void *bytes, size_t bytes_len,
+		struct lvm2_pv_info *out_info);
+
+/**
+ * Read and verify the mda_header of a metadata area. Returns an error only if
+ * the header couldn't be read. If it was read but didn't verify, 0 is returned
+ * and out_mda->valid is set to LVM2_FALSE.
+ */
+int lvm2_read_mda_info(struct lvm2_device *dev,
+		const struct lvm2_disk_area *area,
+		struct lvm2_mda_info *out_mda);
+
+/**
+ * Decode and verify the mda_header of 'area' from the LVM_MDA_HEADER_SIZE
+ * bytes at 'bytes'.
+ */
+void lvm2_parse_mda_info(const void *bytes, const struct lvm2_disk_area *area,
+		struct lvm2_mda_info *out_mda);
+
+/**
+ * Returns LVM2_TRUE if two mda_headers point at the same metadata text, as the
+ * metadata areas of a PV do while their copies are in sync. Only one copy of
+ * such a text needs to be parsed; the others are fallbacks.
+ */
+lvm2_bool lvm2_mda_info_same_text(const struct lvm2_mda_info *a,
+		const struct lvm2_mda_info *b);
+
+/**
+ * Report the logical volumes in 'layout' that reside on the PV described by
+ * 'pv_info' through 'volume_callback'. Volume offsets and lengths are in bytes.
+ * Returns LVM2_FALSE if the callback asked us to stop.
+ */
+lvm2_bool lvm2_layout_report_volumes(const struct lvm2_layout *layout,
+		const struct lvm2_pv_info *pv_info,
+		lvm2_volume_callback volume_callback, void *private_data);
+
+/**
+ * Cache of parsed layouts, holding the most recent layout of each VG seen.
+ *
+ * Every PV of a VG stores an identical copy of the VG metadata, so once one PV
+ * has been parsed, the layout can be reused for the others. Entries are keyed
+ * by (VG id, seqno), and a metadata area is matched to an entry through the
+ * size and CRC of its metadata text as recorded in the raw_locn, which is
+ * available without reading the text, and the UUID of its PV, which the
+ * layout has to list.
+ *
+ * A newer layout of a VG replaces the older one. The cache holds the layouts of
+ * at most LVM2_LAYOUT_CACHE_MAX_ENTRIES VGs, and when it is full, the least
+ * recently used layout that nothing else references is evicted (or the least
+ * recently used one, if all are referenced).
+ *
+ * The cache is not thread safe.
+ */
+struct lvm2_layout_cache;
+
+/** Number of VGs whose layouts a layout cache holds. */
+#define LVM2_LAYOUT_CACHE_MAX_ENTRIES 64
+
+struct lvm2_layout_cache_stats {
+	u64 hits;
+	u64 misses;
+	u64 entries;
+};
+
+int lvm2_layout_cache_create(struct lvm2_layout_cache **out_cache);
+
+void lvm2_layout_cache_destroy(struct lvm2_layout_cache **cache);
+
+/**
+ * Look up the layout of the metadata text described by 'locn' on the PV
+ * described by 'pv_info'. Layouts that don't list the PV aren't returned,
+ * even if their text has the same size and CRC. Returns a new reference to
+ * the layout, or NULL if it isn't cached.
+ */
+struct lvm2_layout* lvm2_layout_cache_lookup(struct lvm2_layout_cache *cache,
+		const struct lvm2_pv_info *pv_info, const struct raw_locn *locn);
+
+/**
+ * Look up the layout of a VG with a specific seqno. Returns a new reference to
+ * the layout, or NULL if it isn't cached.
+ */
+struct lvm2_layout* lvm2_layout_cache_find(struct lvm2_layout_cache *cache,
+		const char *vg_id, size_t vg_id_length, u64 seqno);
+
+/**
+ * Add 'layout', parsed from the metadata text described by 'locn', to the
+ * cache. The cache takes its own reference. If the cache already holds a newer
+ * layout of the same VG, the cache is left unchanged.
+ */
+int lvm2_layout_cache_insert(struct lvm2_layout_cache *cache,
+		const struct raw_locn *locn, struct lvm2_layout *layout);
+
+/**
+ * Drop the layouts that nothing but the cache references any more, e.g. after
+ * the devices that they were scanned from have gone away.
+ */
+void lvm2_layout_cache_trim(struct lvm2_layout_cache *cache);
+
+void lvm2_layout_cache_get_stats(const struct lvm2_layout_cache *cache,
+		struct lvm2_layout_cache_stats *out_stats);
+
 int lvm2_parse_device(struct lvm2_device *dev,
 		lvm2_bool (*volume_callback)(void *private_data,
 			u64 device_size, const char *volume_name,
@@ -215,6 +449,164 @@ int lvm2_parse_device(struct lvm2_device *dev,
 			lvm2_bool is_incomplete),
 		void *private_data);
 
+/**
+ * Like lvm2_parse_device, but reuses the layouts in 'cache' and adds newly
+ * parsed layouts to it.
+ */
+int lvm2_parse_device_cached(struct lvm2_device *dev,
+		struct lvm2_layout_cache *cache,
+		lvm2_volume_callback volume_callback, void *private_data);
+
+/** Default scan window, usually covering label, mda_header and text. */
+#define LVM2_SCAN_WINDOW_DEFAULT (1024 * 1024)
+
+/**
+ * Scan window covering only the label scan sectors. A planner created with it
+ * as its default doesn't read more of a device than that until a scan has
+ * found a label there and learned how much of the device is needed.
+ */
+#define LVM2_SCAN_WINDOW_LABEL (LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE)
+
+/** Largest scan window that will be read speculatively. */
+#define LVM2_SCAN_WINDOW_MAX (8 * 1024 * 1024)
+
+/** Number of devices a scan planner remembers. */
+#define LVM2_SCAN_PLANNER_MAX_DEVICES 256
+
+/**
+ * Scan planner. Scanning a device starts with one speculative read of the
+ * first bytes of the device, and the label, mda_headers and metadata text are
+ * taken from that window when they lie within it, falling back to targeted
+ * reads otherwise. The planner decides how large the window is, starting out at
+ * a default size and then learning from each scan how much of a device was
+ * actually needed.
+ *
+ * The planner is not thread safe.
+ */
+struct lvm2_scan_planner;
+
+int lvm2_scan_planner_create(u64 default_window_size,
+		struct lvm2_scan_planner **out_planner);
+
+void lvm2_scan_planner_destroy(struct lvm2_scan_planner **planner);
+
+/**
+ * Returns the window size to use for the device identified by 'device_key'.
+ */
+u64 lvm2_scan_planner_get_window(struct lvm2_scan_planner *planner,
+		u64 device_key);
+
+/**
+ * Record that scanning the device identified by 'device_key' needed the first
+ * 'window_size' bytes of the device.
+ */
+void lvm2_scan_planner_learn(struct lvm2_scan_planner *planner,
+		u64 device_key, u64 window_size);
+
+/**
+ * What a scan found on a PV, kept by callers that rescan the same device with
+ * lvm2_rescan_device. The layouts hold references of their own, so the state
+ * must be released under the same serialization as the layout cache that
+ * they may be shared with.
+ */
+struct lvm2_scan_state {
+	lvm2_bool valid;	/**< The fields below describe the last scan. */
+	u32 label_checksum;	/**< CRC of the sector holding the label. */
+	struct lvm2_pv_info pv_info;
+	struct lvm2_mda_info mda_infos[LVM2_PV_INFO_MAX_METADATA_AREAS];
+
+	/**
+	 * Layout of each metadata area, or NULL if it had none. Only the area
+	 * whose layout was reported, the one with the highest seqno, has one.
+	 */
+	struct lvm2_layout *layouts[LVM2_PV_INFO_MAX_METADATA_AREAS];
+};
+
+/** Drop the layouts of 'state' and mark it invalid. */
+void lvm2_scan_state_release(struct lvm2_scan_state *state);
+
+struct lvm2_parse_options {
+	struct lvm2_layout_cache *layout_cache;	/**< Optional. */
+	struct lvm2_scan_planner *planner;	/**< Optional. */
+	u64 device_key;		/**< Identifies the device, 0 if unknown. */
+
+	/**
+	 * Optional. The first 'window_size' bytes of the device, already read
+	 * by the caller (e.g. batched with the windows of other devices). Used
+	 * instead of reading the scan window, and not freed.
+	 */
+	struct lvm2_io_buffer *window_buffer;
+	size_t window_size;
+
+	/**
+	 * Hint the device to read the mda_headers and metadata text outside
+	 * the scan window ahead, as soon as their locations are known, and to
+	 * drop them from its cache once the PV has been parsed. Not used by
+	 * asynchronous scans, which read everything they need as windows.
+	 */
+	lvm2_bool io_hints;
+
+	/**
+	 * Optional. Receives what the scan found, replacing its previous
+	 * contents, so that the device can later be rescanned with
+	 * lvm2_rescan_device. Asynchronous scans fill it in when they
+	 * complete.
+	 */
+	struct lvm2_scan_state *scan_state;
+
+	/**
+	 * Optional. Called around every use of 'layout_cache', 'planner' and
+	 * the layouts in 'scan_state', but not around device I/O, so that
+	 * scans of several devices can share them without being serialized
+	 * as a whole. If NULL, the caller has to serialize the scans.
+	 */
+	void (*lock)(void *lock_context);
+	void (*unlock)(void *lock_context);
+	void *lock_context;
+};
+
+/**
+ * Like lvm2_parse_device, but with options. If no planner is given, only the
+ * label scan sectors are read speculatively.
+ */
+int lvm2_parse_device_ex(struct lvm2_device *dev,
+		const struct lvm2_parse_options *options,
+		lvm2_volume_callback volume_callback, void *private_data);
+
+/**
+ * Rescan a device that was scanned before with 'options->scan_state' set.
+ * Only the sector holding the label and the mda_headers are read. If none of
+ * them changed, the metadata texts haven't either (their locations and
+ * checksums are in the mda_headers), and the volumes are reported from the
+ * layouts kept in the state. Otherwise, or if the state is invalid, the device
+ * is scanned again as by lvm2_parse_device_ex.
+ */
+int lvm2_rescan_device(struct lvm2_device *dev,
+		const struct lvm2_parse_options *options,
+		lvm2_volume_callback volume_callback, void *private_data);
+
+/** Called when an asynchronous scan has finished, with 0 or its error. */
+typedef void (*lvm2_scan_done_callback)(void *private_data, int err);
+
+/**
+ * Asynchronous counterpart of lvm2_parse_device_ex. The scan window is read
+ * through 'queue', and the scan advances from the read completions run by
+ * lvm2_io_queue_poll: if the window doesn't hold everything the PV needs, a
+ * larger one is read, and once it does the PV is parsed in memory, the volumes
+ * are reported and 'done_callback' is called. Many devices can thus be scanned
+ * concurrently from one thread.
+ *
+ * 'options' is copied (its window_buffer is ignored), but the objects it
+ * refers to, and the device, must stay valid until 'done_callback' has been
+ * called. Memory backed devices are parsed right away, before this function
+ * returns. Returns an error, and never calls 'done_callback', if the scan
+ * couldn't be started.
+ */
+int lvm2_parse_device_async(struct lvm2_io_queue *queue,
+		struct lvm2_device *dev, const struct lvm2_parse_options *options,
+		lvm2_volume_callback volume_callback,
+		lvm2_scan_done_callback done_callback, void *private_data);
+
 lvm2_bool lvm2_check_layout(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,114 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_vg_assembler.h - Assembling volume groups from the PVs of many devices.
+ *
+ * Scanning a device only tells which LVs touch that one PV. The assembler
+ * collects what the scans of many devices found, joins the PVs by the id of
+ * their VG, keeps the metadata with the highest seqno of each VG and tracks
+ * which of the PVs listed in that metadata have been seen. It can then tell for
+ * each LV how many of its extents lie on PVs that are missing.
+ *
+ * PVs and VGs are kept in hash tables, so assembling a VG takes time linear in
+ * the number of its PVs and LV segments. Like layouts, the assembler is not
+ * thread safe.
+ */
+
+#if !defined(_LIBTLVM_LVM2_VG_ASSEMBLER_H)
+#define _LIBTLVM_LVM2_VG_ASSEMBLER_H
+
+#include "lvm2_text.h"
+#include "lvm2_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lvm2_vg_assembler;
+
+/** A VG as assembled so far. */
+struct lvm2_assembled_vg {
+	/** Metadata with the highest seqno seen for the VG. */
+	const struct lvm2_layout *layout;
+	size_t pvs_len;		/**< PVs listed in the metadata. */
+	size_t present_pvs_len;	/**< Of those, PVs that have been added. */
+};
+
+/** An LV of an assembled VG. */
+struct lvm2_assembled_lv {
+	const struct lvm2_logical_volume *lv;
+	u64 extents_len;	/**< Extents in all segments of the LV. */
+
+	/**
+	 * Extents that aren't backed by a present PV: extents of striped
+	 * segments with any stripe on a missing PV and of mirrored segments
+	 * with all legs on missing PVs. Segments without PV locations (zero,
+	 * error) are never counted as missing.
+	 */
+	u64 missing_extents_len;
+};
+
+typedef lvm2_bool (*lvm2_assembled_lv_callback)(void *private_data,
+		const struct lvm2_assembled_vg *vg,
+		const struct lvm2_assembled_lv *lv);
+
+int lvm2_vg_assembler_create(struct lvm2_vg_assembler **out_assembler);
+
+void lvm2_vg_assembler_destroy(struct lvm2_vg_assembler **assembler);
+
+/**
+ * Add a PV found by a scan. 'layout' is the layout of one of its metadata
+ * areas, or NULL if it has none (PVs without metadata areas are then joined to
+ * their VG by the metadata of the other PVs). Adding the same PV again, e.g.
+ * once per metadata area, is fine. The assembler holds a reference to the
+ * layout of each VG that it keeps.
+ */
+int lvm2_vg_assembler_add_pv(struct lvm2_vg_assembler *assembler,
+		const struct lvm2_pv_info *pv_info, struct lvm2_layout *layout);
+
+size_t lvm2_vg_assembler_get_vgs_len(struct lvm2_vg_assembler *assembler);
+
+/**
+ * Get the VG at 'index', in the order the VGs were first seen. The layout in
+ * 'out_vg' stays valid until the assembler is destroyed or a PV is added.
+ */
+int lvm2_vg_assembler_get_vg(struct lvm2_vg_assembler *assembler,
+		size_t index, struct lvm2_assembled_vg *out_vg);
+
+/**
+ * Returns LVM2_TRUE if the PV at 'pv_index' in the physical_volumes of the
+ * metadata of VG 'vg_index' has been added.
+ */
+lvm2_bool lvm2_vg_assembler_pv_is_present(
+		struct lvm2_vg_assembler *assembler, size_t vg_index,
+		size_t pv_index);
+
+/**
+ * Report the LVs of VG 'vg_index' through 'lv_callback', in the order of the
+ * metadata, until it returns LVM2_FALSE.
+ */
+int lvm2_vg_assembler_report_lvs(struct lvm2_vg_assembler *assembler,
+		size_t vg_index, lvm2_assembled_lv_callback lv_callback,
+		void *private_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !defined(_LIBTLVM_LVM2_VG_ASSEMBLER_H) */
@@ -27,6 +27,7 @@
 #include "IOLVMPartitionScheme.h"
 #include "lvm2_osal.h"
 #include "lvm2_text.h"
+#include "lvm2_block_cache.h"
 
 /* Forward declarations. */
 
@@ -35,6 +36,62 @@ static IOMedia* instantiateMediaObject(IOLVMPartitionScheme *obj,
 	UInt64 partitionBase, UInt64 partitionSize, bool partitionIsWritable,
 	const char *partitionHint);
 
+/** Number of blocks in the block cache used during scans. */
+#define BLOCK_CACHE_BLOCKS 256
+
+/*
+ * Layouts shared between the PVs of a VG and the scan planner remembering how
+ * much of each device a scan needs. Neither is thread safe, so the scans take
+ * layoutCacheLock around each use of them (but not while reading media).
+ */
+static IOLock *layoutCacheLock = NULL;
+static struct lvm2_layout_cache *layoutCache = NULL;
+static struct lvm2_scan_planner *scanPlanner = NULL;
+
+extern "C" kern_return_t IOLVMPartitionScheme_layoutCacheInit(void);
+extern "C" void IOLVMPartitionScheme_layoutCacheFini(void);
+
+kern_return_t IOLVMPartitionScheme_layoutCacheInit(void)
+{
+	int err;
+
+	layoutCacheLock = IOLockAlloc();
+	if(!layoutCacheLock) {
+		LogError("Error while allocating layout cache lock.");
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	err = lvm2_layout_cache_create(&layoutCache);
+	if(err) {
+		LogError("Error while creating layout cache: %d", err);
+		IOLVMPartitionScheme_layoutCacheFini();
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	/* Most media probed are not PVs, so only the label scan sectors are
+	 * read of a device until a label has been found on it. */
+	err = lvm2_scan_planner_create(LVM2_SCAN_WINDOW_LABEL, &scanPlanner);
+	if(err) {
+		LogError("Error while creating scan planner: %d", err);
+		IOLVMPartitionScheme_layoutCacheFini();
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	return KERN_SUCCESS;
+}
+
+void IOLVMPartitionScheme_layoutCacheFini(void)
+{
+	if(scanPlanner)
+		lvm2_scan_planner_destroy(&scanPlanner);
+	if(layoutCache)
+		lvm2_layout_cache_destroy(&layoutCache);
+	if(layoutCacheLock) {
+		IOLockFree(layoutCacheLock);
+		layoutCacheLock = NULL;
+	}
+}
+
 #define super IOPartitionScheme
 OSDefineMetaClassAndStructors(IOLVMPartitionScheme, IOPartitionScheme);
 
@@ -57,7 +114,11 @@ bool IOLVMPartitionScheme::init(OSDictionary *properties)
 	else {
 		/* Initialize a minimal set of state variables. */
 		_partitions = NULL;
-		status = true;
+		_scanState = NULL;
+		_scanStateLock = IOLockAlloc();
+		status = _scanStateLock ? true : false;
+		if(!status)
+			LogError("Error while allocating scan state lock.");
 	}
 
 	return status;
@@ -71,6 +132,23 @@ void IOLVMPartitionScheme::free()
 	if(_partitions)
 		_partitions->release();
 
+	/* Its layouts may be shared with the layout cache, which then doesn't
+	 * need to keep them for this media any more. */
+	if(_scanState) {
+		IOLockLock(layoutCacheLock);
+		lvm2_scan_state_release(_scanState);
+		lvm2_layout_cache_trim(layoutCache);
+		IOLockUnlock(layoutCacheLock);
+
+		lvm2_free((void**) &_scanState,
+			sizeof(struct lvm2_scan_state));
+	}
+
+	if(_scanStateLock) {
+		IOLockFree(_scanStateLock);
+		_scanStateLock = NULL;
+	}
+
 	/* Ask super to clean up its state. */
 	super::free();
 }
@@ -198,6 +276,16 @@ IOReturn IOLVMPartitionScheme::requestProbe(
 	return partitions ? kIOReturnSuccess : kIOReturnError;
 }
 
+static void layoutCacheLockAcquire(void *const lockContext)
+{
+	IOLockLock((IOLock*) lockContext);
+}
+
+static void layoutCacheLockRelease(void *const lockContext)
+{
+	IOLockUnlock((IOLock*) lockContext);
+}
+
 struct LVMDeviceReadContext {
 	IOLVMPartitionScheme *obj;
 	OSSet *partitions;
@@ -265,10 +353,14 @@ OSSet* IOLVMPartitionScheme::scan(SInt32 *score __attribute__((unused)))
 	int err = 0;
 	OSSet *partitions = NULL;
 	struct lvm2_device *dev = NULL;
+	struct lvm2_block_cache *blockCache = NULL;
 	struct LVMDeviceReadContext ctx;
+	struct lvm2_parse_options options;
 
 	LogDebug("%s: Entering with score=%p.", __FUNCTION__, score);
 
+	IOLockLock(_scanStateLock);
+
 	/* Media must be formatted. */
 
 	if(media->isFormatted() == false)
@@ -287,17 +379,45 @@ OSSet* IOLVMPartitionScheme::scan(SInt32 *score __attribute__((unused)))
 
 	LogDebug("\tAllocated 'partitions'.");
 
+	/* Not fatal, every scan will then be a full one. */
+	if(!_scanState && !lvm2_malloc(sizeof(struct lvm2_scan_state),
+		(void**) &_scanState))
+	{
+		memset(_scanState, 0, sizeof(struct lvm2_scan_state));
+	}
+
 	err = lvm2_iokit_device_create(this, media, &dev);
 	if(err) {
 		LogError("Error while opening device: %d", err);
 		goto err_out;
 	}
 
+	/* The block cache only lives for the duration of the scan, so that a
+	 * probe after the media has changed never sees stale blocks, and only
+	 * this scan uses it. Not fatal, the media is then read directly. */
+	err = lvm2_block_cache_create(LVM2_BLOCK_CACHE_BLOCK_SIZE,
+		BLOCK_CACHE_BLOCKS, &blockCache);
+	if(err)
+		LogError("Error while creating block cache: %d", err);
+	else
+		lvm2_device_set_block_cache(dev, blockCache);
+
 	ctx.obj = this;
 	ctx.partitions = partitions;
 	ctx.partitionNumber = 0;
 
-	err = lvm2_parse_device(dev, volumeCallback, &ctx);
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	options.layout_cache = layoutCache;
+	options.planner = scanPlanner;
+	options.device_key = media->getRegistryEntryID();
+	options.scan_state = _scanState;
+	options.lock = layoutCacheLockAcquire;
+	options.unlock = layoutCacheLockRelease;
+	options.lock_context = layoutCacheLock;
+
+	/* A rescan (requestProbe) only reads the label and mda_headers if they
+	 * haven't changed since the last scan. */
+	err = lvm2_rescan_device(dev, &options, volumeCallback, &ctx);
 	if(err) {
 		LogDebug("Error while parsing LVM2 structures: %d", err);
 		goto err_out;
@@ -306,6 +426,10 @@ OSSet* IOLVMPartitionScheme::scan(SInt32 *score __attribute__((unused)))
 cleanup:
 	if(dev)
 		lvm2_iokit_device_destroy(&dev);
+	if(blockCache)
+		lvm2_block_cache_destroy(&blockCache);
+
+	IOLockUnlock(_scanStateLock);
 
 	return partitions;
 
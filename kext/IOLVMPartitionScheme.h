@@ -29,6 +29,8 @@
 
 #define kIOLVMPartitionSchemeClass "IOLVMPartitionScheme"
 
+struct lvm2_scan_state;
+
 #ifdef KERNEL
 #ifdef __cplusplus
 
@@ -46,6 +48,12 @@ protected:
 	/** Set of media objects representing partitions. */
 	OSSet *_partitions;
 
+	/** What the last scan found, so that rescans can skip the text. */
+	struct lvm2_scan_state *_scanState;
+
+	/** Serializes the scans of the provider media, which share _scanState. */
+	IOLock *_scanStateLock;
+
 	/**
 	 * Free all of this object's outstanding resources.
 	 *
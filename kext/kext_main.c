@@ -23,6 +23,10 @@
 kern_return_t IOLVMPartitionScheme_start(kmod_info_t *ki, void *d);
 kern_return_t IOLVMPartitionScheme_stop(kmod_info_t *ki, void *d);
 
+/* Defined in IOLVMPartitionScheme.cpp. */
+kern_return_t IOLVMPartitionScheme_layoutCacheInit(void);
+void IOLVMPartitionScheme_layoutCacheFini(void);
+
 static const char* get_arch_string()
 {
 #if defined(__i386__)
@@ -43,7 +47,7 @@ kern_return_t IOLVMPartitionScheme_start(
 {
 	IOLog("IOLVMPartitionScheme (%s) loading...\n", get_arch_string());
 
-	return KERN_SUCCESS;
+	return IOLVMPartitionScheme_layoutCacheInit();
 }
 
 kern_return_t IOLVMPartitionScheme_stop(
@@ -52,5 +56,7 @@ kern_return_t IOLVMPartitionScheme_stop(
 {
 	IOLog("IOLVMPartitionScheme (%s) unloading...\n", get_arch_string());
 
+	IOLVMPartitionScheme_layoutCacheFini();
+
 	return KERN_SUCCESS;
 }
@@ -18,6 +18,7 @@
 
 #include "lvm2_osal.h"
 #include "lvm2_types.h"
+#include "lvm2_block_cache.h"
 
 #include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOLib.h>
@@ -109,6 +110,11 @@ __private_extern__ const void* lvm2_io_buffer_get_bytes(
 	return result;
 }
 
+__private_extern__ size_t lvm2_io_buffer_get_size(struct lvm2_io_buffer *buf)
+{
+	return buf->buffer->getLength();
+}
+
 __private_extern__ void lvm2_io_buffer_destroy(struct lvm2_io_buffer **buf)
 {
 	LogDebug("%s: Entering with buf=%p", __FUNCTION__, buf);
@@ -119,76 +125,56 @@ __private_extern__ void lvm2_io_buffer_destroy(struct lvm2_io_buffer **buf)
 	LogDebug("%s: Leaving.", __FUNCTION__);
 }
 
-struct lvm2_device {
+struct lvm2_iokit_device {
+	struct lvm2_device dev;	/**< Must be first. */
 	IOStorage *storage;
 	IOMedia *media;
 	u32 block_size;
+	struct lvm2_block_cache *block_cache;
+
+	/* Bounce buffer for unaligned reads, grown to the largest aligned
+	 * request seen and kept until the device is destroyed. */
+	IOBufferMemoryDescriptor *bounce;
 };
 
-__private_extern__ int lvm2_iokit_device_create(IOStorage *const storage,
-		IOMedia *const media, struct lvm2_device **const out_dev)
+static void lvm2_iokit_device_destroy_impl(struct lvm2_device *const in_dev)
 {
-	int err;
-	UInt64 mediaBlockSize;
-	bool mediaIsOpen = false;
-
-	LogDebug("%s: Entering with storage=%p media=%p out_dev=%p",
-		__FUNCTION__, storage, media, out_dev);
-
-	mediaBlockSize = media->getPreferredBlockSize();
-	if(mediaBlockSize > U32_MAX) {
-		LogError("Unrealistic media block size: %" FMTllu,
-			ARGllu(mediaBlockSize));
-		err = EINVAL;
-	}
-	else {
-		/* Open the media with read-only access. */
+	struct lvm2_iokit_device *dev = (struct lvm2_iokit_device*) in_dev;
 
-		mediaIsOpen = storage->open(storage, 0, kIOStorageAccessReader);
-		if(mediaIsOpen == false) {
-			LogError("Error while opening media.");
-			err = EACCES;
-		}
-		else {
-			struct lvm2_device *dev;
+	LogDebug("%s: Entering with dev=%p.", __FUNCTION__, dev);
 
-			err = lvm2_malloc(sizeof(struct lvm2_device),
-				(void**) &dev);
-			if(!err) {
-				memset(dev, 0, sizeof(struct lvm2_device));
-				dev->storage = storage;
-				dev->media = media;
-				dev->block_size = (u32) mediaBlockSize;
+	if(dev->block_cache)
+		lvm2_block_cache_invalidate(dev->block_cache, &dev->dev);
 
-				*out_dev = dev;
-			}
+	dev->storage->close(dev->storage);
 
-			if(err) {
-				storage->close(storage);
-			}
-		}
-	}
+	if(dev->bounce)
+		dev->bounce->release();
 
-	LogDebug("%s: Leaving with %d.", __FUNCTION__, err);
+	lvm2_free((void**) &dev, sizeof(struct lvm2_iokit_device));
 
-	return err;
+	LogDebug("%s: Leaving.", __FUNCTION__);
 }
 
-__private_extern__ void lvm2_iokit_device_destroy(struct lvm2_device **dev)
+static void lvm2_iokit_device_set_block_cache(
+		struct lvm2_device *const in_dev,
+		struct lvm2_block_cache *const cache)
 {
-	LogDebug("%s: Entering with dev=%p.", __FUNCTION__, dev);
-
-	(*dev)->storage->close((*dev)->storage);
+	struct lvm2_iokit_device *const dev =
+		(struct lvm2_iokit_device*) in_dev;
 
-	lvm2_free((void**) dev, sizeof(struct lvm2_device));
+	if(dev->block_cache)
+		lvm2_block_cache_invalidate(dev->block_cache, &dev->dev);
 
-	LogDebug("%s: Leaving.", __FUNCTION__);
+	dev->block_cache = cache;
 }
 
-__private_extern__ int lvm2_device_read(struct lvm2_device *const dev,
+static int lvm2_iokit_device_read_uncached(struct lvm2_device *const in_dev,
 		const u64 in_pos, const size_t in_count,
 		struct lvm2_io_buffer *const in_buf)
 {
+	struct lvm2_iokit_device *const dev =
+		(struct lvm2_iokit_device*) in_dev;
 	int err;
 	IOReturn status;
 
@@ -203,12 +189,6 @@ __private_extern__ int lvm2_device_read(struct lvm2_device *const dev,
 		"in_count=%" FMTzu " in_buf=%p",
 		__FUNCTION__, dev, ARGllu(in_pos), ARGzu(in_count), in_buf);
 
-	if(in_count > SSIZE_MAX) {
-		LogDebug("%s: 'in_count' overflows. Leaving with %d.",
-			__FUNCTION__, ERANGE);
-		return ERANGE;
-	}
-
 	lead_in = (u32) (in_pos % dev->block_size);
 	lead_out = (dev->block_size - (u32) ((lead_in + in_count) %
 		dev->block_size)) % dev->block_size;
@@ -221,32 +201,37 @@ __private_extern__ int lvm2_device_read(struct lvm2_device *const dev,
 	if(lead_in != 0 || lead_out != 0 ||
 		in_count != in_buf->buffer->getLength())
 	{
-		u64 aligned_pos;
-		size_t aligned_count;
-		IOBufferMemoryDescriptor *aligned_buf = NULL;
-
-		aligned_pos = in_pos - lead_in;
-		aligned_count = lead_in + in_count + lead_out;
-
-		LogError("Warning: Unaligned read. Aligning (%" FMTllu ", "
-			"%" FMTzu ") -> (%" FMTllu ", %" FMTzu ")...",
-			ARGllu(in_pos), ARGzu(in_count), ARGllu(aligned_pos),
-			ARGzu(aligned_count));
+		pos = in_pos - lead_in;
+		count = lead_in + in_count + lead_out;
+
+		LogDebug("Unaligned read. Aligning (%" FMTllu ", %" FMTzu ") "
+			"-> (%" FMTllu ", %" FMTzu ")...",
+			ARGllu(in_pos), ARGzu(in_count), ARGllu(pos),
+			ARGzu(count));
+
+		if(!dev->bounce || count > dev->bounce->getCapacity()) {
+			IOBufferMemoryDescriptor *newBounce;
+
+			newBounce = IOBufferMemoryDescriptor::withCapacity(
+				/* capacity      */ count,
+				/* withDirection */ kIODirectionIn);
+			if(newBounce == NULL) {
+				LogError("Bounce buffer allocation (%" FMTzu " "
+					"bytes) failed.",
+					ARGzu(count));
+				LogDebug("%s: Leaving with %d.", __FUNCTION__,
+					ENOMEM);
+				return ENOMEM;
+			}
 
-		aligned_buf = IOBufferMemoryDescriptor::withCapacity(
-			/* capacity      */ aligned_count,
-			/* withDirection */ kIODirectionIn);
-		if(aligned_buf == NULL) {
-			LogError("Temporary memory allocation (%" FMTzu " "
-				"bytes) failed.",
-				ARGzu(aligned_count));
-			LogDebug("%s: Leaving with %d.", __FUNCTION__, ENOMEM);
-			return ENOMEM;
+			if(dev->bounce)
+				dev->bounce->release();
+			dev->bounce = newBounce;
 		}
 
-		pos = aligned_pos;
-		count = aligned_count;
-		buf = aligned_buf;
+		/* The media reads the descriptor's full length. */
+		dev->bounce->setLength(count);
+		buf = dev->bounce;
 	}
 	else {
 		pos = in_pos;
@@ -262,7 +247,8 @@ __private_extern__ int lvm2_device_read(struct lvm2_device *const dev,
 		if(buf != in_buf->buffer) {
 			IOByteCount res;
 			res = in_buf->buffer->writeBytes(0,
-				buf->getBytesNoCopy(), in_count);
+				&((const char*) buf->getBytesNoCopy())[lead_in],
+				in_count);
 			if(res != in_count) {
 				LogError("Failed to write data back into the "
 					"input buffer. Wrote "
@@ -274,16 +260,211 @@ __private_extern__ int lvm2_device_read(struct lvm2_device *const dev,
 		err = 0;
 	}
 
-	if(buf != in_buf->buffer) {
-		buf->release();
+	LogDebug("%s: Leaving with %d", __FUNCTION__, err);
+
+	return err;
+}
+
+static int lvm2_iokit_device_read(struct lvm2_device *const in_dev,
+		const u64 in_pos, const size_t in_count,
+		struct lvm2_io_buffer *const in_buf)
+{
+	struct lvm2_iokit_device *const dev =
+		(struct lvm2_iokit_device*) in_dev;
+
+	if(in_count > SSIZE_MAX || in_count > in_buf->buffer->getLength()) {
+		LogDebug("%s: 'in_count' overflows. Leaving with %d.",
+			__FUNCTION__, ERANGE);
+		return ERANGE;
+	}
+
+	/* If the cache can't serve the read, read it directly. */
+	if(dev->block_cache && !lvm2_block_cache_read(dev->block_cache,
+		&dev->dev, in_pos, in_count, in_buf->buffer->getBytesNoCopy(),
+		lvm2_iokit_device_read_uncached))
+	{
+		return 0;
 	}
 
-	LogDebug("%s: Leaving with %d", __FUNCTION__, err);
+	return lvm2_iokit_device_read_uncached(&dev->dev, in_pos, in_count,
+		in_buf);
+}
+
+static u32 lvm2_iokit_device_get_alignment(struct lvm2_device *const dev)
+{
+	return ((struct lvm2_iokit_device*) dev)->block_size;
+}
+
+/*
+ * Metadata ranges are few and far apart on real media, so vectored reads are
+ * left to the generic fallback, which reads the ranges one at a time. IOMedia
+ * isn't memory backed, so there is no map_range either, and statistics aren't
+ * collected in the kernel.
+ */
+static const struct lvm2_device_ops lvm2_iokit_device_ops = {
+	/* .read            = */ lvm2_iokit_device_read,
+	/* .readv           = */ NULL,
+	/* .get_alignment   = */ lvm2_iokit_device_get_alignment,
+	/* .map_range       = */ NULL,
+	/* .get_stats       = */ NULL,
+	/* .set_block_cache = */ lvm2_iokit_device_set_block_cache,
+	/* .destroy         = */ lvm2_iokit_device_destroy_impl,
+	/* .advise          = */ NULL,
+};
+
+__private_extern__ int lvm2_iokit_device_create(IOStorage *const storage,
+		IOMedia *const media, struct lvm2_device **const out_dev)
+{
+	int err;
+	UInt64 mediaBlockSize;
+	bool mediaIsOpen = false;
+
+	LogDebug("%s: Entering with storage=%p media=%p out_dev=%p",
+		__FUNCTION__, storage, media, out_dev);
+
+	mediaBlockSize = media->getPreferredBlockSize();
+	if(mediaBlockSize > U32_MAX) {
+		LogError("Unrealistic media block size: %" FMTllu,
+			ARGllu(mediaBlockSize));
+		err = EINVAL;
+	}
+	else {
+		/* Open the media with read-only access. */
+
+		mediaIsOpen = storage->open(storage, 0, kIOStorageAccessReader);
+		if(mediaIsOpen == false) {
+			LogError("Error while opening media.");
+			err = EACCES;
+		}
+		else {
+			struct lvm2_iokit_device *dev;
+
+			err = lvm2_malloc(sizeof(struct lvm2_iokit_device),
+				(void**) &dev);
+			if(!err) {
+				memset(dev, 0,
+					sizeof(struct lvm2_iokit_device));
+				dev->dev.ops = &lvm2_iokit_device_ops;
+				dev->storage = storage;
+				dev->media = media;
+				dev->block_size = (u32) mediaBlockSize;
+
+				*out_dev = &dev->dev;
+			}
+
+			if(err) {
+				storage->close(storage);
+			}
+		}
+	}
+
+	LogDebug("%s: Leaving with %d.", __FUNCTION__, err);
 
 	return err;
 }
 
-__private_extern__ u32 lvm2_device_get_alignment(struct lvm2_device *dev)
+__private_extern__ void lvm2_iokit_device_destroy(struct lvm2_device **dev)
+{
+	lvm2_device_destroy(dev);
+}
+
+/*
+ * Asynchronous reads. Probes run one media at a time, so there is nothing to
+ * gain from overlapping reads here: reads are done synchronously when they are
+ * submitted and only their completions are deferred to lvm2_io_queue_poll.
+ */
+
+struct lvm2_iokit_io_request {
+	struct lvm2_iokit_io_request *next;
+	lvm2_device_read_callback completion;
+	void *context;
+	int err;
+};
+
+struct lvm2_io_queue {
+	struct lvm2_iokit_io_request *completed_head;
+	struct lvm2_iokit_io_request *completed_tail;
+};
+
+__private_extern__ int lvm2_io_queue_create(
+		struct lvm2_io_queue **const out_queue)
+{
+	int err;
+	struct lvm2_io_queue *queue;
+
+	err = lvm2_malloc(sizeof(struct lvm2_io_queue), (void**) &queue);
+	if(err)
+		return err;
+
+	memset(queue, 0, sizeof(struct lvm2_io_queue));
+
+	*out_queue = queue;
+
+	return 0;
+}
+
+__private_extern__ void lvm2_io_queue_destroy(
+		struct lvm2_io_queue **const queue)
 {
-	return dev->block_size;
+	while((*queue)->completed_head) {
+		struct lvm2_iokit_io_request *req = (*queue)->completed_head;
+
+		(*queue)->completed_head = req->next;
+		lvm2_free((void**) &req, sizeof(struct lvm2_iokit_io_request));
+	}
+
+	lvm2_free((void**) queue, sizeof(struct lvm2_io_queue));
+}
+
+__private_extern__ int lvm2_device_read_async(
+		struct lvm2_io_queue *const queue,
+		struct lvm2_device *const dev, const u64 pos,
+		const size_t count, struct lvm2_io_buffer *const buf,
+		const lvm2_device_read_callback completion,
+		void *const context)
+{
+	int err;
+	struct lvm2_iokit_io_request *req;
+
+	err = lvm2_malloc(sizeof(struct lvm2_iokit_io_request),
+		(void**) &req);
+	if(err)
+		return err;
+
+	req->next = NULL;
+	req->completion = completion;
+	req->context = context;
+	req->err = lvm2_device_read(dev, pos, count, buf);
+
+	if(queue->completed_tail)
+		queue->completed_tail->next = req;
+	else
+		queue->completed_head = req;
+	queue->completed_tail = req;
+
+	return 0;
+}
+
+__private_extern__ size_t lvm2_io_queue_poll(
+		struct lvm2_io_queue *const queue,
+		const lvm2_bool wait __attribute__((unused)))
+{
+	struct lvm2_iokit_io_request *req;
+	size_t completed_len = 0;
+
+	req = queue->completed_head;
+	queue->completed_head = NULL;
+	queue->completed_tail = NULL;
+
+	while(req) {
+		struct lvm2_iokit_io_request *const next = req->next;
+
+		req->completion(req->context, req->err);
+		lvm2_free((void**) &req, sizeof(struct lvm2_iokit_io_request));
+
+		req = next;
+		++completed_len;
+	}
+
+	return completed_len;
 }
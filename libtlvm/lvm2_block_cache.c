@@ -0,0 +1,427 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_block_cache.h"
+#include "lvm2_osal.h"
+
+#include <string.h>
+
+#include <sys/errno.h>
+
+/** Index value that doesn't refer to any entry. */
+#define LVM2_BLOCK_CACHE_NONE U32_MAX
+
+/**
+ * Requests spanning more than this fraction of the cache are not cached, so
+ * that a single large read (such as a scan window) doesn't flush it.
+ */
+#define LVM2_BLOCK_CACHE_MAX_REQUEST_DIVISOR 4
+
+struct lvm2_block_cache_entry {
+	const struct lvm2_device *dev;	/**< NULL if the entry is unused. */
+	u64 block_no;
+	struct lvm2_io_buffer *buf;	/**< Allocated on first use. */
+	u32 hash_next;
+	u32 lru_prev;
+	u32 lru_next;
+};
+
+/**
+ * All entries are kept on one LRU list, most recently used first. Unused
+ * entries are moved to the tail, so the tail is always the next entry to be
+ * (re)used. An entry that is being filled is on neither the LRU list nor a
+ * hash chain, so that nothing else touches it while the fill function runs.
+ */
+struct lvm2_block_cache {
+	u32 block_size;
+	u32 entries_len;
+	struct lvm2_block_cache_entry *entries;
+	size_t buckets_len;
+	u32 *buckets;
+	u32 lru_head;
+	u32 lru_tail;
+	size_t blocks;
+
+	u64 hits;
+	u64 misses;
+	u64 bypassed;
+};
+
+static size_t lvm2_block_cache_hash(const struct lvm2_block_cache *const cache,
+		const struct lvm2_device *const dev, const u64 block_no)
+{
+	/* Fibonacci hashing of the device pointer and block number. */
+	return (size_t) (((((u64) (size_t) dev) >> 3) ^ block_no) *
+		0x9E3779B97F4A7C15ULL) & (cache->buckets_len - 1);
+}
+
+static void lvm2_block_cache_lru_unlink(struct lvm2_block_cache *const cache,
+		const u32 index)
+{
+	struct lvm2_block_cache_entry *const entry = &cache->entries[index];
+
+	if(entry->lru_prev != LVM2_BLOCK_CACHE_NONE)
+		cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+
+	if(entry->lru_next != LVM2_BLOCK_CACHE_NONE)
+		cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+
+	entry->lru_prev = LVM2_BLOCK_CACHE_NONE;
+	entry->lru_next = LVM2_BLOCK_CACHE_NONE;
+}
+
+static void lvm2_block_cache_lru_push_head(
+		struct lvm2_block_cache *const cache, const u32 index)
+{
+	struct lvm2_block_cache_entry *const entry = &cache->entries[index];
+
+	entry->lru_prev = LVM2_BLOCK_CACHE_NONE;
+	entry->lru_next = cache->lru_head;
+
+	if(cache->lru_head != LVM2_BLOCK_CACHE_NONE)
+		cache->entries[cache->lru_head].lru_prev = index;
+	else
+		cache->lru_tail = index;
+
+	cache->lru_head = index;
+}
+
+static void lvm2_block_cache_lru_push_tail(
+		struct lvm2_block_cache *const cache, const u32 index)
+{
+	struct lvm2_block_cache_entry *const entry = &cache->entries[index];
+
+	entry->lru_prev = cache->lru_tail;
+	entry->lru_next = LVM2_BLOCK_CACHE_NONE;
+
+	if(cache->lru_tail != LVM2_BLOCK_CACHE_NONE)
+		cache->entries[cache->lru_tail].lru_next = index;
+	else
+		cache->lru_head = index;
+
+	cache->lru_tail = index;
+}
+
+static u32 lvm2_block_cache_find(const struct lvm2_block_cache *const cache,
+		const struct lvm2_device *const dev, const u64 block_no)
+{
+	u32 index;
+
+	index = cache->buckets[lvm2_block_cache_hash(cache, dev, block_no)];
+	while(index != LVM2_BLOCK_CACHE_NONE) {
+		const struct lvm2_block_cache_entry *const entry =
+			&cache->entries[index];
+
+		if(entry->dev == dev && entry->block_no == block_no)
+			break;
+
+		index = entry->hash_next;
+	}
+
+	return index;
+}
+
+/**
+ * Remove the entry at 'index' from its hash chain and mark it unused. The
+ * entry's position in the LRU list is left to the caller.
+ */
+static void lvm2_block_cache_unhash(struct lvm2_block_cache *const cache,
+		const u32 index)
+{
+	struct lvm2_block_cache_entry *const entry = &cache->entries[index];
+	u32 *link;
+
+	link = &cache->buckets[lvm2_block_cache_hash(cache, entry->dev,
+		entry->block_no)];
+	while(*link != index)
+		link = &cache->entries[*link].hash_next;
+
+	*link = entry->hash_next;
+
+	entry->dev = NULL;
+	entry->hash_next = LVM2_BLOCK_CACHE_NONE;
+	--cache->blocks;
+}
+
+LVM2_EXPORT int lvm2_block_cache_create(const u32 block_size,
+		const size_t blocks_len, struct lvm2_block_cache **const out_cache)
+{
+	int err;
+	struct lvm2_block_cache *cache = NULL;
+	size_t buckets_len;
+	u32 i;
+
+	if(!block_size || (block_size & (block_size - 1)) || !blocks_len ||
+		blocks_len >= LVM2_BLOCK_CACHE_NONE)
+	{
+		return EINVAL;
+	}
+
+	buckets_len = 1;
+	while(buckets_len < blocks_len)
+		buckets_len *= 2;
+
+	err = lvm2_malloc(sizeof(struct lvm2_block_cache), (void**) &cache);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_block_cache: %d", err);
+		return err;
+	}
+
+	memset(cache, 0, sizeof(struct lvm2_block_cache));
+	cache->block_size = block_size;
+	cache->entries_len = (u32) blocks_len;
+	cache->buckets_len = buckets_len;
+	cache->lru_head = LVM2_BLOCK_CACHE_NONE;
+	cache->lru_tail = LVM2_BLOCK_CACHE_NONE;
+
+	err = lvm2_malloc(blocks_len * sizeof(struct lvm2_block_cache_entry),
+		(void**) &cache->entries);
+	if(err) {
+		LogError("Error while allocating memory for block cache "
+			"entries: %d", err);
+		goto err_out;
+	}
+
+	err = lvm2_malloc(buckets_len * sizeof(u32), (void**) &cache->buckets);
+	if(err) {
+		LogError("Error while allocating memory for block cache "
+			"buckets: %d", err);
+		goto err_out;
+	}
+
+	for(i = 0; i < cache->entries_len; ++i) {
+		struct lvm2_block_cache_entry *const entry = &cache->entries[i];
+
+		memset(entry, 0, sizeof(struct lvm2_block_cache_entry));
+		entry->hash_next = LVM2_BLOCK_CACHE_NONE;
+		lvm2_block_cache_lru_push_tail(cache, i);
+	}
+
+	for(i = 0; i < buckets_len; ++i)
+		cache->buckets[i] = LVM2_BLOCK_CACHE_NONE;
+
+	*out_cache = cache;
+
+	return 0;
+err_out:
+	if(cache->entries) {
+		lvm2_free((void**) &cache->entries,
+			blocks_len * sizeof(struct lvm2_block_cache_entry));
+	}
+
+	lvm2_free((void**) &cache, sizeof(struct lvm2_block_cache));
+
+	return err;
+}
+
+LVM2_EXPORT void lvm2_block_cache_destroy(
+		struct lvm2_block_cache **const cache)
+{
+	u32 i;
+
+	for(i = 0; i < (*cache)->entries_len; ++i) {
+		if((*cache)->entries[i].buf)
+			lvm2_io_buffer_destroy(&(*cache)->entries[i].buf);
+	}
+
+	lvm2_free((void**) &(*cache)->buckets,
+		(*cache)->buckets_len * sizeof(u32));
+	lvm2_free((void**) &(*cache)->entries,
+		(*cache)->entries_len * sizeof(struct lvm2_block_cache_entry));
+	lvm2_free((void**) cache, sizeof(struct lvm2_block_cache));
+}
+
+/**
+ * Return the index of the entry holding block 'block_no' of 'dev', reading it
+ * into the least recently used entry if it isn't cached. Returns ENOTSUP if
+ * every entry is currently being filled.
+ */
+static int lvm2_block_cache_get_block(struct lvm2_block_cache *const cache,
+		struct lvm2_device *const dev, const u64 block_no,
+		const lvm2_block_cache_fill_func fill, u32 *const out_index)
+{
+	int err;
+	u32 index;
+	u32 found;
+	struct lvm2_block_cache_entry *entry;
+	size_t bucket;
+
+	index = lvm2_block_cache_find(cache, dev, block_no);
+	if(index != LVM2_BLOCK_CACHE_NONE) {
+		++cache->hits;
+
+		if(index != cache->lru_head) {
+			lvm2_block_cache_lru_unlink(cache, index);
+			lvm2_block_cache_lru_push_head(cache, index);
+		}
+
+		*out_index = index;
+		return 0;
+	}
+
+	index = cache->lru_tail;
+	if(index == LVM2_BLOCK_CACHE_NONE)
+		return ENOTSUP;
+
+	++cache->misses;
+
+	entry = &cache->entries[index];
+	if(entry->dev)
+		lvm2_block_cache_unhash(cache, index);
+
+	if(!entry->buf) {
+		err = lvm2_io_buffer_create(cache->block_size, &entry->buf);
+		if(err) {
+			LogError("Error while allocating block cache buffer: "
+				"%d", err);
+			return err;
+		}
+	}
+
+	/* Set the entry aside while it is filled, since 'fill' may let other
+	 * threads into the cache. */
+	lvm2_block_cache_lru_unlink(cache, index);
+
+	err = fill(dev, block_no * cache->block_size, cache->block_size,
+		entry->buf);
+	if(err) {
+		lvm2_block_cache_lru_push_tail(cache, index);
+		return err;
+	}
+
+	found = lvm2_block_cache_find(cache, dev, block_no);
+	if(found != LVM2_BLOCK_CACHE_NONE) {
+		/* Another thread cached the same block while we were reading
+		 * it. Keep theirs and give our entry back. */
+		lvm2_block_cache_lru_push_tail(cache, index);
+
+		if(found != cache->lru_head) {
+			lvm2_block_cache_lru_unlink(cache, found);
+			lvm2_block_cache_lru_push_head(cache, found);
+		}
+
+		*out_index = found;
+		return 0;
+	}
+
+	entry->dev = dev;
+	entry->block_no = block_no;
+
+	bucket = lvm2_block_cache_hash(cache, dev, block_no);
+	entry->hash_next = cache->buckets[bucket];
+	cache->buckets[bucket] = index;
+	++cache->blocks;
+
+	lvm2_block_cache_lru_push_head(cache, index);
+
+	*out_index = index;
+
+	return 0;
+}
+
+LVM2_EXPORT int lvm2_block_cache_read(struct lvm2_block_cache *const cache,
+		struct lvm2_device *const dev, const u64 pos, const size_t count,
+		void *const out_data, const lvm2_block_cache_fill_func fill)
+{
+	const u32 alignment = lvm2_device_get_alignment(dev);
+	const u64 block_size = cache->block_size;
+
+	int err;
+	u64 first_block;
+	u64 last_block;
+	u64 block_no;
+	size_t copied = 0;
+
+	if(!count)
+		return 0;
+	else if((u64) count > U64_MAX - pos)
+		return ERANGE;
+
+	first_block = pos / block_size;
+	last_block = (pos + count - 1) / block_size;
+
+	if(!alignment || block_size % alignment ||
+		last_block - first_block >= (cache->entries_len +
+		LVM2_BLOCK_CACHE_MAX_REQUEST_DIVISOR - 1) /
+		LVM2_BLOCK_CACHE_MAX_REQUEST_DIVISOR)
+	{
+		++cache->bypassed;
+		return ENOTSUP;
+	}
+
+	for(block_no = first_block; block_no <= last_block; ++block_no) {
+		const u64 block_pos = block_no * block_size;
+		const size_t block_offset = (block_no == first_block) ?
+			(size_t) (pos - block_pos) : 0;
+		const size_t copy_size =
+			((size_t) block_size - block_offset < count - copied) ?
+			(size_t) block_size - block_offset : count - copied;
+
+		u32 index;
+
+		err = lvm2_block_cache_get_block(cache, dev, block_no, fill,
+			&index);
+		if(err == ENOTSUP) {
+			++cache->bypassed;
+			return err;
+		}
+		else if(err)
+			return err;
+
+		memcpy(&((char*) out_data)[copied],
+			&((const char*) lvm2_io_buffer_get_bytes(
+			cache->entries[index].buf))[block_offset],
+			copy_size);
+		copied += copy_size;
+	}
+
+	return 0;
+}
+
+LVM2_EXPORT void lvm2_block_cache_invalidate(
+		struct lvm2_block_cache *const cache,
+		const struct lvm2_device *const dev)
+{
+	u32 i;
+
+	for(i = 0; i < cache->entries_len; ++i) {
+		if(!cache->entries[i].dev || cache->entries[i].dev != dev)
+			continue;
+
+		lvm2_block_cache_unhash(cache, i);
+		lvm2_block_cache_lru_unlink(cache, i);
+		lvm2_block_cache_lru_push_tail(cache, i);
+	}
+}
+
+LVM2_EXPORT void lvm2_block_cache_get_stats(
+		const struct lvm2_block_cache *const cache,
+		struct lvm2_block_cache_stats *const out_stats)
+{
+	memset(out_stats, 0, sizeof(struct lvm2_block_cache_stats));
+
+	out_stats->hits = cache->hits;
+	out_stats->misses = cache->misses;
+	out_stats->bypassed = cache->bypassed;
+	out_stats->blocks = cache->blocks;
+}
@@ -0,0 +1,95 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Dispatch of the lvm2_device_* functions to the backend of each device. See
+ * lvm2_device.h.
+ */
+
+#include "lvm2_device.h"
+#include "lvm2_osal.h"
+
+#include <sys/errno.h>
+
+LVM2_EXPORT int lvm2_device_read(struct lvm2_device *const dev,
+		const u64 pos, const size_t count,
+		struct lvm2_io_buffer *const buf)
+{
+	return dev->ops->read(dev, pos, count, buf);
+}
+
+LVM2_EXPORT int lvm2_device_readv(struct lvm2_device *const dev,
+		const struct lvm2_read_range *const ranges,
+		const size_t ranges_len)
+{
+	int err = 0;
+	size_t i;
+
+	if(dev->ops->readv)
+		return dev->ops->readv(dev, ranges, ranges_len);
+
+	for(i = 0; i < ranges_len && !err; ++i) {
+		err = dev->ops->read(dev, ranges[i].pos, ranges[i].count,
+			ranges[i].buf);
+	}
+
+	return err;
+}
+
+LVM2_EXPORT u32 lvm2_device_get_alignment(struct lvm2_device *const dev)
+{
+	return dev->ops->get_alignment(dev);
+}
+
+LVM2_EXPORT int lvm2_device_map_range(struct lvm2_device *const dev,
+		const u64 pos, const size_t count, const void **const out_bytes)
+{
+	if(!dev->ops->map_range)
+		return ENOTSUP;
+
+	return dev->ops->map_range(dev, pos, count, out_bytes);
+}
+
+LVM2_EXPORT int lvm2_device_get_stats(struct lvm2_device *const dev,
+		struct lvm2_device_stats *const out_stats)
+{
+	if(!dev->ops->get_stats)
+		return ENOTSUP;
+
+	return dev->ops->get_stats(dev, out_stats);
+}
+
+LVM2_EXPORT void lvm2_device_advise(struct lvm2_device *const dev,
+		const u64 pos, const u64 count, const lvm2_device_advice advice)
+{
+	if(dev->ops->advise)
+		dev->ops->advise(dev, pos, count, advice);
+}
+
+LVM2_EXPORT void lvm2_device_set_block_cache(struct lvm2_device *const dev,
+		struct lvm2_block_cache *const cache)
+{
+	if(dev->ops->set_block_cache)
+		dev->ops->set_block_cache(dev, cache);
+}
+
+LVM2_EXPORT void lvm2_device_destroy(struct lvm2_device **const dev)
+{
+	(*dev)->ops->destroy(*dev);
+	*dev = NULL;
+}
@@ -0,0 +1,724 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_frozen.h"
+#include "lvm2_osal.h"
+
+#include <string.h>
+
+#include <sys/errno.h>
+
+#define LVM2_FROZEN_ALIGNMENT 8
+
+#define AlignSize(size, alignment) \
+	(((size) + ((alignment) - 1)) / (alignment) * (alignment))
+
+struct lvm2_frozen_string_map_entry {
+	const struct lvm2_bounded_string *string;
+	u32 offset;
+	u32 pv_index;
+};
+
+/**
+ * State while freezing a layout. Since all strings in a layout are interned,
+ * each distinct string is a distinct pointer, so the map from strings to their
+ * offsets in the frozen layout is keyed on the pointer alone. The map also
+ * remembers the index of the PV that each PV name belongs to, which lets us
+ * resolve the PV names in stripes and mirrors to indices.
+ */
+struct lvm2_frozen_builder {
+	size_t map_len;
+	struct lvm2_frozen_string_map_entry *map;
+
+	u64 strings_offset;
+	u64 strings_size;
+
+	/* NULL while sizing the layout, destination when filling it in. */
+	struct lvm2_frozen_layout *frozen;
+};
+
+static struct lvm2_frozen_string_map_entry* lvm2_frozen_builder_lookup(
+		const struct lvm2_frozen_builder *const builder,
+		const struct lvm2_bounded_string *const string)
+{
+	const size_t mask = builder->map_len - 1;
+	size_t i;
+
+	/* Fibonacci hashing of the pointer value. */
+	i = (size_t) ((((u64) (size_t) string) >> 3) *
+		0x9E3779B97F4A7C15ULL) & mask;
+	while(builder->map[i].string && builder->map[i].string != string)
+		i = (i + 1) & mask;
+
+	return &builder->map[i];
+}
+
+/**
+ * Returns the offset of 'string' in the frozen layout, adding it to the string
+ * table if it hasn't been seen before. A NULL string (absent optional member)
+ * maps to LVM2_FROZEN_NONE.
+ */
+static u32 lvm2_frozen_builder_add_string(
+		struct lvm2_frozen_builder *const builder,
+		const struct lvm2_bounded_string *const string)
+{
+	struct lvm2_frozen_string_map_entry *entry;
+
+	if(!string)
+		return LVM2_FROZEN_NONE;
+
+	entry = lvm2_frozen_builder_lookup(builder, string);
+	if(!entry->string) {
+		/* The characters start right after the u32 length and each
+		 * entry is padded so that the next length is aligned. */
+		entry->string = string;
+		entry->offset = (u32) (builder->strings_offset +
+			builder->strings_size + sizeof(u32));
+		entry->pv_index = LVM2_FROZEN_NONE;
+
+		builder->strings_size += AlignSize(sizeof(u32) +
+			string->length + 1, sizeof(u32));
+	}
+
+	return entry->offset;
+}
+
+static void lvm2_frozen_builder_walk(
+		struct lvm2_frozen_builder *const builder,
+		const struct lvm2_layout *const layout)
+{
+	const struct lvm2_volume_group *const vg = layout->vg;
+	struct lvm2_frozen_layout *const frozen = builder->frozen;
+	struct lvm2_frozen_physical_volume *frozen_pvs = NULL;
+	struct lvm2_frozen_logical_volume *frozen_lvs = NULL;
+	struct lvm2_frozen_segment *frozen_segments = NULL;
+	struct lvm2_frozen_pv_location *frozen_locations = NULL;
+	u32 segment_index = 0;
+	u32 location_index = 0;
+	size_t i;
+
+	if(frozen) {
+		frozen_pvs = (struct lvm2_frozen_physical_volume*)
+			lvm2_frozen_layout_get_physical_volumes(frozen);
+		frozen_lvs = (struct lvm2_frozen_logical_volume*)
+			lvm2_frozen_layout_get_logical_volumes(frozen);
+		frozen_segments = (struct lvm2_frozen_segment*)
+			lvm2_frozen_layout_get_segments(frozen);
+		frozen_locations = (struct lvm2_frozen_pv_location*)
+			lvm2_frozen_layout_get_locations(frozen);
+
+		frozen->vg_name = lvm2_frozen_builder_add_string(builder,
+			layout->vg_name);
+		frozen->vg_id = lvm2_frozen_builder_add_string(builder,
+			vg->id);
+		frozen->vg_format = lvm2_frozen_builder_add_string(builder,
+			vg->format);
+		frozen->vg_status = vg->status;
+		frozen->vg_flags = vg->flags;
+		frozen->vg_flags_defined = vg->flags_defined ? 1 : 0;
+		frozen->vg_seqno = vg->seqno;
+		frozen->vg_extent_size = vg->extent_size;
+		frozen->vg_max_lv = vg->max_lv;
+		frozen->vg_max_pv = vg->max_pv;
+		frozen->vg_metadata_copies = vg->metadata_copies;
+
+		frozen->contents = lvm2_frozen_builder_add_string(builder,
+			layout->contents);
+		frozen->description = lvm2_frozen_builder_add_string(builder,
+			layout->description);
+		frozen->creation_host = lvm2_frozen_builder_add_string(builder,
+			layout->creation_host);
+		frozen->version = layout->version;
+		frozen->creation_time = layout->creation_time;
+	}
+	else {
+		lvm2_frozen_builder_add_string(builder, layout->vg_name);
+		lvm2_frozen_builder_add_string(builder, vg->id);
+		lvm2_frozen_builder_add_string(builder, vg->format);
+		lvm2_frozen_builder_add_string(builder, layout->contents);
+		lvm2_frozen_builder_add_string(builder, layout->description);
+		lvm2_frozen_builder_add_string(builder, layout->creation_host);
+	}
+
+	for(i = 0; i < vg->physical_volumes_len; ++i) {
+		const struct lvm2_physical_volume *const pv =
+			vg->physical_volumes[i];
+		const u32 name = lvm2_frozen_builder_add_string(builder,
+			pv->name);
+		const u32 id = lvm2_frozen_builder_add_string(builder, pv->id);
+		const u32 device = lvm2_frozen_builder_add_string(builder,
+			pv->device);
+
+		if(!frozen) {
+			/* Only the first PV with a given name can be
+			 * referenced. */
+			struct lvm2_frozen_string_map_entry *const entry =
+				lvm2_frozen_builder_lookup(builder, pv->name);
+
+			if(entry->pv_index == LVM2_FROZEN_NONE)
+				entry->pv_index = (u32) i;
+			continue;
+		}
+
+		frozen_pvs[i].name = name;
+		frozen_pvs[i].id = id;
+		frozen_pvs[i].device = device;
+		frozen_pvs[i].status = pv->status;
+		frozen_pvs[i].flags = pv->flags;
+		frozen_pvs[i].flags_defined = pv->flags_defined ? 1 : 0;
+		frozen_pvs[i].dev_size_defined = pv->dev_size_defined ? 1 : 0;
+		frozen_pvs[i].dev_size = pv->dev_size;
+		frozen_pvs[i].pe_start = pv->pe_start;
+		frozen_pvs[i].pe_count = pv->pe_count;
+	}
+
+	for(i = 0; i < vg->logical_volumes_len; ++i) {
+		const struct lvm2_logical_volume *const lv =
+			vg->logical_volumes[i];
+		const u32 name = lvm2_frozen_builder_add_string(builder,
+			lv->name);
+		const u32 id = lvm2_frozen_builder_add_string(builder, lv->id);
+		const u32 creation_host = lvm2_frozen_builder_add_string(
+			builder, lv->creation_host);
+		const u32 creation_time = lvm2_frozen_builder_add_string(
+			builder, lv->creation_time);
+		const u32 allocation_policy = lvm2_frozen_builder_add_string(
+			builder, lv->allocation_policy);
+		size_t j;
+
+		if(frozen) {
+			frozen_lvs[i].name = name;
+			frozen_lvs[i].id = id;
+			frozen_lvs[i].status = lv->status;
+			frozen_lvs[i].flags = lv->flags;
+			frozen_lvs[i].flags_defined =
+				lv->flags_defined ? 1 : 0;
+			frozen_lvs[i].creation_host = creation_host;
+			frozen_lvs[i].creation_time = creation_time;
+			frozen_lvs[i].allocation_policy = allocation_policy;
+			frozen_lvs[i].first_segment = segment_index;
+			frozen_lvs[i].segments_len = (u32) lv->segments_len;
+		}
+
+		for(j = 0; j < lv->segments_len; ++j) {
+			const struct lvm2_segment *const segment =
+				&lv->segments[j];
+			const struct lvm2_pv_location *const locations =
+				lvm2_segment_get_locations(segment);
+			const u32 type = lvm2_frozen_builder_add_string(builder,
+				segment->type);
+			u32 mirror_log = LVM2_FROZEN_NONE;
+			u32 k;
+
+			if(segment->kind == LVM2_SEGMENT_KIND_MIRRORED) {
+				mirror_log = lvm2_frozen_builder_add_string(
+					builder, segment->u.mirrored.mirror_log);
+			}
+
+			if(frozen) {
+				struct lvm2_frozen_segment *const
+					frozen_segment =
+					&frozen_segments[segment_index];
+
+				frozen_segment->start_extent =
+					segment->start_extent;
+				frozen_segment->extent_count =
+					segment->extent_count;
+				frozen_segment->type = type;
+				frozen_segment->kind = segment->kind;
+				frozen_segment->defined = segment->defined;
+				if(segment->kind ==
+					LVM2_SEGMENT_KIND_MIRRORED)
+				{
+					frozen_segment->count = segment->u.
+						mirrored.mirror_count;
+					frozen_segment->size = segment->u.
+						mirrored.region_size;
+				}
+				else if(segment->kind ==
+					LVM2_SEGMENT_KIND_STRIPED)
+				{
+					frozen_segment->count = segment->u.
+						striped.stripe_count;
+					frozen_segment->size = segment->u.
+						striped.stripe_size;
+				}
+				frozen_segment->mirror_log = mirror_log;
+				frozen_segment->first_location =
+					location_index;
+				frozen_segment->locations_len =
+					segment->locations_len;
+			}
+
+			for(k = 0; k < segment->locations_len; ++k) {
+				const u32 pv_name =
+					lvm2_frozen_builder_add_string(builder,
+					locations[k].pv_name);
+
+				if(frozen) {
+					struct lvm2_frozen_pv_location *const
+						frozen_location =
+						&frozen_locations[
+						location_index];
+
+					frozen_location->pv_name = pv_name;
+					frozen_location->pv_index =
+						lvm2_frozen_builder_lookup(
+						builder, locations[k].pv_name)->
+						pv_index;
+					frozen_location->extent_start =
+						locations[k].extent_start;
+				}
+
+				++location_index;
+			}
+
+			++segment_index;
+		}
+	}
+}
+
+LVM2_EXPORT int lvm2_layout_freeze(const struct lvm2_layout *const layout,
+		struct lvm2_frozen_layout **const out_frozen)
+{
+	int err;
+	const struct lvm2_volume_group *const vg = layout->vg;
+	struct lvm2_frozen_builder builder;
+	struct lvm2_frozen_layout *frozen = NULL;
+	u64 segments_len = 0;
+	u64 locations_len = 0;
+	u64 max_strings;
+	u64 physical_volumes_offset;
+	u64 logical_volumes_offset;
+	u64 segments_offset;
+	u64 locations_offset;
+	u64 size;
+	size_t i;
+	size_t j;
+
+	memset(&builder, 0, sizeof(struct lvm2_frozen_builder));
+
+	for(i = 0; i < vg->logical_volumes_len; ++i) {
+		const struct lvm2_logical_volume *const lv =
+			vg->logical_volumes[i];
+
+		segments_len += lv->segments_len;
+		for(j = 0; j < lv->segments_len; ++j)
+			locations_len += lv->segments[j].locations_len;
+	}
+
+	if(vg->physical_volumes_len > U32_MAX - 1 ||
+		vg->logical_volumes_len > U32_MAX - 1 ||
+		segments_len > U32_MAX - 1 ||
+		locations_len > U32_MAX - 1)
+	{
+		LogError("Layout is too large to be frozen.");
+		err = EOVERFLOW;
+		goto out;
+	}
+
+	physical_volumes_offset = AlignSize(sizeof(struct lvm2_frozen_layout),
+		LVM2_FROZEN_ALIGNMENT);
+	logical_volumes_offset = AlignSize(physical_volumes_offset +
+		vg->physical_volumes_len *
+		sizeof(struct lvm2_frozen_physical_volume),
+		LVM2_FROZEN_ALIGNMENT);
+	segments_offset = AlignSize(logical_volumes_offset +
+		vg->logical_volumes_len *
+		sizeof(struct lvm2_frozen_logical_volume),
+		LVM2_FROZEN_ALIGNMENT);
+	locations_offset = AlignSize(segments_offset +
+		segments_len * sizeof(struct lvm2_frozen_segment),
+		LVM2_FROZEN_ALIGNMENT);
+	builder.strings_offset = AlignSize(locations_offset +
+		locations_len * sizeof(struct lvm2_frozen_pv_location),
+		LVM2_FROZEN_ALIGNMENT);
+
+	/* Upper bound of the number of strings referenced from the layout,
+	 * which the string map must be able to hold at a load of at most
+	 * 1/2. */
+	max_strings = 6 + 3 * vg->physical_volumes_len +
+		5 * vg->logical_volumes_len + 2 * segments_len + locations_len;
+	builder.map_len = 16;
+	while(builder.map_len < 2 * max_strings)
+		builder.map_len *= 2;
+
+	err = lvm2_malloc(builder.map_len *
+		sizeof(struct lvm2_frozen_string_map_entry),
+		(void**) &builder.map);
+	if(err) {
+		LogError("Error while allocating memory for string map: %d",
+			err);
+		goto out;
+	}
+
+	memset(builder.map, 0, builder.map_len *
+		sizeof(struct lvm2_frozen_string_map_entry));
+
+	/* First pass: collect the strings to find out the size of the string
+	 * table, and with it the size of the whole block. */
+	lvm2_frozen_builder_walk(&builder, layout);
+
+	size = AlignSize(builder.strings_offset + builder.strings_size,
+		LVM2_FROZEN_ALIGNMENT);
+	if(size > U32_MAX - 1) {
+		LogError("Layout is too large to be frozen: %" FMTllu " bytes",
+			ARGllu(size));
+		err = EOVERFLOW;
+		goto out;
+	}
+
+	err = lvm2_malloc((size_t) size, (void**) &frozen);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_frozen_layout: %d", err);
+		goto out;
+	}
+
+	memset(frozen, 0, (size_t) size);
+
+	frozen->size = (u32) size;
+	frozen->physical_volumes_offset = (u32) physical_volumes_offset;
+	frozen->physical_volumes_len = (u32) vg->physical_volumes_len;
+	frozen->logical_volumes_offset = (u32) logical_volumes_offset;
+	frozen->logical_volumes_len = (u32) vg->logical_volumes_len;
+	frozen->segments_offset = (u32) segments_offset;
+	frozen->segments_len = (u32) segments_len;
+	frozen->locations_offset = (u32) locations_offset;
+	frozen->locations_len = (u32) locations_len;
+	frozen->strings_offset = (u32) builder.strings_offset;
+	frozen->strings_size = (u32) builder.strings_size;
+
+	/* Second pass: all strings are already in the map, so this only fills
+	 * in the arrays. */
+	builder.frozen = frozen;
+	lvm2_frozen_builder_walk(&builder, layout);
+
+	for(i = 0; i < builder.map_len; ++i) {
+		const struct lvm2_frozen_string_map_entry *const entry =
+			&builder.map[i];
+		char *string;
+
+		if(!entry->string)
+			continue;
+
+		string = (char*) frozen + entry->offset;
+		*(u32*) (string - sizeof(u32)) = (u32) entry->string->length;
+		memcpy(string, entry->string->content, entry->string->length);
+		string[entry->string->length] = '\0';
+	}
+
+	*out_frozen = frozen;
+out:
+	if(builder.map) {
+		lvm2_free((void**) &builder.map, builder.map_len *
+			sizeof(struct lvm2_frozen_string_map_entry));
+	}
+
+	return err;
+}
+
+LVM2_EXPORT int lvm2_frozen_layout_copy(
+		const struct lvm2_frozen_layout *const frozen,
+		struct lvm2_frozen_layout **const out_copy)
+{
+	int err;
+	struct lvm2_frozen_layout *copy = NULL;
+
+	err = lvm2_malloc(frozen->size, (void**) &copy);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_frozen_layout: %d", err);
+		return err;
+	}
+
+	memcpy(copy, frozen, frozen->size);
+
+	*out_copy = copy;
+
+	return 0;
+}
+
+LVM2_EXPORT void lvm2_frozen_layout_destroy(
+		struct lvm2_frozen_layout **const frozen)
+{
+	lvm2_free((void**) frozen, (*frozen)->size);
+}
+
+static lvm2_bool lvm2_frozen_string_is_valid(
+		const struct lvm2_frozen_layout *const frozen,
+		const u32 offset,
+		const lvm2_bool optional)
+{
+	u32 length;
+
+	if(offset == LVM2_FROZEN_NONE)
+		return optional;
+
+	if(offset < (u64) frozen->strings_offset + sizeof(u32) ||
+		offset >= (u64) frozen->strings_offset + frozen->strings_size ||
+		(offset - sizeof(u32)) % sizeof(u32) != 0)
+	{
+		return LVM2_FALSE;
+	}
+
+	lvm2_frozen_layout_get_string(frozen, offset, &length);
+
+	return ((u64) offset + length <
+		(u64) frozen->strings_offset + frozen->strings_size &&
+		((const char*) frozen)[offset + length] == '\0') ?
+		LVM2_TRUE : LVM2_FALSE;
+}
+
+static lvm2_bool lvm2_frozen_array_is_valid(const u32 size,
+		const u32 offset, const u32 length, const size_t element_size)
+{
+	return (offset % LVM2_FROZEN_ALIGNMENT == 0 &&
+		offset >= sizeof(struct lvm2_frozen_layout) &&
+		(u64) offset + (u64) length * element_size <= size) ?
+		LVM2_TRUE : LVM2_FALSE;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_frozen_layout_validate(const void *const data,
+		const size_t size)
+{
+	const struct lvm2_frozen_layout *const frozen =
+		(const struct lvm2_frozen_layout*) data;
+	const struct lvm2_frozen_physical_volume *pvs;
+	const struct lvm2_frozen_logical_volume *lvs;
+	const struct lvm2_frozen_segment *segments;
+	const struct lvm2_frozen_pv_location *locations;
+	u32 i;
+
+	if(size < sizeof(struct lvm2_frozen_layout) || frozen->size != size) {
+		LogError("Invalid frozen layout size.");
+		return LVM2_FALSE;
+	}
+
+	if(!lvm2_frozen_array_is_valid(frozen->size,
+		frozen->physical_volumes_offset, frozen->physical_volumes_len,
+		sizeof(struct lvm2_frozen_physical_volume)) ||
+		!lvm2_frozen_array_is_valid(frozen->size,
+		frozen->logical_volumes_offset, frozen->logical_volumes_len,
+		sizeof(struct lvm2_frozen_logical_volume)) ||
+		!lvm2_frozen_array_is_valid(frozen->size,
+		frozen->segments_offset, frozen->segments_len,
+		sizeof(struct lvm2_frozen_segment)) ||
+		!lvm2_frozen_array_is_valid(frozen->size,
+		frozen->locations_offset, frozen->locations_len,
+		sizeof(struct lvm2_frozen_pv_location)) ||
+		!lvm2_frozen_array_is_valid(frozen->size,
+		frozen->strings_offset, frozen->strings_size, 1))
+	{
+		LogError("Frozen layout array out of range.");
+		return LVM2_FALSE;
+	}
+
+	if(!lvm2_frozen_string_is_valid(frozen, frozen->vg_name, LVM2_FALSE) ||
+		!lvm2_frozen_string_is_valid(frozen, frozen->vg_id,
+		LVM2_FALSE) ||
+		!lvm2_frozen_string_is_valid(frozen, frozen->vg_format,
+		LVM2_TRUE) ||
+		!lvm2_frozen_string_is_valid(frozen, frozen->contents,
+		LVM2_FALSE) ||
+		!lvm2_frozen_string_is_valid(frozen, frozen->description,
+		LVM2_FALSE) ||
+		!lvm2_frozen_string_is_valid(frozen, frozen->creation_host,
+		LVM2_FALSE))
+	{
+		LogError("Invalid string reference in frozen layout header.");
+		return LVM2_FALSE;
+	}
+
+	pvs = lvm2_frozen_layout_get_physical_volumes(frozen);
+	for(i = 0; i < frozen->physical_volumes_len; ++i) {
+		if(!lvm2_frozen_string_is_valid(frozen, pvs[i].name,
+			LVM2_FALSE) ||
+			!lvm2_frozen_string_is_valid(frozen, pvs[i].id,
+			LVM2_FALSE) ||
+			!lvm2_frozen_string_is_valid(frozen, pvs[i].device,
+			LVM2_FALSE))
+		{
+			LogError("Invalid physical volume %" FMTlu " in "
+				"frozen layout.", ARGlu(i));
+			return LVM2_FALSE;
+		}
+	}
+
+	lvs = lvm2_frozen_layout_get_logical_volumes(frozen);
+	for(i = 0; i < frozen->logical_volumes_len; ++i) {
+		if(!lvm2_frozen_string_is_valid(frozen, lvs[i].name,
+			LVM2_FALSE) ||
+			!lvm2_frozen_string_is_valid(frozen, lvs[i].id,
+			LVM2_FALSE) ||
+			!lvm2_frozen_string_is_valid(frozen,
+			lvs[i].creation_host, LVM2_TRUE) ||
+			!lvm2_frozen_string_is_valid(frozen,
+			lvs[i].creation_time, LVM2_TRUE) ||
+			!lvm2_frozen_string_is_valid(frozen,
+			lvs[i].allocation_policy, LVM2_TRUE) ||
+			(u64) lvs[i].first_segment + lvs[i].segments_len >
+			frozen->segments_len)
+		{
+			LogError("Invalid logical volume %" FMTlu " in "
+				"frozen layout.", ARGlu(i));
+			return LVM2_FALSE;
+		}
+	}
+
+	segments = lvm2_frozen_layout_get_segments(frozen);
+	for(i = 0; i < frozen->segments_len; ++i) {
+		if(!lvm2_frozen_string_is_valid(frozen, segments[i].type,
+			LVM2_FALSE) ||
+			!lvm2_frozen_string_is_valid(frozen,
+			segments[i].mirror_log, LVM2_TRUE) ||
+			(u64) segments[i].first_location +
+			segments[i].locations_len > frozen->locations_len)
+		{
+			LogError("Invalid segment %" FMTlu " in frozen "
+				"layout.", ARGlu(i));
+			return LVM2_FALSE;
+		}
+	}
+
+	locations = lvm2_frozen_layout_get_locations(frozen);
+	for(i = 0; i < frozen->locations_len; ++i) {
+		if(!lvm2_frozen_string_is_valid(frozen, locations[i].pv_name,
+			LVM2_FALSE) ||
+			(locations[i].pv_index != LVM2_FROZEN_NONE &&
+			locations[i].pv_index >= frozen->physical_volumes_len))
+		{
+			LogError("Invalid PV location %" FMTlu " in frozen "
+				"layout.", ARGlu(i));
+			return LVM2_FALSE;
+		}
+	}
+
+	return LVM2_TRUE;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_frozen_layout_report_volumes(
+		const struct lvm2_frozen_layout *const frozen,
+		const struct lvm2_pv_info *const pv_info,
+		const lvm2_volume_callback volume_callback,
+		void *const private_data)
+{
+	const struct lvm2_frozen_physical_volume *const pvs =
+		lvm2_frozen_layout_get_physical_volumes(frozen);
+	const struct lvm2_frozen_logical_volume *const lvs =
+		lvm2_frozen_layout_get_logical_volumes(frozen);
+	const struct lvm2_frozen_segment *const segments =
+		lvm2_frozen_layout_get_segments(frozen);
+	const struct lvm2_frozen_pv_location *const locations =
+		lvm2_frozen_layout_get_locations(frozen);
+	u32 pv_index;
+	u32 i;
+
+	for(pv_index = 0; pv_index < frozen->physical_volumes_len;
+		++pv_index)
+	{
+		u32 id_length;
+		const char *const id = lvm2_frozen_layout_get_string(frozen,
+			pvs[pv_index].id, &id_length);
+
+		if(lvm2_pv_id_matches_uuid(id, id_length, pv_info->pv_uuid))
+			break;
+	}
+
+	if(pv_index == frozen->physical_volumes_len) {
+		LogError("No physical volume match found in LVM2 database.");
+		return LVM2_TRUE;
+	}
+
+	for(i = 0; i < frozen->logical_volumes_len; ++i) {
+		const struct lvm2_frozen_logical_volume *const lv = &lvs[i];
+		const char *const lv_name = lvm2_frozen_layout_get_string(
+			frozen, lv->name, NULL);
+		const struct lvm2_frozen_segment *segment_match = NULL;
+		const struct lvm2_frozen_pv_location *pv_match = NULL;
+		lvm2_bool is_incomplete = LVM2_FALSE;
+		u64 partitionStart;
+		u64 partitionLength;
+		u32 j;
+
+		if(lv->segments_len != 1) {
+			LogError("More than one segment in logical volume "
+				"\"%s\". Marking as incomplete.", lv_name);
+
+			is_incomplete = LVM2_TRUE;
+		}
+
+		for(j = 0; !pv_match && j < lv->segments_len; ++j) {
+			const struct lvm2_frozen_segment *const segment =
+				&segments[lv->first_segment + j];
+			u32 k;
+
+			if(segment->kind == LVM2_SEGMENT_KIND_STRIPED ?
+				segment->locations_len != 1 :
+				segment->locations_len > 1)
+			{
+				LogError("More than one %s in segment "
+					"%" FMTlu " of logical volume \"%s\". "
+					"Marking as incomplete.",
+					(segment->kind ==
+					LVM2_SEGMENT_KIND_STRIPED) ?
+					"stripe" : "mirror",
+					ARGlu(j), lv_name);
+
+				is_incomplete = LVM2_TRUE;
+			}
+
+			for(k = 0; k < segment->locations_len; ++k) {
+				const struct lvm2_frozen_pv_location *const
+					location = &locations[
+					segment->first_location + k];
+
+				if(location->pv_index == pv_index) {
+					segment_match = segment;
+					pv_match = location;
+					break;
+				}
+			}
+		}
+
+		if(!pv_match) {
+			LogError("Physical volume \"%s\" not found in logical "
+				"volume's descriptors. Skipping logical volume "
+				"\"%s\"...",
+				lvm2_frozen_layout_get_string(frozen,
+				pvs[pv_index].name, NULL),
+				lv_name);
+			continue;
+		}
+
+		partitionStart = (pvs[pv_index].pe_start +
+			pv_match->extent_start * frozen->vg_extent_size) *
+			LVM_SECTOR_SIZE;
+		partitionLength = segment_match->extent_count *
+			frozen->vg_extent_size * LVM_SECTOR_SIZE;
+
+		if(!volume_callback(private_data, pv_info->device_size,
+			lv_name, partitionStart, partitionLength,
+			is_incomplete))
+		{
+			return LVM2_FALSE;
+		}
+	}
+
+	return LVM2_TRUE;
+}
@@ -0,0 +1,217 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_memory_device.h"
+#include "lvm2_osal.h"
+
+#include <string.h>
+
+#include <sys/errno.h>
+
+struct lvm2_memory_device {
+	struct lvm2_device dev;	/**< Must be first. */
+	u64 size;
+	u32 alignment;
+	size_t extents_len;
+	struct lvm2_memory_extent *extents;
+};
+
+static int lvm2_memory_device_read(struct lvm2_device *const in_dev,
+		const u64 pos, const size_t count,
+		struct lvm2_io_buffer *const buf)
+{
+	const struct lvm2_memory_device *const dev =
+		(const struct lvm2_memory_device*) in_dev;
+
+	/* Buffers are writable, the const is for the parsers' sake. */
+	char *const out = (char*) lvm2_io_buffer_get_bytes(buf);
+	u64 cur = pos;
+	size_t i;
+
+	if(count > lvm2_io_buffer_get_size(buf))
+		return ERANGE;
+
+	/* Same semantics as the other backends: the full read or nothing. */
+	if(pos > dev->size || count > dev->size - pos)
+		return EIO;
+
+	for(i = 0; i < dev->extents_len && cur < pos + count; ++i) {
+		const struct lvm2_memory_extent *const extent =
+			&dev->extents[i];
+		u64 end;
+
+		if(extent->pos + extent->size <= cur)
+			continue;
+		else if(extent->pos >= pos + count)
+			break;
+
+		if(extent->pos > cur) {
+			memset(&out[cur - pos], 0,
+				(size_t) (extent->pos - cur));
+			cur = extent->pos;
+		}
+
+		end = extent->pos + extent->size;
+		if(end > pos + count)
+			end = pos + count;
+
+		memcpy(&out[cur - pos],
+			&((const char*) extent->data)[cur - extent->pos],
+			(size_t) (end - cur));
+		cur = end;
+	}
+
+	if(cur < pos + count)
+		memset(&out[cur - pos], 0, (size_t) (pos + count - cur));
+
+	return 0;
+}
+
+static u32 lvm2_memory_device_get_alignment(struct lvm2_device *const dev)
+{
+	return ((const struct lvm2_memory_device*) dev)->alignment;
+}
+
+static int lvm2_memory_device_map_range(struct lvm2_device *const in_dev,
+		const u64 pos, const size_t count, const void **const out_bytes)
+{
+	const struct lvm2_memory_device *const dev =
+		(const struct lvm2_memory_device*) in_dev;
+	size_t i;
+
+	if(pos > dev->size || count > dev->size - pos)
+		return EIO;
+
+	/* Ranges that aren't covered by a single extent have to be read. */
+	for(i = 0; i < dev->extents_len; ++i) {
+		const struct lvm2_memory_extent *const extent =
+			&dev->extents[i];
+
+		if(extent->pos <= pos && pos - extent->pos <= extent->size &&
+			count <= extent->size - (pos - extent->pos))
+		{
+			*out_bytes = &((const char*) extent->data)[
+				pos - extent->pos];
+			return 0;
+		}
+	}
+
+	return ENOTSUP;
+}
+
+static void lvm2_memory_device_destroy(struct lvm2_device *const in_dev)
+{
+	struct lvm2_memory_device *dev = (struct lvm2_memory_device*) in_dev;
+
+	if(dev->extents) {
+		lvm2_free((void**) &dev->extents,
+			dev->extents_len * sizeof(struct lvm2_memory_extent));
+	}
+
+	lvm2_free((void**) &dev, sizeof(struct lvm2_memory_device));
+}
+
+static const struct lvm2_device_ops lvm2_memory_device_ops = {
+	/* .read            = */ lvm2_memory_device_read,
+	/* .readv           = */ NULL,
+	/* .get_alignment   = */ lvm2_memory_device_get_alignment,
+	/* .map_range       = */ lvm2_memory_device_map_range,
+	/* .get_stats       = */ NULL,
+	/* .set_block_cache = */ NULL,
+	/* .destroy         = */ lvm2_memory_device_destroy,
+	/* .advise          = */ NULL,
+};
+
+LVM2_EXPORT int lvm2_memory_device_create(const void *const data,
+		const u64 size, const u32 alignment,
+		struct lvm2_device **const out_dev)
+{
+	struct lvm2_memory_extent extent;
+
+	if(size > SIZE_MAX)
+		return EINVAL;
+
+	extent.pos = 0;
+	extent.data = data;
+	extent.size = (size_t) size;
+
+	return lvm2_memory_device_create_ex(&extent, 1, size, alignment,
+		out_dev);
+}
+
+LVM2_EXPORT int lvm2_memory_device_create_ex(
+		const struct lvm2_memory_extent *const extents,
+		const size_t extents_len, const u64 size, const u32 alignment,
+		struct lvm2_device **const out_dev)
+{
+	int err;
+	struct lvm2_memory_device *dev = NULL;
+	u64 end = 0;
+	size_t i;
+
+	if(!alignment || (alignment & (alignment - 1))) {
+		LogError("Alignment %" FMTlu " is not a power of two.",
+			ARGlu(alignment));
+		return EINVAL;
+	}
+
+	for(i = 0; i < extents_len; ++i) {
+		if(extents[i].pos < end || extents[i].pos > size ||
+			extents[i].size > size - extents[i].pos)
+		{
+			LogError("Extent %" FMTzu " is out of order or out of "
+				"range.", ARGzu(i));
+			return EINVAL;
+		}
+
+		end = extents[i].pos + extents[i].size;
+	}
+
+	err = lvm2_malloc(sizeof(struct lvm2_memory_device), (void**) &dev);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_memory_device: %d", err);
+		return err;
+	}
+
+	memset(dev, 0, sizeof(struct lvm2_memory_device));
+	dev->dev.ops = &lvm2_memory_device_ops;
+	dev->size = size;
+	dev->alignment = alignment;
+
+	if(extents_len) {
+		err = lvm2_malloc(extents_len *
+			sizeof(struct lvm2_memory_extent),
+			(void**) &dev->extents);
+		if(err) {
+			LogError("Error while allocating memory for extent "
+				"list: %d", err);
+			lvm2_free((void**) &dev,
+				sizeof(struct lvm2_memory_device));
+			return err;
+		}
+
+		memcpy(dev->extents, extents,
+			extents_len * sizeof(struct lvm2_memory_extent));
+		dev->extents_len = extents_len;
+	}
+
+	*out_dev = &dev->dev;
+
+	return 0;
+}
@@ -76,35 +76,215 @@ static int lvm2_bounded_string_create(const char *const content,
 	return err;
 }
 
-static int lvm2_bounded_string_dup(const struct lvm2_bounded_string *const orig,
-		struct lvm2_bounded_string **const out_dup)
+static void lvm2_bounded_string_destroy(
+		struct lvm2_bounded_string **string)
+{
+	lvm2_free((void**) string,
+		sizeof(struct lvm2_bounded_string) +
+		(((*string)->length + 1) * sizeof(char)));
+}
+
+/**
+ * Table of interned strings, scoped to one lvm2_layout. Every string in the
+ * layout is looked up here before it's stored, so identical strings (PV names
+ * referenced from stripes, segment types, creation hosts...) share a single
+ * immutable copy and can be compared by pointer.
+ */
+struct lvm2_string_table {
+	size_t buckets_len;
+	size_t strings_len;
+	const struct lvm2_bounded_string **buckets;
+
+	u64 references;
+	u64 referenced_bytes;
+	u64 stored_bytes;
+};
+
+#define LVM2_STRING_TABLE_INITIAL_BUCKETS 64
+
+static size_t lvm2_bounded_string_alloc_size(const int length)
+{
+	return sizeof(struct lvm2_bounded_string) +
+		((length + 1) * sizeof(char));
+}
+
+static u32 lvm2_string_hash(const char *const content, const int length)
+{
+	/* 32-bit FNV-1a. */
+	u32 hash = 0x811C9DC5U;
+	int i;
+
+	for(i = 0; i < length; ++i) {
+		hash ^= (u8) content[i];
+		hash *= 0x01000193U;
+	}
+
+	return hash;
+}
+
+static int lvm2_string_table_create(
+		struct lvm2_string_table **const out_table)
+{
+	int err;
+	struct lvm2_string_table *table = NULL;
+	const struct lvm2_bounded_string **buckets = NULL;
+
+	err = lvm2_malloc(sizeof(struct lvm2_string_table), (void**) &table);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_string_table: %d", err);
+		goto out;
+	}
+
+	err = lvm2_malloc(LVM2_STRING_TABLE_INITIAL_BUCKETS *
+		sizeof(struct lvm2_bounded_string*), (void**) &buckets);
+	if(err) {
+		LogError("Error while allocating memory for string table "
+			"buckets: %d", err);
+		lvm2_free((void**) &table, sizeof(struct lvm2_string_table));
+		goto out;
+	}
+
+	memset(table, 0, sizeof(struct lvm2_string_table));
+	memset(buckets, 0, LVM2_STRING_TABLE_INITIAL_BUCKETS *
+		sizeof(struct lvm2_bounded_string*));
+
+	table->buckets_len = LVM2_STRING_TABLE_INITIAL_BUCKETS;
+	table->buckets = buckets;
+
+	*out_table = table;
+out:
+	return err;
+}
+
+static void lvm2_string_table_destroy(struct lvm2_string_table **const table)
+{
+	size_t i;
+
+	for(i = 0; i < (*table)->buckets_len; ++i) {
+		struct lvm2_bounded_string *string =
+			(struct lvm2_bounded_string*) (*table)->buckets[i];
+
+		if(string)
+			lvm2_bounded_string_destroy(&string);
+	}
+
+	lvm2_free((void**) &(*table)->buckets,
+		(*table)->buckets_len * sizeof(struct lvm2_bounded_string*));
+	lvm2_free((void**) table, sizeof(struct lvm2_string_table));
+}
+
+static int lvm2_string_table_grow(struct lvm2_string_table *const table)
+{
+	int err;
+	const size_t new_buckets_len = table->buckets_len * 2;
+	const struct lvm2_bounded_string **new_buckets = NULL;
+	size_t i;
+
+	err = lvm2_malloc(new_buckets_len *
+		sizeof(struct lvm2_bounded_string*), (void**) &new_buckets);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " string "
+			"table buckets: %d", ARGzu(new_buckets_len), err);
+		return err;
+	}
+
+	memset(new_buckets, 0,
+		new_buckets_len * sizeof(struct lvm2_bounded_string*));
+
+	for(i = 0; i < table->buckets_len; ++i) {
+		const struct lvm2_bounded_string *const string =
+			table->buckets[i];
+		size_t j;
+
+		if(!string)
+			continue;
+
+		j = lvm2_string_hash(string->content, string->length) &
+			(new_buckets_len - 1);
+		while(new_buckets[j])
+			j = (j + 1) & (new_buckets_len - 1);
+
+		new_buckets[j] = string;
+	}
+
+	lvm2_free((void**) &table->buckets,
+		table->buckets_len * sizeof(struct lvm2_bounded_string*));
+
+	table->buckets_len = new_buckets_len;
+	table->buckets = new_buckets;
+
+	return 0;
+}
+
+/**
+ * Look up (or insert) the string of length @length at @content in @table.
+ * The returned string is owned by the table and must not be freed or modified
+ * by the caller.
+ */
+static int lvm2_string_table_intern_chars(
+		struct lvm2_string_table *const table,
+		const char *const content, const int length,
+		const struct lvm2_bounded_string **const out_string)
 {
 	int err;
-	struct lvm2_bounded_string *dup;
+	size_t i;
+	struct lvm2_bounded_string *string = NULL;
 
-	if(orig->length < 0)
+	if(length < 0)
 		return EINVAL;
 
-	err = lvm2_malloc(sizeof(struct lvm2_bounded_string) +
-		((orig->length + 1) * sizeof(char)), (void**) &dup);
-	if(!err) {
-		dup->length = orig->length;
-		memcpy(dup->content, orig->content,
-			orig->length * sizeof(char));
-		dup->content[orig->length] = '\0';
+	table->references++;
+	table->referenced_bytes += lvm2_bounded_string_alloc_size(length);
+
+	i = lvm2_string_hash(content, length) & (table->buckets_len - 1);
+	while(table->buckets[i]) {
+		const struct lvm2_bounded_string *const cur =
+			table->buckets[i];
 
-		*out_dup = dup;
+		if(cur->length == length &&
+			!memcmp(cur->content, content, length))
+		{
+			*out_string = cur;
+			return 0;
+		}
+
+		i = (i + 1) & (table->buckets_len - 1);
 	}
 
-	return err;
+	/* Keep the load factor at or below 3/4. */
+	if((table->strings_len + 1) * 4 > table->buckets_len * 3) {
+		err = lvm2_string_table_grow(table);
+		if(err)
+			return err;
+
+		i = lvm2_string_hash(content, length) &
+			(table->buckets_len - 1);
+		while(table->buckets[i])
+			i = (i + 1) & (table->buckets_len - 1);
+	}
+
+	err = lvm2_bounded_string_create(content, length, &string);
+	if(err) {
+		LogError("Error while creating interned string: %d", err);
+		return err;
+	}
+
+	table->buckets[i] = string;
+	table->strings_len++;
+	table->stored_bytes += lvm2_bounded_string_alloc_size(length);
+
+	*out_string = string;
+
+	return 0;
 }
 
-static void lvm2_bounded_string_destroy(
-		struct lvm2_bounded_string **string)
+static int lvm2_string_table_intern(struct lvm2_string_table *const table,
+		const struct lvm2_bounded_string *const orig,
+		const struct lvm2_bounded_string **const out_string)
 {
-	lvm2_free((void**) string,
-		sizeof(struct lvm2_bounded_string) +
-		(((*string)->length + 1) * sizeof(char)));
+	return lvm2_string_table_intern_chars(table, orig->content,
+		orig->length, out_string);
 }
 
 static int lvm2_dom_obj_initialize(const lvm2_dom_type type,
@@ -1379,55 +1559,95 @@ static int lvm2_dom_tree_lookup_u64(
 }
 #endif
 
-static int lvm2_pv_location_create(
-		const struct lvm2_bounded_string *const pv_name,
-		const u64 extent_start,
-		struct lvm2_pv_location **const out_stripe)
+/**
+ * Parse a 'stripes' or 'mirrors' array of (PV name, extent) pairs. If the
+ * array has no more than LVM2_SEGMENT_INLINE_LOCATIONS entries the result is
+ * stored in 'inline_locations' and '*out_locations' points there, otherwise a
+ * new array is allocated.
+ */
+static int lvm2_segment_parse_locations(
+		struct lvm2_string_table *const strings,
+		const struct lvm2_dom_array *const array,
+		const char *const array_name,
+		struct lvm2_pv_location *const inline_locations,
+		struct lvm2_pv_location **const out_locations,
+		size_t *const out_locations_len)
 {
-	int err;
-	struct lvm2_pv_location *stripe = NULL;
-	struct lvm2_bounded_string *dup_pv_name = NULL;
+	int err = 0;
+	size_t j;
+	struct lvm2_pv_location *locations = NULL;
+	size_t locations_len;
 
-	err = lvm2_malloc(sizeof(struct lvm2_pv_location), (void**) &stripe);
-	if(err) {
-		LogError("Error while allocating memory for struct "
-			"lvm2_pv_location: %d", err);
+	if(array->elements_len % 2 != 0) {
+		LogError("Uneven '%s' array length: %" FMTzu,
+			array_name, ARGzu(array->elements_len));
+		return EINVAL;
+	}
+
+	locations_len = array->elements_len / 2;
+	if(locations_len > U32_MAX) {
+		LogError("Too many elements in '%s' array: %" FMTzu,
+			array_name, ARGzu(locations_len));
+		return EINVAL;
+	}
+
+	if(locations_len <= LVM2_SEGMENT_INLINE_LOCATIONS) {
+		locations = inline_locations;
+	}
+	else {
+		err = lvm2_malloc(locations_len *
+			sizeof(struct lvm2_pv_location), (void**) &locations);
+		if(err) {
+			LogError("Error while allocating memory for '%s' "
+				"array.", array_name);
+			return err;
+		}
 	}
-	else if((err = lvm2_bounded_string_dup(pv_name, &dup_pv_name)) != 0) {
-		LogError("Error while duplicating bounded string: %d", err);
+
+	for(j = 0; j < locations_len; ++j) {
+		const struct lvm2_dom_value *const pv_name_obj =
+			array->elements[j * 2];
+		const struct lvm2_dom_value *const extent_start_obj =
+			array->elements[(j * 2) + 1];
+
+		err = lvm2_layout_parse_u64_value(extent_start_obj,
+			&locations[j].extent_start);
+		if(err) {
+			LogError("Error while parsing u64 value: %d", err);
+			break;
+		}
+
+		err = lvm2_string_table_intern(strings, pv_name_obj->value,
+			&locations[j].pv_name);
+		if(err) {
+			LogError("Error while interning bounded string: %d",
+				err);
+			break;
+		}
 	}
 
 	if(err) {
-		if(dup_pv_name)
-			lvm2_bounded_string_destroy(&dup_pv_name);
-		if(stripe)
-			lvm2_free((void**) &stripe,
+		if(locations != inline_locations) {
+			lvm2_free((void**) &locations,
+				locations_len *
 				sizeof(struct lvm2_pv_location));
+		}
 	}
 	else {
-		stripe->pv_name = dup_pv_name;
-		stripe->extent_start = extent_start;
-
-		*out_stripe = stripe;
+		*out_locations = locations;
+		*out_locations_len = locations_len;
 	}
 
 	return err;
 }
 
-static void lvm2_pv_location_destroy(struct lvm2_pv_location **const stripe)
-{
-	lvm2_bounded_string_destroy(&(*stripe)->pv_name);
-
-	lvm2_free((void**) stripe, sizeof(struct lvm2_pv_location));
-}
-
-static int lvm2_segment_create(
+static int lvm2_segment_init(
+		struct lvm2_string_table *const strings,
 		const struct lvm2_dom_section *const segment_section,
-		struct lvm2_segment **const out_segment)
+		struct lvm2_segment *const out_segment)
 {
-	int err;
+	int err = 0;
 	size_t i;
-	struct lvm2_segment *segment = NULL;
 
 	lvm2_bool start_extent_defined = LVM2_FALSE;
 	u64 start_extent = 0;
@@ -1435,7 +1655,7 @@ static int lvm2_segment_create(
 	lvm2_bool extent_count_defined = LVM2_FALSE;
 	u64 extent_count = 0;
 
-	struct lvm2_bounded_string *type = NULL;
+	const struct lvm2_bounded_string *type = NULL;
 
 	/* Variables only existing in striped or plain (stripe_count = 1)
 	 * volumes. */
@@ -1446,21 +1666,26 @@ static int lvm2_segment_create(
 	lvm2_bool stripe_size_defined = LVM2_FALSE;
 	u64 stripe_size = 0;
 
+	struct lvm2_pv_location stripes_inline[LVM2_SEGMENT_INLINE_LOCATIONS];
 	size_t stripes_len = 0;
-	struct lvm2_pv_location **stripes = NULL;
+	struct lvm2_pv_location *stripes = NULL;
 
 	/* Variables only existing in mirrored volumes. */
 
 	lvm2_bool mirror_count_defined = LVM2_FALSE;
 	u64 mirror_count = 0;
 
-	struct lvm2_bounded_string *mirror_log = NULL;
+	const struct lvm2_bounded_string *mirror_log = NULL;
 
 	lvm2_bool region_size_defined = LVM2_FALSE;
 	u64 region_size = 0;
 
+	struct lvm2_pv_location mirrors_inline[LVM2_SEGMENT_INLINE_LOCATIONS];
 	size_t mirrors_len = 0;
-	struct lvm2_pv_location **mirrors = NULL;
+	struct lvm2_pv_location *mirrors = NULL;
+
+	lvm2_bool is_striped;
+	lvm2_bool is_mirrored;
 
 	for(i = 0; i < segment_section->children_len; ++i) {
 		const struct lvm2_dom_obj *const cur_obj =
@@ -1519,8 +1744,8 @@ static int lvm2_segment_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&type);
+				err = lvm2_string_table_intern(strings,
+					value->value, &type);
 				if(err)
 					break;
 			}
@@ -1594,8 +1819,8 @@ static int lvm2_segment_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&mirror_log);
+				err = lvm2_string_table_intern(strings,
+					value->value, &mirror_log);
 				if(err) {
 					break;
 				}
@@ -1629,24 +1854,38 @@ static int lvm2_segment_create(
 			}
 		}
 		else if(cur_obj->type == LVM2_DOM_TYPE_ARRAY) {
-			struct lvm2_dom_array *const array =
+			const struct lvm2_dom_array *const array =
 				(struct lvm2_dom_array*) cur_obj;
 
-			struct lvm2_pv_location ***location_array_ptr = NULL;
-			size_t *location_array_length_ptr = NULL;
-			const char *location_array_name = "";
-
 			if(!strncmp(name->content, "stripes", name->length)) {
-				location_array_ptr = &stripes;
-				location_array_length_ptr = &stripes_len;
-				location_array_name = "stripes";
+				if(stripes) {
+					LogError("Duplicate definition of "
+						"'stripes'.");
+					err = EINVAL;
+					break;
+				}
+
+				err = lvm2_segment_parse_locations(strings,
+					array, "stripes", stripes_inline,
+					&stripes, &stripes_len);
+				if(err)
+					break;
 			}
 			else if(!strncmp(name->content, "mirrors",
 				name->length))
 			{
-				location_array_ptr = &mirrors;
-				location_array_length_ptr = &mirrors_len;
-				location_array_name = "mirrors";
+				if(mirrors) {
+					LogError("Duplicate definition of "
+						"'mirrors'.");
+					err = EINVAL;
+					break;
+				}
+
+				err = lvm2_segment_parse_locations(strings,
+					array, "mirrors", mirrors_inline,
+					&mirrors, &mirrors_len);
+				if(err)
+					break;
 			}
 			else {
 				LogError("Unrecognized array-type member in "
@@ -1655,106 +1894,6 @@ static int lvm2_segment_create(
 				err = EINVAL;
 				break;
 			}
-
-			if(location_array_ptr && location_array_length_ptr) {
-				size_t j;
-				struct lvm2_pv_location **new_location_array =
-					NULL;
-				size_t new_location_array_len;
-
-				if(*location_array_ptr) {
-					LogError("Duplicate definition of "
-						"'%s'.", location_array_name);
-					err = EINVAL;
-					break;
-				}
-
-				if(array->elements_len % 2 != 0) {
-					LogError("Uneven '%s' array length: "
-						"%" FMTzu,
-						location_array_name,
-						ARGzu(array->elements_len));
-					err = EINVAL;
-					break;
-				}
-
-				new_location_array_len =
-					array->elements_len / 2;
-
-				err = lvm2_malloc(new_location_array_len *
-					sizeof(struct lvm2_pv_location*),
-					(void**) &new_location_array);
-				if(err) {
-					LogError("Error while allocating "
-						"memory for "
-						"'new_location_array' array.");
-					break;
-				}
-
-				memset(new_location_array, 0,
-					new_location_array_len *
-					sizeof(struct lvm2_pv_location*));
-
-				for(j = 0; j < new_location_array_len; ++j) {
-					const struct lvm2_dom_value
-						*const pv_name_obj =
-						array->elements[j * 2];
-					const struct lvm2_dom_value
-						*const extent_start_obj =
-						array->elements[(j * 2) + 1];
-
-					const struct lvm2_bounded_string
-						*const pv_name =
-						pv_name_obj->value;
-					u64 extent_start = 0;
-
-					struct lvm2_pv_location *location =
-						NULL;
-
-					err = lvm2_layout_parse_u64_value(
-						extent_start_obj,
-						&extent_start);
-					if(err) {
-						LogError("Error while parsing "
-							"u64 value: %d", err);
-						break;
-					}
-
-					err = lvm2_pv_location_create(pv_name,
-						extent_start, &location);
-					if(err) {
-						LogError("Error while creating "
-							"'lvm2_pv_location': "
-							"%d", err);
-						break;
-					}
-
-					new_location_array[j] = location;
-				}
-
-				if(err) {
-					for(j = 0; j < new_location_array_len;
-						++j)
-					{
-						if(new_location_array[j]) {
-							lvm2_pv_location_destroy(
-								&new_location_array[j]
-							);
-						}
-					}
-
-					lvm2_free((void**) &new_location_array,
-						new_location_array_len *
-						sizeof(struct
-						lvm2_pv_location*));
-				}
-				else {
-					*location_array_ptr =
-						new_location_array;
-					*location_array_length_ptr =
-						new_location_array_len;
-				}
-			}
 		}
 		else if(cur_obj->type == LVM2_DOM_TYPE_SECTION) {
 			if(0) {
@@ -1788,124 +1927,122 @@ static int lvm2_segment_create(
 		}
 	}
 
-	if(!err) {
-		err = lvm2_malloc(sizeof(struct lvm2_segment),
-			(void**) &segment);
-		if(err) {
-			LogError("Error while allocating memory for struct "
-				"lvm2_segment: %d",
-				err);
-		}
-		else
-			memset(segment, 0, sizeof(struct lvm2_segment));
+	is_striped = stripe_count_defined || stripe_size_defined ||
+		stripes;
+	is_mirrored = mirror_count_defined || mirror_log ||
+		region_size_defined || mirrors;
+
+	if(!err && is_striped && is_mirrored) {
+		/* The striped and mirrored members share storage in struct
+		 * lvm2_segment, so we can't represent this. */
+		LogError("Segment has both striped and mirrored members "
+			"(corrupt LVM metadata or new LVM feature?).");
+		err = EINVAL;
 	}
 
 	if(!err) {
-		segment->start_extent = start_extent;
-
-		segment->extent_count = extent_count;
-
-		segment->type = type;
-
-		segment->stripe_count_defined = stripe_count_defined;
-		segment->stripe_count = stripe_count_defined ? stripe_count : 0;
-
-		segment->stripe_size_defined = stripe_size_defined;
-		segment->stripe_size = stripe_size_defined ? stripe_size : 0;
-
-		segment->stripes_len = stripes ? stripes_len : 0;
-		segment->stripes = stripes;
-
-		segment->mirror_count_defined = mirror_count_defined;
-		segment->mirror_count = mirror_count_defined ? mirror_count : 0;
-
-		segment->mirror_log = mirror_log;
-
-		segment->region_size_defined = region_size_defined;
-		segment->region_size = region_size_defined ? region_size : 0;
-
-		segment->mirrors_len = mirrors ? mirrors_len : 0;
-		segment->mirrors = mirrors;
-
-		*out_segment = segment;
+		if(stripe_count > U32_MAX ||
+			stripe_size > U32_MAX ||
+			mirror_count > U32_MAX ||
+			region_size > U32_MAX)
+		{
+			LogError("Value out of range in lvm2_segment:%s%s%s%s",
+				stripe_count > U32_MAX ? " stripe_count" : "",
+				stripe_size > U32_MAX ? " stripe_size" : "",
+				mirror_count > U32_MAX ? " mirror_count" : "",
+				region_size > U32_MAX ? " region_size" : "");
+			err = EINVAL;
+		}
 	}
-	else {
-		if(segment)
-			lvm2_free((void**) &segment,
-				sizeof(struct lvm2_segment));
 
-		if(mirrors) {
-			size_t j;
-
-			for(j = 0; j < mirrors_len; ++j) {
-				lvm2_pv_location_destroy(&mirrors[j]);
-			}
-
-			mirrors_len = 0;
-			lvm2_free((void**) &mirrors,
-				mirrors_len * sizeof(struct lvm2_pv_location*));
+	if(!err) {
+		struct lvm2_pv_location *locations = NULL;
+		size_t locations_len = 0;
+
+		memset(out_segment, 0, sizeof(struct lvm2_segment));
+
+		out_segment->start_extent = start_extent;
+		out_segment->extent_count = extent_count;
+		out_segment->type = type;
+
+		if(is_mirrored) {
+			out_segment->kind = LVM2_SEGMENT_KIND_MIRRORED;
+			out_segment->defined =
+				(mirror_count_defined ?
+				LVM2_SEGMENT_COUNT_DEFINED : 0) |
+				(region_size_defined ?
+				LVM2_SEGMENT_SIZE_DEFINED : 0) |
+				(mirrors ? LVM2_SEGMENT_LOCATIONS_DEFINED : 0);
+			out_segment->u.mirrored.mirror_count =
+				(u32) mirror_count;
+			out_segment->u.mirrored.region_size =
+				(u32) region_size;
+			out_segment->u.mirrored.mirror_log = mirror_log;
+
+			locations = mirrors;
+			locations_len = mirrors_len;
+			mirrors = NULL;
 		}
-
-		if(mirror_log) {
-			lvm2_bounded_string_destroy(&mirror_log);
+		else if(is_striped) {
+			out_segment->kind = LVM2_SEGMENT_KIND_STRIPED;
+			out_segment->defined =
+				(stripe_count_defined ?
+				LVM2_SEGMENT_COUNT_DEFINED : 0) |
+				(stripe_size_defined ?
+				LVM2_SEGMENT_SIZE_DEFINED : 0) |
+				(stripes ? LVM2_SEGMENT_LOCATIONS_DEFINED : 0);
+			out_segment->u.striped.stripe_count =
+				(u32) stripe_count;
+			out_segment->u.striped.stripe_size = (u32) stripe_size;
+
+			locations = stripes;
+			locations_len = stripes_len;
+			stripes = NULL;
+		}
+		else {
+			out_segment->kind = LVM2_SEGMENT_KIND_NONE;
 		}
 
-		if(stripes) {
-			size_t j;
-
-			for(j = 0; j < stripes_len; ++j) {
-				lvm2_pv_location_destroy(&stripes[j]);
+		out_segment->locations_len = (u32) locations_len;
+		if(locations_len <= LVM2_SEGMENT_INLINE_LOCATIONS) {
+			if(locations_len) {
+				memcpy(out_segment->locations.inline_locations,
+					locations, locations_len *
+					sizeof(struct lvm2_pv_location));
 			}
-
-			stripes_len = 0;
-			lvm2_free((void**) &stripes,
-				stripes_len * sizeof(struct lvm2_pv_location*));
 		}
-		if(type)
-			lvm2_bounded_string_destroy(&type);
-	}
-
-	return err;
-}
-
-static void lvm2_segment_destroy(struct lvm2_segment **const segment)
-{
-	size_t i;
-
-	if((*segment)->mirrors) {
-		size_t j;
-
-		for(j = 0; j < (*segment)->mirrors_len; ++j) {
-			lvm2_pv_location_destroy(&(*segment)->mirrors[j]);
+		else {
+			/* Ownership of the array moves to the segment. */
+			out_segment->locations.external = locations;
 		}
+	}
 
-		lvm2_free((void**) &(*segment)->mirrors,
-			(*segment)->mirrors_len *
-			sizeof(struct lvm2_pv_location*));
-		(*segment)->mirrors_len = 0;
+	if(mirrors && mirrors != mirrors_inline) {
+		lvm2_free((void**) &mirrors,
+			mirrors_len * sizeof(struct lvm2_pv_location));
 	}
 
-	if((*segment)->mirror_log) {
-		lvm2_bounded_string_destroy(&(*segment)->mirror_log);
+	if(stripes && stripes != stripes_inline) {
+		lvm2_free((void**) &stripes,
+			stripes_len * sizeof(struct lvm2_pv_location));
 	}
 
-	if((*segment)->stripes) {
-		for(i = 0; i < (*segment)->stripes_len; ++i) {
-			lvm2_pv_location_destroy(&(*segment)->stripes[i]);
-		}
+	return err;
+}
 
-		lvm2_free((void**) &(*segment)->stripes,
-			  (*segment)->stripes_len *
-			  sizeof(struct lvm2_pv_location*));
-		(*segment)->stripes_len = 0;
+static void lvm2_segment_cleanup(struct lvm2_segment *const segment)
+{
+	if(segment->locations_len > LVM2_SEGMENT_INLINE_LOCATIONS) {
+		lvm2_free((void**) &segment->locations.external,
+			segment->locations_len *
+			sizeof(struct lvm2_pv_location));
 	}
 
-	lvm2_bounded_string_destroy(&(*segment)->type);
-
-	lvm2_free((void**) segment, sizeof(struct lvm2_segment));
+	segment->locations_len = 0;
 }
 
 static int lvm2_logical_volume_create(
+		struct lvm2_string_table *const strings,
 		const struct lvm2_bounded_string *const lv_name,
 		const struct lvm2_dom_section *const lv_section,
 		struct lvm2_logical_volume **const out_lv)
@@ -1914,9 +2051,9 @@ static int lvm2_logical_volume_create(
 	size_t i;
 	struct lvm2_logical_volume *lv = NULL;
 
-	struct lvm2_bounded_string *lv_name_dup = NULL;
+	const struct lvm2_bounded_string *lv_name_dup = NULL;
 
-	struct lvm2_bounded_string *id = NULL;
+	const struct lvm2_bounded_string *id = NULL;
 
 	lvm2_bool status_defined = LVM2_FALSE;
 	lvm2_logical_volume_status status = 0;
@@ -1924,17 +2061,17 @@ static int lvm2_logical_volume_create(
 	lvm2_bool flags_defined = LVM2_FALSE;
 	lvm2_logical_volume_flags flags = 0;
 
-	struct lvm2_bounded_string *creation_host = NULL;
+	const struct lvm2_bounded_string *creation_host = NULL;
 
-	struct lvm2_bounded_string *creation_time = NULL;
+	const struct lvm2_bounded_string *creation_time = NULL;
 
-	struct lvm2_bounded_string *allocation_policy = NULL;
+	const struct lvm2_bounded_string *allocation_policy = NULL;
 
 	lvm2_bool segment_count_defined = LVM2_FALSE;
 	u64 segment_count = 0;
 
 	size_t segments_len = 0;
-	struct lvm2_segment **segments = NULL;
+	struct lvm2_segment *segments = NULL;
 
 	for(i = 0; i < lv_section->children_len; ++i) {
 		const struct lvm2_dom_obj *const cur_obj =
@@ -1954,8 +2091,8 @@ static int lvm2_logical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&id);
+				err = lvm2_string_table_intern(strings,
+					value->value, &id);
 				if(err)
 					break;
 			}
@@ -1969,8 +2106,8 @@ static int lvm2_logical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&creation_host);
+				err = lvm2_string_table_intern(strings,
+					value->value, &creation_host);
 				if(err)
 					break;
 			}
@@ -1984,8 +2121,8 @@ static int lvm2_logical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&creation_time);
+				err = lvm2_string_table_intern(strings,
+					value->value, &creation_time);
 				if(err)
 					break;
 			}
@@ -1999,8 +2136,8 @@ static int lvm2_logical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&allocation_policy);
+				err = lvm2_string_table_intern(strings,
+					value->value, &allocation_policy);
 				if(err) {
 					break;
 				}
@@ -2147,38 +2284,36 @@ static int lvm2_logical_volume_create(
 				 * be improved if needed, but I don't think it
 				 * will be necessary. */
 
-				/* Expand 'segments' array. */
-				struct lvm2_segment **new_segments = NULL;
+				/* Expand 'segments' array. The segments are
+				 * stored by value so that walking them doesn't
+				 * require chasing a pointer per segment. */
+				struct lvm2_segment *new_segments = NULL;
 				size_t new_segments_len = segments_len + 1;
 
-				struct lvm2_segment **old_segments = segments;
+				struct lvm2_segment *old_segments = segments;
 				size_t old_segments_len = segments_len;
 
-				struct lvm2_segment *new_segment = NULL;
-
 				err = lvm2_malloc(new_segments_len *
-					sizeof(struct lvm2_segment*),
+					sizeof(struct lvm2_segment),
 					(void**) &new_segments);
 				if(err)
 					break;
 
-				if(old_segments && old_segments_len) {
-					memcpy(new_segments, old_segments,
-						old_segments_len *
-						sizeof(struct lvm2_segment*));
-				}
-
-				err = lvm2_segment_create(section,
-					&new_segment);
+				err = lvm2_segment_init(strings, section,
+					&new_segments[old_segments_len]);
 				if(err) {
 					/* Clean up new_segments allocation. */
 					lvm2_free((void**) &new_segments,
 						new_segments_len *
-						sizeof(struct lvm2_segment*));
+						sizeof(struct lvm2_segment));
 					break;
 				}
 
-				new_segments[old_segments_len] = new_segment;
+				if(old_segments && old_segments_len) {
+					memcpy(new_segments, old_segments,
+						old_segments_len *
+						sizeof(struct lvm2_segment));
+				}
 
 				segments = new_segments;
 				segments_len = new_segments_len;
@@ -2186,7 +2321,7 @@ static int lvm2_logical_volume_create(
 				if(old_segments) {
 					lvm2_free((void**) &old_segments,
 						old_segments_len *
-						sizeof(struct lvm2_segment*));
+						sizeof(struct lvm2_segment));
 				}
 			}
 			else {
@@ -2205,9 +2340,10 @@ static int lvm2_logical_volume_create(
 	}
 
 	if(!err) {
-		err = lvm2_bounded_string_dup(lv_name, &lv_name_dup);
+		err = lvm2_string_table_intern(strings, lv_name,
+			&lv_name_dup);
 		if(err) {
-			LogError("Error while duplicating string: %d", err);
+			LogError("Error while interning string: %d", err);
 		}
 	}
 
@@ -2276,34 +2412,16 @@ static int lvm2_logical_volume_create(
 			lvm2_free((void**) &lv,
 				sizeof(struct lvm2_logical_volume));
 
-		if(lv_name_dup)
-			lvm2_bounded_string_destroy(&lv_name_dup);
-
 		if(segments_len) {
 			size_t j;
 
 			for(j = 0; j < segments_len; ++j) {
-				lvm2_segment_destroy(&segments[j]);
+				lvm2_segment_cleanup(&segments[j]);
 			}
 
 			lvm2_free((void**) &segments,
-				segments_len * sizeof(struct lvm2_segment*));
+				segments_len * sizeof(struct lvm2_segment));
 		}
-
-		if(allocation_policy) {
-			lvm2_bounded_string_destroy(&allocation_policy);
-		}
-
-		if(creation_time) {
-			lvm2_bounded_string_destroy(&creation_time);
-		}
-
-		if(creation_host) {
-			lvm2_bounded_string_destroy(&creation_host);
-		}
-
-		if(id)
-			lvm2_bounded_string_destroy(&id);
 	}
 
 	return err;
@@ -2311,37 +2429,22 @@ static int lvm2_logical_volume_create(
 
 static void lvm2_logical_volume_destroy(struct lvm2_logical_volume **lv)
 {
-	lvm2_bounded_string_destroy(&(*lv)->name);
-
 	if(&(*lv)->segments_len) {
 		size_t i;
 
 		for(i = 0; i < (*lv)->segments_len; ++i) {
-			lvm2_segment_destroy(&(*lv)->segments[i]);
+			lvm2_segment_cleanup(&(*lv)->segments[i]);
 		}
 
 		lvm2_free((void**) &(*lv)->segments,
-			(*lv)->segments_len * sizeof(struct lvm2_segment*));
+			(*lv)->segments_len * sizeof(struct lvm2_segment));
 	}
 
-	if((*lv)->allocation_policy) {
-		lvm2_bounded_string_destroy(&(*lv)->allocation_policy);
-	}
-
-	if((*lv)->creation_time) {
-		lvm2_bounded_string_destroy(&(*lv)->creation_time);
-	}
-
-	if((*lv)->creation_host) {
-		lvm2_bounded_string_destroy(&(*lv)->creation_host);
-	}
-
-	lvm2_bounded_string_destroy(&(*lv)->id);
-
 	lvm2_free((void**) lv, sizeof(struct lvm2_logical_volume));
 }
 
 static int lvm2_physical_volume_create(
+		struct lvm2_string_table *const strings,
 		const struct lvm2_bounded_string *const pv_name,
 		const struct lvm2_dom_section *const pv_section,
 		struct lvm2_physical_volume **const out_pv)
@@ -2350,11 +2453,11 @@ static int lvm2_physical_volume_create(
 	size_t i;
 	struct lvm2_physical_volume *pv = NULL;
 
-	struct lvm2_bounded_string *pv_name_dup = NULL;
+	const struct lvm2_bounded_string *pv_name_dup = NULL;
 
-	struct lvm2_bounded_string *id = NULL;
+	const struct lvm2_bounded_string *id = NULL;
 
-	struct lvm2_bounded_string *device = NULL;
+	const struct lvm2_bounded_string *device = NULL;
 
 	lvm2_bool status_defined = LVM2_FALSE;
 	lvm2_physical_volume_status status = 0;
@@ -2388,8 +2491,8 @@ static int lvm2_physical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&id);
+				err = lvm2_string_table_intern(strings,
+					value->value, &id);
 				if(err) {
 					LogError("Error while parsing value of "
 						"'id' as u64'.");
@@ -2405,8 +2508,8 @@ static int lvm2_physical_volume_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&device);
+				err = lvm2_string_table_intern(strings,
+					value->value, &device);
 				if(err) {
 					LogError("Error while parsing value of "
 						"'device' as u64'.");
@@ -2584,9 +2687,10 @@ static int lvm2_physical_volume_create(
 	}
 
 	if(!err) {
-		err = lvm2_bounded_string_dup(pv_name, &pv_name_dup);
+		err = lvm2_string_table_intern(strings, pv_name,
+			&pv_name_dup);
 		if(err) {
-			LogError("Error while duplicating string: %d", err);
+			LogError("Error while interning string: %d", err);
 		}
 	}
 
@@ -2653,12 +2757,6 @@ static int lvm2_physical_volume_create(
 		if(pv)
 			lvm2_free((void**) &pv,
 				sizeof(struct lvm2_physical_volume));
-		if(pv_name_dup)
-			lvm2_bounded_string_destroy(&pv_name_dup);
-		if(device)
-			lvm2_bounded_string_destroy(&device);
-		if(id)
-			lvm2_bounded_string_destroy(&id);
 	}
 
 	return err;
@@ -2666,14 +2764,11 @@ static int lvm2_physical_volume_create(
 
 static void lvm2_physical_volume_destroy(struct lvm2_physical_volume **pv)
 {
-	lvm2_bounded_string_destroy(&(*pv)->name);
-	lvm2_bounded_string_destroy(&(*pv)->device);
-	lvm2_bounded_string_destroy(&(*pv)->id);
-
 	lvm2_free((void**) pv, sizeof(struct lvm2_physical_volume));
 }
 
 static int lvm2_volume_group_create(
+		struct lvm2_string_table *const strings,
 		const struct lvm2_dom_section *const vg_section,
 		struct lvm2_volume_group **const out_vg)
 {
@@ -2681,12 +2776,12 @@ static int lvm2_volume_group_create(
 	size_t i;
 	struct lvm2_volume_group *vg = NULL;
 
-	struct lvm2_bounded_string *id = NULL;
+	const struct lvm2_bounded_string *id = NULL;
 
 	lvm2_bool seqno_defined = LVM2_FALSE;
 	u64 seqno = 0;
 
-	struct lvm2_bounded_string *format = NULL;
+	const struct lvm2_bounded_string *format = NULL;
 
 	lvm2_bool status_defined = LVM2_FALSE;
 	lvm2_volume_group_status status = 0;
@@ -2730,8 +2825,8 @@ static int lvm2_volume_group_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&id);
+				err = lvm2_string_table_intern(strings,
+					value->value, &id);
 				if(err) {
 					LogError("Error while parsing value of "
 						"'id' as u64'.");
@@ -2777,8 +2872,8 @@ static int lvm2_volume_group_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&format);
+				err = lvm2_string_table_intern(strings,
+					value->value, &format);
 				if(err)
 					break;
 			}
@@ -3012,6 +3107,7 @@ static int lvm2_volume_group_create(
 					}
 
 					err = lvm2_physical_volume_create(
+						strings,
 						grandchild_obj->name,
 						(struct lvm2_dom_section*)
 						grandchild_obj,
@@ -3067,6 +3163,7 @@ static int lvm2_volume_group_create(
 					}
 
 					err = lvm2_logical_volume_create(
+						strings,
 						grandchild_obj->name,
 						(struct lvm2_dom_section*)
 						grandchild_obj,
@@ -3194,13 +3291,6 @@ static int lvm2_volume_group_create(
 				physical_volumes_len *
 				sizeof(struct lvm2_physical_volume*));
 		}
-
-		if(format) {
-			lvm2_bounded_string_destroy(&format);
-		}
-
-		if(id)
-			lvm2_bounded_string_destroy(&id);
 	}
 
 	return err;
@@ -3235,12 +3325,6 @@ static void lvm2_volume_group_destroy(struct lvm2_volume_group **vg)
 			sizeof(struct lvm2_physical_volume*));
 	}
 
-	if((*vg)->format) {
-		lvm2_bounded_string_destroy(&(*vg)->format);
-	}
-
-	lvm2_bounded_string_destroy(&(*vg)->id);
-
 	lvm2_free((void**) vg, sizeof(struct lvm2_volume_group));
 }
 
@@ -3251,23 +3335,31 @@ LVM2_EXPORT int lvm2_layout_create(
 	int err = 0;
 	size_t i;
 
-	struct lvm2_bounded_string *vg_name = NULL;
+	struct lvm2_string_table *strings = NULL;
+
+	const struct lvm2_bounded_string *vg_name = NULL;
 	struct lvm2_volume_group *vg = NULL;
 
-	struct lvm2_bounded_string *contents = NULL;
+	const struct lvm2_bounded_string *contents = NULL;
 
 	lvm2_bool version_defined = LVM2_FALSE;
 	u64 version = 0;
 
-	struct lvm2_bounded_string *description = NULL;
+	const struct lvm2_bounded_string *description = NULL;
 
-	struct lvm2_bounded_string *creation_host = NULL;
+	const struct lvm2_bounded_string *creation_host = NULL;
 
 	lvm2_bool creation_time_defined = LVM2_FALSE;
 	u64 creation_time = 0;
 
 	struct lvm2_layout *layout = NULL;
 
+	err = lvm2_string_table_create(&strings);
+	if(err) {
+		LogError("Error while creating string table: %d", err);
+		return err;
+	}
+
 	/* Search for vg_name candidates. */
 	for(i = 0; i < root_section->children_len; ++i) {
 		const struct lvm2_dom_obj *child = root_section->children[i];
@@ -3285,8 +3377,8 @@ LVM2_EXPORT int lvm2_layout_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&contents);
+				err = lvm2_string_table_intern(strings,
+					value->value, &contents);
 				if(err)
 					break;
 			}
@@ -3320,8 +3412,8 @@ LVM2_EXPORT int lvm2_layout_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&description);
+				err = lvm2_string_table_intern(strings,
+					value->value, &description);
 				if(err)
 					break;
 			}
@@ -3335,8 +3427,8 @@ LVM2_EXPORT int lvm2_layout_create(
 					break;
 				}
 
-				err = lvm2_bounded_string_dup(value->value,
-					&creation_host);
+				err = lvm2_string_table_intern(strings,
+					value->value, &creation_host);
 				if(err)
 					break;
 			}
@@ -3382,7 +3474,7 @@ LVM2_EXPORT int lvm2_layout_create(
 			}
 		}
 		else if(child->type == LVM2_DOM_TYPE_SECTION) {
-			struct lvm2_bounded_string *dup_vg_name = NULL;
+			const struct lvm2_bounded_string *dup_vg_name = NULL;
 
 			if(vg_name || vg) {
 				LogError("More than one sub-section in root. "
@@ -3392,17 +3484,15 @@ LVM2_EXPORT int lvm2_layout_create(
 				break;
 			}
 
-			err = lvm2_bounded_string_dup(child->name,
+			err = lvm2_string_table_intern(strings, child->name,
 				&dup_vg_name);
 			if(err)
 				break;
 
-			err = lvm2_volume_group_create(
+			err = lvm2_volume_group_create(strings,
 				(struct lvm2_dom_section*) child, &vg);
-			if(err) {
-				lvm2_bounded_string_destroy(&dup_vg_name);
+			if(err)
 				break;
-			}
 
 			vg_name = dup_vg_name;
 
@@ -3445,6 +3535,8 @@ LVM2_EXPORT int lvm2_layout_create(
 		else {
 			memset(layout, 0, sizeof(struct lvm2_layout));
 
+			layout->refcount = 1;
+			layout->strings = strings;
 			layout->vg_name = vg_name;
 			layout->vg = vg;
 			layout->contents = contents;
@@ -3458,16 +3550,10 @@ LVM2_EXPORT int lvm2_layout_create(
 	if(err) {
 		if(layout)
 			lvm2_free((void**) &layout, sizeof(struct lvm2_layout));
-		if(creation_host)
-			lvm2_bounded_string_destroy(&creation_host);
-		if(description)
-			lvm2_bounded_string_destroy(&description);
-		if(contents)
-			lvm2_bounded_string_destroy(&contents);
 		if(vg)
 			lvm2_volume_group_destroy(&vg);
-		if(vg_name)
-			lvm2_bounded_string_destroy(&vg_name);
+		if(strings)
+			lvm2_string_table_destroy(&strings);
 	}
 	else
 		*out_layout = layout;	
@@ -3478,19 +3564,129 @@ LVM2_EXPORT int lvm2_layout_create(
 LVM2_EXPORT void lvm2_layout_destroy(
 		struct lvm2_layout **const layout)
 {
-	lvm2_bounded_string_destroy(&(*layout)->creation_host);
-	lvm2_bounded_string_destroy(&(*layout)->description);
-	lvm2_bounded_string_destroy(&(*layout)->contents);
-
 	lvm2_volume_group_destroy(&(*layout)->vg);
-	lvm2_bounded_string_destroy(&(*layout)->vg_name);
+
+	/* All strings in the layout are owned by the string table. */
+	lvm2_string_table_destroy(&(*layout)->strings);
 
 	lvm2_free((void**) layout, sizeof(struct lvm2_layout));
 }
 
+LVM2_EXPORT struct lvm2_layout* lvm2_layout_retain(
+		struct lvm2_layout *const layout)
+{
+	++layout->refcount;
+
+	return layout;
+}
+
+LVM2_EXPORT void lvm2_layout_release(struct lvm2_layout **const layout)
+{
+	if(--(*layout)->refcount == 0)
+		lvm2_layout_destroy(layout);
+	else
+		*layout = NULL;
+}
+
+LVM2_EXPORT void lvm2_layout_get_string_stats(
+		const struct lvm2_layout *const layout,
+		struct lvm2_string_stats *const out_stats)
+{
+	const struct lvm2_string_table *const strings = layout->strings;
+
+	memset(out_stats, 0, sizeof(struct lvm2_string_stats));
+
+	out_stats->unique_strings = strings->strings_len;
+	out_stats->references = strings->references;
+	out_stats->referenced_bytes = strings->referenced_bytes;
+	out_stats->stored_bytes = strings->stored_bytes;
+	out_stats->table_bytes = sizeof(struct lvm2_string_table) +
+		strings->buckets_len * sizeof(struct lvm2_bounded_string*);
+}
+
 #define AlignSize(size, alignment) \
         ((((size) + (alignment) - 1) / (alignment)) * (alignment))
 
+/**
+ * Check that the metadata text described by 'locn' lies within a metadata area
+ * of 'metadata_size' bytes.
+ */
+static int lvm2_check_text_locn(const u64 metadata_size,
+		const struct raw_locn *const locn)
+{
+	const u64 locn_offset = le64_to_cpu(locn->offset);
+	const u64 locn_size = le64_to_cpu(locn->size);
+
+	if(locn_offset >= metadata_size) {
+		LogError("locn offset out of range for metadata area (offset: "
+			"%" FMTllu " max: %" FMTllu ").",
+			ARGllu(locn_offset), ARGllu(metadata_size));
+		return EINVAL;
+	}
+	else if(locn_size > (metadata_size - locn_offset)) {
+		LogError("locn size out of range for metadata area (size: "
+			"%" FMTllu " max: %" FMTllu ").",
+			ARGllu(locn_size), ARGllu(metadata_size - locn_offset));
+		return EINVAL;
+	}
+	else if(locn_size > SIZE_MAX) {
+		LogError("locn_size out of range (%" FMTllu ").",
+			ARGllu(locn_size));
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+LVM2_EXPORT int lvm2_parse_layout_text(const char *const text,
+		const size_t text_len, struct lvm2_layout **const out_layout)
+{
+	int err;
+	struct lvm2_dom_section *parse_result = NULL;
+
+	//LogDebug("LVM2 text: %.*s", text_len, text);
+
+	if(!lvm2_parse_text(text, text_len, &parse_result)) {
+		LogError("Error while parsing text.");
+		return EIO;
+	}
+
+	err = lvm2_layout_create(parse_result, out_layout);
+	if(err) {
+		LogError("Error while converting parsed result into structured "
+			"data: %d", err);
+	}
+
+	lvm2_dom_section_destroy(&parse_result, LVM2_TRUE);
+
+	return err;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_text_checksum_matches(const char *const text,
+		const size_t text_len, const struct raw_locn *const locn)
+{
+	return lvm2_calc_crc(LVM_INITIAL_CRC, text, text_len) ==
+		le32_to_cpu(locn->checksum) ? LVM2_TRUE : LVM2_FALSE;
+}
+
+/**
+ * Parse metadata text that was read for 'locn', after checking it against the
+ * checksum in 'locn'. Returns EIO if it doesn't match, e.g. because the text
+ * was torn by an interrupted write, so that the caller can try another copy.
+ */
+static int lvm2_parse_checked_text(const char *const text,
+		const size_t text_len, const struct raw_locn *const locn,
+		struct lvm2_layout **const out_layout)
+{
+	if(!lvm2_text_checksum_matches(text, text_len, locn)) {
+		LogError("Checksum mismatch in metadata text (expected: "
+			"0x%" FMTlX ").", ARGlX(le32_to_cpu(locn->checksum)));
+		return EIO;
+	}
+
+	return lvm2_parse_layout_text(text, text_len, out_layout);
+}
+
 LVM2_EXPORT int lvm2_read_text(struct lvm2_device *dev,
 		const u64 metadata_offset, const u64 metadata_size,
 		const struct raw_locn *const locn,
@@ -3515,8 +3711,8 @@ LVM2_EXPORT int lvm2_read_text(struct lvm2_device *dev,
 
 	char *text;
 	size_t text_len;
+	const void *mapped_text;
 
-	struct lvm2_dom_section *parse_result = NULL;
 	struct lvm2_layout *layout = NULL;
 
 	LogDebug("%s: Entering with dev=%p metadata_offset = %" FMTllu " "
@@ -3530,27 +3726,23 @@ LVM2_EXPORT int lvm2_read_text(struct lvm2_device *dev,
 	LogDebug("locn_checksum = 0x%" FMTlX, ARGlX(locn_checksum));
 	LogDebug("locn_filler = 0x%" FMTlX, ARGlX(locn_filler));
 
-	if(locn_offset >= metadata_size) {
-		LogError("locn offset out of range for metadata area (offset: "
-			"%" FMTllu " max: %" FMTllu ").",
-			ARGllu(locn_offset), ARGllu(metadata_size));
-		err = EINVAL;
-		goto err_out;
-	}
-	else if(locn_size > (metadata_size - locn_offset)) {
-		LogError("locn size out of range for metadata area (size: "
-			"%" FMTllu " max: %" FMTllu ").",
-			ARGllu(locn_size), ARGllu(metadata_size - locn_offset));
-		err = EINVAL;
-		goto err_out;
-	}
-	else if(locn_size > SIZE_MAX) {
-		LogError("locn_size out of range (%" FMTllu ").",
-			ARGllu(locn_size));
-		err = EINVAL;
+	err = lvm2_check_text_locn(metadata_size, locn);
+	if(err)
 		goto err_out;
+
+	if(!lvm2_device_map_range(dev, metadata_offset + locn_offset,
+		(size_t) locn_size, &mapped_text))
+	{
+		err = lvm2_parse_checked_text((const char*) mapped_text,
+			(size_t) locn_size, locn, &layout);
+		if(err)
+			goto err_out;
+
+		*out_layout = layout;
+		goto cleanup;
 	}
-	else if(media_block_size > SIZE_MAX) {
+
+	if(media_block_size > SIZE_MAX) {
 		LogError("media_block_size out of range (%" FMTllu ").",
 			ARGllu(media_block_size));
 		err = EINVAL;
@@ -3584,29 +3776,12 @@ LVM2_EXPORT int lvm2_read_text(struct lvm2_device *dev,
 		[text_buffer_inset];
 	text_len = (size_t) locn_size;
 
-	//LogDebug("LVM2 text: %.*s", text_len, text);
-
-	if(!lvm2_parse_text(text, text_len, &parse_result)) {
-		LogError("Error while parsing text.");
-		err = EIO;
-		goto err_out;
-	}
-
-	err = lvm2_layout_create(parse_result, &layout);
-	if(err) {
-		LogError("Error while converting parsed result into structured "
-			"data: %d", err);
+	err = lvm2_parse_checked_text(text, text_len, locn, &layout);
+	if(err)
 		goto err_out;
-	}
-
-	lvm2_dom_section_destroy(&parse_result, LVM2_TRUE);
 
 	*out_layout = layout;
 cleanup:
-	if(err && layout)
-		lvm2_layout_destroy(&layout);
-	if(parse_result)
-		lvm2_dom_section_destroy(&parse_result, LVM2_TRUE);
 	if(text_buffer)
 		lvm2_io_buffer_destroy(&text_buffer);
 
@@ -3624,34 +3799,21 @@ err_out:
 static lvm2_bool lvm2_parse_device_find_pv_location(
 		const struct lvm2_logical_volume *const lv,
 		const struct lvm2_physical_volume *const pv,
-		struct lvm2_segment **const out_segment,
-		struct lvm2_pv_location **const out_location,
+		const struct lvm2_segment **const out_segment,
+		const struct lvm2_pv_location **const out_location,
 		lvm2_bool *const out_lv_is_incomplete)
 {
-	u64 seg_no;
-	u64 stripe_no;
-	u64 mirror_no;
-
-	for(seg_no = 0; seg_no < lv->segment_count; ++seg_no) {
-		if(lv->segments[seg_no]->stripes &&
-			lv->segments[seg_no]->mirrors)
-		{
-			LogError("Segment %" FMTzu " of logical volume "
-				"\"%.*s\" has both stripes and mirrors "
-				"(corrupt LVM metadata or new LVM feature?). "
-				"Marking as incomplete.",
-				ARGzu(seg_no),
-				lv->name->length,
-				lv->name->content);
-
-			*out_lv_is_incomplete = LVM2_TRUE;
-		}
+	size_t seg_no;
 
-		if(lv->segments[seg_no]->stripes) {
-			LogDebug("Matching with %" FMTzu " stripes...",
-				ARGzu(lv->segments[seg_no]->stripes_len));
+	for(seg_no = 0; seg_no < lv->segments_len; ++seg_no) {
+		const struct lvm2_segment *const segment =
+			&lv->segments[seg_no];
+		const struct lvm2_pv_location *const locations =
+			lvm2_segment_get_locations(segment);
+		u32 location_no;
 
-			if(lv->segments[seg_no]->stripes_len != 1) {
+		if(segment->kind == LVM2_SEGMENT_KIND_STRIPED) {
+			if(segment->locations_len != 1) {
 				LogError("More than one stripe in segment "
 					"%" FMTzu " of logical volume "
 					"\"%.*s\". Marking as incomplete.",
@@ -3661,41 +3823,9 @@ static lvm2_bool lvm2_parse_device_find_pv_location(
 
 				*out_lv_is_incomplete = LVM2_TRUE;
 			}
-
-			for(stripe_no = 0;
-				stripe_no < lv->segments[seg_no]->stripes_len;
-				++stripe_no)
-			{
-				const struct lvm2_bounded_string *pv_name;
-
-				pv_name = lv->segments[seg_no]->
-					stripes[stripe_no]->pv_name;
-
-				LogDebug("\tMatching with stripe \"%.*s\"...",
-					pv_name->length,
-					pv_name->content);
-
-				if(pv_name->length == pv->name->length &&
-					!strncmp(pv_name->content,
-					pv->name->content, pv_name->length))
-				{
-					/* Match found. Break inner loop. */
-					break;
-				}
-			}
-
-			/* Break outer loop if a match was found among the
-			 * stripes. */
-			if(stripe_no < lv->segments[seg_no]->stripes_len) {
-				break;
-			}
 		}
-
-		if(lv->segments[seg_no]->mirrors) {
-			LogDebug("Matching with %" FMTzu " mirrors...",
-				ARGzu(lv->segments[seg_no]->mirrors_len));
-
-			if(lv->segments[seg_no]->mirrors_len > 1) {
+		else if(segment->kind == LVM2_SEGMENT_KIND_MIRRORED) {
+			if(segment->locations_len > 1) {
 				LogError("More than one mirror in segment "
 					"%" FMTzu " of logical volume "
 					"\"%.*s\". Marking as incomplete.",
@@ -3705,139 +3835,110 @@ static lvm2_bool lvm2_parse_device_find_pv_location(
 
 				*out_lv_is_incomplete = LVM2_TRUE;
 			}
+		}
+		else {
+			continue;
+		}
 
-			for(mirror_no = 0;
-				mirror_no < lv->segments[seg_no]->mirrors_len;
-				++mirror_no)
-			{
-				const struct lvm2_bounded_string *pv_name;
-
-				pv_name = lv->segments[seg_no]->
-					mirrors[mirror_no]->pv_name;
-
-				LogDebug("\tMatching with mirror \"%.*s\"...",
-					pv_name->length,
-					pv_name->content);
-
-				if(pv_name->length == pv->name->length &&
-					!strncmp(pv_name->content,
-					pv->name->content, pv_name->length))
-				{
-					/* Match found. Break inner loop. */
-					break;
-				}
-			}
+		LogDebug("Matching with %" FMTllu " %ss...",
+			ARGllu(segment->locations_len),
+			(segment->kind == LVM2_SEGMENT_KIND_STRIPED) ?
+			"stripe" : "mirror");
 
-			/* Break outer loop if a match was found among the
-			 * mirrors. */
-			if(mirror_no < lv->segments[seg_no]->mirrors_len) {
-				break;
+		for(location_no = 0; location_no < segment->locations_len;
+			++location_no)
+		{
+			const struct lvm2_bounded_string *const pv_name =
+				locations[location_no].pv_name;
+
+			LogDebug("\tMatching with location \"%.*s\"...",
+				pv_name->length,
+				pv_name->content);
+
+			/* Strings are interned per layout, so equal names are
+			 * the same object. */
+			if(pv_name == pv->name) {
+				*out_segment = segment;
+				*out_location = &locations[location_no];
+				return LVM2_TRUE;
 			}
 		}
 	}
 
-	if(seg_no == lv->segment_count) {
-		/* No match. */
+	/* No match. */
+	return LVM2_FALSE;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_pv_id_matches_uuid(const char *const id,
+		const size_t id_length, const char *const pv_uuid)
+{
+	/* The id in the metadata text is the 32 character UUID from the
+	 * pv_header, split into groups of 6-4-4-4-4-4-6 characters by
+	 * dashes. */
+	static const size_t group_lengths[7] = { 6, 4, 4, 4, 4, 4, 6 };
+	size_t id_offset = 0;
+	size_t uuid_offset = 0;
+	size_t i;
+
+	if(id_length != LVM_ID_LEN + 6) {
+		LogError("Invalid id length %" FMTzu, ARGzu(id_length));
 		return LVM2_FALSE;
 	}
-	else if(stripe_no < lv->segments[seg_no]->stripes_len) {
-		/* Match found in stripes. */
-		*out_segment = lv->segments[seg_no];
-		*out_location = lv->segments[seg_no]->stripes[stripe_no];
-		return LVM2_TRUE;
-	}
-	else if(mirror_no < lv->segments[seg_no]->mirrors_len) {
-		/* Match found in mirrors. */
-		*out_segment = lv->segments[seg_no];
-		*out_location = lv->segments[seg_no]->mirrors[mirror_no];
-		return LVM2_TRUE;
-	}
-	else {
-		LogError("Unexpected: both stripe_no (%" FMTzu ") and "
-			"mirror_no (%" FMTzu ") have reached the end.",
-			ARGzu(stripe_no),
-			ARGzu(mirror_no));
-		return LVM2_FALSE;
+
+	for(i = 0; i < 7; ++i) {
+		if(i != 0 && id[id_offset++] != '-')
+			return LVM2_FALSE;
+
+		if(strncmp(&id[id_offset], &pv_uuid[uuid_offset],
+			group_lengths[i]))
+		{
+			return LVM2_FALSE;
+		}
+
+		id_offset += group_lengths[i];
+		uuid_offset += group_lengths[i];
 	}
+
+	return LVM2_TRUE;
 }
 
-LVM2_EXPORT int lvm2_parse_device(struct lvm2_device *const dev,
-		lvm2_bool (*const volume_callback)(void *private_data,
-			u64 device_size, const char *volume_name,
-			u64 volume_start, u64 volume_length,
-			lvm2_bool is_incomplete),
-		void *const private_data)
+/**
+ * Locate and verify the LVM2 label and pv_header in 'window', which holds the
+ * first LVM_LABEL_SCAN_SECTORS sectors of a device (or more).
+ */
+LVM2_EXPORT int lvm2_parse_pv_info(const void *const window,
+		const size_t window_size, struct lvm2_pv_info *const out_info)
 {
-	const u64 media_block_size = lvm2_device_get_alignment(dev);
-
 	int err;
-	struct lvm2_io_buffer *buffer = NULL;
-	struct lvm2_io_buffer *secondary_buffer = NULL;
-	u64 read_offset = 0;
-	size_t buffer_size = 0;
-	size_t secondary_buffer_size = 0;
 	u32 i;
 	s32 firstLabel = -1;
-	lvm2_bool manual_break = LVM2_FALSE;
-
-	LogDebug("%s: Entering with dev=%p.", __FUNCTION__, dev);
-
-	if(media_block_size > SIZE_MAX) {
-		LogError("Unrealistic media block size: %" FMTllu,
-			ARGllu(media_block_size));
-		goto out_err;
-	}
 
-	/* Allocate a suitably sized buffer. */
+	const void *sectorBytes;
+	size_t sectorBytesLength;
+	const struct label_header *labelHeader;
+	const struct pv_header *pvHeader;
 
-	buffer_size = (size_t) AlignSize(LVM_SECTOR_SIZE, media_block_size);
-	err = lvm2_io_buffer_create(buffer_size, &buffer);
-	if(err) {
-		LogError("Error while allocating 'buffer' (%" FMTzu " bytes).",
-			ARGzu(buffer_size));
-		goto out_err;
-	}
+	u64 labelSector;
+	u32 labelCrc;
+	u32 calculatedCrc;
+	u32 contentOffset;
 
-	LogDebug("\tAllocated 'buffer': %" FMTzu " bytes",
-		ARGzu(buffer_size));
+	u32 disk_areas_idx;
+	size_t dataAreasLength;
+	size_t metadataAreasLength;
 
-	secondary_buffer_size =
-		(size_t) AlignSize(LVM_MDA_HEADER_SIZE, media_block_size);
-	err = lvm2_io_buffer_create(secondary_buffer_size, &secondary_buffer);
-	if(err) {
-		LogError("Error while allocating 'secondary_buffer' "
-			"(%" FMTzu "bytes).",
-			ARGzu(secondary_buffer_size));
-		goto out_err;
+	if(window_size < LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE) {
+		LogError("Label scan window too small (%" FMTzu " bytes).",
+			ARGzu(window_size));
+		return EINVAL;
 	}
 
-	LogDebug("\tAllocated 'secondary_buffer': %" FMTzu " bytes",
-		ARGzu(secondary_buffer_size));
-
-	/* Open the media with read-only access. */
-
-	LogDebug("\tMedia is open.");
-
 	for(i = 0; i < LVM_LABEL_SCAN_SECTORS; ++i) {
-		const struct label_header *labelHeader;
-		u64 labelSector;
-		u32 labelCrc;
-		u32 calculatedCrc;
-
-		read_offset = i * LVM_SECTOR_SIZE;
-
 		LogDebug("Searching for LVM label at sector %" FMTlu "...",
 			ARGlu(i));
 
-		err = lvm2_device_read(dev, read_offset, buffer_size, buffer);
-		if(err) {
-			LogError("Error while reading sector %" FMTlu ".",
-				ARGlu(i));
-			goto out_err;
-		}
-
 		labelHeader = (const struct label_header*)
-			lvm2_io_buffer_get_bytes(buffer);
+			&((const char*) window)[i * LVM_SECTOR_SIZE];
 
 		LogDebug("\tlabel_header = {");
 		LogDebug("\t\t.id = '%.*s'", 8, labelHeader->id);
@@ -3885,474 +3986,1878 @@ LVM2_EXPORT int lvm2_parse_device(struct lvm2_device *const dev,
 
 	if(firstLabel < 0) {
 		LogDebug("No LVM label found on volume.");
+		err = EIO;
 		goto out_err;
 	}
 
-	{
-		const void *sectorBytes;
-		const struct label_header *labelHeader;
-		const struct pv_header *pvHeader;
-
-		u64 labelSector;
-		u32 labelCrc;
-		u32 calculatedCrc;
-		u32 contentOffset;
-
-		u64 deviceSize;
+	/* The label has already been verified above. The pv_header has to be
+	 * in the same sector as the label (the sector that its CRC covers),
+	 * and nothing past that sector is looked at, since 'window' may be a
+	 * mapping of just the label scan sectors. */
+	sectorBytes = &((const char*) window)[firstLabel * LVM_SECTOR_SIZE];
+	sectorBytesLength = LVM_SECTOR_SIZE;
+	labelHeader = (const struct label_header*) sectorBytes;
 
-		u32 disk_areas_idx;
-		size_t dataAreasLength;
-		size_t metadataAreasLength;
-
-		struct lvm2_layout *layout = NULL;
+	contentOffset = le32_to_cpu(labelHeader->offset_xl);
+	if(contentOffset < sizeof(struct label_header)) {
+		LogError("Content overlaps header (content offset: %" FMTlu ").",
+			ARGlu(contentOffset));
+		err = EIO;
+		goto out_err;
+	}
+	else if(contentOffset > sectorBytesLength - sizeof(struct pv_header)) {
+		LogError("Content overflows into the next sector (content "
+			"offset: %" FMTlu ").", ARGlu(contentOffset));
+		err = EIO;
+		goto out_err;
+	}
 
-		read_offset = firstLabel * LVM_SECTOR_SIZE;
+	if(memcmp(labelHeader->type, LVM_LVM2_LABEL, 8)) {
+		LogError("Unsupported label type: '%.*s'.",
+			8, labelHeader->type);
+		err = EIO;
+		goto out_err;
+	}
 
-		err = lvm2_device_read(dev, read_offset, buffer_size, buffer);
-		if(err) {
-			LogError("\tError while reading label sector "
-				"%" FMTlu ": %d",
-				ARGlu(i), err);
-			goto out_err;
-		}
+	pvHeader = (struct pv_header*) &((char*) sectorBytes)[contentOffset];
 
-		sectorBytes = lvm2_io_buffer_get_bytes(buffer);
-		labelHeader = (const struct label_header*) sectorBytes;
+	/* Each entry, including the terminating one, is checked to lie within
+	 * the sector before it's read. */
+	disk_areas_idx = 0;
+	for(;;) {
+		const uintptr_t ptrDiff = (uintptr_t)
+			&pvHeader->disk_areas_xl[disk_areas_idx] -
+			(uintptr_t) sectorBytes;
 
-		/* Re-verify label fields. If the first three don't verify we
-		 * have a very strange situation, indicated with the tag
-		 * 'Unexpected:' before the error messages. */
-		if(memcmp(labelHeader->id, "LABELONE", 8)) {
-			LogError("Unexpected: 'id' magic does not match.");
+		if(ptrDiff + sizeof(struct disk_locn) > sectorBytesLength) {
+			LogError("Data areas overflow into the next sector "
+				"(index %" FMTzu ").", ARGzu(disk_areas_idx));
+			err = EIO;
 			goto out_err;
 		}
 
-		labelSector = le64_to_cpu(labelHeader->sector_xl);
-		if(labelSector != (u32) firstLabel) {
-			LogError("Unexpected: 'sector_xl' does not match "
-				 "actual sector (%" FMTllu " != %" FMTlu ").",
-				 ARGllu(labelSector), ARGlu(firstLabel));
-			goto out_err;
-		}
+		if(pvHeader->disk_areas_xl[disk_areas_idx].offset == 0)
+			break;
 
-		labelCrc = le32_to_cpu(labelHeader->crc_xl);
-		calculatedCrc = lvm2_calc_crc(LVM_INITIAL_CRC,
-			&labelHeader->offset_xl, LVM_SECTOR_SIZE -
-			offsetof(struct label_header, offset_xl));
-		if(labelCrc != calculatedCrc) {
-			LogError("Unexpected: Stored and calculated CRC32 "
-				 "checksums don't match (0x%08" FMTlX " "
-				 "!= 0x%08" FMTlX ").",
-				 ARGlx(labelCrc), ARGlX(calculatedCrc));
+		++disk_areas_idx;
+	}
+	dataAreasLength = disk_areas_idx;
+	++disk_areas_idx;
+	for(;;) {
+		const uintptr_t ptrDiff = (uintptr_t)
+			&pvHeader->disk_areas_xl[disk_areas_idx] -
+			(uintptr_t) sectorBytes;
+
+		if(ptrDiff + sizeof(struct disk_locn) > sectorBytesLength) {
+			LogError("Metadata areas overflow into the next sector "
+				"(index %" FMTzu ").", ARGzu(disk_areas_idx));
+			err = EIO;
 			goto out_err;
 		}
 
-		contentOffset = le32_to_cpu(labelHeader->offset_xl);
-		if(contentOffset < sizeof(struct label_header)) {
-			LogError("Content overlaps header (content offset: "
-				 "%" FMTlu ").", ARGlu(contentOffset));
-			goto out_err;
-		}
+		if(pvHeader->disk_areas_xl[disk_areas_idx].offset == 0)
+			break;
 
-		if(memcmp(labelHeader->type, LVM_LVM2_LABEL, 8)) {
-			LogError("Unsupported label type: '%.*s'.",
-				8, labelHeader->type);
-			goto out_err;
-		}
+		++disk_areas_idx;
+	}
+	metadataAreasLength = disk_areas_idx - (dataAreasLength + 1);
 
-		pvHeader = (struct pv_header*)
-			&((char*) sectorBytes)[contentOffset];
+	if(dataAreasLength != metadataAreasLength) {
+		LogError("Size mismatch between PV data and metadata areas "
+			"(%" FMTzu " != %" FMTzu ").",
+			ARGzu(dataAreasLength), ARGzu(metadataAreasLength));
+		err = EIO;
+		goto out_err;
+	}
 
-		disk_areas_idx = 0;
-		while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0) {
-			const uintptr_t ptrDiff = (uintptr_t)
-				&pvHeader->disk_areas_xl[disk_areas_idx] -
-				(uintptr_t) sectorBytes;
+	if(metadataAreasLength > LVM2_PV_INFO_MAX_METADATA_AREAS) {
+		LogError("Too many metadata areas (%" FMTzu " > %d).",
+			ARGzu(metadataAreasLength),
+			LVM2_PV_INFO_MAX_METADATA_AREAS);
+		err = EIO;
+		goto out_err;
+	}
+
+#if defined(DEBUG)
+	LogDebug("\tpvHeader = {");
+	LogDebug("\t\tpv_uuid = '%.*s'", LVM_ID_LEN, pvHeader->pv_uuid);
+	LogDebug("\t\tdevice_size_xl = %" FMTllu,
+		ARGllu(le64_to_cpu(pvHeader->device_size_xl)));
+	LogDebug("\t\tdisk_areas_xl = {");
+	LogDebug("\t\t\tdata_areas = {");
+	disk_areas_idx = 0;
+	while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0 &&
+		disk_areas_idx < dataAreasLength)
+	{
+		LogDebug("\t\t\t\t{");
+		LogDebug("\t\t\t\t\toffset = %" FMTllu,
+			ARGllu(le64_to_cpu(pvHeader->
+			disk_areas_xl[disk_areas_idx].offset)));
+		LogDebug("\t\t\t\t\tsize = %" FMTllu,
+			ARGllu(le64_to_cpu(pvHeader->
+			disk_areas_xl[disk_areas_idx].size)));
+		LogDebug("\t\t\t\t}");
+
+		++disk_areas_idx;
+	}
+	LogDebug("\t\t\t}");
+	++disk_areas_idx;
+	LogDebug("\t\t\tmetadata_areas = {");
+	while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0 &&
+		disk_areas_idx < (dataAreasLength + 1 + metadataAreasLength))
+	{
+		LogDebug("\t\t\t\t{");
+		LogDebug("\t\t\t\t\toffset = %" FMTllu,
+			ARGllu(le64_to_cpu(pvHeader->
+			disk_areas_xl[disk_areas_idx].offset)));
+		LogDebug("\t\t\t\t\tsize = %" FMTllu,
+			ARGllu(le64_to_cpu(pvHeader->
+			disk_areas_xl[disk_areas_idx].size)));
+		LogDebug("\t\t\t\t}");
+
+		++disk_areas_idx;
+	}
+	LogDebug("\t\t\t}");
+	LogDebug("\t\t}");
+	LogDebug("\t}");
+#endif /* defined(DEBUG) */
+
+	memset(out_info, 0, sizeof(struct lvm2_pv_info));
+	memcpy(out_info->pv_uuid, pvHeader->pv_uuid, LVM_ID_LEN);
+	out_info->device_size = le64_to_cpu(pvHeader->device_size_xl);
+	out_info->label_sector = (u32) firstLabel;
+	out_info->data_areas_len = dataAreasLength;
+	out_info->metadata_areas_len = metadataAreasLength;
+	for(i = 0; i < metadataAreasLength; ++i) {
+		const struct disk_locn *const meta_locn =
+			&pvHeader->disk_areas_xl[dataAreasLength + 1 + i];
+
+		out_info->metadata_areas[i].offset =
+			le64_to_cpu(meta_locn->offset);
+		out_info->metadata_areas[i].size =
+			le64_to_cpu(meta_locn->size);
+	}
+
+	return 0;
+out_err:
+	if(!err)
+		err = EIO;
+
+	return err;
+}
+
+
+LVM2_EXPORT int lvm2_read_pv_info(struct lvm2_device *const dev,
+		struct lvm2_pv_info *const out_info)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+
+	int err;
+	struct lvm2_io_buffer *buffer = NULL;
+	size_t buffer_size = 0;
+	const void *bytes;
+
+	LogDebug("%s: Entering with dev=%p.", __FUNCTION__, dev);
+
+	if(media_block_size > SIZE_MAX) {
+		LogError("Unrealistic media block size: %" FMTllu,
+			ARGllu(media_block_size));
+		return EINVAL;
+	}
+
+	if(!lvm2_device_map_range(dev, 0, LVM_LABEL_SCAN_SECTORS *
+		LVM_SECTOR_SIZE, &bytes))
+	{
+		return lvm2_parse_pv_info(bytes, LVM_LABEL_SCAN_SECTORS *
+			LVM_SECTOR_SIZE, out_info);
+	}
+
+	/* Allocate a buffer covering the whole label scan window, so that all
+	 * candidate sectors can be fetched with a single read. */
+
+	buffer_size = (size_t) AlignSize(LVM_LABEL_SCAN_SECTORS *
+		LVM_SECTOR_SIZE, media_block_size);
+	err = lvm2_io_buffer_create(buffer_size, &buffer);
+	if(err) {
+		LogError("Error while allocating 'buffer' (%" FMTzu " bytes).",
+			ARGzu(buffer_size));
+		return err;
+	}
+
+	LogDebug("\tAllocated 'buffer': %" FMTzu " bytes",
+		ARGzu(buffer_size));
+
+	err = lvm2_device_read(dev, 0, buffer_size, buffer);
+	if(err) {
+		LogError("Error while reading label scan sectors.");
+	}
+	else {
+		err = lvm2_parse_pv_info(lvm2_io_buffer_get_bytes(buffer),
+			buffer_size, out_info);
+	}
+
+	lvm2_io_buffer_destroy(&buffer);
+
+	return err;
+}
+
+/**
+ * Verify the mda_header in 'bytes' (LVM_MDA_HEADER_SIZE bytes) read from the
+ * start of the metadata area 'area'.
+ */
+LVM2_EXPORT void lvm2_parse_mda_info(const void *const bytes,
+		const struct lvm2_disk_area *const area,
+		struct lvm2_mda_info *const out_mda)
+{
+	const u64 meta_offset = area->offset;
+	const u64 meta_size = area->size;
+	const struct mda_header *const mdaHeader =
+		(const struct mda_header*) bytes;
+
+	u32 mda_checksum;
+	u32 mda_version;
+	u64 mda_start;
+	u64 mda_size;
+
+	u32 mda_calculated_checksum;
+
+	memset(out_mda, 0, sizeof(struct lvm2_mda_info));
+	out_mda->offset = meta_offset;
+	out_mda->size = meta_size;
+	out_mda->valid = LVM2_FALSE;
+
+#if defined(DEBUG)
+	LogDebug("mdaHeader = {");
+	LogDebug("\tchecksum_xl = 0x%08" FMTlX,
+		ARGlX(le32_to_cpu(mdaHeader->checksum_xl)));
+	LogDebug("\tmagic = '%.*s'", 16, mdaHeader->magic);
+	LogDebug("\tversion = %" FMTlu,
+		ARGlu(le32_to_cpu(mdaHeader->version)));
+	LogDebug("\tstart = %" FMTllu, ARGllu(le64_to_cpu(mdaHeader->start)));
+	LogDebug("\tsize = %" FMTllu, ARGllu(le64_to_cpu(mdaHeader->size)));
+	LogDebug("\traw_locns = {");
+	{
+		size_t raw_locns_idx = 0;
+
+		while(memcmp(&null_raw_locn,
+			&mdaHeader->raw_locns[raw_locns_idx],
+			sizeof(struct raw_locn)) != 0)
+		{
+			const struct raw_locn *const cur_locn =
+				&mdaHeader->raw_locns[raw_locns_idx];
+
+			LogDebug("\t\t[%" FMTllu "] = {",
+				ARGllu(raw_locns_idx));
+			LogDebug("\t\t\toffset = %" FMTllu,
+				ARGllu(le64_to_cpu(cur_locn->offset)));
+			LogDebug("\t\t\tsize = %" FMTllu,
+				ARGllu(le64_to_cpu(cur_locn->size)));
+			LogDebug("\t\t\tchecksum = 0x%08" FMTlX,
+				ARGlX(le32_to_cpu(cur_locn->checksum)));
+			LogDebug("\t\t\tfiller = %" FMTlu,
+				ARGlu(le32_to_cpu(cur_locn->filler)));
+			LogDebug("\t\t}");
+
+			++raw_locns_idx;
+		}
+	}
+	LogDebug("\t}");
+	LogDebug("}");
+#endif /* defined(DEBUG) */
+
+	mda_checksum = le32_to_cpu(mdaHeader->checksum_xl);
+	mda_version = le32_to_cpu(mdaHeader->version);
+	mda_start = le64_to_cpu(mdaHeader->start);
+	mda_size = le64_to_cpu(mdaHeader->size);
+
+	mda_calculated_checksum = lvm2_calc_crc(LVM_INITIAL_CRC,
+		mdaHeader->magic, LVM_MDA_HEADER_SIZE -
+		offsetof(struct mda_header, magic));
+	if(mda_calculated_checksum != mda_checksum) {
+		LogError("mda_header checksum mismatch (calculated: "
+			"0x%" FMTlX " expected: 0x%" FMTlX ").",
+			ARGlX(mda_calculated_checksum), ARGlX(mda_checksum));
+		return;
+	}
+
+	if(mda_version != 1) {
+		LogError("Unsupported mda_version: %" FMTlu,
+			ARGlu(mda_version));
+		return;
+	}
+
+	if(mda_start != meta_offset) {
+		LogError("mda_start does not match metadata offset "
+			"(%" FMTllu " != %" FMTllu ").",
+			ARGllu(mda_start), ARGllu(meta_offset));
+		return;
+	}
+
+	if(mda_size != meta_size) {
+		LogError("mda_size does not match metadata size "
+			"(%" FMTllu " != %" FMTllu ").",
+			ARGllu(mda_size), ARGllu(meta_size));
+		return;
+	}
+
+	if(memcmp(&mdaHeader->raw_locns[0], &null_raw_locn,
+		sizeof(struct raw_locn)) == 0)
+	{
+		LogError("Missing first raw_locn.");
+		return;
+	}
+	else if(memcmp(&mdaHeader->raw_locns[1], &null_raw_locn,
+		sizeof(struct raw_locn)) != 0)
+	{
+		LogError("Found more than one raw_locn (currently "
+			"unsupported).");
+		return;
+	}
+
+	out_mda->checksum = mda_checksum;
+	memcpy(&out_mda->locn, &mdaHeader->raw_locns[0],
+		sizeof(struct raw_locn));
+	out_mda->valid = LVM2_TRUE;
+}
+
+
+LVM2_EXPORT int lvm2_read_mda_info(struct lvm2_device *const dev,
+		const struct lvm2_disk_area *const area,
+		struct lvm2_mda_info *const out_mda)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+
+	int err;
+	struct lvm2_io_buffer *buffer = NULL;
+	size_t buffer_size;
+	const void *bytes;
+
+	memset(out_mda, 0, sizeof(struct lvm2_mda_info));
+	out_mda->offset = area->offset;
+	out_mda->size = area->size;
+	out_mda->valid = LVM2_FALSE;
+
+	if(!lvm2_device_map_range(dev, area->offset, LVM_MDA_HEADER_SIZE,
+		&bytes))
+	{
+		lvm2_parse_mda_info(bytes, area, out_mda);
+		return 0;
+	}
+
+	if(media_block_size > SIZE_MAX) {
+		LogError("Unrealistic media block size: %" FMTllu,
+			ARGllu(media_block_size));
+		return EINVAL;
+	}
+
+	buffer_size = (size_t) AlignSize(LVM_MDA_HEADER_SIZE,
+		media_block_size);
+	err = lvm2_io_buffer_create(buffer_size, &buffer);
+	if(err) {
+		LogError("Error while allocating 'buffer' (%" FMTzu "bytes).",
+			ARGzu(buffer_size));
+		return err;
+	}
+
+	err = lvm2_device_read(dev, area->offset, buffer_size, buffer);
+	if(err) {
+		LogError("Error while reading first metadata sector (offset "
+			"%" FMTllu " bytes): %d", ARGllu(area->offset), err);
+	}
+	else {
+		lvm2_parse_mda_info(lvm2_io_buffer_get_bytes(buffer), area,
+			out_mda);
+	}
+
+	lvm2_io_buffer_destroy(&buffer);
+
+	return err;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_layout_report_volumes(
+		const struct lvm2_layout *const layout,
+		const struct lvm2_pv_info *const pv_info,
+		const lvm2_volume_callback volume_callback,
+		void *const private_data)
+{
+	size_t j;
+	const struct lvm2_physical_volume *match = NULL;
+
+	for(j = 0; j < layout->vg->physical_volumes_len; ++j) {
+		const struct lvm2_physical_volume *const pv =
+			layout->vg->physical_volumes[j];
+
+		if(lvm2_pv_id_matches_uuid(pv->id->content, pv->id->length,
+			pv_info->pv_uuid))
+		{
+			LogDebug("Found physical volume: '%.*s'",
+				pv->name->length, pv->name->content);
+			match = pv;
+			break;
+		}
+	}
+
+	if(!match) {
+		LogError("No physical volume match found in LVM2 database.");
+		return LVM2_TRUE;
+	}
+
+	for(j = 0; j < layout->vg->logical_volumes_len; ++j) {
+		const struct lvm2_logical_volume *const lv =
+			layout->vg->logical_volumes[j];
+		u64 partitionStart;
+		u64 partitionLength;
+		lvm2_bool is_incomplete = LVM2_FALSE;
+		const struct lvm2_segment *segment_match = NULL;
+		const struct lvm2_pv_location *pv_match = NULL;
+
+		if(lv->segment_count != 1) {
+			LogError("More than one segment in logical volume "
+				"\"%.*s\". Marking as incomplete.",
+				lv->name->length, lv->name->content);
+
+			is_incomplete = LVM2_TRUE;
+		}
+
+		/* Search for our PV among the LV's segments and stripes. */
+		LogDebug("Searching for physical volume \"%.*s\" in logical "
+			"volume's descriptors...",
+			match->name->length, match->name->content);
+		if(!lvm2_parse_device_find_pv_location(lv, match,
+			&segment_match, &pv_match, &is_incomplete))
+		{
+			LogError("Physical volume \"%.*s\" not found in "
+				"logical volume's descriptors. Skipping "
+				"logical volume \"%.*s\"...",
+				match->name->length, match->name->content,
+				lv->name->length, lv->name->content);
+			continue;
+		}
+
+		/* pe_start and extent_size are in LVM sectors, regardless
+		 * of the block size of the device. */
+		partitionStart = (match->pe_start +
+			pv_match->extent_start * layout->vg->extent_size) *
+			LVM_SECTOR_SIZE;
+		LogDebug("partitionStart: %" FMTllu, ARGllu(partitionStart));
+
+		partitionLength = segment_match->extent_count *
+			layout->vg->extent_size * LVM_SECTOR_SIZE;
+		LogDebug("partitionLength: %" FMTllu, ARGllu(partitionLength));
+
+		if(!volume_callback(private_data, pv_info->device_size,
+			lv->name->content, partitionStart, partitionLength,
+			is_incomplete))
+		{
+			return LVM2_FALSE;
+		}
+	}
+
+	return LVM2_TRUE;
+}
+
+struct lvm2_layout_cache_entry {
+	struct lvm2_layout *layout;
+	u64 text_size;
+	u32 text_checksum;
+	u64 last_used;		/**< Value of 'clock' when last used. */
+};
+
+struct lvm2_layout_cache {
+	size_t entries_len;
+	size_t entries_capacity;
+	struct lvm2_layout_cache_entry *entries;
+	u64 clock;
+	u64 hits;
+	u64 misses;
+};
+
+LVM2_EXPORT int lvm2_layout_cache_create(
+		struct lvm2_layout_cache **const out_cache)
+{
+	int err;
+	struct lvm2_layout_cache *cache;
+
+	err = lvm2_malloc(sizeof(struct lvm2_layout_cache), (void**) &cache);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_layout_cache: %d", err);
+		return err;
+	}
+
+	memset(cache, 0, sizeof(struct lvm2_layout_cache));
+
+	*out_cache = cache;
+
+	return 0;
+}
+
+LVM2_EXPORT void lvm2_layout_cache_destroy(
+		struct lvm2_layout_cache **const cache)
+{
+	size_t i;
+
+	for(i = 0; i < (*cache)->entries_len; ++i)
+		lvm2_layout_release(&(*cache)->entries[i].layout);
+
+	if((*cache)->entries) {
+		lvm2_free((void**) &(*cache)->entries,
+			(*cache)->entries_capacity *
+			sizeof(struct lvm2_layout_cache_entry));
+	}
+
+	lvm2_free((void**) cache, sizeof(struct lvm2_layout_cache));
+}
+
+/** Returns LVM2_TRUE if 'layout' lists the PV whose UUID is 'pv_uuid'. */
+static lvm2_bool lvm2_layout_has_pv(const struct lvm2_layout *const layout,
+		const char *const pv_uuid)
+{
+	const struct lvm2_volume_group *const vg = layout->vg;
+	size_t i;
+
+	for(i = 0; i < vg->physical_volumes_len; ++i) {
+		const struct lvm2_bounded_string *const id =
+			vg->physical_volumes[i]->id;
+
+		if(lvm2_pv_id_matches_uuid(id->content, id->length, pv_uuid))
+			return LVM2_TRUE;
+	}
+
+	return LVM2_FALSE;
+}
+
+/**
+ * Find the entry for the metadata text described by 'locn' on the PV described
+ * by 'pv_info'. The size and CRC of the text alone could also match the text of
+ * another VG, so an entry only matches if its layout lists the PV.
+ */
+static struct lvm2_layout_cache_entry* lvm2_layout_cache_find_locn(
+		struct lvm2_layout_cache *const cache,
+		const struct lvm2_pv_info *const pv_info,
+		const struct raw_locn *const locn)
+{
+	const u64 text_size = le64_to_cpu(locn->size);
+	const u32 text_checksum = le32_to_cpu(locn->checksum);
+
+	size_t i;
+
+	for(i = 0; i < cache->entries_len; ++i) {
+		struct lvm2_layout_cache_entry *const entry =
+			&cache->entries[i];
+
+		if(entry->text_size != text_size ||
+			entry->text_checksum != text_checksum)
+		{
+			continue;
+		}
+
+		if(!lvm2_layout_has_pv(entry->layout, pv_info->pv_uuid)) {
+			LogDebug("Cached layout of VG \"%.*s\" matches the "
+				"metadata text but not the PV, ignoring.",
+				entry->layout->vg->id->length,
+				entry->layout->vg->id->content);
+			continue;
+		}
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+LVM2_EXPORT struct lvm2_layout* lvm2_layout_cache_lookup(
+		struct lvm2_layout_cache *const cache,
+		const struct lvm2_pv_info *const pv_info,
+		const struct raw_locn *const locn)
+{
+	struct lvm2_layout_cache_entry *const entry =
+		lvm2_layout_cache_find_locn(cache, pv_info, locn);
+
+	if(!entry) {
+		++cache->misses;
+		return NULL;
+	}
+
+	++cache->hits;
+	entry->last_used = ++cache->clock;
+
+	return lvm2_layout_retain(entry->layout);
+}
+
+static struct lvm2_layout_cache_entry* lvm2_layout_cache_find_vg(
+		struct lvm2_layout_cache *const cache,
+		const char *const vg_id, const size_t vg_id_length)
+{
+	size_t i;
+
+	for(i = 0; i < cache->entries_len; ++i) {
+		const struct lvm2_bounded_string *const id =
+			cache->entries[i].layout->vg->id;
+
+		if((size_t) id->length == vg_id_length &&
+			!memcmp(id->content, vg_id, vg_id_length))
+		{
+			return &cache->entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+LVM2_EXPORT struct lvm2_layout* lvm2_layout_cache_find(
+		struct lvm2_layout_cache *const cache,
+		const char *const vg_id, const size_t vg_id_length,
+		const u64 seqno)
+{
+	struct lvm2_layout_cache_entry *const entry =
+		lvm2_layout_cache_find_vg(cache, vg_id, vg_id_length);
+
+	if(!entry || entry->layout->vg->seqno != seqno)
+		return NULL;
+
+	entry->last_used = ++cache->clock;
+
+	return lvm2_layout_retain(entry->layout);
+}
+
+/** Drop the cache's reference to the layout of entry 'index'. */
+static void lvm2_layout_cache_remove(struct lvm2_layout_cache *const cache,
+		const size_t index)
+{
+	lvm2_layout_release(&cache->entries[index].layout);
+
+	memmove(&cache->entries[index], &cache->entries[index + 1],
+		(cache->entries_len - index - 1) *
+		sizeof(struct lvm2_layout_cache_entry));
+	--cache->entries_len;
+}
+
+/**
+ * Make room for a new entry in a full cache, preferring layouts that nothing
+ * else references, as they are the ones that evicting actually frees.
+ */
+static void lvm2_layout_cache_evict(struct lvm2_layout_cache *const cache)
+{
+	size_t victim = 0;
+	lvm2_bool victim_unused = LVM2_FALSE;
+	size_t i;
+
+	for(i = 0; i < cache->entries_len; ++i) {
+		const struct lvm2_layout_cache_entry *const entry =
+			&cache->entries[i];
+		const lvm2_bool unused =
+			entry->layout->refcount == 1 ? LVM2_TRUE : LVM2_FALSE;
+
+		if(i == 0 || (unused && !victim_unused) ||
+			(unused == victim_unused &&
+			entry->last_used < cache->entries[victim].last_used))
+		{
+			victim = i;
+			victim_unused = unused;
+		}
+	}
+
+	LogDebug("Evicting cached layout of VG \"%.*s\".",
+		cache->entries[victim].layout->vg->id->length,
+		cache->entries[victim].layout->vg->id->content);
+
+	lvm2_layout_cache_remove(cache, victim);
+}
+
+LVM2_EXPORT int lvm2_layout_cache_insert(
+		struct lvm2_layout_cache *const cache,
+		const struct raw_locn *const locn,
+		struct lvm2_layout *const layout)
+{
+	const struct lvm2_bounded_string *const vg_id = layout->vg->id;
+
+	int err;
+	struct lvm2_layout_cache_entry *entry;
+
+	entry = lvm2_layout_cache_find_vg(cache, vg_id->content,
+		(size_t) vg_id->length);
+	if(entry) {
+		if(entry->layout->vg->seqno > layout->vg->seqno) {
+			LogDebug("Not caching layout of VG \"%.*s\" with "
+				"seqno %" FMTllu " (have %" FMTllu ").",
+				vg_id->length, vg_id->content,
+				ARGllu(layout->vg->seqno),
+				ARGllu(entry->layout->vg->seqno));
+			return 0;
+		}
+
+		/* Superseded, it's only kept alive by its other users. */
+		lvm2_layout_release(&entry->layout);
+	}
+	else {
+		if(cache->entries_len == LVM2_LAYOUT_CACHE_MAX_ENTRIES)
+			lvm2_layout_cache_evict(cache);
+
+		if(cache->entries_len == cache->entries_capacity) {
+			const size_t new_capacity =
+				cache->entries_capacity ?
+				cache->entries_capacity * 2 : 4;
+			struct lvm2_layout_cache_entry *new_entries;
+
+			err = lvm2_malloc(new_capacity *
+				sizeof(struct lvm2_layout_cache_entry),
+				(void**) &new_entries);
+			if(err) {
+				LogError("Error while allocating memory for "
+					"layout cache entries: %d", err);
+				return err;
+			}
+
+			if(cache->entries) {
+				memcpy(new_entries, cache->entries,
+					cache->entries_len *
+					sizeof(struct lvm2_layout_cache_entry));
+				lvm2_free((void**) &cache->entries,
+					cache->entries_capacity *
+					sizeof(struct lvm2_layout_cache_entry));
+			}
+
+			cache->entries = new_entries;
+			cache->entries_capacity = new_capacity;
+		}
+
+		entry = &cache->entries[cache->entries_len++];
+	}
+
+	entry->layout = lvm2_layout_retain(layout);
+	entry->text_size = le64_to_cpu(locn->size);
+	entry->text_checksum = le32_to_cpu(locn->checksum);
+	entry->last_used = ++cache->clock;
+
+	return 0;
+}
+
+LVM2_EXPORT void lvm2_layout_cache_trim(struct lvm2_layout_cache *const cache)
+{
+	size_t i = 0;
+
+	while(i < cache->entries_len) {
+		if(cache->entries[i].layout->refcount == 1)
+			lvm2_layout_cache_remove(cache, i);
+		else
+			++i;
+	}
+}
+
+LVM2_EXPORT void lvm2_layout_cache_get_stats(
+		const struct lvm2_layout_cache *const cache,
+		struct lvm2_layout_cache_stats *const out_stats)
+{
+	memset(out_stats, 0, sizeof(struct lvm2_layout_cache_stats));
+
+	out_stats->hits = cache->hits;
+	out_stats->misses = cache->misses;
+	out_stats->entries = cache->entries_len;
+}
+
+LVM2_EXPORT int lvm2_parse_device(struct lvm2_device *const dev,
+		lvm2_bool (*const volume_callback)(void *private_data,
+			u64 device_size, const char *volume_name,
+			u64 volume_start, u64 volume_length,
+			lvm2_bool is_incomplete),
+		void *const private_data)
+{
+	return lvm2_parse_device_cached(dev, NULL, volume_callback,
+		private_data);
+}
+
+LVM2_EXPORT int lvm2_parse_device_cached(struct lvm2_device *const dev,
+		struct lvm2_layout_cache *const cache,
+		const lvm2_volume_callback volume_callback,
+		void *const private_data)
+{
+	struct lvm2_parse_options options;
+
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	options.layout_cache = cache;
+
+	return lvm2_parse_device_ex(dev, &options, volume_callback,
+		private_data);
+}
+
+struct lvm2_scan_planner_entry {
+	u64 device_key;
+	u64 window_size;
+};
+
+struct lvm2_scan_planner {
+	u64 default_window_size;
+	size_t entries_len;
+	size_t next_victim;
+	struct lvm2_scan_planner_entry entries[LVM2_SCAN_PLANNER_MAX_DEVICES];
+};
+
+LVM2_EXPORT int lvm2_scan_planner_create(const u64 default_window_size,
+		struct lvm2_scan_planner **const out_planner)
+{
+	int err;
+	struct lvm2_scan_planner *planner;
+
+	err = lvm2_malloc(sizeof(struct lvm2_scan_planner), (void**) &planner);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_scan_planner: %d", err);
+		return err;
+	}
+
+	memset(planner, 0, sizeof(struct lvm2_scan_planner));
+	planner->default_window_size = default_window_size;
+
+	*out_planner = planner;
+
+	return 0;
+}
+
+LVM2_EXPORT void lvm2_scan_planner_destroy(
+		struct lvm2_scan_planner **const planner)
+{
+	lvm2_free((void**) planner, sizeof(struct lvm2_scan_planner));
+}
+
+static struct lvm2_scan_planner_entry* lvm2_scan_planner_find(
+		struct lvm2_scan_planner *const planner, const u64 device_key)
+{
+	size_t i;
+
+	for(i = 0; i < planner->entries_len; ++i) {
+		if(planner->entries[i].device_key == device_key)
+			return &planner->entries[i];
+	}
+
+	return NULL;
+}
+
+LVM2_EXPORT u64 lvm2_scan_planner_get_window(
+		struct lvm2_scan_planner *const planner, const u64 device_key)
+{
+	const struct lvm2_scan_planner_entry *entry = NULL;
+
+	if(device_key)
+		entry = lvm2_scan_planner_find(planner, device_key);
+
+	return entry ? entry->window_size : planner->default_window_size;
+}
+
+LVM2_EXPORT void lvm2_scan_planner_learn(
+		struct lvm2_scan_planner *const planner, const u64 device_key,
+		const u64 window_size)
+{
+	struct lvm2_scan_planner_entry *entry;
+
+	if(!device_key)
+		return;
+
+	entry = lvm2_scan_planner_find(planner, device_key);
+	if(!entry) {
+		if(planner->entries_len < LVM2_SCAN_PLANNER_MAX_DEVICES) {
+			entry = &planner->entries[planner->entries_len++];
+		}
+		else {
+			/* Full. Replace entries round-robin. */
+			entry = &planner->entries[planner->next_victim];
+			planner->next_victim = (planner->next_victim + 1) %
+				LVM2_SCAN_PLANNER_MAX_DEVICES;
+		}
+
+		entry->device_key = device_key;
+	}
+
+	entry->window_size = window_size;
+}
+
+/**
+ * Returns a pointer to the bytes [offset, offset + size) of the device if they
+ * lie within the speculatively read window, NULL otherwise. If the range would
+ * fit within LVM2_SCAN_WINDOW_MAX, it's recorded in '*needed_size' so that the
+ * planner can size the window to cover it next time.
+ */
+static const void* lvm2_scan_window_get(const void *const window,
+		const size_t window_size, const u64 offset, const u64 size,
+		u64 *const needed_size)
+{
+	if(offset > LVM2_SCAN_WINDOW_MAX ||
+		size > LVM2_SCAN_WINDOW_MAX - offset)
+	{
+		return NULL;
+	}
+
+	if(offset + size > *needed_size)
+		*needed_size = offset + size;
+
+	if(offset + size > window_size)
+		return NULL;
+
+	return &((const char*) window)[offset];
+}
+
+/**
+ * Take the caller's lock around a use of the layout cache, the planner or the
+ * layouts of the scan state.
+ */
+static void lvm2_scan_lock(const struct lvm2_parse_options *const options)
+{
+	if(options->lock)
+		options->lock(options->lock_context);
+}
+
+static void lvm2_scan_unlock(const struct lvm2_parse_options *const options)
+{
+	if(options->unlock)
+		options->unlock(options->lock_context);
+}
+
+/**
+ * Returns the size of the scan window of a device according to the planner.
+ */
+static size_t lvm2_scan_get_window_size(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const size_t label_window_size)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+
+	if(options->planner) {
+		u64 planned_size;
+
+		lvm2_scan_lock(options);
+		planned_size = lvm2_scan_planner_get_window(options->planner,
+			options->device_key);
+		lvm2_scan_unlock(options);
+
+		if(planned_size > label_window_size &&
+			planned_size <= LVM2_SCAN_WINDOW_MAX)
+		{
+			return (size_t) AlignSize(planned_size,
+				media_block_size);
+		}
+	}
+
+	return label_window_size;
+}
+
+/**
+ * Read the scan window of a device, sized according to the planner.
+ */
+static int lvm2_scan_read_window(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const size_t label_window_size,
+		struct lvm2_io_buffer **const out_window_buffer,
+		size_t *const out_window_size)
+{
+	int err;
+	struct lvm2_io_buffer *window_buffer = NULL;
+	size_t window_size = lvm2_scan_get_window_size(dev, options,
+		label_window_size);
+
+	/* Speculatively read the whole window in one request. If that fails,
+	 * e.g. because the device is smaller than the window, fall back to
+	 * reading only the label scan sectors. */
+	for(;;) {
+		LogDebug("Reading %" FMTzu " byte scan window.",
+			ARGzu(window_size));
+
+		err = lvm2_io_buffer_create(window_size, &window_buffer);
+		if(err) {
+			LogError("Error while allocating 'window_buffer' "
+				"(%" FMTzu " bytes).", ARGzu(window_size));
+			return err;
+		}
+
+		err = lvm2_device_read(dev, 0, window_size, window_buffer);
+		if(!err || window_size == label_window_size)
+			break;
+
+		LogDebug("Error %d while reading scan window. Retrying with "
+			"label scan sectors only.", err);
+		lvm2_io_buffer_destroy(&window_buffer);
+		window_size = label_window_size;
+	}
+
+	if(err) {
+		LogError("Error while reading label scan sectors.");
+		lvm2_io_buffer_destroy(&window_buffer);
+		return err;
+	}
+
+	*out_window_buffer = window_buffer;
+	*out_window_size = window_size;
+
+	return 0;
+}
+
+/**
+ * Returns a pointer to the bytes [offset, offset + size) of the device, either
+ * directly from the device if it's memory backed, or from the scan window.
+ * Returns NULL if neither has them.
+ */
+static const void* lvm2_scan_get_bytes(struct lvm2_device *const dev,
+		const void *const window, const size_t window_size,
+		const u64 offset, const u64 size, u64 *const needed_size)
+{
+	const void *bytes;
+
+	if(size <= SIZE_MAX &&
+		!lvm2_device_map_range(dev, offset, (size_t) size, &bytes))
+	{
+		return bytes;
+	}
+
+	return lvm2_scan_window_get(window, window_size, offset, size,
+		needed_size);
+}
+
+/**
+ * Get the mda_headers of the metadata areas of a PV, from memory where they are
+ * available and otherwise all in one vectored read. On return, have_mda[i] is
+ * true for each area whose mda_header is in out_mdas[i]. Failing to read
+ * isn't an error here, the caller reads the missing headers one at a time.
+ */
+static void lvm2_scan_get_mda_infos(struct lvm2_device *const dev,
+		const void *const window, const size_t window_size,
+		const struct lvm2_pv_info *const pv_info,
+		u64 *const needed_size,
+		struct lvm2_mda_info out_mdas[LVM2_PV_INFO_MAX_METADATA_AREAS],
+		lvm2_bool have_mda[LVM2_PV_INFO_MAX_METADATA_AREAS])
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+	const size_t buffer_size = (size_t) AlignSize(LVM_MDA_HEADER_SIZE,
+		media_block_size);
+
+	int err = 0;
+	struct lvm2_read_range ranges[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	size_t area_indices[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	size_t ranges_len = 0;
+	size_t i;
+
+	for(i = 0; i < pv_info->metadata_areas_len; ++i) {
+		const struct lvm2_disk_area *const area =
+			&pv_info->metadata_areas[i];
+		const void *bytes;
+
+		bytes = lvm2_scan_get_bytes(dev, window, window_size,
+			area->offset, LVM_MDA_HEADER_SIZE, needed_size);
+		if(bytes) {
+			lvm2_parse_mda_info(bytes, area, &out_mdas[i]);
+			have_mda[i] = LVM2_TRUE;
+			continue;
+		}
+
+		have_mda[i] = LVM2_FALSE;
+
+		err = lvm2_io_buffer_create(buffer_size,
+			&ranges[ranges_len].buf);
+		if(err) {
+			LogError("Error while allocating mda_header buffer "
+				"(%" FMTzu " bytes).", ARGzu(buffer_size));
+			break;
+		}
+
+		ranges[ranges_len].pos = area->offset;
+		ranges[ranges_len].count = buffer_size;
+		area_indices[ranges_len] = i;
+		++ranges_len;
+	}
+
+	if(!err && ranges_len) {
+		LogDebug("Reading %" FMTzu " mda_header(s) outside the scan "
+			"window.", ARGzu(ranges_len));
+
+		err = lvm2_device_readv(dev, ranges, ranges_len);
+		if(err) {
+			LogDebug("Error %d while reading mda_headers. Reading "
+				"them one at a time.", err);
+		}
+	}
+
+	for(i = 0; i < ranges_len; ++i) {
+		const size_t area_index = area_indices[i];
+
+		if(!err) {
+			lvm2_parse_mda_info(
+				lvm2_io_buffer_get_bytes(ranges[i].buf),
+				&pv_info->metadata_areas[area_index],
+				&out_mdas[area_index]);
+			have_mda[area_index] = LVM2_TRUE;
+		}
+
+		lvm2_io_buffer_destroy(&ranges[i].buf);
+	}
+}
+
+/** Ranges outside the scan window that a scan has asked to be read ahead. */
+struct lvm2_scan_hints {
+	size_t ranges_len;
+	struct {
+		u64 offset;
+		u64 size;
+	} ranges[2 * LVM2_PV_INFO_MAX_METADATA_AREAS];
+};
+
+/**
+ * Ask the device to read [offset, offset + size) ahead, if hints are enabled
+ * and the range isn't in the scan window.
+ */
+static void lvm2_scan_hint(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const size_t window_size, struct lvm2_scan_hints *const hints,
+		const u64 offset, const u64 size)
+{
+	const size_t max_ranges_len =
+		sizeof(hints->ranges) / sizeof(hints->ranges[0]);
+
+	if(!options->io_hints || hints->ranges_len == max_ranges_len ||
+		(offset <= window_size && size <= window_size - offset))
+	{
+		return;
+	}
+
+	lvm2_device_advise(dev, offset, size, LVM2_DEVICE_ADVICE_WILLNEED);
+
+	hints->ranges[hints->ranges_len].offset = offset;
+	hints->ranges[hints->ranges_len].size = size;
+	++hints->ranges_len;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_mda_info_same_text(
+		const struct lvm2_mda_info *const a,
+		const struct lvm2_mda_info *const b)
+{
+	return (a->locn.size == b->locn.size &&
+		a->locn.checksum == b->locn.checksum) ?
+		LVM2_TRUE : LVM2_FALSE;
+}
+
+/**
+ * Hint the metadata texts of all valid metadata areas whose mda_headers have
+ * been read, except the ones whose layouts are already cached and copies of
+ * texts that are hinted already, so that they are read ahead while the first
+ * one is parsed.
+ */
+static void lvm2_scan_hint_texts(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const size_t window_size, struct lvm2_scan_hints *const hints,
+		const struct lvm2_pv_info *const pv_info,
+		const struct lvm2_mda_info *const mda_infos,
+		const lvm2_bool *const have_mda)
+{
+	size_t i;
+
+	if(!options->io_hints)
+		return;
+
+	for(i = 0; i < pv_info->metadata_areas_len; ++i) {
+		const struct lvm2_disk_area *const area =
+			&pv_info->metadata_areas[i];
+		const struct lvm2_mda_info *const mda_info = &mda_infos[i];
+		u64 text_offset;
+		u64 text_size;
+		lvm2_bool cached = LVM2_FALSE;
+		size_t j;
+
+		if(!have_mda[i] || !mda_info->valid)
+			continue;
+
+		for(j = 0; j < i; ++j) {
+			if(have_mda[j] && mda_infos[j].valid &&
+				lvm2_mda_info_same_text(&mda_infos[j],
+				mda_info))
+			{
+				break;
+			}
+		}
+
+		if(j < i)
+			continue;
+
+		/* Bad locations are reported when the text is read. */
+		text_offset = le64_to_cpu(mda_info->locn.offset);
+		text_size = le64_to_cpu(mda_info->locn.size);
+		if(text_offset >= area->size ||
+			text_size > area->size - text_offset)
+		{
+			continue;
+		}
+
+		if(options->layout_cache) {
+			lvm2_scan_lock(options);
+			cached = lvm2_layout_cache_find_locn(
+				options->layout_cache, pv_info,
+				&mda_info->locn) ? LVM2_TRUE : LVM2_FALSE;
+			lvm2_scan_unlock(options);
+		}
+
+		if(cached)
+			continue;
+
+		lvm2_scan_hint(dev, options, window_size, hints,
+			area->offset + text_offset, text_size);
+	}
+}
+
+/** Drop the hinted ranges again, now that the PV has been parsed. */
+static void lvm2_scan_hints_release(struct lvm2_device *const dev,
+		const struct lvm2_scan_hints *const hints)
+{
+	size_t i;
+
+	for(i = 0; i < hints->ranges_len; ++i) {
+		lvm2_device_advise(dev, hints->ranges[i].offset,
+			hints->ranges[i].size, LVM2_DEVICE_ADVICE_DONTNEED);
+	}
+}
+
+/**
+ * Get the layout of the metadata text of one metadata area: from the layout
+ * cache if it's there, otherwise by parsing the text in memory or in the scan
+ * window if it's there, and otherwise by reading it from the device.
+ */
+static int lvm2_scan_read_layout(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const void *const window, const size_t window_size,
+		const struct lvm2_pv_info *const pv_info,
+		const struct lvm2_disk_area *const area,
+		const struct lvm2_mda_info *const mda_info,
+		u64 *const needed_size, struct lvm2_layout **const out_layout)
+{
+	int err;
+	const void *bytes;
+	struct lvm2_layout *layout = NULL;
+	const u64 text_offset = area->offset +
+		le64_to_cpu(mda_info->locn.offset);
+	const u64 text_size = le64_to_cpu(mda_info->locn.size);
+
+	if(options->layout_cache) {
+		lvm2_scan_lock(options);
+		layout = lvm2_layout_cache_lookup(options->layout_cache,
+			pv_info, &mda_info->locn);
+		lvm2_scan_unlock(options);
+		if(layout) {
+			LogDebug("Reusing cached layout.");
+			*out_layout = layout;
+			return 0;
+		}
+	}
+
+	err = lvm2_check_text_locn(area->size, &mda_info->locn);
+	if(err)
+		return err;
+
+	bytes = lvm2_scan_get_bytes(dev, window, window_size, text_offset,
+		text_size, needed_size);
+	if(bytes) {
+		err = lvm2_parse_checked_text((const char*) bytes,
+			(size_t) text_size, &mda_info->locn, &layout);
+	}
+	else {
+		err = lvm2_read_text(dev, area->offset, area->size,
+			&mda_info->locn, &layout);
+	}
+
+	if(err)
+		return err;
+
+	LogDebug("Successfully read LVM2 text.");
+
+	if(options->layout_cache) {
+		lvm2_scan_lock(options);
+		err = lvm2_layout_cache_insert(options->layout_cache,
+			&mda_info->locn, layout);
+		lvm2_scan_unlock(options);
+
+		/* Not fatal, we just won't share it. */
+		if(err)
+			LogError("Error while caching layout.");
+	}
+
+	*out_layout = layout;
+
+	return 0;
+}
+
+LVM2_EXPORT int lvm2_parse_device_ex(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const lvm2_volume_callback volume_callback,
+		void *const private_data)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+	const size_t label_window_size = (size_t) AlignSize(
+		LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE, media_block_size);
+
+	struct lvm2_scan_state *const state = options->scan_state;
+
+	int err;
+	struct lvm2_io_buffer *window_buffer = NULL;
+	const void *window;
+	size_t window_size = label_window_size;
+	u64 needed_size = label_window_size;
+	struct lvm2_pv_info pv_info;
+	struct lvm2_mda_info mda_infos[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool have_mda[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool parsed[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	struct lvm2_scan_hints hints;
+	struct lvm2_layout *best_layout = NULL;
+	size_t best_index = 0;
+	int mda_err = 0;
+	size_t i;
+
+	LogDebug("%s: Entering with dev=%p options=%p.", __FUNCTION__, dev,
+		options);
+
+	hints.ranges_len = 0;
+	memset(parsed, 0, sizeof(parsed));
+
+	if(state) {
+		lvm2_scan_lock(options);
+		lvm2_scan_state_release(state);
+		lvm2_scan_unlock(options);
+	}
+
+	if(media_block_size > SIZE_MAX) {
+		LogError("Unrealistic media block size: %" FMTllu,
+			ARGllu(media_block_size));
+		return EINVAL;
+	}
+
+	if(!lvm2_device_map_range(dev, 0, label_window_size, &window)) {
+		LogDebug("Device is memory backed, parsing in place.");
+	}
+	else if(options->window_buffer &&
+		options->window_size >= label_window_size)
+	{
+		window_buffer = options->window_buffer;
+		window_size = options->window_size;
+	}
+	else {
+		err = lvm2_scan_read_window(dev, options, label_window_size,
+			&window_buffer, &window_size);
+		if(err)
+			goto out;
+	}
+
+	if(window_buffer)
+		window = lvm2_io_buffer_get_bytes(window_buffer);
+
+	err = lvm2_parse_pv_info(window, window_size, &pv_info);
+	if(err)
+		goto out;
+
+	if(state) {
+		state->pv_info = pv_info;
+		state->label_checksum = lvm2_calc_crc(LVM_INITIAL_CRC,
+			(const char*) window +
+			pv_info.label_sector * LVM_SECTOR_SIZE,
+			LVM_SECTOR_SIZE);
+	}
 
-			if(ptrDiff > buffer_size) {
-				LogError("Data areas overflow into the next "
-					"sector (index %" FMTzu ").",
-					ARGzu(disk_areas_idx));
-				goto out_err;
+	for(i = 0; i < pv_info.metadata_areas_len; ++i) {
+		lvm2_scan_hint(dev, options, window_size, &hints,
+			pv_info.metadata_areas[i].offset, LVM_MDA_HEADER_SIZE);
+	}
+
+	lvm2_scan_get_mda_infos(dev, window, window_size, &pv_info,
+		&needed_size, mda_infos, have_mda);
+
+	lvm2_scan_hint_texts(dev, options, window_size, &hints, &pv_info,
+		mda_infos, have_mda);
+
+	/* Get all mda_headers before parsing any text, so that the copies can
+	 * be compared. An area whose mda_header can't be read is skipped, the
+	 * other copies may still be fine. */
+	for(i = 0; i < pv_info.metadata_areas_len; ++i) {
+		if(!have_mda[i]) {
+			err = lvm2_read_mda_info(dev, &pv_info.metadata_areas[i],
+				&mda_infos[i]);
+			if(err) {
+				LogError("Error while reading mda_header of "
+					"metadata area %" FMTzu ": %d",
+					ARGzu(i), err);
+				mda_err = err;
+				continue;
 			}
 
-			++disk_areas_idx;
+			have_mda[i] = LVM2_TRUE;
 		}
-		dataAreasLength = disk_areas_idx;
-		++disk_areas_idx;
-		while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0) {
-			const uintptr_t ptrDiff = (uintptr_t)
-				&pvHeader->disk_areas_xl[disk_areas_idx] -
-				(uintptr_t) sectorBytes;
-
-			if(ptrDiff > buffer_size) {
-				LogError("Metadata areas overflow into the "
-					"next sector (index %" FMTzu ").",
-					ARGzu(disk_areas_idx));
-				goto out_err;
+
+		if(state)
+			state->mda_infos[i] = mda_infos[i];
+	}
+
+	/* Parse one copy of each distinct metadata text and keep the layout
+	 * with the highest seqno, so that the volumes are reported once. While
+	 * the copies are in sync there is only one text, and the copies after
+	 * the first are only read if the ones before them can't be read or
+	 * fail their checksum. */
+	for(i = 0; i < pv_info.metadata_areas_len; ++i) {
+		struct lvm2_layout *layout = NULL;
+		size_t j;
+
+		if(!have_mda[i] || !mda_infos[i].valid)
+			continue;
+
+		for(j = 0; j < i; ++j) {
+			if(parsed[j] && lvm2_mda_info_same_text(&mda_infos[j],
+				&mda_infos[i]))
+			{
+				break;
 			}
+		}
 
-			++disk_areas_idx;
+		if(j < i) {
+			LogDebug("Metadata area %" FMTzu " holds a copy of the "
+				"text of area %" FMTzu ", skipping.",
+				ARGzu(i), ARGzu(j));
+			continue;
 		}
-		metadataAreasLength = disk_areas_idx - (dataAreasLength + 1);
 
-		if(dataAreasLength != metadataAreasLength) {
-			LogError("Size mismatch between PV data and metadata "
-				"areas (%" FMTzu " != %" FMTzu ").",
-				ARGzu(dataAreasLength),
-				ARGzu(metadataAreasLength));
-			goto out_err;
+		err = lvm2_scan_read_layout(dev, options, window, window_size,
+			&pv_info, &pv_info.metadata_areas[i], &mda_infos[i],
+			&needed_size, &layout);
+		if(err) {
+			LogDebug("Error while reading LVM2 text of metadata "
+				"area %" FMTzu ": %d", ARGzu(i), err);
+			continue;
 		}
 
-#if defined(DEBUG)
-		LogDebug("\tpvHeader = {");
-		LogDebug("\t\tpv_uuid = '%.*s'", LVM_ID_LEN, pvHeader->pv_uuid);
-		LogDebug("\t\tdevice_size_xl = %" FMTllu,
-			ARGllu(le64_to_cpu(pvHeader->device_size_xl)));
-		LogDebug("\t\tdisk_areas_xl = {");
-		LogDebug("\t\t\tdata_areas = {");
-		disk_areas_idx = 0;
-		while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0 &&
-			disk_areas_idx < dataAreasLength)
+		parsed[i] = LVM2_TRUE;
+
+		if(best_layout && layout->vg->seqno <= best_layout->vg->seqno) {
+			lvm2_scan_lock(options);
+			lvm2_layout_release(&layout);
+			lvm2_scan_unlock(options);
+			continue;
+		}
+
+		if(best_layout) {
+			LogDebug("Metadata area %" FMTzu " is newer than area "
+				"%" FMTzu " (seqno %" FMTllu " > %" FMTllu ").",
+				ARGzu(i), ARGzu(best_index),
+				ARGllu(layout->vg->seqno),
+				ARGllu(best_layout->vg->seqno));
+			lvm2_scan_lock(options);
+			lvm2_layout_release(&best_layout);
+			lvm2_scan_unlock(options);
+		}
+
+		best_layout = layout;
+		best_index = i;
+	}
+
+	err = 0;
+	if(best_layout) {
+		lvm2_layout_report_volumes(best_layout, &pv_info,
+			volume_callback, private_data);
+
+		if(state) {
+			state->layouts[best_index] = best_layout;
+		}
+		else {
+			lvm2_scan_lock(options);
+			lvm2_layout_release(&best_layout);
+			lvm2_scan_unlock(options);
+		}
+	}
+	else if(mda_err) {
+		err = mda_err;
+	}
+
+	/* Only a scan that got all mda_headers can be repeated from the
+	 * state. */
+	if(state && !mda_err)
+		state->valid = LVM2_TRUE;
+out:
+	lvm2_scan_hints_release(dev, &hints);
+
+	/* Remember how much of the device this scan needed (just the label
+	 * scan sectors if there was no label). */
+	if(options->planner) {
+		lvm2_scan_lock(options);
+		lvm2_scan_planner_learn(options->planner, options->device_key,
+			AlignSize(needed_size, media_block_size));
+		lvm2_scan_unlock(options);
+	}
+
+	if(window_buffer && window_buffer != options->window_buffer)
+		lvm2_io_buffer_destroy(&window_buffer);
+
+	return err;
+}
+
+LVM2_EXPORT void lvm2_scan_state_release(struct lvm2_scan_state *const state)
+{
+	size_t i;
+
+	for(i = 0; i < LVM2_PV_INFO_MAX_METADATA_AREAS; ++i) {
+		if(state->layouts[i])
+			lvm2_layout_release(&state->layouts[i]);
+	}
+
+	memset(state, 0, sizeof(struct lvm2_scan_state));
+}
+
+/**
+ * Check whether the label and mda_headers of a device still match 'state'. The
+ * label sector is read together with the first mda_header when that lies near
+ * the start of the device (as it does on PVs created by LVM), so that an
+ * unchanged PV with one metadata area costs a single read.
+ */
+static lvm2_bool lvm2_rescan_is_unchanged(struct lvm2_device *const dev,
+		const struct lvm2_scan_state *const state)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+	const struct lvm2_pv_info *const pv_info = &state->pv_info;
+	const u64 label_offset = (u64) pv_info->label_sector * LVM_SECTOR_SIZE;
+
+	int err;
+	struct lvm2_io_buffer *window_buffer = NULL;
+	const void *window;
+	size_t window_size;
+	u64 needed_size = 0;
+	struct lvm2_mda_info mda_infos[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool have_mda[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool unchanged = LVM2_FALSE;
+	size_t i;
+
+	window_size = (size_t) AlignSize(label_offset + LVM_SECTOR_SIZE,
+		media_block_size);
+	if(pv_info->metadata_areas_len &&
+		pv_info->metadata_areas[0].offset <=
+		LVM2_SCAN_WINDOW_DEFAULT - LVM_MDA_HEADER_SIZE)
+	{
+		window_size = (size_t) AlignSize(
+			pv_info->metadata_areas[0].offset +
+			LVM_MDA_HEADER_SIZE, media_block_size);
+	}
+
+	if(lvm2_device_map_range(dev, 0, window_size, &window)) {
+		err = lvm2_io_buffer_create(window_size, &window_buffer);
+		if(err) {
+			LogError("Error while allocating rescan window "
+				"(%" FMTzu " bytes).", ARGzu(window_size));
+			return LVM2_FALSE;
+		}
+
+		err = lvm2_device_read(dev, 0, window_size, window_buffer);
+		if(err) {
+			LogDebug("Error while reading rescan window: %d", err);
+			goto out;
+		}
+
+		window = lvm2_io_buffer_get_bytes(window_buffer);
+	}
+
+	if(lvm2_calc_crc(LVM_INITIAL_CRC, (const char*) window + label_offset,
+		LVM_SECTOR_SIZE) != state->label_checksum)
+	{
+		LogDebug("Label sector has changed.");
+		goto out;
+	}
+
+	lvm2_scan_get_mda_infos(dev, window, window_size, pv_info,
+		&needed_size, mda_infos, have_mda);
+
+	for(i = 0; i < pv_info->metadata_areas_len; ++i) {
+		const struct lvm2_mda_info *const old_info =
+			&state->mda_infos[i];
+
+		if(!have_mda[i] && lvm2_read_mda_info(dev,
+			&pv_info->metadata_areas[i], &mda_infos[i]))
 		{
-			LogDebug("\t\t\t\t{");
-			LogDebug("\t\t\t\t\toffset = %" FMTllu,
-				ARGllu(le64_to_cpu(pvHeader->
-				disk_areas_xl[disk_areas_idx].offset)));
-			LogDebug("\t\t\t\t\tsize = %" FMTllu,
-				ARGllu(le64_to_cpu(pvHeader->
-				disk_areas_xl[disk_areas_idx].size)));
-			LogDebug("\t\t\t\t}");
-
-			++disk_areas_idx;
-		}
-		LogDebug("\t\t\t}");
-		++disk_areas_idx;
-		LogDebug("\t\t\tmetadata_areas = {");
-		while(pvHeader->disk_areas_xl[disk_areas_idx].offset != 0 &&
-			disk_areas_idx < (dataAreasLength + 1 +
-			metadataAreasLength))
+			goto out;
+		}
+
+		if(mda_infos[i].valid != old_info->valid ||
+			(old_info->valid &&
+			(mda_infos[i].checksum != old_info->checksum ||
+			memcmp(&mda_infos[i].locn, &old_info->locn,
+			sizeof(struct raw_locn)))))
 		{
-			LogDebug("\t\t\t\t{");
-			LogDebug("\t\t\t\t\toffset = %" FMTllu,
-				ARGllu(le64_to_cpu(pvHeader->
-				disk_areas_xl[disk_areas_idx].offset)));
-			LogDebug("\t\t\t\t\tsize = %" FMTllu,
-				ARGllu(le64_to_cpu(pvHeader->
-				disk_areas_xl[disk_areas_idx].size)));
-			LogDebug("\t\t\t\t}");
-
-			++disk_areas_idx;
-		}
-		LogDebug("\t\t\t}");
-		LogDebug("\t\t}");
-		LogDebug("\t}");
-#endif /* defined(DEBUG) */
+			LogDebug("mda_header %" FMTzu " has changed.",
+				ARGzu(i));
+			goto out;
+		}
+	}
+
+	unchanged = LVM2_TRUE;
+out:
+	if(window_buffer)
+		lvm2_io_buffer_destroy(&window_buffer);
+
+	return unchanged;
+}
+
+LVM2_EXPORT int lvm2_rescan_device(struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const lvm2_volume_callback volume_callback,
+		void *const private_data)
+{
+	struct lvm2_scan_state *const state = options->scan_state;
+
+	size_t i;
+
+	LogDebug("%s: Entering with dev=%p options=%p.", __FUNCTION__, dev,
+		options);
+
+	if(!state || !state->valid ||
+		lvm2_device_get_alignment(dev) > LVM2_SCAN_WINDOW_DEFAULT ||
+		!lvm2_rescan_is_unchanged(dev, state))
+	{
+		return lvm2_parse_device_ex(dev, options, volume_callback,
+			private_data);
+	}
 
-		deviceSize = le64_to_cpu(pvHeader->device_size_xl);
-		for(disk_areas_idx = 0; !manual_break &&
-			pvHeader->disk_areas_xl[disk_areas_idx].offset != 0;
-			++disk_areas_idx)
+	LogDebug("Metadata unchanged, reporting volumes of the last scan.");
+
+	for(i = 0; i < state->pv_info.metadata_areas_len; ++i) {
+		if(state->layouts[i] &&
+			!lvm2_layout_report_volumes(state->layouts[i],
+			&state->pv_info, volume_callback, private_data))
 		{
-			const struct disk_locn *locn;
-			const struct disk_locn *meta_locn;
-			u64 meta_offset;
-			u64 meta_size;
-
-			const struct mda_header *mdaHeader;
-			u32 mda_checksum;
-			u32 mda_version;
-			u64 mda_start;
-			u64 mda_size;
-
-			u32 mda_calculated_checksum;
-
-			if(disk_areas_idx >= dataAreasLength) {
-				LogError("Overflow when iterating through disk "
-					"areas (%" FMTzu " >= %" FMTzu ").",
-					ARGzu(disk_areas_idx),
-					ARGzu(dataAreasLength));
-				goto out_err;
-			}
+			break;
+		}
+	}
 
-			locn = &pvHeader->disk_areas_xl[disk_areas_idx];
-			meta_locn = &pvHeader->disk_areas_xl[dataAreasLength +
-				1 + disk_areas_idx];
+	return 0;
+}
 
-			meta_offset = le64_to_cpu(meta_locn->offset);
-			meta_size = le64_to_cpu(meta_locn->size);
+/**
+ * Returns how much of the start of the device (aligned or not) a scan needs in
+ * memory to parse the PV without further reads, as far as can be told from
+ * 'window'. If the mda_headers aren't in the window, the answer only covers
+ * the headers and has to be asked again once they have been read.
+ */
+static u64 lvm2_scan_get_needed_size(const void *const window,
+		const size_t window_size,
+		struct lvm2_layout_cache *const layout_cache)
+{
+	u64 needed_size = window_size;
+	struct lvm2_pv_info pv_info;
+	size_t i;
 
-			err = lvm2_device_read(dev, meta_offset,
-				secondary_buffer_size, secondary_buffer);
-			if(err) {
-				LogError("Error while reading first metadata "
-					"sector of PV number %" FMTlu " "
-					"(offset %" FMTzu " bytes): %d",
-					ARGlu(disk_areas_idx),
-					ARGzu(meta_offset), err);
-				goto out_err;
-			}
+	if(lvm2_parse_pv_info(window, window_size, &pv_info))
+		return needed_size;
 
-			mdaHeader = (const struct mda_header*)
-				lvm2_io_buffer_get_bytes(secondary_buffer);
+	for(i = 0; i < pv_info.metadata_areas_len; ++i) {
+		const struct lvm2_disk_area *const area =
+			&pv_info.metadata_areas[i];
 
-#if defined(DEBUG)
-			LogDebug("mdaHeader[%" FMTlu "] = {",
-				ARGlu(disk_areas_idx));
-			LogDebug("\tchecksum_xl = 0x%08" FMTlX,
-				ARGlX(le32_to_cpu(mdaHeader->checksum_xl)));
-			LogDebug("\tmagic = '%.*s'", 16, mdaHeader->magic);
-			LogDebug("\tversion = %" FMTlu,
-				ARGlu(le32_to_cpu(mdaHeader->version)));
-			LogDebug("\tstart = %" FMTllu,
-				ARGllu(le64_to_cpu(mdaHeader->start)));
-			LogDebug("\tsize = %" FMTllu,
-				ARGllu(le64_to_cpu(mdaHeader->size)));
-			LogDebug("\traw_locns = {");
-			{
-				size_t raw_locns_idx = 0;
+		const void *bytes;
+		struct lvm2_mda_info mda_info;
+		lvm2_bool cached = LVM2_FALSE;
 
-				while(memcmp(&null_raw_locn,
-					&mdaHeader->raw_locns[raw_locns_idx],
-					sizeof(struct raw_locn)) != 0)
-				{
-					const struct raw_locn *const cur_locn =
-						&mdaHeader->
-						raw_locns[raw_locns_idx];
-
-					LogDebug("\t\t[%" FMTllu "] = {",
-						ARGllu(raw_locns_idx));
-					LogDebug("\t\t\toffset = %" FMTllu,
-						ARGllu(le64_to_cpu(
-						cur_locn->offset)));
-					LogDebug("\t\t\tsize = %" FMTllu,
-						ARGllu(le64_to_cpu(
-						cur_locn->size)));
-					LogDebug("\t\t\tchecksum = 0x%08" FMTlX,
-						ARGlX(le32_to_cpu(
-						cur_locn->checksum)));
-					LogDebug("\t\t\tfiller = %" FMTlu,
-						ARGlu(le32_to_cpu(
-						cur_locn->filler)));
-					LogDebug("\t\t}");
-
-					++raw_locns_idx;
-				}
-			}
-			LogDebug("\t}");
-			LogDebug("}");
-#endif /* defined(DEBUG) */
+		bytes = lvm2_scan_window_get(window, window_size, area->offset,
+			LVM_MDA_HEADER_SIZE, &needed_size);
+		if(!bytes)
+			continue;
 
-			mda_checksum = le32_to_cpu(mdaHeader->checksum_xl);
-			mda_version = le32_to_cpu(mdaHeader->version);
-			mda_start = le64_to_cpu(mdaHeader->start);
-			mda_size = le64_to_cpu(mdaHeader->size);
-
-			mda_calculated_checksum = lvm2_calc_crc(LVM_INITIAL_CRC,
-				mdaHeader->magic, LVM_MDA_HEADER_SIZE -
-				offsetof(struct mda_header, magic));
-			if(mda_calculated_checksum != mda_checksum) {
-				LogError("mda_header checksum mismatch "
-					"(calculated: 0x%" FMTlX " expected: "
-					"0x%" FMTlX ").",
-					ARGlX(mda_calculated_checksum),
-					ARGlX(mda_checksum));
-				continue;
-			}
+		lvm2_parse_mda_info(bytes, area, &mda_info);
+		if(!mda_info.valid ||
+			lvm2_check_text_locn(area->size, &mda_info.locn))
+		{
+			continue;
+		}
 
-			if(mda_version != 1) {
-				LogError("Unsupported mda_version: %" FMTlu,
-					ARGlu(mda_version));
-				continue;
-			}
+		/* No need for the text if its layout is cached. Looked up
+		 * without lvm2_layout_cache_lookup so that the cache
+		 * statistics aren't affected. */
+		if(layout_cache && lvm2_layout_cache_find_locn(layout_cache,
+			&pv_info, &mda_info.locn))
+		{
+			cached = LVM2_TRUE;
+		}
 
-			if(mda_start != meta_offset) {
-				LogError("mda_start does not match metadata "
-					"offset (%" FMTllu " != %" FMTllu ").",
-					ARGllu(mda_start), ARGllu(meta_offset));
-				continue;
-			}
+		if(!cached) {
+			lvm2_scan_window_get(window, window_size,
+				area->offset + le64_to_cpu(mda_info.locn.offset),
+				le64_to_cpu(mda_info.locn.size), &needed_size);
+		}
+	}
 
-			if(mda_size != meta_size) {
-				LogError("mda_size does not match metadata "
-					"size (%" FMTllu " != %" FMTllu ").",
-					ARGllu(mda_size), ARGllu(meta_size));
-				continue;
-			}
+	return needed_size;
+}
 
-			if(memcmp(&mdaHeader->raw_locns[0], &null_raw_locn,
-				sizeof(struct raw_locn)) == 0)
-			{
-				LogError("Missing first raw_locn.");
-				continue;
-			}
-			else if(memcmp(&mdaHeader->raw_locns[1], &null_raw_locn,
-				sizeof(struct raw_locn)) != 0)
-			{
-				LogError("Found more than one raw_locn "
-					"(currently unsupported).");
-				continue;
-			}
+/** Maximum number of reads that an asynchronous scan issues. */
+#define LVM2_SCAN_ASYNC_MAX_READS 3
 
-			err = lvm2_read_text(dev, meta_offset, meta_size,
-				&mdaHeader->raw_locns[0], &layout);
-			if(err) {
-				LogDebug("Error while reading LVM2 text: %d",
-					err);
-				continue;
-			}
+/**
+ * State of an asynchronous scan. A scan reads a window at the start of the
+ * device and, when the window turns out not to hold everything that the PV
+ * needs, reads a larger one, until it can be parsed in memory.
+ */
+struct lvm2_scan_async {
+	struct lvm2_io_queue *queue;
+	struct lvm2_device *dev;
+	struct lvm2_parse_options options;
+	lvm2_volume_callback volume_callback;
+	lvm2_scan_done_callback done_callback;
+	void *private_data;
+
+	size_t label_window_size;
+	struct lvm2_io_buffer *window_buffer;
+	size_t window_size;
+	unsigned int reads;
+};
 
-			LogDebug("Successfully read LVM2 text.");
+static void lvm2_scan_async_read_done(void *context, int err);
 
-			{
-				size_t j;
-				const struct lvm2_physical_volume *match = NULL;
+static void lvm2_scan_async_finish(struct lvm2_scan_async *scan, const int err)
+{
+	const lvm2_scan_done_callback done_callback = scan->done_callback;
+	void *const private_data = scan->private_data;
 
-				for(j = 0; j < layout->vg->physical_volumes_len;
-					++j)
-				{
-					const char *const our_uuid =
-						(char*) pvHeader->pv_uuid;
-					const struct lvm2_physical_volume *const
-						pv =
-						layout->vg->physical_volumes[j];
-
-					if(pv->id->length != 38) {
-						LogError("Invalid id length %d",
-							pv->id->length);
-						continue;
-					}
+	if(scan->window_buffer)
+		lvm2_io_buffer_destroy(&scan->window_buffer);
 
-					if(!strncmp(&pv->id->content[0],
-						&our_uuid[0], 6) &&
-						pv->id->content[6] == '-' &&
-						!strncmp(&pv->id->content[7],
-						&our_uuid[6], 4) &&
-						pv->id->content[11] == '-' &&
-						!strncmp(&pv->id->content[12],
-						&our_uuid[10], 4) &&
-						pv->id->content[16] == '-' &&
-						!strncmp(&pv->id->content[17],
-						&our_uuid[14], 4) &&
-						pv->id->content[21] == '-' &&
-						!strncmp(&pv->id->content[22],
-						&our_uuid[18], 4) &&
-						pv->id->content[26] == '-' &&
-						!strncmp(&pv->id->content[27],
-						&our_uuid[22], 4) &&
-						pv->id->content[31] == '-' &&
-						!strncmp(&pv->id->content[32],
-						&our_uuid[26], 6))
-					{
-						LogDebug("Found physical "
-							"volume: '%.*s'",
-							pv->name->length,
-							pv->name->content);
-						match = pv;
-						break;
-					}
-				}
+	lvm2_free((void**) &scan, sizeof(struct lvm2_scan_async));
 
-				if(!match) {
-					LogError("No physical volume match "
-						"found in LVM2 database.");
-				}
-				else for(j = 0;
-					j < layout->vg->logical_volumes_len;
-					++j)
-				{
-					const struct lvm2_logical_volume *const
-						lv =
-						layout->vg->logical_volumes[j];
-					u64 partitionStart;
-					u64 partitionLength;
-					lvm2_bool is_incomplete = LVM2_FALSE;
-					struct lvm2_segment *segment_match =
-						NULL;
-					struct lvm2_pv_location *pv_match =
-						NULL;
-
-					if(lv->segment_count != 1) {
-						LogError("More than one "
-							"segment in logical "
-							"volume \"%.*s\". "
-							"Marking as "
-							"incomplete.",
-							lv->name->length,
-							lv->name->content);
-
-						is_incomplete = LVM2_TRUE;
-					}
+	done_callback(private_data, err);
+}
 
-					/* Search for our PV among the LV's
-					 * segments and stripes. */
-					LogDebug("Searching for physical "
-						"volume \"%.*s\" in logical "
-						"volume's descriptors...",
-						match->name->length,
-						match->name->content);
-					if(!lvm2_parse_device_find_pv_location(
-						lv, match, &segment_match,
-						&pv_match, &is_incomplete))
-					{
-						LogError("Physical volume "
-							"\"%.*s\" not found in "
-							"logical volume's "
-							"descriptors. Skipping "
-							"logical volume "
-							"\"%.*s\"...",
-							match->name->length,
-							match->name->content,
-							lv->name->length,
-							lv->name->content);
-						continue;
-					}
+/**
+ * Start reading a window of 'window_size' bytes.
+ */
+static int lvm2_scan_async_read(struct lvm2_scan_async *const scan,
+		const size_t window_size)
+{
+	int err;
 
-					partitionStart = (match->pe_start +
-						pv_match->extent_start *
-						layout->vg->extent_size) *
-						media_block_size /* 512? */;
-					LogDebug("partitionStart: %" FMTllu,
-						ARGllu(partitionStart));
-
-					partitionLength =
-						segment_match->extent_count *
-						layout->vg->extent_size *
-						media_block_size /* 512? */;
-
-					LogDebug("partitionLength: %" FMTllu,
-						ARGllu(partitionLength));
-
-					if(!volume_callback(private_data,
-						deviceSize, lv->name->content,
-						partitionStart,
-						partitionLength,
-						is_incomplete))
-					{
-						manual_break = LVM2_TRUE;
-						break;
-					}
-				}
+	if(scan->window_buffer)
+		lvm2_io_buffer_destroy(&scan->window_buffer);
 
-				lvm2_layout_destroy(&layout);
-			}
-		}
+	LogDebug("Reading %" FMTzu " byte scan window asynchronously.",
+		ARGzu(window_size));
+
+	err = lvm2_io_buffer_create(window_size, &scan->window_buffer);
+	if(err) {
+		LogError("Error while allocating 'window_buffer' "
+			"(%" FMTzu " bytes).", ARGzu(window_size));
+		return err;
 	}
 
-cleanup:
-	/* Release our resources. */
+	scan->window_size = window_size;
+	++scan->reads;
 
-	if(secondary_buffer)
-		lvm2_io_buffer_destroy(&secondary_buffer);
-	if(buffer)
-		lvm2_io_buffer_destroy(&buffer);
+	err = lvm2_device_read_async(scan->queue, scan->dev, 0, window_size,
+		scan->window_buffer, lvm2_scan_async_read_done, scan);
+	if(err)
+		lvm2_io_buffer_destroy(&scan->window_buffer);
 
 	return err;
-out_err:
-	if(!err)
-		err = EIO;
+}
 
-	goto cleanup;
+static void lvm2_scan_async_read_done(void *const context, int err)
+{
+	struct lvm2_scan_async *const scan = (struct lvm2_scan_async*) context;
+	const u64 media_block_size = lvm2_device_get_alignment(scan->dev);
+
+	if(err) {
+		/* As in lvm2_scan_read_window, e.g. a device smaller than the
+		 * window. Retry with the label scan sectors only. */
+		if(scan->window_size != scan->label_window_size) {
+			LogDebug("Error %d while reading scan window. Retrying "
+				"with label scan sectors only.", err);
+			err = lvm2_scan_async_read(scan,
+				scan->label_window_size);
+			if(!err)
+				return;
+		}
+
+		LogError("Error while reading label scan sectors.");
+		lvm2_scan_async_finish(scan, err);
+		return;
+	}
+
+	if(scan->reads < LVM2_SCAN_ASYNC_MAX_READS) {
+		u64 needed_size;
+
+		lvm2_scan_lock(&scan->options);
+		needed_size = lvm2_scan_get_needed_size(
+			lvm2_io_buffer_get_bytes(scan->window_buffer),
+			scan->window_size, scan->options.layout_cache);
+		lvm2_scan_unlock(&scan->options);
+
+		if(needed_size > scan->window_size &&
+			needed_size <= LVM2_SCAN_WINDOW_MAX)
+		{
+			err = lvm2_scan_async_read(scan,
+				(size_t) AlignSize(needed_size,
+				media_block_size));
+			if(!err)
+				return;
+
+			lvm2_scan_async_finish(scan, err);
+			return;
+		}
+	}
+
+	/* Everything we can read up front is in the window. Anything beyond
+	 * LVM2_SCAN_WINDOW_MAX is read synchronously while parsing. */
+	scan->options.window_buffer = scan->window_buffer;
+	scan->options.window_size = scan->window_size;
+
+	err = lvm2_parse_device_ex(scan->dev, &scan->options,
+		scan->volume_callback, scan->private_data);
+
+	lvm2_scan_async_finish(scan, err);
+}
+
+LVM2_EXPORT int lvm2_parse_device_async(struct lvm2_io_queue *const queue,
+		struct lvm2_device *const dev,
+		const struct lvm2_parse_options *const options,
+		const lvm2_volume_callback volume_callback,
+		const lvm2_scan_done_callback done_callback,
+		void *const private_data)
+{
+	const u64 media_block_size = lvm2_device_get_alignment(dev);
+	const size_t label_window_size = (size_t) AlignSize(
+		LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE, media_block_size);
+
+	int err;
+	const void *mapped;
+	struct lvm2_scan_async *scan = NULL;
+
+	if(media_block_size > SIZE_MAX) {
+		LogError("Unrealistic media block size: %" FMTllu,
+			ARGllu(media_block_size));
+		return EINVAL;
+	}
+
+	if(!lvm2_device_map_range(dev, 0, label_window_size, &mapped)) {
+		/* Memory backed, there is nothing to wait for. */
+		err = lvm2_parse_device_ex(dev, options, volume_callback,
+			private_data);
+		done_callback(private_data, err);
+		return 0;
+	}
+
+	err = lvm2_malloc(sizeof(struct lvm2_scan_async), (void**) &scan);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_scan_async: %d", err);
+		return err;
+	}
+
+	memset(scan, 0, sizeof(struct lvm2_scan_async));
+	scan->queue = queue;
+	scan->dev = dev;
+	scan->options = *options;
+	scan->options.window_buffer = NULL;
+	scan->options.window_size = 0;
+	scan->volume_callback = volume_callback;
+	scan->done_callback = done_callback;
+	scan->private_data = private_data;
+	scan->label_window_size = label_window_size;
+
+	err = lvm2_scan_async_read(scan, lvm2_scan_get_window_size(dev,
+		options, label_window_size));
+	if(err)
+		lvm2_free((void**) &scan, sizeof(struct lvm2_scan_async));
+
+	return err;
 }
 
 LVM2_EXPORT lvm2_bool lvm2_check_layout()
@@ -0,0 +1,718 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_vg_assembler.h"
+#include "lvm2_osal.h"
+
+#include <string.h>
+
+#include <sys/errno.h>
+
+#define LVM2_VG_ASSEMBLER_INITIAL_BUCKETS 64
+
+/** Bucket of the table of added PVs, keyed by the UUID of the pv_header. */
+struct lvm2_vg_assembler_pv_bucket {
+	lvm2_bool used;
+	char pv_uuid[LVM_ID_LEN];
+};
+
+/** Bucket of the table mapping PV names of a layout to their index. */
+struct lvm2_vg_assembler_name_bucket {
+	const struct lvm2_bounded_string *name;	/**< NULL if unused. */
+	size_t pv_index;
+};
+
+struct lvm2_vg_assembler_vg {
+	struct lvm2_layout *layout;
+
+	/**
+	 * Presence of each PV of the layout, NULL until it's needed. Valid
+	 * while the assembler holds 'present_pvs_generation' PVs.
+	 */
+	u8 *pv_present;
+	size_t present_pvs_generation;
+	size_t present_pvs_len;
+
+	/** PV name to index table of the layout, NULL until it's needed. */
+	size_t name_buckets_len;
+	struct lvm2_vg_assembler_name_bucket *name_buckets;
+};
+
+struct lvm2_vg_assembler {
+	size_t pv_buckets_len;
+	size_t pvs_len;
+	struct lvm2_vg_assembler_pv_bucket *pv_buckets;
+
+	/** VG index + 1 per bucket, keyed by the VG id. 0 if unused. */
+	size_t vg_buckets_len;
+	size_t *vg_buckets;
+
+	size_t vgs_len;
+	size_t vgs_capacity;
+	struct lvm2_vg_assembler_vg *vgs;
+};
+
+static u32 lvm2_vg_assembler_hash(const char *const content,
+		const size_t length)
+{
+	/* 32-bit FNV-1a. */
+	u32 hash = 0x811C9DC5U;
+	size_t i;
+
+	for(i = 0; i < length; ++i) {
+		hash ^= (u8) content[i];
+		hash *= 0x01000193U;
+	}
+
+	return hash;
+}
+
+/**
+ * Convert the id of a PV in the metadata text to the UUID of its pv_header by
+ * removing the dashes between the 6-4-4-4-4-4-6 character groups.
+ */
+static lvm2_bool lvm2_vg_assembler_pv_id_to_uuid(
+		const struct lvm2_bounded_string *const id,
+		char out_pv_uuid[LVM_ID_LEN])
+{
+	size_t uuid_offset = 0;
+	int i;
+
+	if(id->length != LVM_ID_LEN + 6)
+		return LVM2_FALSE;
+
+	for(i = 0; i < id->length; ++i) {
+		if(i == 6 || i == 11 || i == 16 || i == 21 || i == 26 ||
+			i == 31)
+		{
+			if(id->content[i] != '-')
+				return LVM2_FALSE;
+			continue;
+		}
+
+		out_pv_uuid[uuid_offset++] = id->content[i];
+	}
+
+	return LVM2_TRUE;
+}
+
+static void lvm2_vg_assembler_vg_invalidate(
+		struct lvm2_vg_assembler_vg *const vg)
+{
+	if(vg->pv_present) {
+		lvm2_free((void**) &vg->pv_present,
+			vg->layout->vg->physical_volumes_len ?
+			vg->layout->vg->physical_volumes_len : 1);
+	}
+
+	if(vg->name_buckets) {
+		lvm2_free((void**) &vg->name_buckets, vg->name_buckets_len *
+			sizeof(struct lvm2_vg_assembler_name_bucket));
+	}
+
+	vg->present_pvs_len = 0;
+	vg->name_buckets_len = 0;
+}
+
+LVM2_EXPORT int lvm2_vg_assembler_create(
+		struct lvm2_vg_assembler **const out_assembler)
+{
+	int err;
+	struct lvm2_vg_assembler *assembler = NULL;
+
+	err = lvm2_malloc(sizeof(struct lvm2_vg_assembler),
+		(void**) &assembler);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_vg_assembler: %d", err);
+		goto out;
+	}
+
+	memset(assembler, 0, sizeof(struct lvm2_vg_assembler));
+
+	err = lvm2_malloc(LVM2_VG_ASSEMBLER_INITIAL_BUCKETS *
+		sizeof(struct lvm2_vg_assembler_pv_bucket),
+		(void**) &assembler->pv_buckets);
+	if(err) {
+		LogError("Error while allocating memory for PV buckets: %d",
+			err);
+		goto err_out;
+	}
+
+	memset(assembler->pv_buckets, 0, LVM2_VG_ASSEMBLER_INITIAL_BUCKETS *
+		sizeof(struct lvm2_vg_assembler_pv_bucket));
+	assembler->pv_buckets_len = LVM2_VG_ASSEMBLER_INITIAL_BUCKETS;
+
+	err = lvm2_malloc(LVM2_VG_ASSEMBLER_INITIAL_BUCKETS * sizeof(size_t),
+		(void**) &assembler->vg_buckets);
+	if(err) {
+		LogError("Error while allocating memory for VG buckets: %d",
+			err);
+		goto err_out;
+	}
+
+	memset(assembler->vg_buckets, 0,
+		LVM2_VG_ASSEMBLER_INITIAL_BUCKETS * sizeof(size_t));
+	assembler->vg_buckets_len = LVM2_VG_ASSEMBLER_INITIAL_BUCKETS;
+
+	*out_assembler = assembler;
+out:
+	return err;
+err_out:
+	lvm2_vg_assembler_destroy(&assembler);
+	goto out;
+}
+
+LVM2_EXPORT void lvm2_vg_assembler_destroy(
+		struct lvm2_vg_assembler **const assembler)
+{
+	size_t i;
+
+	for(i = 0; i < (*assembler)->vgs_len; ++i) {
+		struct lvm2_vg_assembler_vg *const vg = &(*assembler)->vgs[i];
+
+		lvm2_vg_assembler_vg_invalidate(vg);
+		lvm2_layout_release(&vg->layout);
+	}
+
+	if((*assembler)->vgs) {
+		lvm2_free((void**) &(*assembler)->vgs,
+			(*assembler)->vgs_capacity *
+			sizeof(struct lvm2_vg_assembler_vg));
+	}
+
+	if((*assembler)->vg_buckets) {
+		lvm2_free((void**) &(*assembler)->vg_buckets,
+			(*assembler)->vg_buckets_len * sizeof(size_t));
+	}
+
+	if((*assembler)->pv_buckets) {
+		lvm2_free((void**) &(*assembler)->pv_buckets,
+			(*assembler)->pv_buckets_len *
+			sizeof(struct lvm2_vg_assembler_pv_bucket));
+	}
+
+	lvm2_free((void**) assembler, sizeof(struct lvm2_vg_assembler));
+}
+
+static lvm2_bool lvm2_vg_assembler_lookup_pv(
+		const struct lvm2_vg_assembler *const assembler,
+		const char pv_uuid[LVM_ID_LEN], size_t *const out_bucket)
+{
+	size_t i;
+
+	i = lvm2_vg_assembler_hash(pv_uuid, LVM_ID_LEN) &
+		(assembler->pv_buckets_len - 1);
+	while(assembler->pv_buckets[i].used) {
+		if(!memcmp(assembler->pv_buckets[i].pv_uuid, pv_uuid,
+			LVM_ID_LEN))
+		{
+			*out_bucket = i;
+			return LVM2_TRUE;
+		}
+
+		i = (i + 1) & (assembler->pv_buckets_len - 1);
+	}
+
+	*out_bucket = i;
+	return LVM2_FALSE;
+}
+
+static int lvm2_vg_assembler_grow_pvs(
+		struct lvm2_vg_assembler *const assembler)
+{
+	int err;
+	const size_t new_buckets_len = assembler->pv_buckets_len * 2;
+	struct lvm2_vg_assembler_pv_bucket *new_buckets = NULL;
+	size_t i;
+
+	err = lvm2_malloc(new_buckets_len *
+		sizeof(struct lvm2_vg_assembler_pv_bucket),
+		(void**) &new_buckets);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " PV "
+			"buckets: %d", ARGzu(new_buckets_len), err);
+		return err;
+	}
+
+	memset(new_buckets, 0,
+		new_buckets_len * sizeof(struct lvm2_vg_assembler_pv_bucket));
+
+	for(i = 0; i < assembler->pv_buckets_len; ++i) {
+		const struct lvm2_vg_assembler_pv_bucket *const bucket =
+			&assembler->pv_buckets[i];
+		size_t j;
+
+		if(!bucket->used)
+			continue;
+
+		j = lvm2_vg_assembler_hash(bucket->pv_uuid, LVM_ID_LEN) &
+			(new_buckets_len - 1);
+		while(new_buckets[j].used)
+			j = (j + 1) & (new_buckets_len - 1);
+
+		new_buckets[j] = *bucket;
+	}
+
+	lvm2_free((void**) &assembler->pv_buckets, assembler->pv_buckets_len *
+		sizeof(struct lvm2_vg_assembler_pv_bucket));
+
+	assembler->pv_buckets_len = new_buckets_len;
+	assembler->pv_buckets = new_buckets;
+
+	return 0;
+}
+
+static int lvm2_vg_assembler_insert_pv(
+		struct lvm2_vg_assembler *const assembler,
+		const char pv_uuid[LVM_ID_LEN])
+{
+	int err;
+	size_t i;
+
+	if(lvm2_vg_assembler_lookup_pv(assembler, pv_uuid, &i))
+		return 0;
+
+	/* Keep the load factor at or below 3/4. */
+	if((assembler->pvs_len + 1) * 4 > assembler->pv_buckets_len * 3) {
+		err = lvm2_vg_assembler_grow_pvs(assembler);
+		if(err)
+			return err;
+
+		lvm2_vg_assembler_lookup_pv(assembler, pv_uuid, &i);
+	}
+
+	assembler->pv_buckets[i].used = LVM2_TRUE;
+	memcpy(assembler->pv_buckets[i].pv_uuid, pv_uuid, LVM_ID_LEN);
+	assembler->pvs_len++;
+
+	return 0;
+}
+
+static lvm2_bool lvm2_vg_assembler_lookup_vg(
+		const struct lvm2_vg_assembler *const assembler,
+		const struct lvm2_bounded_string *const vg_id,
+		size_t *const out_bucket)
+{
+	size_t i;
+
+	i = lvm2_vg_assembler_hash(vg_id->content, vg_id->length) &
+		(assembler->vg_buckets_len - 1);
+	while(assembler->vg_buckets[i]) {
+		const struct lvm2_bounded_string *const cur =
+			assembler->vgs[assembler->vg_buckets[i] - 1].layout->
+			vg->id;
+
+		if(cur->length == vg_id->length &&
+			!memcmp(cur->content, vg_id->content, vg_id->length))
+		{
+			*out_bucket = i;
+			return LVM2_TRUE;
+		}
+
+		i = (i + 1) & (assembler->vg_buckets_len - 1);
+	}
+
+	*out_bucket = i;
+	return LVM2_FALSE;
+}
+
+static int lvm2_vg_assembler_grow_vgs(
+		struct lvm2_vg_assembler *const assembler)
+{
+	int err;
+	const size_t new_buckets_len = assembler->vg_buckets_len * 2;
+	size_t *new_buckets = NULL;
+	size_t i;
+
+	err = lvm2_malloc(new_buckets_len * sizeof(size_t),
+		(void**) &new_buckets);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " VG "
+			"buckets: %d", ARGzu(new_buckets_len), err);
+		return err;
+	}
+
+	memset(new_buckets, 0, new_buckets_len * sizeof(size_t));
+
+	for(i = 0; i < assembler->vgs_len; ++i) {
+		const struct lvm2_bounded_string *const vg_id =
+			assembler->vgs[i].layout->vg->id;
+		size_t j;
+
+		j = lvm2_vg_assembler_hash(vg_id->content, vg_id->length) &
+			(new_buckets_len - 1);
+		while(new_buckets[j])
+			j = (j + 1) & (new_buckets_len - 1);
+
+		new_buckets[j] = i + 1;
+	}
+
+	lvm2_free((void**) &assembler->vg_buckets,
+		assembler->vg_buckets_len * sizeof(size_t));
+
+	assembler->vg_buckets_len = new_buckets_len;
+	assembler->vg_buckets = new_buckets;
+
+	return 0;
+}
+
+static int lvm2_vg_assembler_add_layout(
+		struct lvm2_vg_assembler *const assembler,
+		struct lvm2_layout *const layout)
+{
+	int err;
+	struct lvm2_vg_assembler_vg *vg;
+	size_t i;
+
+	if(lvm2_vg_assembler_lookup_vg(assembler, layout->vg->id, &i)) {
+		vg = &assembler->vgs[assembler->vg_buckets[i] - 1];
+
+		/* Keep the newest metadata. On equal seqnos the first layout
+		 * is kept, since they should then be identical. */
+		if(layout->vg->seqno <= vg->layout->vg->seqno)
+			return 0;
+
+		LogDebug("Replacing metadata of VG '%.*s' seqno %" FMTllu
+			" with seqno %" FMTllu ".",
+			layout->vg->id->length, layout->vg->id->content,
+			ARGllu(vg->layout->vg->seqno),
+			ARGllu(layout->vg->seqno));
+
+		lvm2_vg_assembler_vg_invalidate(vg);
+		lvm2_layout_release(&vg->layout);
+		vg->layout = lvm2_layout_retain(layout);
+
+		return 0;
+	}
+
+	if(assembler->vgs_len == assembler->vgs_capacity) {
+		const size_t new_capacity = assembler->vgs_capacity ?
+			assembler->vgs_capacity * 2 : 4;
+		struct lvm2_vg_assembler_vg *new_vgs = NULL;
+
+		err = lvm2_malloc(new_capacity *
+			sizeof(struct lvm2_vg_assembler_vg),
+			(void**) &new_vgs);
+		if(err) {
+			LogError("Error while allocating memory for %" FMTzu
+				" VGs: %d", ARGzu(new_capacity), err);
+			return err;
+		}
+
+		if(assembler->vgs) {
+			memcpy(new_vgs, assembler->vgs, assembler->vgs_len *
+				sizeof(struct lvm2_vg_assembler_vg));
+			lvm2_free((void**) &assembler->vgs,
+				assembler->vgs_capacity *
+				sizeof(struct lvm2_vg_assembler_vg));
+		}
+
+		assembler->vgs_capacity = new_capacity;
+		assembler->vgs = new_vgs;
+	}
+
+	/* Keep the load factor at or below 3/4. */
+	if((assembler->vgs_len + 1) * 4 > assembler->vg_buckets_len * 3) {
+		err = lvm2_vg_assembler_grow_vgs(assembler);
+		if(err)
+			return err;
+
+		lvm2_vg_assembler_lookup_vg(assembler, layout->vg->id, &i);
+	}
+
+	vg = &assembler->vgs[assembler->vgs_len];
+	memset(vg, 0, sizeof(struct lvm2_vg_assembler_vg));
+	vg->layout = lvm2_layout_retain(layout);
+
+	assembler->vg_buckets[i] = ++assembler->vgs_len;
+
+	return 0;
+}
+
+LVM2_EXPORT int lvm2_vg_assembler_add_pv(
+		struct lvm2_vg_assembler *const assembler,
+		const struct lvm2_pv_info *const pv_info,
+		struct lvm2_layout *const layout)
+{
+	int err;
+
+	err = lvm2_vg_assembler_insert_pv(assembler, pv_info->pv_uuid);
+	if(err)
+		return err;
+
+	if(!layout)
+		return 0;
+
+	if(!layout->vg || !layout->vg->id) {
+		LogError("Layout without a volume group id.");
+		return EINVAL;
+	}
+
+	return lvm2_vg_assembler_add_layout(assembler, layout);
+}
+
+LVM2_EXPORT size_t lvm2_vg_assembler_get_vgs_len(
+		struct lvm2_vg_assembler *const assembler)
+{
+	return assembler->vgs_len;
+}
+
+/** Bring the presence of the PVs of 'vg' up to date with the added PVs. */
+static int lvm2_vg_assembler_update_vg(
+		const struct lvm2_vg_assembler *const assembler,
+		struct lvm2_vg_assembler_vg *const vg)
+{
+	int err;
+	const struct lvm2_volume_group *const lvm_vg = vg->layout->vg;
+	size_t i;
+
+	if(vg->pv_present &&
+		vg->present_pvs_generation == assembler->pvs_len)
+	{
+		return 0;
+	}
+
+	if(!vg->pv_present) {
+		err = lvm2_malloc(lvm_vg->physical_volumes_len ?
+			lvm_vg->physical_volumes_len : 1,
+			(void**) &vg->pv_present);
+		if(err) {
+			LogError("Error while allocating memory for PV "
+				"presence: %d", err);
+			return err;
+		}
+	}
+
+	vg->present_pvs_len = 0;
+	for(i = 0; i < lvm_vg->physical_volumes_len; ++i) {
+		char pv_uuid[LVM_ID_LEN];
+		size_t bucket;
+
+		vg->pv_present[i] = 0;
+
+		if(!lvm2_vg_assembler_pv_id_to_uuid(
+			lvm_vg->physical_volumes[i]->id, pv_uuid))
+		{
+			LogError("Invalid PV id in VG metadata: '%.*s'",
+				lvm_vg->physical_volumes[i]->id->length,
+				lvm_vg->physical_volumes[i]->id->content);
+			continue;
+		}
+
+		if(lvm2_vg_assembler_lookup_pv(assembler, pv_uuid, &bucket)) {
+			vg->pv_present[i] = 1;
+			vg->present_pvs_len++;
+		}
+	}
+
+	vg->present_pvs_generation = assembler->pvs_len;
+
+	return 0;
+}
+
+LVM2_EXPORT int lvm2_vg_assembler_get_vg(
+		struct lvm2_vg_assembler *const assembler, const size_t index,
+		struct lvm2_assembled_vg *const out_vg)
+{
+	int err;
+	struct lvm2_vg_assembler_vg *const vg = &assembler->vgs[index];
+
+	err = lvm2_vg_assembler_update_vg(assembler, vg);
+	if(err)
+		return err;
+
+	out_vg->layout = vg->layout;
+	out_vg->pvs_len = vg->layout->vg->physical_volumes_len;
+	out_vg->present_pvs_len = vg->present_pvs_len;
+
+	return 0;
+}
+
+LVM2_EXPORT lvm2_bool lvm2_vg_assembler_pv_is_present(
+		struct lvm2_vg_assembler *const assembler,
+		const size_t vg_index, const size_t pv_index)
+{
+	struct lvm2_vg_assembler_vg *const vg = &assembler->vgs[vg_index];
+
+	if(pv_index >= vg->layout->vg->physical_volumes_len ||
+		lvm2_vg_assembler_update_vg(assembler, vg))
+	{
+		return LVM2_FALSE;
+	}
+
+	return vg->pv_present[pv_index] ? LVM2_TRUE : LVM2_FALSE;
+}
+
+static size_t lvm2_vg_assembler_name_hash(
+		const struct lvm2_bounded_string *const name)
+{
+	/* Names are interned in the layout, so they're hashed by address. */
+	const uintptr_t address = (uintptr_t) name;
+
+	return lvm2_vg_assembler_hash((const char*) &address,
+		sizeof(address));
+}
+
+/** Build the table mapping the interned PV names of 'vg' to their index. */
+static int lvm2_vg_assembler_build_names(
+		struct lvm2_vg_assembler_vg *const vg)
+{
+	int err;
+	const struct lvm2_volume_group *const lvm_vg = vg->layout->vg;
+	size_t buckets_len = LVM2_VG_ASSEMBLER_INITIAL_BUCKETS;
+	size_t i;
+
+	if(vg->name_buckets)
+		return 0;
+
+	while(lvm_vg->physical_volumes_len * 4 > buckets_len * 3)
+		buckets_len *= 2;
+
+	err = lvm2_malloc(buckets_len *
+		sizeof(struct lvm2_vg_assembler_name_bucket),
+		(void**) &vg->name_buckets);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " PV "
+			"name buckets: %d", ARGzu(buckets_len), err);
+		return err;
+	}
+
+	memset(vg->name_buckets, 0,
+		buckets_len * sizeof(struct lvm2_vg_assembler_name_bucket));
+	vg->name_buckets_len = buckets_len;
+
+	for(i = 0; i < lvm_vg->physical_volumes_len; ++i) {
+		const struct lvm2_bounded_string *const name =
+			lvm_vg->physical_volumes[i]->name;
+		size_t j;
+
+		j = lvm2_vg_assembler_name_hash(name) & (buckets_len - 1);
+		while(vg->name_buckets[j].name &&
+			vg->name_buckets[j].name != name)
+		{
+			j = (j + 1) & (buckets_len - 1);
+		}
+
+		vg->name_buckets[j].name = name;
+		vg->name_buckets[j].pv_index = i;
+	}
+
+	return 0;
+}
+
+static lvm2_bool lvm2_vg_assembler_location_is_present(
+		const struct lvm2_vg_assembler_vg *const vg,
+		const struct lvm2_pv_location *const location)
+{
+	size_t j;
+
+	j = lvm2_vg_assembler_name_hash(location->pv_name) &
+		(vg->name_buckets_len - 1);
+	while(vg->name_buckets[j].name) {
+		if(vg->name_buckets[j].name == location->pv_name)
+			return vg->pv_present[vg->name_buckets[j].pv_index] ?
+				LVM2_TRUE : LVM2_FALSE;
+
+		j = (j + 1) & (vg->name_buckets_len - 1);
+	}
+
+	/* A location on a PV that isn't in the VG can't be backed. */
+	return LVM2_FALSE;
+}
+
+static lvm2_bool lvm2_vg_assembler_segment_is_backed(
+		const struct lvm2_vg_assembler_vg *const vg,
+		const struct lvm2_segment *const segment)
+{
+	const struct lvm2_pv_location *const locations =
+		lvm2_segment_get_locations(segment);
+	u32 i;
+
+	if(!segment->locations_len) {
+		/* Segments without PV locations (zero, error) don't need any
+		 * PV to be present. */
+		return LVM2_TRUE;
+	}
+
+	for(i = 0; i < segment->locations_len; ++i) {
+		const lvm2_bool present =
+			lvm2_vg_assembler_location_is_present(vg,
+			&locations[i]);
+
+		if(segment->kind == LVM2_SEGMENT_KIND_MIRRORED) {
+			/* One leg is enough. */
+			if(present)
+				return LVM2_TRUE;
+		}
+		else if(!present) {
+			/* Every stripe is needed. */
+			return LVM2_FALSE;
+		}
+	}
+
+	return (segment->kind == LVM2_SEGMENT_KIND_MIRRORED) ?
+		LVM2_FALSE : LVM2_TRUE;
+}
+
+LVM2_EXPORT int lvm2_vg_assembler_report_lvs(
+		struct lvm2_vg_assembler *const assembler,
+		const size_t vg_index, lvm2_assembled_lv_callback lv_callback,
+		void *const private_data)
+{
+	int err;
+	struct lvm2_vg_assembler_vg *const vg = &assembler->vgs[vg_index];
+	const struct lvm2_volume_group *const lvm_vg = vg->layout->vg;
+	struct lvm2_assembled_vg assembled_vg;
+	size_t i;
+
+	err = lvm2_vg_assembler_get_vg(assembler, vg_index, &assembled_vg);
+	if(err)
+		return err;
+
+	err = lvm2_vg_assembler_build_names(vg);
+	if(err)
+		return err;
+
+	for(i = 0; i < lvm_vg->logical_volumes_len; ++i) {
+		const struct lvm2_logical_volume *const lv =
+			lvm_vg->logical_volumes[i];
+		struct lvm2_assembled_lv assembled_lv;
+		size_t j;
+
+		assembled_lv.lv = lv;
+		assembled_lv.extents_len = 0;
+		assembled_lv.missing_extents_len = 0;
+
+		for(j = 0; j < lv->segments_len; ++j) {
+			const struct lvm2_segment *const segment =
+				&lv->segments[j];
+
+			assembled_lv.extents_len += segment->extent_count;
+			if(!lvm2_vg_assembler_segment_is_backed(vg, segment)) {
+				assembled_lv.missing_extents_len +=
+					segment->extent_count;
+			}
+		}
+
+		if(!lv_callback(private_data, &assembled_vg, &assembled_lv))
+			break;
+	}
+
+	return 0;
+}
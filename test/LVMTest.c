@@ -23,11 +23,20 @@
 #include <string.h>
 #include <errno.h>
 
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
+#include "lvm2_block_cache.h"
+#include "lvm2_cache_file.h"
+#include "lvm2_frozen.h"
 #include "lvm2_log.h"
+#include "lvm2_memory_device.h"
+#include "lvm2_parallel_scan.h"
+#include "lvm2_scan_pipeline.h"
 #include "lvm2_text.h"
+#include "lvm2_vg_assembler.h"
 
 /* Defined in lvm2_osal_unix.c. */
 long long lvm2_get_allocations(void);
@@ -38,56 +47,62 @@ long long lvm2_get_allocations(void);
 		fprintf(stderr, "\n"); \
 	} while(0)
 
-static void print_lvm2_pv_location(struct lvm2_pv_location *stripe)
+static void print_lvm2_pv_location(const struct lvm2_pv_location *stripe)
 {
 	emit("\t\t\t\tpv_name: %s", stripe->pv_name->content);
 	emit("\t\t\t\textent_start: %" FMTllu, ARGllu(stripe->extent_start));
 }
 
-static void print_lvm2_segment(struct lvm2_segment *segment)
+static void print_lvm2_segment(const struct lvm2_segment *segment)
 {
+	const struct lvm2_pv_location *const locations =
+		lvm2_segment_get_locations(segment);
+
 	emit("\t\t\tstart_extent: %" FMTllu, ARGllu(segment->start_extent));
 	emit("\t\t\textent_count: %" FMTllu, ARGllu(segment->extent_count));
 	emit("\t\t\ttype: %s", segment->type->content);
 
-	if(segment->stripe_count_defined) {
-		emit("\t\t\tstripe_count: %" FMTllu,
-			ARGllu(segment->stripe_count));
-	}
-	if(segment->stripe_size_defined) {
-		emit("\t\t\tstripe_size: %" FMTllu,
-			ARGllu(segment->stripe_size));
-	}
-	if(segment->stripes) {
-		size_t i;
-
-		for(i = 0; i < segment->stripes_len; ++i) {
-			emit("\t\t\tstripes[%" FMTzu "]:",
-				ARGzu(i));
-			print_lvm2_pv_location(segment->stripes[i]);
+	if(segment->kind == LVM2_SEGMENT_KIND_STRIPED) {
+		if(segment->defined & LVM2_SEGMENT_COUNT_DEFINED) {
+			emit("\t\t\tstripe_count: %" FMTllu,
+				ARGllu(segment->u.striped.stripe_count));
 		}
-	}
+		if(segment->defined & LVM2_SEGMENT_SIZE_DEFINED) {
+			emit("\t\t\tstripe_size: %" FMTllu,
+				ARGllu(segment->u.striped.stripe_size));
+		}
+		if(segment->defined & LVM2_SEGMENT_LOCATIONS_DEFINED) {
+			u32 i;
 
-	if(segment->mirror_count_defined) {
-		emit("\t\t\tmirror_count: %" FMTllu,
-			ARGllu(segment->mirror_count));
-	}
-	if(segment->mirror_log) {
-		emit("\t\t\t: %.*s",
-			segment->mirror_log->length,
-			segment->mirror_log->content);
-	}
-	if(segment->region_size_defined) {
-		emit("\t\t\tregion_size: %" FMTllu,
-			ARGllu(segment->region_size));
+			for(i = 0; i < segment->locations_len; ++i) {
+				emit("\t\t\tstripes[%" FMTzu "]:",
+					ARGzu(i));
+				print_lvm2_pv_location(&locations[i]);
+			}
+		}
 	}
-	if(segment->mirrors) {
-		size_t i;
+	else if(segment->kind == LVM2_SEGMENT_KIND_MIRRORED) {
+		if(segment->defined & LVM2_SEGMENT_COUNT_DEFINED) {
+			emit("\t\t\tmirror_count: %" FMTllu,
+				ARGllu(segment->u.mirrored.mirror_count));
+		}
+		if(segment->u.mirrored.mirror_log) {
+			emit("\t\t\tmirror_log: %.*s",
+				segment->u.mirrored.mirror_log->length,
+				segment->u.mirrored.mirror_log->content);
+		}
+		if(segment->defined & LVM2_SEGMENT_SIZE_DEFINED) {
+			emit("\t\t\tregion_size: %" FMTllu,
+				ARGllu(segment->u.mirrored.region_size));
+		}
+		if(segment->defined & LVM2_SEGMENT_LOCATIONS_DEFINED) {
+			u32 i;
 
-		for(i = 0; i < segment->mirrors_len; ++i) {
-			emit("\t\t\tmirrors[%" FMTzu "]:",
-				ARGzu(i));
-			print_lvm2_pv_location(segment->mirrors[i]);
+			for(i = 0; i < segment->locations_len; ++i) {
+				emit("\t\t\tmirrors[%" FMTzu "]:",
+					ARGzu(i));
+				print_lvm2_pv_location(&locations[i]);
+			}
 		}
 	}
 }
@@ -108,7 +123,7 @@ static void print_lvm2_logical_volume(struct lvm2_logical_volume *lv)
 		for(i = 0; i < lv->segments_len; ++i) {
 			emit("\t\tsegments[%" FMTzu "]:",
 				ARGzu(i));
-			print_lvm2_segment(lv->segments[i]);
+			print_lvm2_segment(&lv->segments[i]);
 		}
 	}
 }
@@ -175,8 +190,135 @@ static void print_lvm2_layout(struct lvm2_layout *layout)
 	emit("creation_time: %" FMTllu, ARGllu(layout->creation_time));
 }
 
+static void print_lvm2_string_stats(struct lvm2_layout *layout)
+{
+	struct lvm2_string_stats stats;
+
+	lvm2_layout_get_string_stats(layout, &stats);
+
+	emit("string table:");
+	emit("\tunique_strings: %" FMTllu, ARGllu(stats.unique_strings));
+	emit("\treferences: %" FMTllu, ARGllu(stats.references));
+	emit("\treferenced_bytes: %" FMTllu, ARGllu(stats.referenced_bytes));
+	emit("\tstored_bytes: %" FMTllu, ARGllu(stats.stored_bytes));
+	emit("\ttable_bytes: %" FMTllu, ARGllu(stats.table_bytes));
+}
+
+static void print_lvm2_frozen_layout(struct lvm2_layout *layout)
+{
+	int err;
+	struct lvm2_frozen_layout *frozen = NULL;
+
+	err = lvm2_layout_freeze(layout, &frozen);
+	if(err) {
+		emit("lvm2_layout_freeze returned with error: %d", err);
+		return;
+	}
+
+	emit("frozen layout:");
+	emit("\tsize: %" FMTllu, ARGllu(frozen->size));
+	emit("\tphysical_volumes_len: %" FMTllu,
+		ARGllu(frozen->physical_volumes_len));
+	emit("\tlogical_volumes_len: %" FMTllu,
+		ARGllu(frozen->logical_volumes_len));
+	emit("\tsegments_len: %" FMTllu, ARGllu(frozen->segments_len));
+	emit("\tlocations_len: %" FMTllu, ARGllu(frozen->locations_len));
+	emit("\tstrings_size: %" FMTllu, ARGllu(frozen->strings_size));
+
+	lvm2_frozen_layout_destroy(&frozen);
+}
+
 #undef emit
 
+/** Flags passed to lvm2_unix_device_create_ex for all devices. */
+static u32 device_flags = 0;
+
+/** Scan devices with asynchronous reads. */
+static lvm2_bool async_scan = LVM2_FALSE;
+
+/** Pass read ahead hints to the devices during scans. */
+static lvm2_bool io_hints = LVM2_FALSE;
+
+/** Number of parses per device in benchmark mode, or 0. */
+static unsigned long benchmark_iterations = 0;
+
+/** Number of threads to scan devices on, or 0 to not use a thread pool. */
+static unsigned long scan_threads = 0;
+
+/** Scan on the threads as a work-stealing pipeline rather than a pool. */
+static lvm2_bool pipeline_scan = LVM2_FALSE;
+
+/** Number of times to rescan a device after scanning it, or 0. */
+static unsigned long rescans = 0;
+
+/**
+ * Dump the layouts that a scan of a single device parsed, with their string
+ * table stats and the size of their frozen form.
+ */
+static lvm2_bool dump_layouts = LVM2_FALSE;
+
+/** Assemble the VGs of the scanned devices rather than report each PV. */
+static lvm2_bool assemble_vgs = LVM2_FALSE;
+
+/** Block cache that all devices are read through, if any. */
+static struct lvm2_block_cache *block_cache = NULL;
+
+static int open_device(const char *const device_name,
+		struct lvm2_device **const out_dev)
+{
+	int err;
+
+	err = lvm2_unix_device_create_ex(device_name, device_flags, out_dev);
+	if(!err && block_cache)
+		lvm2_device_set_block_cache(*out_dev, block_cache);
+
+	return err;
+}
+
+/** I/O statistics of all closed devices, if device statistics are enabled. */
+static struct lvm2_device_stats io_stats;
+
+static void close_device(struct lvm2_device **const dev)
+{
+	struct lvm2_device_stats stats;
+	size_t i;
+
+	if(!lvm2_device_get_stats(*dev, &stats)) {
+		io_stats.reads += stats.reads;
+		io_stats.bytes += stats.bytes;
+		io_stats.unaligned_reads += stats.unaligned_reads;
+		io_stats.wasted_bytes += stats.wasted_bytes;
+		io_stats.total_latency_us += stats.total_latency_us;
+		for(i = 0; i < LVM2_DEVICE_LATENCY_BUCKETS; ++i)
+			io_stats.latency[i] += stats.latency[i];
+	}
+
+	lvm2_unix_device_destroy(dev);
+}
+
+static void print_io_stats(void)
+{
+	size_t i;
+
+	fprintf(stderr, "I/O: %" FMTllu " reads, %" FMTllu " bytes, "
+		"%" FMTllu " unaligned (%" FMTllu " bytes wasted), "
+		"%" FMTllu " us total.\n", ARGllu(io_stats.reads),
+		ARGllu(io_stats.bytes), ARGllu(io_stats.unaligned_reads),
+		ARGllu(io_stats.wasted_bytes),
+		ARGllu(io_stats.total_latency_us));
+
+	for(i = 0; i < LVM2_DEVICE_LATENCY_BUCKETS; ++i) {
+		if(!io_stats.latency[i])
+			continue;
+
+		fprintf(stderr, "\t%s%" FMTllu " us: %" FMTllu "\n",
+			(i == LVM2_DEVICE_LATENCY_BUCKETS - 1) ? ">= " : "< ",
+			ARGllu((i == LVM2_DEVICE_LATENCY_BUCKETS - 1) ?
+			(1ULL << i) : (2ULL << i)),
+			ARGllu(io_stats.latency[i]));
+	}
+}
+
 static int read_text_main(const char *const device_name)
 {
 	int ret = (EXIT_FAILURE);
@@ -246,6 +388,10 @@ static int read_text_main(const char *const device_name)
 								"\n");
 							print_lvm2_layout(
 								layout);
+							print_lvm2_string_stats(
+								layout);
+							print_lvm2_frozen_layout(
+								layout);
 
 							lvm2_layout_destroy(
 								&layout);
@@ -309,14 +455,23 @@ static int read_device_main(const char *const device_name)
 	int ret = (EXIT_FAILURE);
 	int err;
 	struct lvm2_device *dev = NULL;
+	struct lvm2_scan_state state;
+	struct lvm2_parse_options options;
+	size_t i;
+
+	memset(&state, 0, sizeof(struct lvm2_scan_state));
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	if(dump_layouts)
+		options.scan_state = &state;
 
-	err = lvm2_unix_device_create(device_name, &dev);
+	err = open_device(device_name, &dev);
 	if(err) {
 		LogError("Error while opening \"%s\": %d (%s)",
 			device_name, err, strerror(err));
 	}
 	else {
-		err = lvm2_parse_device(dev, &volume_callback, NULL);
+		err = lvm2_parse_device_ex(dev, &options, &volume_callback,
+			NULL);
 		if(err) {
 			LogError("Error while parsing LVM2 volume: %d (%s)",
 				err, strerror(err));
@@ -325,9 +480,971 @@ static int read_device_main(const char *const device_name)
 			ret = (EXIT_SUCCESS);
 		}
 
-		lvm2_unix_device_destroy(&dev);
+		for(i = 0; i < state.pv_info.metadata_areas_len; ++i) {
+			if(!state.layouts[i])
+				continue;
+
+			print_lvm2_layout(state.layouts[i]);
+			print_lvm2_string_stats(state.layouts[i]);
+			print_lvm2_frozen_layout(state.layouts[i]);
+		}
+
+		lvm2_scan_state_release(&state);
+		close_device(&dev);
+	}
+
+	return ret;
+}
+
+static lvm2_bool quiet_volume_callback(
+		void *const private_data __attribute__((unused)),
+		const u64 device_size __attribute__((unused)),
+		const char *const volume_name __attribute__((unused)),
+		const u64 volume_start __attribute__((unused)),
+		const u64 volume_length __attribute__((unused)),
+		const lvm2_bool is_incomplete __attribute__((unused)))
+{
+	return LVM2_TRUE;
+}
+
+/** Read all of a file into a malloc'd buffer. */
+static int load_file(const char *const file_name, void **const out_data,
+		u64 *const out_size)
+{
+	int err = 0;
+	int fd;
+	struct stat stbuf;
+	char *data = NULL;
+	size_t done = 0;
+
+	fd = open(file_name, O_RDONLY);
+	if(fd == -1)
+		return errno ? errno : ENOENT;
+
+	if(fstat(fd, &stbuf) == -1) {
+		err = errno ? errno : EIO;
+	}
+	else if(!S_ISREG(stbuf.st_mode) || stbuf.st_size <= 0 ||
+		(u64) stbuf.st_size > SIZE_MAX)
+	{
+		err = EINVAL;
+	}
+	else {
+		data = malloc((size_t) stbuf.st_size);
+		if(!data)
+			err = ENOMEM;
+	}
+
+	while(!err && done < (size_t) stbuf.st_size) {
+		const ssize_t res = read(fd, &data[done],
+			(size_t) stbuf.st_size - done);
+		if(res == -1)
+			err = errno ? errno : EIO;
+		else if(!res)
+			err = EIO;
+		else
+			done += (size_t) res;
+	}
+
+	close(fd);
+
+	if(err) {
+		if(data)
+			free(data);
+		return err;
+	}
+
+	*out_data = data;
+	*out_size = (u64) stbuf.st_size;
+
+	return 0;
+}
+
+/**
+ * Parse devices loaded into memory 'iterations' times over, so that the cost
+ * of parsing can be measured without any I/O. The volumes are printed on the
+ * first pass only.
+ */
+static int benchmark_main(const unsigned long iterations,
+		const int device_names_len,
+		const char *const *const device_names)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	void **datas;
+	struct lvm2_device **devs;
+	struct timespec start;
+	struct timespec end;
+	u64 elapsed_ns;
+	unsigned long iteration;
+	int devs_len = 0;
+	int i;
+
+	datas = calloc((size_t) device_names_len, sizeof(void*));
+	devs = calloc((size_t) device_names_len, sizeof(struct lvm2_device*));
+	if(!datas || !devs) {
+		LogError("Error while allocating device arrays.");
+		goto out;
+	}
+
+	for(; devs_len < device_names_len; ++devs_len) {
+		u64 size = 0;
+
+		err = load_file(device_names[devs_len], &datas[devs_len],
+			&size);
+		if(!err) {
+			err = lvm2_memory_device_create(datas[devs_len], size,
+				LVM_SECTOR_SIZE, &devs[devs_len]);
+		}
+
+		if(err) {
+			LogError("Error while loading \"%s\": %d (%s)",
+				device_names[devs_len], err, strerror(err));
+			goto out;
+		}
+	}
+
+	for(i = 0; i < devs_len; ++i) {
+		err = lvm2_parse_device(devs[i], &volume_callback, NULL);
+		if(err) {
+			LogError("Error while parsing \"%s\": %d (%s)",
+				device_names[i], err, strerror(err));
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(iteration = 0; iteration < iterations; ++iteration) {
+		for(i = 0; i < devs_len; ++i) {
+			lvm2_parse_device(devs[i], &quiet_volume_callback,
+				NULL);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed_ns = (u64) (end.tv_sec - start.tv_sec) * 1000000000 +
+		(u64) end.tv_nsec - (u64) start.tv_nsec;
+	fprintf(stderr, "Benchmark: %" FMTllu " parses in %" FMTllu " us, "
+		"%" FMTllu " ns per parse.\n",
+		ARGllu((u64) iterations * (u64) devs_len),
+		ARGllu(elapsed_ns / 1000),
+		ARGllu(iterations ? elapsed_ns / ((u64) iterations *
+		(u64) devs_len) : 0));
+
+	ret = (EXIT_SUCCESS);
+out:
+	for(i = 0; i < devs_len; ++i) {
+		if(devs[i])
+			lvm2_device_destroy(&devs[i]);
+		if(datas[i])
+			free(datas[i]);
+	}
+	if(devs)
+		free(devs);
+	if(datas)
+		free(datas);
+
+	return ret;
+}
+
+/**
+ * Scan a device, then rescan it 'rescans_len' times from the state of the
+ * first scan. The volumes are printed by the scan and by the last rescan.
+ */
+static int rescan_main(const unsigned long rescans_len,
+		const char *const device_name)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	struct lvm2_device *dev = NULL;
+	struct lvm2_scan_state state;
+	struct lvm2_parse_options options;
+	struct timespec start;
+	struct timespec end;
+	unsigned long i;
+
+	memset(&state, 0, sizeof(struct lvm2_scan_state));
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	options.scan_state = &state;
+
+	err = open_device(device_name, &dev);
+	if(err) {
+		LogError("Error while opening \"%s\": %d (%s)",
+			device_name, err, strerror(err));
+		return ret;
+	}
+
+	err = lvm2_parse_device_ex(dev, &options, &volume_callback, NULL);
+	if(err) {
+		LogError("Error while parsing LVM2 volume: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < rescans_len; ++i) {
+		err = lvm2_rescan_device(dev, &options,
+			(i + 1 == rescans_len) ? &volume_callback :
+			&quiet_volume_callback, NULL);
+		if(err) {
+			LogError("Error while rescanning LVM2 volume: %d (%s)",
+				err, strerror(err));
+			goto out;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "Rescanned %lu times in %" FMTllu " us.\n",
+		rescans_len,
+		ARGllu(((u64) (end.tv_sec - start.tv_sec) * 1000000000 +
+		(u64) end.tv_nsec - (u64) start.tv_nsec) / 1000));
+
+	ret = (EXIT_SUCCESS);
+out:
+	lvm2_scan_state_release(&state);
+	close_device(&dev);
+
+	return ret;
+}
+
+typedef int (*scan_func)(const char *const *paths, size_t paths_len,
+		size_t threads_len, u32 device_flags,
+		struct lvm2_scan_result **out_results);
+
+/**
+ * Scan devices with 'scan' on 'threads_len' threads and report the volumes of
+ * each, in the order the devices were given.
+ */
+static int parallel_scan_main(const scan_func scan, const size_t threads_len,
+		const int device_names_len,
+		const char *const *const device_names)
+{
+	int ret = (EXIT_SUCCESS);
+	int err;
+	struct lvm2_scan_result *results = NULL;
+	struct timespec start;
+	struct timespec end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = scan(device_names, (size_t) device_names_len, threads_len,
+		device_flags, &results);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(err) {
+		LogError("Error while scanning devices: %d (%s)", err,
+			strerror(err));
+		return (EXIT_FAILURE);
+	}
+
+	for(i = 0; i < device_names_len; ++i) {
+		const struct lvm2_scan_result *const result = &results[i];
+
+		if(result->err) {
+			LogError("Error while scanning \"%s\": %d (%s)",
+				result->path, result->err,
+				strerror(result->err));
+			ret = (EXIT_FAILURE);
+			continue;
+		}
+
+		if(result->layout) {
+			lvm2_layout_report_volumes(result->layout,
+				&result->pv_info, &volume_callback, NULL);
+		}
+	}
+
+	fprintf(stderr, "Scanned %d devices on %" FMTzu " threads in "
+		"%" FMTllu " us.\n", device_names_len, ARGzu(threads_len),
+		ARGllu(((u64) (end.tv_sec - start.tv_sec) * 1000000000 +
+		(u64) end.tv_nsec - (u64) start.tv_nsec) / 1000));
+
+	lvm2_parallel_scan_results_destroy(&results,
+		(size_t) device_names_len);
+
+	return ret;
+}
+
+static lvm2_bool assembled_lv_callback(
+		void *const private_data __attribute__((unused)),
+		const struct lvm2_assembled_vg *const vg
+		__attribute__((unused)),
+		const struct lvm2_assembled_lv *const lv)
+{
+	fprintf(stdout, "\t%.*s: %" FMTllu " extents", lv->lv->name->length,
+		lv->lv->name->content, ARGllu(lv->extents_len));
+	if(lv->missing_extents_len) {
+		fprintf(stdout, " (%" FMTllu " missing)",
+			ARGllu(lv->missing_extents_len));
+	}
+	fprintf(stdout, "\n");
+
+	return LVM2_TRUE;
+}
+
+/**
+ * Scan devices with 'scan' on 'threads_len' threads, assemble the VGs that
+ * they belong to and report which PVs and LV extents are missing.
+ */
+static int assemble_main(const scan_func scan, const size_t threads_len,
+		const int device_names_len,
+		const char *const *const device_names)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	struct lvm2_scan_result *results = NULL;
+	struct lvm2_vg_assembler *assembler = NULL;
+	int i;
+	size_t j;
+	size_t vgs_len;
+
+	err = scan(device_names, (size_t) device_names_len, threads_len,
+		device_flags, &results);
+	if(err) {
+		LogError("Error while scanning devices: %d (%s)", err,
+			strerror(err));
+		return (EXIT_FAILURE);
+	}
+
+	err = lvm2_vg_assembler_create(&assembler);
+	if(err) {
+		LogError("Error while creating VG assembler: %d (%s)", err,
+			strerror(err));
+		goto out;
+	}
+
+	for(i = 0; i < device_names_len; ++i) {
+		const struct lvm2_scan_result *const result = &results[i];
+
+		if(result->err) {
+			LogError("Error while scanning \"%s\": %d (%s)",
+				result->path, result->err,
+				strerror(result->err));
+			continue;
+		}
+
+		err = lvm2_vg_assembler_add_pv(assembler, &result->pv_info,
+			result->layout);
+		if(err)
+			goto out;
+	}
+
+	vgs_len = lvm2_vg_assembler_get_vgs_len(assembler);
+	for(j = 0; j < vgs_len; ++j) {
+		struct lvm2_assembled_vg vg;
+
+		err = lvm2_vg_assembler_get_vg(assembler, j, &vg);
+		if(err)
+			goto out;
+
+		fprintf(stdout, "%.*s: seqno %" FMTllu ", %" FMTzu "/%" FMTzu
+			" PVs present\n", vg.layout->vg_name->length,
+			vg.layout->vg_name->content,
+			ARGllu(vg.layout->vg->seqno),
+			ARGzu(vg.present_pvs_len), ARGzu(vg.pvs_len));
+
+		err = lvm2_vg_assembler_report_lvs(assembler, j,
+			&assembled_lv_callback, NULL);
+		if(err)
+			goto out;
+	}
+
+	ret = (EXIT_SUCCESS);
+out:
+	if(err) {
+		LogError("Error while assembling VGs: %d (%s)", err,
+			strerror(err));
+	}
+	if(assembler)
+		lvm2_vg_assembler_destroy(&assembler);
+	lvm2_parallel_scan_results_destroy(&results,
+		(size_t) device_names_len);
+
+	return ret;
+}
+
+/**
+ * Scan devices 'iterations' times over with both the thread pool and the
+ * pipeline on 'threads_len' threads, and compare the time a scan takes.
+ */
+static int scan_benchmark_main(const unsigned long iterations,
+		const size_t threads_len, const int device_names_len,
+		const char *const *const device_names)
+{
+	static const struct {
+		const char *name;
+		scan_func scan;
+	} scanners[] = {
+		{ "pool", &lvm2_parallel_scan },
+		{ "pipeline", &lvm2_pipeline_scan },
+	};
+
+	size_t i;
+
+	for(i = 0; i < sizeof(scanners) / sizeof(scanners[0]); ++i) {
+		struct timespec start;
+		struct timespec end;
+		u64 elapsed_ns;
+		unsigned long iteration;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(iteration = 0; iteration < iterations; ++iteration) {
+			struct lvm2_scan_result *results = NULL;
+			const int err = scanners[i].scan(device_names,
+				(size_t) device_names_len, threads_len,
+				device_flags, &results);
+			if(err) {
+				LogError("Error while scanning devices: %d "
+					"(%s)", err, strerror(err));
+				return (EXIT_FAILURE);
+			}
+
+			lvm2_parallel_scan_results_destroy(&results,
+				(size_t) device_names_len);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		elapsed_ns = (u64) (end.tv_sec - start.tv_sec) * 1000000000 +
+			(u64) end.tv_nsec - (u64) start.tv_nsec;
+		fprintf(stderr, "Benchmark (%s): %lu scans of %d devices on "
+			"%" FMTzu " threads in %" FMTllu " us, %" FMTllu " us "
+			"per scan.\n", scanners[i].name, iterations,
+			device_names_len, ARGzu(threads_len),
+			ARGllu(elapsed_ns / 1000),
+			ARGllu(iterations ? elapsed_ns / 1000 / iterations :
+			0));
+	}
+
+	return (EXIT_SUCCESS);
+}
+
+/**
+ * Identify a device to the scan planner.
+ */
+static u64 get_device_key(const char *const device_name)
+{
+	struct stat stbuf;
+
+	if(stat(device_name, &stbuf))
+		return 0;
+
+	return ((u64) stbuf.st_dev << 32) ^ (u64) stbuf.st_ino;
+}
+
+/**
+ * Scan several devices, sharing parsed layouts between the PVs of each VG.
+ * The scan windows of all devices are read up front as one batch, through
+ * io_uring where available.
+ */
+static int read_devices_main(const int device_names_len,
+		const char *const *const device_names)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	struct lvm2_layout_cache *cache = NULL;
+	struct lvm2_scan_planner *planner = NULL;
+	struct lvm2_unix_uring *ring = NULL;
+	struct lvm2_unix_read_request *reqs = NULL;
+	u64 *device_keys = NULL;
+	struct lvm2_parse_options options;
+	struct lvm2_layout_cache_stats stats;
+	size_t reqs_len = 0;
+	int i;
+
+	err = lvm2_layout_cache_create(&cache);
+	if(err) {
+		LogError("Error while creating layout cache: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	err = lvm2_scan_planner_create(LVM2_SCAN_WINDOW_DEFAULT, &planner);
+	if(err) {
+		LogError("Error while creating scan planner: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	err = lvm2_unix_uring_create(64, &ring);
+	if(err) {
+		LogDebug("io_uring unavailable (%d), using pread.", err);
+		ring = NULL;
+	}
+
+	reqs = calloc((size_t) device_names_len,
+		sizeof(struct lvm2_unix_read_request));
+	device_keys = calloc((size_t) device_names_len, sizeof(u64));
+	if(!reqs || !device_keys) {
+		LogError("Error while allocating request array.");
+		goto out;
+	}
+
+	ret = (EXIT_SUCCESS);
+
+	for(i = 0; i < device_names_len; ++i) {
+		struct lvm2_unix_read_request *const req = &reqs[reqs_len];
+		const void *mapped;
+		u64 alignment;
+
+		err = open_device(device_names[i], &req->dev);
+		if(err) {
+			LogError("Error while opening \"%s\": %d (%s)",
+				device_names[i], err, strerror(err));
+			ret = (EXIT_FAILURE);
+			continue;
+		}
+
+		device_keys[reqs_len] = get_device_key(device_names[i]);
+
+		if(!lvm2_device_map_range(req->dev, 0, 0, &mapped)) {
+			/* Memory backed, parsed in place without a window. */
+			req->buf = NULL;
+			req->err = ENOTSUP;
+			++reqs_len;
+			continue;
+		}
+
+		alignment = lvm2_device_get_alignment(req->dev);
+		req->count = (size_t) lvm2_scan_planner_get_window(planner,
+			device_keys[reqs_len]);
+		if(req->count < LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE)
+			req->count = LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE;
+		req->count = (size_t) ((req->count + alignment - 1) /
+			alignment * alignment);
+
+		err = lvm2_io_buffer_create(req->count, &req->buf);
+		if(err) {
+			LogError("Error while allocating window for \"%s\": "
+				"%d (%s)", device_names[i], err,
+				strerror(err));
+			close_device(&req->dev);
+			ret = (EXIT_FAILURE);
+			continue;
+		}
+
+		++reqs_len;
+	}
+
+	err = lvm2_unix_read_batch(ring, reqs, reqs_len);
+	if(err) {
+		LogError("Error while reading scan windows: %d (%s)",
+			err, strerror(err));
+		ret = (EXIT_FAILURE);
+		goto out;
+	}
+
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	options.layout_cache = cache;
+	options.planner = planner;
+	options.io_hints = io_hints;
+
+	for(i = 0; i < (int) reqs_len; ++i) {
+		struct lvm2_unix_read_request *const req = &reqs[i];
+
+		/* If the window couldn't be read (e.g. the device is smaller
+		 * than the window), lvm2_parse_device_ex reads what it
+		 * needs. */
+		options.device_key = device_keys[i];
+		options.window_buffer = req->err ? NULL : req->buf;
+		options.window_size = req->err ? 0 : req->count;
+
+		err = lvm2_parse_device_ex(req->dev, &options,
+			&volume_callback, NULL);
+		if(err) {
+			LogError("Error while parsing LVM2 volume: %d (%s)",
+				err, strerror(err));
+			ret = (EXIT_FAILURE);
+		}
+	}
+
+	lvm2_layout_cache_get_stats(cache, &stats);
+	fprintf(stderr, "Layout cache: %" FMTllu " hits, %" FMTllu " "
+		"misses, %" FMTllu " VGs.\n", ARGllu(stats.hits),
+		ARGllu(stats.misses), ARGllu(stats.entries));
+out:
+	for(i = 0; i < (int) reqs_len; ++i) {
+		if(reqs[i].buf)
+			lvm2_io_buffer_destroy(&reqs[i].buf);
+		close_device(&reqs[i].dev);
+	}
+	if(device_keys)
+		free(device_keys);
+	if(reqs)
+		free(reqs);
+	if(ring)
+		lvm2_unix_uring_destroy(&ring);
+	if(planner)
+		lvm2_scan_planner_destroy(&planner);
+	if(cache)
+		lvm2_layout_cache_destroy(&cache);
+
+	return ret;
+}
+
+static void scan_done_callback(void *const private_data, const int err)
+{
+	int *const ret = (int*) private_data;
+
+	if(err) {
+		LogError("Error while parsing LVM2 volume: %d (%s)",
+			err, strerror(err));
+		*ret = (EXIT_FAILURE);
+	}
+}
+
+/**
+ * Scan several devices concurrently from this thread, driven by the
+ * completions of asynchronous reads.
+ */
+static int read_devices_async_main(const int device_names_len,
+		const char *const *const device_names)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	struct lvm2_layout_cache *cache = NULL;
+	struct lvm2_scan_planner *planner = NULL;
+	struct lvm2_io_queue *queue = NULL;
+	struct lvm2_device **devs = NULL;
+	struct lvm2_parse_options options;
+	struct lvm2_layout_cache_stats stats;
+	int devs_len = 0;
+	int i;
+
+	err = lvm2_layout_cache_create(&cache);
+	if(err) {
+		LogError("Error while creating layout cache: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	err = lvm2_scan_planner_create(LVM2_SCAN_WINDOW_DEFAULT, &planner);
+	if(err) {
+		LogError("Error while creating scan planner: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	err = lvm2_io_queue_create(&queue);
+	if(err) {
+		LogError("Error while creating I/O queue: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	devs = calloc((size_t) device_names_len, sizeof(struct lvm2_device*));
+	if(!devs) {
+		LogError("Error while allocating device array.");
+		goto out;
+	}
+
+	ret = (EXIT_SUCCESS);
+
+	memset(&options, 0, sizeof(struct lvm2_parse_options));
+	options.layout_cache = cache;
+	options.planner = planner;
+	options.io_hints = io_hints;
+
+	for(i = 0; i < device_names_len; ++i) {
+		err = open_device(device_names[i], &devs[devs_len]);
+		if(err) {
+			LogError("Error while opening \"%s\": %d (%s)",
+				device_names[i], err, strerror(err));
+			ret = (EXIT_FAILURE);
+			continue;
+		}
+
+		options.device_key = get_device_key(device_names[i]);
+
+		err = lvm2_parse_device_async(queue, devs[devs_len], &options,
+			&volume_callback, &scan_done_callback, &ret);
+		if(err) {
+			LogError("Error while starting scan of \"%s\": %d (%s)",
+				device_names[i], err, strerror(err));
+			ret = (EXIT_FAILURE);
+		}
+
+		++devs_len;
+	}
+
+	while(lvm2_io_queue_poll(queue, LVM2_TRUE));
+
+	lvm2_layout_cache_get_stats(cache, &stats);
+	fprintf(stderr, "Layout cache: %" FMTllu " hits, %" FMTllu " "
+		"misses, %" FMTllu " VGs.\n", ARGllu(stats.hits),
+		ARGllu(stats.misses), ARGllu(stats.entries));
+out:
+	if(queue)
+		lvm2_io_queue_destroy(&queue);
+	for(i = 0; i < devs_len; ++i)
+		close_device(&devs[i]);
+	if(devs)
+		free(devs);
+	if(planner)
+		lvm2_scan_planner_destroy(&planner);
+	if(cache)
+		lvm2_layout_cache_destroy(&cache);
+
+	return ret;
+}
+
+static int read_device_cached_main(const char *const cache_path,
+		const char *const device_name)
+{
+	int ret = (EXIT_FAILURE);
+	int err;
+	struct lvm2_cache_file *cache = NULL;
+	struct lvm2_device *dev = NULL;
+	struct lvm2_pv_info pv_info;
+	struct lvm2_mda_info mda_infos[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	const struct lvm2_frozen_layout
+		*area_layouts[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	const struct lvm2_frozen_layout *best_layout = NULL;
+	struct lvm2_frozen_layout *new_layouts[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	size_t new_layouts_len = 0;
+	struct lvm2_cache_file_record *records = NULL;
+	size_t records_len = 0;
+	size_t old_records_len = 0;
+	struct lvm2_cache_file_device cached_device;
+	struct lvm2_cache_file_device device;
+	lvm2_bool have_identity;
+	lvm2_bool have_cached_device = LVM2_FALSE;
+	lvm2_bool label_hit = LVM2_FALSE;
+	lvm2_bool device_changed;
+	struct lvm2_cache_file_device *devices = NULL;
+	size_t devices_len = 0;
+	size_t old_devices_len = 0;
+	size_t hits = 0;
+	int mda_err = 0;
+	size_t i;
+
+	memset(area_layouts, 0, sizeof(area_layouts));
+
+	err = lvm2_cache_file_open(cache_path, &cache);
+	if(err == ENOENT) {
+		LogDebug("No cache file at \"%s\".", cache_path);
+	}
+	else if(err) {
+		LogError("Ignoring unusable cache file \"%s\": %d (%s)",
+			cache_path, err, strerror(err));
+	}
+
+	memset(&device, 0, sizeof(struct lvm2_cache_file_device));
+	have_identity = lvm2_cache_file_get_identity(device_name, &device) ?
+		LVM2_FALSE : LVM2_TRUE;
+	if(cache && have_identity) {
+		have_cached_device = lvm2_cache_file_lookup_device(cache,
+			device.dev, device.ino, &cached_device);
+	}
+
+	/* A file that had no label and hasn't been written since needn't
+	 * even be opened. */
+	if(have_cached_device && cached_device.no_label &&
+		lvm2_cache_file_device_unchanged(&cached_device, &device))
+	{
+		LogDebug("No LVM label on unchanged device (cached).");
+		LogError("Error while reading PV label: %d (%s)",
+			EIO, strerror(EIO));
+		goto out;
+	}
+
+	err = open_device(device_name, &dev);
+	if(err) {
+		LogError("Error while opening \"%s\": %d (%s)",
+			device_name, err, strerror(err));
+		goto out;
+	}
+
+	/* Without a label, the scan fails, but the device is still recorded
+	 * so that the next scan can reject it cheaply. */
+	err = lvm2_cache_file_read_pv_info(dev,
+		have_cached_device ? &cached_device : NULL, &device,
+		&label_hit);
+	if(err) {
+		LogError("Error while reading PV label: %d (%s)",
+			err, strerror(err));
+		if(!device.no_label)
+			goto out;
+	}
+
+	pv_info = device.pv_info;
+
+	/* Keep the records of all other PVs, this one is rewritten below. */
+	if(cache)
+		old_records_len = lvm2_cache_file_get_records_len(cache);
+
+	records = malloc((old_records_len + pv_info.metadata_areas_len) *
+		sizeof(struct lvm2_cache_file_record) + 1);
+	if(!records) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for(i = 0; i < old_records_len; ++i) {
+		lvm2_cache_file_get_record(cache, i, &records[records_len]);
+		if(memcmp(records[records_len].pv_uuid, pv_info.pv_uuid,
+			LVM_ID_LEN))
+		{
+			++records_len;
+		}
+	}
+
+	/* Like lvm2_parse_device_ex, get one layout per distinct metadata
+	 * text (copies of a text that was read share its layout) and report
+	 * the one with the highest seqno. Every area still gets a record, so
+	 * that the next scan finds it whichever copy it looks at. */
+	for(i = 0; i < pv_info.metadata_areas_len; ++i) {
+		struct lvm2_mda_info *const mda_info = &mda_infos[i];
+		const struct lvm2_frozen_layout *frozen = NULL;
+		struct lvm2_cache_file_record *record;
+		size_t j;
+
+		err = lvm2_read_mda_info(dev, &pv_info.metadata_areas[i],
+			mda_info);
+		if(err) {
+			LogError("Error while reading mda_header of metadata "
+				"area %" FMTzu ": %d (%s)", ARGzu(i), err,
+				strerror(err));
+			mda_err = err;
+			err = 0;
+			continue;
+		}
+		else if(!mda_info->valid) {
+			continue;
+		}
+
+		device.mda_checksums[i] = mda_info->checksum;
+
+		for(j = 0; j < i; ++j) {
+			if(area_layouts[j] &&
+				lvm2_mda_info_same_text(&mda_infos[j], mda_info))
+			{
+				break;
+			}
+		}
+
+		if(j < i) {
+			frozen = area_layouts[j];
+		}
+		else if(cache) {
+			frozen = lvm2_cache_file_lookup(cache, &pv_info,
+				mda_info);
+			if(frozen)
+				++hits;
+		}
+
+		if(!frozen) {
+			struct lvm2_layout *layout = NULL;
+
+			err = lvm2_read_text(dev, mda_info->offset,
+				mda_info->size, &mda_info->locn, &layout);
+			if(err) {
+				LogError("Error while reading LVM2 text: %d "
+					"(%s)", err, strerror(err));
+				err = 0;
+				continue;
+			}
+
+			err = lvm2_layout_freeze(layout,
+				&new_layouts[new_layouts_len]);
+			lvm2_layout_destroy(&layout);
+			if(err) {
+				LogError("Error while freezing layout: %d (%s)",
+					err, strerror(err));
+				goto out;
+			}
+
+			frozen = new_layouts[new_layouts_len++];
+		}
+
+		area_layouts[i] = frozen;
+
+		record = &records[records_len++];
+		memcpy(record->pv_uuid, pv_info.pv_uuid, LVM_ID_LEN);
+		record->mda_offset = mda_info->offset;
+		record->mda_checksum = mda_info->checksum;
+		record->seqno = frozen->vg_seqno;
+		record->layout = frozen;
+
+		if(frozen->vg_seqno > device.seqno)
+			device.seqno = frozen->vg_seqno;
+
+		if(!best_layout || frozen->vg_seqno > best_layout->vg_seqno)
+			best_layout = frozen;
+	}
+
+	if(best_layout) {
+		lvm2_frozen_layout_report_volumes(best_layout, &pv_info,
+			&volume_callback, NULL);
+	}
+	else if(mda_err) {
+		/* Nothing to record that the next scan could use. */
+		goto out;
+	}
+
+	LogDebug("Cache hits: %" FMTzu "/%" FMTzu " (label %s%s)", ARGzu(hits),
+		ARGzu(pv_info.metadata_areas_len),
+		label_hit ? "cached" : "decoded",
+		device.no_label ? ", none found" : "");
+
+	/* Keep the records of all other devices, and replace the record of
+	 * this one if anything about it changed. */
+	device_changed = have_identity && (!label_hit ||
+		cached_device.size != device.size ||
+		cached_device.generation != device.generation ||
+		cached_device.seqno != device.seqno ||
+		memcmp(cached_device.mda_checksums, device.mda_checksums,
+		sizeof(device.mda_checksums)));
+
+	if(cache)
+		old_devices_len = lvm2_cache_file_get_devices_len(cache);
+
+	devices = malloc((old_devices_len + 1) *
+		sizeof(struct lvm2_cache_file_device));
+	if(!devices) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for(i = 0; i < old_devices_len; ++i) {
+		lvm2_cache_file_get_device(cache, i, &devices[devices_len]);
+		if(!have_identity || devices[devices_len].dev != device.dev ||
+			devices[devices_len].ino != device.ino)
+		{
+			++devices_len;
+		}
+	}
+
+	if(have_identity)
+		devices[devices_len++] = device;
+
+	/* Only rewrite the cache file if something changed. */
+	if(!cache || new_layouts_len || records_len != old_records_len ||
+		device_changed)
+	{
+		err = lvm2_cache_file_write(cache_path, records, records_len,
+			devices, devices_len);
+		if(err) {
+			LogError("Error while writing cache file \"%s\": %d "
+				"(%s)", cache_path, err, strerror(err));
+			goto out;
+		}
 	}
 
+	if(device.no_label)
+		goto out;
+
+	ret = (EXIT_SUCCESS);
+out:
+	for(i = 0; i < new_layouts_len; ++i)
+		lvm2_frozen_layout_destroy(&new_layouts[i]);
+	if(devices)
+		free(devices);
+	if(records)
+		free(records);
+	if(dev)
+		close_device(&dev);
+	if(cache)
+		lvm2_cache_file_close(&cache);
+
 	return ret;
 }
 
@@ -339,15 +1456,128 @@ int main(int argc, char **argv)
 		return (EXIT_FAILURE);
 	}
 
-	if(argc != 2) {
-		fprintf(stderr, "usage: %s <file>\n",
-			argc ? argv[0] : "<null>");
+	const char *const prog_name = argc ? argv[0] : "<null>";
+
+	int ret;
+
+	while(argc > 1) {
+		if(!strcmp(argv[1], "-d")) {
+			/* Direct I/O, bypassing the page cache. */
+			device_flags |= LVM2_UNIX_DEVICE_DIRECT;
+		}
+		else if(!strcmp(argv[1], "-s")) {
+			/* Collect and print I/O statistics. */
+			device_flags |= LVM2_UNIX_DEVICE_STATS;
+		}
+		else if(!strcmp(argv[1], "-r")) {
+			io_hints = LVM2_TRUE;
+		}
+		else if(!strcmp(argv[1], "-a")) {
+			async_scan = LVM2_TRUE;
+		}
+		else if(!strcmp(argv[1], "-w")) {
+			pipeline_scan = LVM2_TRUE;
+		}
+		else if(!strcmp(argv[1], "-l")) {
+			dump_layouts = LVM2_TRUE;
+		}
+		else if(!strcmp(argv[1], "-g")) {
+			assemble_vgs = LVM2_TRUE;
+		}
+		else if(!strcmp(argv[1], "-m") && argc > 2) {
+			/* Benchmark parsing of devices loaded into memory. */
+			benchmark_iterations = strtoul(argv[2], NULL, 10);
+
+			--argc;
+			++argv;
+		}
+		else if(!strcmp(argv[1], "-n") && argc > 2) {
+			/* Rescan the device after scanning it. */
+			rescans = strtoul(argv[2], NULL, 10);
+
+			--argc;
+			++argv;
+		}
+		else if(!strcmp(argv[1], "-j") && argc > 2) {
+			/* Scan on a pool of threads. */
+			scan_threads = strtoul(argv[2], NULL, 10);
+
+			--argc;
+			++argv;
+		}
+		else if(!strcmp(argv[1], "-b") && argc > 2) {
+			/* Read through a block cache of the given size. */
+			const int err = lvm2_block_cache_create(
+				LVM2_BLOCK_CACHE_BLOCK_SIZE,
+				strtoul(argv[2], NULL, 10), &block_cache);
+			if(err) {
+				LogError("Error while creating block cache: "
+					"%d (%s)", err, strerror(err));
+				return (EXIT_FAILURE);
+			}
+
+			--argc;
+			++argv;
+		}
+		else {
+			break;
+		}
+
+		--argc;
+		++argv;
+	}
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s [-a] [-d] [-g] [-l] [-r] [-s] [-w] "
+			"[-b <blocks>] [-j <threads>] [-m <iterations>] "
+			"[-n <rescans>] [-c <cachefile>] <file> [<file>...]\n",
+			prog_name);
 		exit(EXIT_FAILURE);
 		return (EXIT_FAILURE);
 	}
 
-	if(1)
-		return read_device_main(argv[1]);
+	if(argc == 4 && !strcmp(argv[1], "-c"))
+		ret = read_device_cached_main(argv[2], argv[3]);
+	else if(scan_threads && benchmark_iterations)
+		ret = scan_benchmark_main(benchmark_iterations,
+			(size_t) scan_threads, argc - 1,
+			(const char**) &argv[1]);
+	else if(assemble_vgs)
+		ret = assemble_main(pipeline_scan ? &lvm2_pipeline_scan :
+			&lvm2_parallel_scan, scan_threads ? (size_t) scan_threads :
+			1, argc - 1, (const char**) &argv[1]);
+	else if(scan_threads)
+		ret = parallel_scan_main(pipeline_scan ? &lvm2_pipeline_scan :
+			&lvm2_parallel_scan, (size_t) scan_threads, argc - 1,
+			(const char**) &argv[1]);
+	else if(benchmark_iterations)
+		ret = benchmark_main(benchmark_iterations, argc - 1,
+			(const char**) &argv[1]);
+	else if(rescans && argc == 2)
+		ret = rescan_main(rescans, argv[1]);
+	else if(async_scan)
+		ret = read_devices_async_main(argc - 1,
+			(const char**) &argv[1]);
+	else if(argc > 2)
+		ret = read_devices_main(argc - 1, (const char**) &argv[1]);
+	else if(1)
+		ret = read_device_main(argv[1]);
 	else
-		return read_text_main(argv[1]);
+		ret = read_text_main(argv[1]);
+
+	if(device_flags & LVM2_UNIX_DEVICE_STATS)
+		print_io_stats();
+
+	if(block_cache) {
+		struct lvm2_block_cache_stats stats;
+
+		lvm2_block_cache_get_stats(block_cache, &stats);
+		fprintf(stderr, "Block cache: %" FMTllu " hits, %" FMTllu " "
+			"misses, %" FMTllu " bypassed.\n", ARGllu(stats.hits),
+			ARGllu(stats.misses), ARGllu(stats.bypassed));
+
+		lvm2_block_cache_destroy(&block_cache);
+	}
+
+	return ret;
 }
@@ -0,0 +1,790 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_cache_file.h"
+#include "lvm2_log.h"
+#include "lvm2_osal.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LVM2_CACHE_FILE_MAGIC "LVM2LCF1"
+#define LVM2_CACHE_FILE_VERSION 4
+
+/** Device entry flag: the label scan sectors hold no LVM label. */
+#define LVM2_CACHE_FILE_DEVICE_NO_LABEL 0x1
+
+#if defined(__APPLE__)
+#define LVM2_STAT_MTIME(st) ((st)->st_mtimespec)
+#else
+#define LVM2_STAT_MTIME(st) ((st)->st_mtim)
+#endif
+
+/*
+ * On-disk format: a header, followed by the entries sorted by key, the device
+ * entries sorted by identity and then the frozen layouts, each aligned to 8
+ * bytes. The header holds a CRC of everything after it, so that a damaged file
+ * is rejected as a whole rather than served as scan results.
+ */
+
+struct lvm2_cache_file_header {
+	char magic[8];
+	u32 version;
+	u32 entries_len;
+	u64 size;		/**< Size of the whole file. */
+	u32 devices_len;
+	u32 checksum;		/**< CRC of everything after the header. */
+};
+
+struct lvm2_cache_file_entry {
+	char pv_uuid[LVM_ID_LEN];
+	u64 mda_offset;
+	u32 mda_checksum;
+	u32 layout_size;
+	u64 layout_offset;
+	u64 seqno;
+};
+
+struct lvm2_cache_file_device_entry {
+	u64 dev;
+	u64 ino;
+	u64 size;
+	u64 generation;
+	u32 flags;
+	u32 label_checksum;
+	u32 label_sector;
+	u32 reserved;
+	char pv_uuid[LVM_ID_LEN];
+	u64 device_size;
+	u32 data_areas_len;
+	u32 metadata_areas_len;
+	struct lvm2_disk_area metadata_areas[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	u32 mda_checksums[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	u64 seqno;
+};
+
+struct lvm2_cache_file {
+	void *map;
+	size_t map_size;
+	const struct lvm2_cache_file_header *header;
+	const struct lvm2_cache_file_entry *entries;
+	const struct lvm2_cache_file_device_entry *devices;
+};
+
+static int lvm2_cache_file_compare_identity(const u64 a_dev, const u64 a_ino,
+		const u64 b_dev, const u64 b_ino)
+{
+	if(a_dev != b_dev)
+		return (a_dev < b_dev) ? -1 : 1;
+	else if(a_ino != b_ino)
+		return (a_ino < b_ino) ? -1 : 1;
+	else
+		return 0;
+}
+
+static int lvm2_cache_file_compare_devices(const void *const a,
+		const void *const b)
+{
+	const struct lvm2_cache_file_device *const a_device =
+		(const struct lvm2_cache_file_device*) a;
+	const struct lvm2_cache_file_device *const b_device =
+		(const struct lvm2_cache_file_device*) b;
+
+	return lvm2_cache_file_compare_identity(a_device->dev, a_device->ino,
+		b_device->dev, b_device->ino);
+}
+
+static int lvm2_cache_file_compare_key(const char *const a_uuid,
+		const u64 a_mda_offset, const char *const b_uuid,
+		const u64 b_mda_offset)
+{
+	const int res = memcmp(a_uuid, b_uuid, LVM_ID_LEN);
+
+	if(res)
+		return res;
+	else if(a_mda_offset != b_mda_offset)
+		return (a_mda_offset < b_mda_offset) ? -1 : 1;
+	else
+		return 0;
+}
+
+static int lvm2_cache_file_compare_records(const void *const a,
+		const void *const b)
+{
+	const struct lvm2_cache_file_record *const a_record =
+		(const struct lvm2_cache_file_record*) a;
+	const struct lvm2_cache_file_record *const b_record =
+		(const struct lvm2_cache_file_record*) b;
+
+	return lvm2_cache_file_compare_key(a_record->pv_uuid,
+		a_record->mda_offset, b_record->pv_uuid,
+		b_record->mda_offset);
+}
+
+static lvm2_bool lvm2_cache_file_validate(const void *const map,
+		const size_t map_size)
+{
+	const struct lvm2_cache_file_header *const header =
+		(const struct lvm2_cache_file_header*) map;
+	const struct lvm2_cache_file_entry *entries;
+	const struct lvm2_cache_file_device_entry *devices;
+	u64 entries_end;
+	u32 i;
+
+	if(map_size < sizeof(struct lvm2_cache_file_header) ||
+		memcmp(header->magic, LVM2_CACHE_FILE_MAGIC, 8) ||
+		header->version != LVM2_CACHE_FILE_VERSION ||
+		header->size != map_size)
+	{
+		LogError("Invalid cache file header.");
+		return LVM2_FALSE;
+	}
+
+	if(lvm2_calc_crc(LVM_INITIAL_CRC, header + 1,
+		map_size - sizeof(struct lvm2_cache_file_header)) !=
+		header->checksum)
+	{
+		LogError("Cache file checksum mismatch.");
+		return LVM2_FALSE;
+	}
+
+	entries = (const struct lvm2_cache_file_entry*) (header + 1);
+	devices = (const struct lvm2_cache_file_device_entry*)
+		(entries + header->entries_len);
+	entries_end = sizeof(struct lvm2_cache_file_header) +
+		(u64) header->entries_len *
+		sizeof(struct lvm2_cache_file_entry) +
+		(u64) header->devices_len *
+		sizeof(struct lvm2_cache_file_device_entry);
+	if(entries_end > map_size) {
+		LogError("Cache file entries out of range.");
+		return LVM2_FALSE;
+	}
+
+	for(i = 0; i < header->devices_len; ++i) {
+		/* The label fields are handed out as a pv_info, so they have
+		 * to be within what lvm2_parse_pv_info would produce. */
+		if(devices[i].metadata_areas_len >
+			LVM2_PV_INFO_MAX_METADATA_AREAS ||
+			devices[i].data_areas_len !=
+			devices[i].metadata_areas_len ||
+			devices[i].label_sector >= LVM_LABEL_SCAN_SECTORS)
+		{
+			LogError("Cache file device %" FMTlu " out of range.",
+				ARGlu(i));
+			return LVM2_FALSE;
+		}
+
+		if(i != 0 && lvm2_cache_file_compare_identity(
+			devices[i - 1].dev, devices[i - 1].ino,
+			devices[i].dev, devices[i].ino) >= 0)
+		{
+			LogError("Cache file devices out of order.");
+			return LVM2_FALSE;
+		}
+	}
+
+	for(i = 0; i < header->entries_len; ++i) {
+		const struct lvm2_cache_file_entry *const entry = &entries[i];
+
+		/* Compared without adding, so that an offset near the end
+		 * of the u64 range can't wrap around. */
+		if(entry->layout_offset < entries_end ||
+			entry->layout_offset % 8 != 0 ||
+			entry->layout_offset > map_size ||
+			entry->layout_size > map_size - entry->layout_offset)
+		{
+			LogError("Cache file entry %" FMTlu " out of range.",
+				ARGlu(i));
+			return LVM2_FALSE;
+		}
+
+		if(i != 0 && lvm2_cache_file_compare_key(
+			entries[i - 1].pv_uuid, entries[i - 1].mda_offset,
+			entry->pv_uuid, entry->mda_offset) >= 0)
+		{
+			LogError("Cache file entries out of order.");
+			return LVM2_FALSE;
+		}
+
+		if(!lvm2_frozen_layout_validate(
+			(const char*) map + entry->layout_offset,
+			entry->layout_size))
+		{
+			LogError("Invalid layout in cache file entry "
+				"%" FMTlu ".", ARGlu(i));
+			return LVM2_FALSE;
+		}
+	}
+
+	return LVM2_TRUE;
+}
+
+int lvm2_cache_file_open(const char *const path,
+		struct lvm2_cache_file **const out_cache)
+{
+	int err;
+	int fd;
+	struct stat stbuf;
+	void *map = MAP_FAILED;
+	struct lvm2_cache_file *cache = NULL;
+
+	fd = open(path, O_RDONLY);
+	if(fd == -1) {
+		return errno ? errno : ENOENT;
+	}
+
+	if(fstat(fd, &stbuf) == -1) {
+		err = errno ? errno : EIO;
+		goto out;
+	}
+
+	if(stbuf.st_size <= 0 || (u64) stbuf.st_size > SIZE_MAX) {
+		err = EINVAL;
+		goto out;
+	}
+
+	map = mmap(NULL, (size_t) stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		err = errno ? errno : EIO;
+		LogError("Error while mapping cache file: %d (%s)",
+			err, strerror(err));
+		goto out;
+	}
+
+	if(!lvm2_cache_file_validate(map, (size_t) stbuf.st_size)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	err = lvm2_malloc(sizeof(struct lvm2_cache_file), (void**) &cache);
+	if(err)
+		goto out;
+
+	memset(cache, 0, sizeof(struct lvm2_cache_file));
+	cache->map = map;
+	cache->map_size = (size_t) stbuf.st_size;
+	cache->header = (const struct lvm2_cache_file_header*) map;
+	cache->entries = (const struct lvm2_cache_file_entry*)
+		(cache->header + 1);
+	cache->devices = (const struct lvm2_cache_file_device_entry*)
+		(cache->entries + cache->header->entries_len);
+
+	*out_cache = cache;
+out:
+	if(err && map != MAP_FAILED)
+		munmap(map, (size_t) stbuf.st_size);
+
+	close(fd);
+
+	return err;
+}
+
+void lvm2_cache_file_close(struct lvm2_cache_file **const cache)
+{
+	if(munmap((*cache)->map, (*cache)->map_size) == -1) {
+		LogError("Ignoring error on munmap: %d (%s)",
+			errno, strerror(errno));
+	}
+
+	lvm2_free((void**) cache, sizeof(struct lvm2_cache_file));
+}
+
+const struct lvm2_frozen_layout* lvm2_cache_file_lookup(
+		const struct lvm2_cache_file *const cache,
+		const struct lvm2_pv_info *const pv_info,
+		const struct lvm2_mda_info *const mda_info)
+{
+	size_t low = 0;
+	size_t high = cache->header->entries_len;
+
+	while(low < high) {
+		const size_t mid = low + (high - low) / 2;
+		const struct lvm2_cache_file_entry *const entry =
+			&cache->entries[mid];
+		const int res = lvm2_cache_file_compare_key(entry->pv_uuid,
+			entry->mda_offset, pv_info->pv_uuid, mda_info->offset);
+
+		if(res < 0) {
+			low = mid + 1;
+		}
+		else if(res > 0) {
+			high = mid;
+		}
+		else if(entry->mda_checksum != mda_info->checksum) {
+			LogDebug("Stale cache entry (mda_header checksum "
+				"0x%08" FMTlX " != 0x%08" FMTlX ").",
+				ARGlX(entry->mda_checksum),
+				ARGlX(mda_info->checksum));
+			return NULL;
+		}
+		else {
+			return (const struct lvm2_frozen_layout*)
+				((const char*) cache->map +
+				entry->layout_offset);
+		}
+	}
+
+	return NULL;
+}
+
+size_t lvm2_cache_file_get_records_len(
+		const struct lvm2_cache_file *const cache)
+{
+	return cache->header->entries_len;
+}
+
+void lvm2_cache_file_get_record(const struct lvm2_cache_file *const cache,
+		const size_t index, struct lvm2_cache_file_record *out_record)
+{
+	const struct lvm2_cache_file_entry *const entry =
+		&cache->entries[index];
+
+	memcpy(out_record->pv_uuid, entry->pv_uuid, LVM_ID_LEN);
+	out_record->mda_offset = entry->mda_offset;
+	out_record->mda_checksum = entry->mda_checksum;
+	out_record->seqno = entry->seqno;
+	out_record->layout = (const struct lvm2_frozen_layout*)
+		((const char*) cache->map + entry->layout_offset);
+}
+
+int lvm2_cache_file_get_identity(const char *const path,
+		struct lvm2_cache_file_device *const out_device)
+{
+	struct stat stbuf;
+
+	if(stat(path, &stbuf) == -1)
+		return errno ? errno : EIO;
+
+	memset(out_device, 0, sizeof(struct lvm2_cache_file_device));
+	out_device->dev = (u64) stbuf.st_dev;
+	out_device->ino = (u64) stbuf.st_ino;
+
+	/* Writes to a regular file show in its mtime. The mtime of a device
+	 * node doesn't change when the device is written, so the contents of
+	 * devices always have to be checked. */
+	if(S_ISREG(stbuf.st_mode)) {
+		out_device->size = (u64) stbuf.st_size;
+		out_device->generation =
+			(u64) LVM2_STAT_MTIME(&stbuf).tv_sec * 1000000000 +
+			(u64) LVM2_STAT_MTIME(&stbuf).tv_nsec;
+	}
+
+	return 0;
+}
+
+lvm2_bool lvm2_cache_file_device_unchanged(
+		const struct lvm2_cache_file_device *const cached,
+		const struct lvm2_cache_file_device *const device)
+{
+	return cached->generation && cached->generation ==
+		device->generation && cached->size == device->size;
+}
+
+static void lvm2_cache_file_get_device_entry(
+		const struct lvm2_cache_file_device_entry *const entry,
+		struct lvm2_cache_file_device *const out_device)
+{
+	u32 i;
+
+	memset(out_device, 0, sizeof(struct lvm2_cache_file_device));
+	out_device->dev = entry->dev;
+	out_device->ino = entry->ino;
+	out_device->size = entry->size;
+	out_device->generation = entry->generation;
+	out_device->no_label = (entry->flags &
+		LVM2_CACHE_FILE_DEVICE_NO_LABEL) ? LVM2_TRUE : LVM2_FALSE;
+	out_device->label_checksum = entry->label_checksum;
+	memcpy(out_device->pv_info.pv_uuid, entry->pv_uuid, LVM_ID_LEN);
+	out_device->pv_info.device_size = entry->device_size;
+	out_device->pv_info.label_sector = entry->label_sector;
+	out_device->pv_info.data_areas_len = entry->data_areas_len;
+	out_device->pv_info.metadata_areas_len = entry->metadata_areas_len;
+	for(i = 0; i < entry->metadata_areas_len; ++i) {
+		out_device->pv_info.metadata_areas[i] =
+			entry->metadata_areas[i];
+		out_device->mda_checksums[i] = entry->mda_checksums[i];
+	}
+	out_device->seqno = entry->seqno;
+}
+
+lvm2_bool lvm2_cache_file_lookup_device(
+		const struct lvm2_cache_file *const cache, const u64 dev,
+		const u64 ino, struct lvm2_cache_file_device *const out_device)
+{
+	size_t low = 0;
+	size_t high = cache->header->devices_len;
+
+	while(low < high) {
+		const size_t mid = low + (high - low) / 2;
+		const struct lvm2_cache_file_device_entry *const entry =
+			&cache->devices[mid];
+		const int res = lvm2_cache_file_compare_identity(entry->dev,
+			entry->ino, dev, ino);
+
+		if(res < 0) {
+			low = mid + 1;
+		}
+		else if(res > 0) {
+			high = mid;
+		}
+		else {
+			lvm2_cache_file_get_device_entry(entry, out_device);
+			return LVM2_TRUE;
+		}
+	}
+
+	return LVM2_FALSE;
+}
+
+size_t lvm2_cache_file_get_devices_len(
+		const struct lvm2_cache_file *const cache)
+{
+	return cache->header->devices_len;
+}
+
+void lvm2_cache_file_get_device(const struct lvm2_cache_file *const cache,
+		const size_t index, struct lvm2_cache_file_device *out_device)
+{
+	lvm2_cache_file_get_device_entry(&cache->devices[index], out_device);
+}
+
+int lvm2_cache_file_read_pv_info(struct lvm2_device *const dev,
+		const struct lvm2_cache_file_device *const cached,
+		struct lvm2_cache_file_device *const device,
+		lvm2_bool *const out_hit)
+{
+	const u32 alignment = lvm2_device_get_alignment(dev);
+	const size_t window_size = LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE;
+
+	int err;
+	struct lvm2_io_buffer *buffer = NULL;
+	const void *window;
+	u32 checksum;
+
+	if(lvm2_device_map_range(dev, 0, window_size, &window)) {
+		err = lvm2_io_buffer_create((window_size + alignment - 1) /
+			alignment * alignment, &buffer);
+		if(err) {
+			LogError("Error while allocating label buffer.");
+			return err;
+		}
+
+		err = lvm2_device_read(dev, 0,
+			lvm2_io_buffer_get_size(buffer), buffer);
+		if(err) {
+			LogError("Error while reading label scan sectors.");
+			goto out;
+		}
+
+		window = lvm2_io_buffer_get_bytes(buffer);
+	}
+
+	checksum = lvm2_calc_crc(LVM_INITIAL_CRC, window, window_size);
+	if(cached && cached->label_checksum == checksum) {
+		device->pv_info = cached->pv_info;
+		device->no_label = cached->no_label;
+		*out_hit = LVM2_TRUE;
+		err = cached->no_label ? EIO : 0;
+	}
+	else {
+		err = lvm2_parse_pv_info(window, window_size,
+			&device->pv_info);
+		device->no_label = err ? LVM2_TRUE : LVM2_FALSE;
+		*out_hit = LVM2_FALSE;
+	}
+
+	if(device->no_label)
+		memset(&device->pv_info, 0, sizeof(struct lvm2_pv_info));
+
+	device->label_checksum = checksum;
+out:
+	if(buffer)
+		lvm2_io_buffer_destroy(&buffer);
+
+	return err;
+}
+
+static int lvm2_cache_file_write_fully(const int fd, const void *const data,
+		const size_t size)
+{
+	size_t written = 0;
+
+	while(written < size) {
+		const ssize_t res = write(fd, (const char*) data + written,
+			size - written);
+
+		if(res == -1) {
+			if(errno == EINTR)
+				continue;
+			return errno ? errno : EIO;
+		}
+
+		written += (size_t) res;
+	}
+
+	return 0;
+}
+
+int lvm2_cache_file_write(const char *const path,
+		const struct lvm2_cache_file_record *const records,
+		const size_t records_len,
+		const struct lvm2_cache_file_device *const devices,
+		const size_t devices_len)
+{
+	static const char zeroes[8] = { 0 };
+
+	int err;
+	int fd = -1;
+	char *tmp_path = NULL;
+	size_t tmp_path_size;
+	struct lvm2_cache_file_record *sorted = NULL;
+	struct lvm2_cache_file_header header;
+	struct lvm2_cache_file_entry *entries = NULL;
+	struct lvm2_cache_file_device *sorted_devices = NULL;
+	struct lvm2_cache_file_device_entry *device_entries = NULL;
+	u64 offset;
+	u32 checksum;
+	size_t i;
+	size_t j;
+
+	if(records_len > U32_MAX || devices_len > U32_MAX)
+		return EINVAL;
+
+	tmp_path_size = strlen(path) + sizeof(".tmp");
+	err = lvm2_malloc(tmp_path_size, (void**) &tmp_path);
+	if(err)
+		goto out;
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+
+	if(records_len) {
+		err = lvm2_malloc(records_len *
+			sizeof(struct lvm2_cache_file_record),
+			(void**) &sorted);
+		if(err)
+			goto out;
+
+		err = lvm2_malloc(records_len *
+			sizeof(struct lvm2_cache_file_entry),
+			(void**) &entries);
+		if(err)
+			goto out;
+
+		memcpy(sorted, records, records_len *
+			sizeof(struct lvm2_cache_file_record));
+		qsort(sorted, records_len,
+			sizeof(struct lvm2_cache_file_record),
+			lvm2_cache_file_compare_records);
+
+		for(i = 1; i < records_len; ++i) {
+			if(!lvm2_cache_file_compare_records(&sorted[i - 1],
+				&sorted[i]))
+			{
+				LogError("Duplicate cache file record.");
+				err = EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	if(devices_len) {
+		err = lvm2_malloc(devices_len *
+			sizeof(struct lvm2_cache_file_device),
+			(void**) &sorted_devices);
+		if(err)
+			goto out;
+
+		err = lvm2_malloc(devices_len *
+			sizeof(struct lvm2_cache_file_device_entry),
+			(void**) &device_entries);
+		if(err)
+			goto out;
+
+		memcpy(sorted_devices, devices, devices_len *
+			sizeof(struct lvm2_cache_file_device));
+		qsort(sorted_devices, devices_len,
+			sizeof(struct lvm2_cache_file_device),
+			lvm2_cache_file_compare_devices);
+
+		for(i = 0; i < devices_len; ++i) {
+			const struct lvm2_cache_file_device *const device =
+				&sorted_devices[i];
+			struct lvm2_cache_file_device_entry *const cur =
+				&device_entries[i];
+
+			if(i != 0 && !lvm2_cache_file_compare_devices(
+				&sorted_devices[i - 1], device))
+			{
+				LogError("Duplicate cache file device.");
+				err = EINVAL;
+				goto out;
+			}
+
+			memset(cur, 0,
+				sizeof(struct lvm2_cache_file_device_entry));
+			cur->dev = device->dev;
+			cur->ino = device->ino;
+			cur->size = device->size;
+			cur->generation = device->generation;
+			cur->flags = device->no_label ?
+				LVM2_CACHE_FILE_DEVICE_NO_LABEL : 0;
+			cur->label_checksum = device->label_checksum;
+			cur->label_sector = device->pv_info.label_sector;
+			memcpy(cur->pv_uuid, device->pv_info.pv_uuid,
+				LVM_ID_LEN);
+			cur->device_size = device->pv_info.device_size;
+			cur->data_areas_len =
+				(u32) device->pv_info.data_areas_len;
+			cur->metadata_areas_len =
+				(u32) device->pv_info.metadata_areas_len;
+			for(j = 0; j < device->pv_info.metadata_areas_len;
+				++j)
+			{
+				cur->metadata_areas[j] =
+					device->pv_info.metadata_areas[j];
+				cur->mda_checksums[j] =
+					device->mda_checksums[j];
+			}
+			cur->seqno = device->seqno;
+		}
+	}
+
+	memset(&header, 0, sizeof(struct lvm2_cache_file_header));
+	memcpy(header.magic, LVM2_CACHE_FILE_MAGIC, 8);
+	header.version = LVM2_CACHE_FILE_VERSION;
+	header.devices_len = (u32) devices_len;
+
+	offset = sizeof(struct lvm2_cache_file_header) +
+		records_len * sizeof(struct lvm2_cache_file_entry) +
+		devices_len * sizeof(struct lvm2_cache_file_device_entry);
+	for(i = 0; i < records_len; ++i) {
+		struct lvm2_cache_file_entry *const cur =
+			&entries[header.entries_len];
+
+		memset(cur, 0, sizeof(struct lvm2_cache_file_entry));
+		memcpy(cur->pv_uuid, sorted[i].pv_uuid, LVM_ID_LEN);
+		cur->mda_offset = sorted[i].mda_offset;
+		cur->mda_checksum = sorted[i].mda_checksum;
+		cur->seqno = sorted[i].seqno;
+		cur->layout_size = sorted[i].layout->size;
+		cur->layout_offset = offset;
+
+		offset += (sorted[i].layout->size + 7) / 8 * 8;
+		++header.entries_len;
+	}
+	header.size = offset;
+
+	/* The CRC covers the rest of the file in the order it is written
+	 * below. */
+	checksum = LVM_INITIAL_CRC;
+	checksum = lvm2_calc_crc(checksum, entries,
+		header.entries_len * sizeof(struct lvm2_cache_file_entry));
+	checksum = lvm2_calc_crc(checksum, device_entries,
+		header.devices_len *
+		sizeof(struct lvm2_cache_file_device_entry));
+	for(i = 0; i < records_len; ++i) {
+		const u32 size = sorted[i].layout->size;
+
+		checksum = lvm2_calc_crc(checksum, sorted[i].layout, size);
+		if(size % 8 != 0) {
+			checksum = lvm2_calc_crc(checksum, zeroes,
+				8 - size % 8);
+		}
+	}
+	header.checksum = checksum;
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1) {
+		err = errno ? errno : EIO;
+		LogError("Error while creating \"%s\": %d (%s)",
+			tmp_path, err, strerror(err));
+		goto out;
+	}
+
+	err = lvm2_cache_file_write_fully(fd, &header,
+		sizeof(struct lvm2_cache_file_header));
+	if(!err && header.entries_len) {
+		err = lvm2_cache_file_write_fully(fd, entries,
+			header.entries_len *
+			sizeof(struct lvm2_cache_file_entry));
+	}
+	if(!err && header.devices_len) {
+		err = lvm2_cache_file_write_fully(fd, device_entries,
+			header.devices_len *
+			sizeof(struct lvm2_cache_file_device_entry));
+	}
+
+	for(i = 0; !err && i < records_len; ++i) {
+		const u32 size = sorted[i].layout->size;
+
+		err = lvm2_cache_file_write_fully(fd, sorted[i].layout, size);
+		if(!err && size % 8 != 0) {
+			err = lvm2_cache_file_write_fully(fd, zeroes,
+				8 - size % 8);
+		}
+	}
+
+	if(err) {
+		LogError("Error while writing \"%s\": %d (%s)",
+			tmp_path, err, strerror(err));
+	}
+	else if(fsync(fd) == -1) {
+		err = errno ? errno : EIO;
+	}
+
+	if(close(fd) == -1 && !err)
+		err = errno ? errno : EIO;
+	fd = -1;
+
+	if(!err && rename(tmp_path, path) == -1) {
+		err = errno ? errno : EIO;
+		LogError("Error while renaming \"%s\" to \"%s\": %d (%s)",
+			tmp_path, path, err, strerror(err));
+	}
+
+	if(err)
+		unlink(tmp_path);
+out:
+	if(device_entries) {
+		lvm2_free((void**) &device_entries, devices_len *
+			sizeof(struct lvm2_cache_file_device_entry));
+	}
+	if(sorted_devices) {
+		lvm2_free((void**) &sorted_devices, devices_len *
+			sizeof(struct lvm2_cache_file_device));
+	}
+	if(entries) {
+		lvm2_free((void**) &entries, records_len *
+			sizeof(struct lvm2_cache_file_entry));
+	}
+	if(sorted) {
+		lvm2_free((void**) &sorted, records_len *
+			sizeof(struct lvm2_cache_file_record));
+	}
+	if(tmp_path)
+		lvm2_free((void**) &tmp_path, tmp_path_size);
+
+	return err;
+}
@@ -0,0 +1,137 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_cache_file.h - Persistent cache of frozen layouts.
+ *
+ * The cache file holds one frozen layout (see lvm2_frozen.h) per metadata area
+ * of each PV that has been scanned, keyed by the PV UUID, the offset of the
+ * metadata area and the checksum of its mda_header. The mda_header checksum
+ * covers the location, size and checksum of the metadata text, so if it
+ * matches, the cached layout is the one that parsing the text would produce
+ * and a scanner only has to read the label and the mda_header of the PV.
+ *
+ * It also holds one device record per scanned device, keyed by the identity
+ * of the device (st_dev and st_ino of its path) and holding the checksum of
+ * its label scan sectors together with the decoded label. A scanner that finds
+ * the same sectors on the device again takes the label from the record instead
+ * of decoding it. Devices without an LVM label get a record as well, so that
+ * they are rejected without decoding, and regular files whose size and mtime
+ * haven't changed are rejected without reading them at all.
+ *
+ * The file is mapped into memory and the layouts are used in place. It is
+ * written in host byte order and is not meant to be moved between machines.
+ */
+
+#if !defined(_LVM2_CACHE_FILE_H)
+#define _LVM2_CACHE_FILE_H
+
+#include "lvm2_frozen.h"
+#include "lvm2_text.h"
+
+struct lvm2_cache_file;
+
+struct lvm2_cache_file_record {
+	char pv_uuid[LVM_ID_LEN];
+	u64 mda_offset;
+	u32 mda_checksum;
+	u64 seqno;	/**< VG seqno of the layout. */
+	const struct lvm2_frozen_layout *layout;
+};
+
+struct lvm2_cache_file_device {
+	u64 dev;		/**< st_dev of the device's path. */
+	u64 ino;		/**< st_ino of the device's path. */
+	u64 size;		/**< Size of a regular file, else 0. */
+	u64 generation;		/**< mtime of a regular file, else 0. */
+	lvm2_bool no_label;	/**< No LVM label, 'pv_info' is unused. */
+	u32 label_checksum;	/**< CRC of the label scan sectors. */
+	struct lvm2_pv_info pv_info;
+
+	/** mda_header checksum of each metadata area, 0 if it didn't verify. */
+	u32 mda_checksums[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	u64 seqno;		/**< Highest VG seqno found on the device. */
+};
+
+/**
+ * Map the cache file at 'path'. Returns ENOENT if there is no such file and
+ * EINVAL if the file isn't a valid cache file.
+ */
+int lvm2_cache_file_open(const char *path, struct lvm2_cache_file **out_cache);
+
+void lvm2_cache_file_close(struct lvm2_cache_file **cache);
+
+/**
+ * Look up the cached layout for a metadata area. The returned layout points
+ * into the mapping and stays valid until the cache file is closed.
+ */
+const struct lvm2_frozen_layout* lvm2_cache_file_lookup(
+		const struct lvm2_cache_file *cache,
+		const struct lvm2_pv_info *pv_info,
+		const struct lvm2_mda_info *mda_info);
+
+size_t lvm2_cache_file_get_records_len(const struct lvm2_cache_file *cache);
+
+void lvm2_cache_file_get_record(const struct lvm2_cache_file *cache,
+		size_t index, struct lvm2_cache_file_record *out_record);
+
+/**
+ * Start a device record for the device at 'path', filling in its identity and
+ * generation.
+ */
+int lvm2_cache_file_get_identity(const char *path,
+		struct lvm2_cache_file_device *out_device);
+
+/**
+ * Returns LVM2_TRUE if 'device' is known not to have changed since 'cached'
+ * was recorded, without looking at its contents.
+ */
+lvm2_bool lvm2_cache_file_device_unchanged(
+		const struct lvm2_cache_file_device *cached,
+		const struct lvm2_cache_file_device *device);
+
+/** Look up the record of a device by its identity. */
+lvm2_bool lvm2_cache_file_lookup_device(const struct lvm2_cache_file *cache,
+		u64 dev, u64 ino, struct lvm2_cache_file_device *out_device);
+
+size_t lvm2_cache_file_get_devices_len(const struct lvm2_cache_file *cache);
+
+void lvm2_cache_file_get_device(const struct lvm2_cache_file *cache,
+		size_t index, struct lvm2_cache_file_device *out_device);
+
+/**
+ * Read the label scan sectors of 'dev' and decode its label into the record
+ * 'device', like lvm2_read_pv_info. If the sectors still have the checksum
+ * recorded in 'cached' (may be NULL), the label, or the lack of one, is taken
+ * from the record instead and '*out_hit' is set. If the sectors were read but
+ * hold no label, 'device->no_label' is set and EIO is returned.
+ */
+int lvm2_cache_file_read_pv_info(struct lvm2_device *dev,
+		const struct lvm2_cache_file_device *cached,
+		struct lvm2_cache_file_device *device, lvm2_bool *out_hit);
+
+/**
+ * Write a new cache file with the given records and device records, replacing
+ * any existing file at 'path' atomically.
+ */
+int lvm2_cache_file_write(const char *path,
+		const struct lvm2_cache_file_record *records, size_t records_len,
+		const struct lvm2_cache_file_device *devices,
+		size_t devices_len);
+
+#endif /* !defined(_LVM2_CACHE_FILE_H) */
@@ -16,8 +16,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* O_DIRECT */
+#endif
+
 #include "lvm2_osal.h"
 #include "lvm2_device.h"
+#include "lvm2_block_cache.h"
 
 #include <stdlib.h>
 #include <limits.h>
@@ -26,8 +31,21 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* Updated atomically, since libtlvm may be used from several threads. */
 static long long allocations = 0;
 
 int lvm2_malloc(size_t size, void **out_ptr)
@@ -37,7 +55,7 @@ int lvm2_malloc(size_t size, void **out_ptr)
 	ptr = malloc(size);
 	if(ptr) {
 		*out_ptr = ptr;
-		++allocations;
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
 		return 0;
 	}
 	else {
@@ -50,19 +68,124 @@ void lvm2_free(void **ptr,
 {
 	free(*ptr);
 	*ptr = NULL;
-	--allocations;
+	__atomic_sub_fetch(&allocations, 1, __ATOMIC_RELAXED);
 }
 
 long long lvm2_get_allocations(void);
 
 long long lvm2_get_allocations(void) {
-	return allocations;
+	return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+/* Aligned buffer pool. */
+
+/*
+ * I/O buffers are aligned so that they can be used for O_DIRECT reads, and are
+ * recycled through a pool of power-of-two size classes so that a scan doesn't
+ * keep allocating and freeing aligned memory.
+ */
+
+/** Size of the smallest class, log2. */
+#define LVM2_UNIX_POOL_MIN_SHIFT 12
+/** Number of size classes (4 KiB - 8 MiB). */
+#define LVM2_UNIX_POOL_CLASSES 12
+/** Number of free buffers kept per class. */
+#define LVM2_UNIX_POOL_DEPTH 8
+
+static struct {
+	pthread_mutex_t lock;
+	size_t free_len[LVM2_UNIX_POOL_CLASSES];
+	void *free[LVM2_UNIX_POOL_CLASSES][LVM2_UNIX_POOL_DEPTH];
+} lvm2_unix_pool = { PTHREAD_MUTEX_INITIALIZER, { 0 }, { { NULL } } };
+
+/**
+ * Returns the pool class for 'size', or LVM2_UNIX_POOL_CLASSES if the size is
+ * too large to be pooled.
+ */
+static size_t lvm2_unix_pool_class(const size_t size)
+{
+	size_t class_no = 0;
+
+	while(class_no < LVM2_UNIX_POOL_CLASSES &&
+		((size_t) 1 << (LVM2_UNIX_POOL_MIN_SHIFT + class_no)) < size)
+	{
+		++class_no;
+	}
+
+	return class_no;
+}
+
+/**
+ * Allocate at least 'size' bytes aligned to 'alignment', which must be a power
+ * of two. Pooled buffers only have LVM2_UNIX_IO_BUFFER_ALIGNMENT, so larger
+ * alignments are always allocated fresh. Freed buffers go back to the pool
+ * either way, since over-aligned buffers serve any request.
+ */
+static int lvm2_unix_aligned_alloc(const size_t size, const size_t alignment,
+		void **const out_ptr, size_t *const out_alloc_size)
+{
+	const size_t class_no = lvm2_unix_pool_class(size);
+
+	int err;
+	void *ptr = NULL;
+	size_t alloc_size;
+
+	if(class_no < LVM2_UNIX_POOL_CLASSES) {
+		alloc_size = (size_t) 1 << (LVM2_UNIX_POOL_MIN_SHIFT +
+			class_no);
+
+		pthread_mutex_lock(&lvm2_unix_pool.lock);
+		if(alignment <= LVM2_UNIX_IO_BUFFER_ALIGNMENT &&
+			lvm2_unix_pool.free_len[class_no])
+		{
+			ptr = lvm2_unix_pool.free[class_no]
+				[--lvm2_unix_pool.free_len[class_no]];
+		}
+		pthread_mutex_unlock(&lvm2_unix_pool.lock);
+	}
+	else {
+		alloc_size = size;
+	}
+
+	if(!ptr) {
+		err = posix_memalign(&ptr,
+			(alignment > LVM2_UNIX_IO_BUFFER_ALIGNMENT) ?
+			alignment : LVM2_UNIX_IO_BUFFER_ALIGNMENT, alloc_size);
+		if(err)
+			return err;
+	}
+
+	*out_ptr = ptr;
+	*out_alloc_size = alloc_size;
+
+	return 0;
+}
+
+static void lvm2_unix_aligned_free(void **const ptr, const size_t alloc_size)
+{
+	const size_t class_no = lvm2_unix_pool_class(alloc_size);
+
+	if(class_no < LVM2_UNIX_POOL_CLASSES) {
+		pthread_mutex_lock(&lvm2_unix_pool.lock);
+		if(lvm2_unix_pool.free_len[class_no] < LVM2_UNIX_POOL_DEPTH) {
+			lvm2_unix_pool.free[class_no]
+				[lvm2_unix_pool.free_len[class_no]++] = *ptr;
+			*ptr = NULL;
+		}
+		pthread_mutex_unlock(&lvm2_unix_pool.lock);
+	}
+
+	if(*ptr) {
+		free(*ptr);
+		*ptr = NULL;
+	}
 }
 
 /* Device layer implementation. */
 
 struct lvm2_io_buffer {
 	size_t size;
+	size_t alloc_size;
 	void *data;
 };
 
@@ -74,10 +197,13 @@ int lvm2_io_buffer_create(size_t size, struct lvm2_io_buffer **out_buf)
 	err = lvm2_malloc(sizeof(struct lvm2_io_buffer), (void**) &buf);
 	if(!err) {
 		void *data;
+		size_t alloc_size;
 
-		err = lvm2_malloc(size, &data);
+		err = lvm2_unix_aligned_alloc(size,
+			LVM2_UNIX_IO_BUFFER_ALIGNMENT, &data, &alloc_size);
 		if(!err) {
 			buf->size = size;
+			buf->alloc_size = alloc_size;
 			buf->data = data;
 
 			*out_buf = buf;
@@ -96,9 +222,14 @@ const void* lvm2_io_buffer_get_bytes(struct lvm2_io_buffer *buf)
 	return buf->data;
 }
 
+size_t lvm2_io_buffer_get_size(struct lvm2_io_buffer *buf)
+{
+	return buf->size;
+}
+
 void lvm2_io_buffer_destroy(struct lvm2_io_buffer **buf)
 {
-	lvm2_free(&(*buf)->data, (*buf)->size);
+	lvm2_unix_aligned_free(&(*buf)->data, (*buf)->alloc_size);
 	lvm2_free((void**) buf, sizeof(struct lvm2_io_buffer));
 }
 
@@ -182,18 +313,122 @@ static int lvm2_unix_get_block_size(int fd, u32 *out_block_size)
 #error "Add OS-specific ioctl for getting a device's minimum block size here."
 #endif
 
-struct lvm2_device {
+struct lvm2_unix_device {
+	struct lvm2_device dev;	/**< Must be first. */
 	int fd;
 	u32 block_size;
+	lvm2_bool direct;	/**< Reads bypass the page cache. */
+	const void *map;	/**< Mapping of a regular file, or NULL. */
+	size_t map_size;
+	struct lvm2_block_cache *block_cache;
+
+	/* Bounce buffer for unaligned reads, grown to the largest aligned
+	 * request seen and kept until the device is destroyed. Protected by
+	 * bounce_lock, since asynchronous reads of the same device may run
+	 * concurrently. */
+	pthread_mutex_t bounce_lock;
+	void *bounce;
+	size_t bounce_size;
+
+	/* I/O statistics, if LVM2_UNIX_DEVICE_STATS was given. */
+	lvm2_bool stats_enabled;
+	pthread_mutex_t stats_lock;
+	struct lvm2_device_stats stats;
 };
 
+/*
+ * Block caches aren't thread safe and may be shared between devices, so all
+ * use of them from this layer is serialized. The lock is dropped while a
+ * missing block is read from the device.
+ */
+static pthread_mutex_t lvm2_unix_block_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct lvm2_device_ops lvm2_unix_device_ops;
+
 int lvm2_unix_device_create(const char *const name,
 		struct lvm2_device **const out_dev)
+{
+	return lvm2_unix_device_create_ex(name, 0, out_dev);
+}
+
+/**
+ * Make reads from 'fd' bypass the page cache, on systems where this can't be
+ * requested when opening the file.
+ */
+static int lvm2_unix_set_direct(const int fd)
+{
+#if defined(O_DIRECT)
+	/* Set at open time. */
+	(void) fd;
+#elif defined(F_NOCACHE)
+	if(fcntl(fd, F_NOCACHE, 1) == -1)
+		return errno ? errno : EINVAL;
+#else
+	(void) fd;
+	return ENOTSUP;
+#endif
+
+	return 0;
+}
+
+/**
+ * Get the alignment that direct I/O on 'fd' needs. This is the logical block
+ * size of the device (or of the device under a file system), which may be far
+ * smaller than the preferred I/O size in st_blksize. Where it can't be told,
+ * the buffer alignment is assumed, which covers common devices.
+ */
+static int lvm2_unix_get_direct_alignment(const int fd,
+		const struct stat *const stbuf, u32 *const out_alignment)
+{
+#if defined(__linux__) && defined(STATX_DIOALIGN)
+	struct statx stx;
+
+	memset(&stx, 0, sizeof(struct statx));
+	if(!statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) &&
+		(stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align)
+	{
+		*out_alignment = (stx.stx_dio_mem_align >
+			stx.stx_dio_offset_align) ? stx.stx_dio_mem_align :
+			stx.stx_dio_offset_align;
+		return 0;
+	}
+#endif
+
+#if defined(__linux__) && defined(BLKSSZGET)
+	if(S_ISBLK(stbuf->st_mode)) {
+		int sector_size = 0;
+
+		if(ioctl(fd, BLKSSZGET, &sector_size))
+			return errno ? errno : EIO;
+		else if(sector_size <= 0)
+			return ERANGE;
+
+		*out_alignment = (u32) sector_size;
+		return 0;
+	}
+#endif
+
+	if(!S_ISREG(stbuf->st_mode))
+		return lvm2_unix_get_block_size(fd, out_alignment);
+
+	*out_alignment = LVM2_UNIX_IO_BUFFER_ALIGNMENT;
+
+	return 0;
+}
+
+int lvm2_unix_device_create_ex(const char *const name, const u32 flags,
+		struct lvm2_device **const out_dev)
 {
 	int err;
+	int open_flags = O_RDONLY;
 	int fd;
 
-	fd = open(name, O_RDONLY);
+#if defined(O_DIRECT)
+	if(flags & LVM2_UNIX_DEVICE_DIRECT)
+		open_flags |= O_DIRECT;
+#endif
+
+	fd = open(name, open_flags);
 	if(fd == -1) {
 		err = errno ? errno : ENOENT;
 	}
@@ -201,14 +436,51 @@ int lvm2_unix_device_create(const char *const name,
 		int res;
 		struct stat stbuf;
 		u32 block_size;
+		void *map = NULL;
 
 		memset(&stbuf, 0, sizeof(struct stat));
 		res = fstat(fd, &stbuf);
 		if(res == -1) {
 			err = errno ? errno : EIO;
 		}
-		else if(stbuf.st_mode & S_IFREG) {
+		else if(flags & LVM2_UNIX_DEVICE_DIRECT) {
+			/* Reads into io buffers that aren't aligned to this
+			 * go through the bounce buffer, which is. */
+			block_size = 0;
+			err = lvm2_unix_get_direct_alignment(fd, &stbuf,
+				&block_size);
+			if(err) {
+				LogError("Error while getting direct I/O "
+					"alignment for device: %d (%s)", err,
+					strerror(err));
+			}
+			else if(block_size & (block_size - 1)) {
+				LogError("Direct I/O alignment %" FMTlu " is "
+					"not a power of two.",
+					ARGlu(block_size));
+				err = ENOTSUP;
+			}
+		}
+		else if(S_ISREG(stbuf.st_mode)) {
 			block_size = 1;
+			err = 0;
+
+			/* Disk images are mapped, so that reads are served from
+			 * the page cache without a system call and can be
+			 * parsed in place through lvm2_device_map_range. If
+			 * mapping fails we fall back to pread. */
+			if(stbuf.st_size > 0 &&
+				(u64) stbuf.st_size <= SIZE_MAX)
+			{
+				map = mmap(NULL, (size_t) stbuf.st_size,
+					PROT_READ, MAP_SHARED, fd, 0);
+				if(map == MAP_FAILED) {
+					LogDebug("Error while mapping device: "
+						"%d (%s)", errno,
+						strerror(errno));
+					map = NULL;
+				}
+			}
 		}
 		else {
 			block_size = 0;
@@ -219,19 +491,44 @@ int lvm2_unix_device_create(const char *const name,
 			}
 		}
 
+		if(!err && (flags & LVM2_UNIX_DEVICE_DIRECT)) {
+			err = lvm2_unix_set_direct(fd);
+			if(err) {
+				LogError("Error while enabling direct I/O: %d "
+					"(%s)", err, strerror(err));
+			}
+		}
+
 		if(!err) {
-			struct lvm2_device *dev;
+			struct lvm2_unix_device *dev;
 
-			err = lvm2_malloc(sizeof(struct lvm2_device),
+			err = lvm2_malloc(sizeof(struct lvm2_unix_device),
 				(void**) &dev);
 			if(!err) {
-				memset(dev, 0, sizeof(struct lvm2_device));
+				memset(dev, 0, sizeof(struct lvm2_unix_device));
+				dev->dev.ops = &lvm2_unix_device_ops;
+				pthread_mutex_init(&dev->bounce_lock, NULL);
+				pthread_mutex_init(&dev->stats_lock, NULL);
+				dev->stats_enabled =
+					(flags & LVM2_UNIX_DEVICE_STATS) ?
+					LVM2_TRUE : LVM2_FALSE;
 				dev->fd = fd;
 				dev->block_size = block_size;
+				dev->direct =
+					(flags & LVM2_UNIX_DEVICE_DIRECT) ?
+					LVM2_TRUE : LVM2_FALSE;
+				dev->map = map;
+				dev->map_size = map ? (size_t) stbuf.st_size : 0;
 
-				*out_dev = dev;
+				*out_dev = &dev->dev;
 			}
 		}
+
+		if(err) {
+			if(map)
+				munmap(map, (size_t) stbuf.st_size);
+			close(fd);
+		}
 	}
 
 	return err;
@@ -239,20 +536,156 @@ int lvm2_unix_device_create(const char *const name,
 
 void lvm2_unix_device_destroy(struct lvm2_device **dev)
 {
-	if(close((*dev)->fd) == -1) {
+	lvm2_device_destroy(dev);
+}
+
+static void lvm2_unix_device_set_block_cache(struct lvm2_device *const in_dev,
+		struct lvm2_block_cache *const cache)
+{
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+
+	pthread_mutex_lock(&lvm2_unix_block_cache_lock);
+	if(dev->block_cache)
+		lvm2_block_cache_invalidate(dev->block_cache, &dev->dev);
+
+	dev->block_cache = cache;
+	pthread_mutex_unlock(&lvm2_unix_block_cache_lock);
+}
+
+static void lvm2_unix_device_destroy_impl(struct lvm2_device *const in_dev)
+{
+	struct lvm2_unix_device *dev = (struct lvm2_unix_device*) in_dev;
+
+	lvm2_unix_device_set_block_cache(&dev->dev, NULL);
+
+	if(dev->map && munmap((void*) dev->map, dev->map_size) == -1) {
+		LogError("Ignoring error on munmap: %d (%s)",
+			errno, strerror(errno));
+	}
+
+	if(close(dev->fd) == -1) {
 		LogError("Ignoring error on close: %d (%s)",
 			errno, strerror(errno));
 	}
 
-	lvm2_free((void**) dev, sizeof(struct lvm2_device));
+	if(dev->bounce)
+		lvm2_unix_aligned_free(&dev->bounce, dev->bounce_size);
+
+	pthread_mutex_destroy(&dev->stats_lock);
+	pthread_mutex_destroy(&dev->bounce_lock);
+	lvm2_free((void**) &dev, sizeof(struct lvm2_unix_device));
 }
 
-int lvm2_device_read(struct lvm2_device *const dev, const u64 in_pos,
-		const size_t in_count, struct lvm2_io_buffer *const in_buf)
+/* I/O statistics. */
+
+static u64 lvm2_unix_now_us(void)
 {
-	static const off_t max_off_t =
-		((off_t) 1) << ((sizeof(off_t) * 8) - 1);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64) ts.tv_sec * 1000000 + (u64) ts.tv_nsec / 1000;
+}
+
+/**
+ * Record a request to the device that transferred 'transferred' bytes to
+ * satisfy 'requested' bytes of reads, and was issued at 'start_us'.
+ */
+static void lvm2_unix_device_account(struct lvm2_unix_device *const dev,
+		const u64 requested, const u64 transferred, const u64 start_us)
+{
+	u64 latency_us;
+	size_t bucket = 0;
+
+	if(!dev->stats_enabled)
+		return;
+
+	latency_us = lvm2_unix_now_us() - start_us;
+	while(bucket < LVM2_DEVICE_LATENCY_BUCKETS - 1 &&
+		(latency_us >> (bucket + 1)))
+	{
+		++bucket;
+	}
+
+	pthread_mutex_lock(&dev->stats_lock);
+	++dev->stats.reads;
+	dev->stats.bytes += transferred;
+	if(transferred > requested) {
+		++dev->stats.unaligned_reads;
+		dev->stats.wasted_bytes += transferred - requested;
+	}
+	dev->stats.total_latency_us += latency_us;
+	++dev->stats.latency[bucket];
+	pthread_mutex_unlock(&dev->stats_lock);
+}
 
+static int lvm2_unix_device_get_stats(struct lvm2_device *const in_dev,
+		struct lvm2_device_stats *const out_stats)
+{
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+
+	if(!dev->stats_enabled)
+		return ENOTSUP;
+
+	pthread_mutex_lock(&dev->stats_lock);
+	*out_stats = dev->stats;
+	pthread_mutex_unlock(&dev->stats_lock);
+
+	return 0;
+}
+
+/**
+ * Returns LVM2_TRUE if 'data' is aligned well enough to read into it from the
+ * device. Only direct reads care, and only on devices that need more than the
+ * alignment that all io buffers have.
+ */
+static lvm2_bool lvm2_unix_device_can_read_into(
+		const struct lvm2_unix_device *const dev, const void *const data)
+{
+	return (!dev->direct || !((size_t) data % dev->block_size)) ?
+		LVM2_TRUE : LVM2_FALSE;
+}
+
+/**
+ * Make sure that the device's bounce buffer holds at least 'count' bytes. The
+ * caller must hold bounce_lock. It is aligned for direct reads of the device.
+ */
+static int lvm2_unix_device_grow_bounce(struct lvm2_unix_device *const dev,
+		const size_t count)
+{
+	int err;
+	void *new_bounce;
+	size_t new_bounce_size;
+
+	if(count <= dev->bounce_size)
+		return 0;
+
+	err = lvm2_unix_aligned_alloc(count, dev->block_size, &new_bounce,
+		&new_bounce_size);
+	if(err) {
+		LogError("Bounce buffer allocation (%" FMTzu " bytes) failed: "
+			"%d (%s)", ARGzu(count), err, strerror(err));
+		return err;
+	}
+
+	if(dev->bounce)
+		lvm2_unix_aligned_free(&dev->bounce, dev->bounce_size);
+
+	dev->bounce = new_bounce;
+	dev->bounce_size = new_bounce_size;
+
+	return 0;
+}
+
+/**
+ * Read from the device itself, bypassing the block cache. The range checks
+ * have been done by lvm2_device_read.
+ */
+static int lvm2_unix_device_read_uncached(struct lvm2_device *const in_dev,
+		const u64 in_pos, const size_t in_count,
+		struct lvm2_io_buffer *const in_buf)
+{
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
 	int err;
 	ssize_t res;
 
@@ -262,45 +695,32 @@ int lvm2_device_read(struct lvm2_device *const dev, const u64 in_pos,
 	u64 pos;
 	size_t count;
 	void *buf;
-
-	LogDebug("%s: Entering with dev=%p in_pos=%" FMTllu " "
-		"in_count=%" FMTzu " in_buf=%p...",
-		__PRETTY_FUNCTION__, dev, ARGllu(in_pos), ARGzu(in_count),
-		in_buf);
-
-	if(in_pos > (u64) max_off_t)
-		return ERANGE;
-	if(in_count > in_buf->size || in_count > SSIZE_MAX)
-		return ERANGE;
+	u64 start_us;
 
 	lead_in = (u32) (in_pos % dev->block_size);
 	lead_out = (dev->block_size - (u32) ((lead_in + in_count) %
 		dev->block_size)) % dev->block_size;
 
-	if(lead_in != 0 || lead_out != 0) {
-		u64 aligned_pos;
-		size_t aligned_count;
-		void *aligned_buf = NULL;
+	if(lead_in != 0 || lead_out != 0 ||
+		!lvm2_unix_device_can_read_into(dev, in_buf->data))
+	{
+		pos = in_pos - lead_in;
+		count = lead_in + in_count + lead_out;
 
-		aligned_pos = in_pos - lead_in;
-		aligned_count = lead_in + in_count + lead_out;
+		LogDebug("Unaligned read. Aligning (%" FMTllu ", %" FMTzu ") "
+			"-> (%" FMTllu ", %" FMTzu ")...",
+			ARGllu(in_pos), ARGzu(in_count), ARGllu(pos),
+			ARGzu(count));
 
-		LogError("Warning: Unaligned read. Aligning (%" FMTllu ", "
-			"%" FMTzu ") -> (%" FMTllu ", %" FMTzu ")...",
-			ARGllu(in_pos), ARGzu(in_count), ARGllu(aligned_pos),
-			ARGzu(aligned_count));
+		pthread_mutex_lock(&dev->bounce_lock);
 
-		err = lvm2_malloc(aligned_count, &aligned_buf);
+		err = lvm2_unix_device_grow_bounce(dev, count);
 		if(err) {
-			LogError("Temporary memory allocation (%" FMTzu " "
-				"bytes) failed: %d (%s)",
-				ARGzu(aligned_count), err, strerror(err));
+			pthread_mutex_unlock(&dev->bounce_lock);
 			return err;
 		}
 
-		pos = aligned_pos;
-		count = aligned_count;
-		buf = aligned_buf;
+		buf = dev->bounce;
 	}
 	else {
 		pos = in_pos;
@@ -308,6 +728,8 @@ int lvm2_device_read(struct lvm2_device *const dev, const u64 in_pos,
 		buf = in_buf->data;
 	}
 
+	start_us = dev->stats_enabled ? lvm2_unix_now_us() : 0;
+
 	res = pread(dev->fd, buf, count, (off_t) pos);
 	if(res == -1) {
 		err = errno ? errno : EIO;
@@ -318,21 +740,957 @@ int lvm2_device_read(struct lvm2_device *const dev, const u64 in_pos,
 		err = EIO;
 	}
 	else {
+		lvm2_unix_device_account(dev, in_count, count, start_us);
+
 		if(buf != in_buf->data) {
-			memcpy(in_buf, &((char*) buf)[lead_in], in_count);
+			memcpy(in_buf->data, &((char*) buf)[lead_in],
+				in_count);
 		}
 
 		err = 0;
 	}
 
-	if(buf != in_buf->data) {
-		lvm2_free(&buf, count);
+	if(buf != in_buf->data)
+		pthread_mutex_unlock(&dev->bounce_lock);
+
+	return err;
+}
+
+/**
+ * Fill function for the block cache. Called with lvm2_unix_block_cache_lock
+ * held, which is released for the duration of the read so that reads of other
+ * devices sharing the cache aren't held up behind it.
+ */
+static int lvm2_unix_device_read_cache_fill(struct lvm2_device *const dev,
+		const u64 pos, const size_t count,
+		struct lvm2_io_buffer *const buf)
+{
+	int err;
+
+	pthread_mutex_unlock(&lvm2_unix_block_cache_lock);
+	err = lvm2_unix_device_read_uncached(dev, pos, count, buf);
+	pthread_mutex_lock(&lvm2_unix_block_cache_lock);
+
+	return err;
+}
+
+static int lvm2_unix_device_read(struct lvm2_device *const in_dev,
+		const u64 in_pos, const size_t in_count,
+		struct lvm2_io_buffer *const in_buf)
+{
+	static const off_t max_off_t =
+		((off_t) 1) << ((sizeof(off_t) * 8) - 1);
+
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+
+	LogDebug("%s: Entering with dev=%p in_pos=%" FMTllu " "
+		"in_count=%" FMTzu " in_buf=%p...",
+		__PRETTY_FUNCTION__, dev, ARGllu(in_pos), ARGzu(in_count),
+		in_buf);
+
+	if(in_pos > (u64) max_off_t)
+		return ERANGE;
+	if(in_count > in_buf->size || in_count > SSIZE_MAX)
+		return ERANGE;
+
+	if(dev->map) {
+		const u64 start_us =
+			dev->stats_enabled ? lvm2_unix_now_us() : 0;
+
+		/* Same semantics as pread: the full read or nothing. */
+		if(in_pos > dev->map_size || in_count > dev->map_size - in_pos)
+			return EIO;
+
+		memcpy(in_buf->data, &((const char*) dev->map)[in_pos],
+			in_count);
+		lvm2_unix_device_account(dev, in_count, in_count, start_us);
+		return 0;
+	}
+
+	/* If the cache can't serve the read (too large, or a block beyond
+	 * the end of the device), read it directly. */
+	if(dev->block_cache) {
+		int err;
+
+		pthread_mutex_lock(&lvm2_unix_block_cache_lock);
+		err = lvm2_block_cache_read(dev->block_cache, &dev->dev,
+			in_pos, in_count, in_buf->data,
+			lvm2_unix_device_read_cache_fill);
+		pthread_mutex_unlock(&lvm2_unix_block_cache_lock);
+		if(!err)
+			return 0;
+	}
+
+	return lvm2_unix_device_read_uncached(&dev->dev, in_pos, in_count,
+		in_buf);
+}
+
+static u32 lvm2_unix_device_get_alignment(struct lvm2_device *const dev)
+{
+	return ((struct lvm2_unix_device*) dev)->block_size;
+}
+
+static int lvm2_unix_device_map_range(struct lvm2_device *const in_dev,
+		const u64 pos, const size_t count, const void **const out_bytes)
+{
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+
+	if(!dev->map)
+		return ENOTSUP;
+	else if(pos > dev->map_size || count > dev->map_size - pos)
+		return EIO;
+
+	*out_bytes = &((const char*) dev->map)[pos];
+
+	return 0;
+}
+
+static void lvm2_unix_device_advise(struct lvm2_device *const in_dev,
+		const u64 pos, const u64 count, const lvm2_device_advice advice)
+{
+	static const off_t max_off_t =
+		((off_t) 1) << ((sizeof(off_t) * 8) - 1);
+
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+	int err = 0;
+
+	/* Direct reads don't go through the page cache, so there is nothing
+	 * to read ahead or drop. */
+	if(dev->direct || pos > (u64) max_off_t ||
+		count > (u64) max_off_t - pos)
+	{
+		return;
+	}
+
+#if defined(POSIX_FADV_WILLNEED)
+	err = posix_fadvise(dev->fd, (off_t) pos, (off_t) count,
+		(advice == LVM2_DEVICE_ADVICE_WILLNEED) ?
+		POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+#elif defined(F_RDADVISE)
+	/* Darwin only has a read ahead hint. */
+	if(advice == LVM2_DEVICE_ADVICE_WILLNEED) {
+		struct radvisory ra;
+
+		ra.ra_offset = (off_t) pos;
+		ra.ra_count = (count > INT_MAX) ? INT_MAX : (int) count;
+		if(fcntl(dev->fd, F_RDADVISE, &ra) == -1)
+			err = errno;
+	}
+#else
+	(void) advice;
+#endif
+
+	if(err) {
+		LogDebug("Ignoring error from access hint: %d (%s)", err,
+			strerror(err));
+	}
+}
+
+/* Vectored reads. */
+
+/**
+ * Read the ranges ranges[order[0]] ... ranges[order[run_len - 1]], which are
+ * sorted by position and together span the aligned range
+ * [aligned_start, aligned_end), in one request.
+ */
+static int lvm2_unix_device_read_run(struct lvm2_unix_device *const dev,
+		const struct lvm2_read_range *const ranges,
+		const size_t *const order, const size_t run_len,
+		const u64 aligned_start, const u64 aligned_end)
+{
+	const size_t total = (size_t) (aligned_end - aligned_start);
+
+	int err;
+	ssize_t res;
+	lvm2_bool direct = (run_len <= IOV_MAX) ? LVM2_TRUE : LVM2_FALSE;
+	u64 requested = 0;
+	u64 start_us;
+	size_t i;
+
+	for(i = 0; i < run_len; ++i)
+		requested += ranges[order[i]].count;
+
+	/* If the ranges tile the aligned range exactly, they are read
+	 * straight into their buffers. */
+	for(i = 0; i < run_len && direct; ++i) {
+		const struct lvm2_read_range *const range = &ranges[order[i]];
+
+		if(range->pos != (i ? ranges[order[i - 1]].pos +
+			ranges[order[i - 1]].count : aligned_start) ||
+			range->count % dev->block_size ||
+			!lvm2_unix_device_can_read_into(dev, range->buf->data))
+		{
+			direct = LVM2_FALSE;
+		}
+	}
+
+	if(direct) {
+		struct iovec *iov = NULL;
+
+		err = lvm2_malloc(run_len * sizeof(struct iovec),
+			(void**) &iov);
+		if(err)
+			return err;
+
+		for(i = 0; i < run_len; ++i) {
+			iov[i].iov_base = ranges[order[i]].buf->data;
+			iov[i].iov_len = ranges[order[i]].count;
+		}
+
+		start_us = dev->stats_enabled ? lvm2_unix_now_us() : 0;
+		res = preadv(dev->fd, iov, (int) run_len,
+			(off_t) aligned_start);
+		if(res == -1)
+			err = errno ? errno : EIO;
+		else if(res != (ssize_t) total)
+			err = EIO;
+		else
+			lvm2_unix_device_account(dev, requested, total,
+				start_us);
+
+		lvm2_free((void**) &iov, run_len * sizeof(struct iovec));
+
+		return err;
+	}
+
+	pthread_mutex_lock(&dev->bounce_lock);
+
+	err = lvm2_unix_device_grow_bounce(dev, total);
+	if(!err) {
+		start_us = dev->stats_enabled ? lvm2_unix_now_us() : 0;
+		res = pread(dev->fd, dev->bounce, total, (off_t) aligned_start);
+		if(res == -1)
+			err = errno ? errno : EIO;
+		else if(res != (ssize_t) total)
+			err = EIO;
+		else
+			lvm2_unix_device_account(dev, requested, total,
+				start_us);
 	}
 
+	for(i = 0; i < run_len && !err; ++i) {
+		const struct lvm2_read_range *const range = &ranges[order[i]];
+
+		memcpy(range->buf->data, &((const char*) dev->bounce)[
+			range->pos - aligned_start], range->count);
+	}
+
+	pthread_mutex_unlock(&dev->bounce_lock);
+
+	return err;
+}
+
+static int lvm2_unix_device_readv(struct lvm2_device *const in_dev,
+		const struct lvm2_read_range *const ranges,
+		const size_t ranges_len)
+{
+	static const off_t max_off_t =
+		((off_t) 1) << ((sizeof(off_t) * 8) - 1);
+
+	struct lvm2_unix_device *const dev = (struct lvm2_unix_device*) in_dev;
+
+	int err = 0;
+	size_t *order = NULL;
+	size_t i;
+	size_t j;
+
+	for(i = 0; i < ranges_len; ++i) {
+		if(ranges[i].pos > (u64) max_off_t ||
+			ranges[i].count > ranges[i].buf->size ||
+			ranges[i].count > (u64) max_off_t - ranges[i].pos)
+		{
+			return ERANGE;
+		}
+	}
+
+	/* Mapped devices and devices with a block cache gain nothing from
+	 * merging. */
+	if(dev->map || dev->block_cache || ranges_len < 2) {
+		for(i = 0; i < ranges_len && !err; ++i) {
+			err = lvm2_unix_device_read(&dev->dev, ranges[i].pos,
+				ranges[i].count, ranges[i].buf);
+		}
+
+		return err;
+	}
+
+	err = lvm2_malloc(ranges_len * sizeof(size_t), (void**) &order);
+	if(err)
+		return err;
+
+	/* Sort by position. There are only ever a handful of ranges. */
+	for(i = 0; i < ranges_len; ++i) {
+		for(j = i; j > 0 && ranges[order[j - 1]].pos > ranges[i].pos;
+			--j)
+		{
+			order[j] = order[j - 1];
+		}
+
+		order[j] = i;
+	}
+
+	/* Merge ranges that touch or overlap once aligned. */
+	for(i = 0; i < ranges_len && !err; i = j) {
+		const struct lvm2_read_range *const first = &ranges[order[i]];
+		const u64 aligned_start = first->pos -
+			first->pos % dev->block_size;
+		u64 aligned_end = aligned_start;
+
+		for(j = i; j < ranges_len; ++j) {
+			const struct lvm2_read_range *const range =
+				&ranges[order[j]];
+			const u64 end = range->pos + range->count;
+
+			if(range->pos - range->pos % dev->block_size >
+				aligned_end && j > i)
+			{
+				break;
+			}
+
+			if(end > aligned_end) {
+				aligned_end = (end + dev->block_size - 1) /
+					dev->block_size * dev->block_size;
+			}
+		}
+
+		if(aligned_end - aligned_start > SSIZE_MAX) {
+			err = ERANGE;
+			break;
+		}
+
+		LogDebug("Reading %" FMTzu " range(s) as (%" FMTllu ", "
+			"%" FMTllu ").", ARGzu(j - i), ARGllu(aligned_start),
+			ARGllu(aligned_end - aligned_start));
+
+		err = lvm2_unix_device_read_run(dev, ranges, &order[i], j - i,
+			aligned_start, aligned_end);
+	}
+
+	lvm2_free((void**) &order, ranges_len * sizeof(size_t));
+
 	return err;
 }
 
-u32 lvm2_device_get_alignment(struct lvm2_device *dev)
+static const struct lvm2_device_ops lvm2_unix_device_ops = {
+	/* .read            = */ lvm2_unix_device_read,
+	/* .readv           = */ lvm2_unix_device_readv,
+	/* .get_alignment   = */ lvm2_unix_device_get_alignment,
+	/* .map_range       = */ lvm2_unix_device_map_range,
+	/* .get_stats       = */ lvm2_unix_device_get_stats,
+	/* .set_block_cache = */ lvm2_unix_device_set_block_cache,
+	/* .destroy         = */ lvm2_unix_device_destroy_impl,
+	/* .advise          = */ lvm2_unix_device_advise,
+};
+
+/**
+ * Get the unix device behind 'dev', or NULL if 'dev' belongs to another
+ * backend.
+ */
+static struct lvm2_unix_device* lvm2_unix_device_get(
+		struct lvm2_device *const dev)
 {
-	return dev->block_size;
+	return (dev->ops == &lvm2_unix_device_ops) ?
+		(struct lvm2_unix_device*) dev : NULL;
 }
+
+/* Asynchronous reads. */
+
+/** Number of worker threads of an lvm2_io_queue. */
+#define LVM2_UNIX_IO_QUEUE_THREADS 8
+
+struct lvm2_unix_io_request {
+	struct lvm2_unix_io_request *next;
+	struct lvm2_device *dev;
+	u64 pos;
+	size_t count;
+	struct lvm2_io_buffer *buf;
+	lvm2_device_read_callback completion;
+	void *context;
+	int err;
+};
+
+struct lvm2_unix_io_list {
+	struct lvm2_unix_io_request *head;
+	struct lvm2_unix_io_request *tail;
+};
+
+/*
+ * Reads are handed to a fixed pool of worker threads, which perform them with
+ * lvm2_device_read and move them to the completed list, from where
+ * lvm2_io_queue_poll picks them up.
+ */
+struct lvm2_io_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t submitted_cond;
+	pthread_cond_t completed_cond;
+	struct lvm2_unix_io_list submitted;
+	struct lvm2_unix_io_list completed;
+	size_t in_flight;	/**< Submitted, but not yet polled. */
+	lvm2_bool stopping;
+	size_t threads_len;
+	pthread_t threads[LVM2_UNIX_IO_QUEUE_THREADS];
+};
+
+static void lvm2_unix_io_list_append(struct lvm2_unix_io_list *const list,
+		struct lvm2_unix_io_request *const req)
+{
+	req->next = NULL;
+
+	if(list->tail)
+		list->tail->next = req;
+	else
+		list->head = req;
+
+	list->tail = req;
+}
+
+static void lvm2_unix_io_list_free(struct lvm2_unix_io_list *const list)
+{
+	while(list->head) {
+		struct lvm2_unix_io_request *req = list->head;
+
+		list->head = req->next;
+		lvm2_free((void**) &req, sizeof(struct lvm2_unix_io_request));
+	}
+
+	list->tail = NULL;
+}
+
+static void* lvm2_unix_io_queue_worker(void *const arg)
+{
+	struct lvm2_io_queue *const queue = (struct lvm2_io_queue*) arg;
+
+	pthread_mutex_lock(&queue->lock);
+	for(;;) {
+		struct lvm2_unix_io_request *req;
+
+		while(!queue->submitted.head && !queue->stopping)
+			pthread_cond_wait(&queue->submitted_cond, &queue->lock);
+
+		req = queue->submitted.head;
+		if(!req)
+			break;
+
+		queue->submitted.head = req->next;
+		if(!queue->submitted.head)
+			queue->submitted.tail = NULL;
+
+		pthread_mutex_unlock(&queue->lock);
+		req->err = lvm2_device_read(req->dev, req->pos, req->count,
+			req->buf);
+		pthread_mutex_lock(&queue->lock);
+
+		lvm2_unix_io_list_append(&queue->completed, req);
+		pthread_cond_signal(&queue->completed_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+int lvm2_io_queue_create(struct lvm2_io_queue **const out_queue)
+{
+	int err;
+	struct lvm2_io_queue *queue = NULL;
+
+	err = lvm2_malloc(sizeof(struct lvm2_io_queue), (void**) &queue);
+	if(err) {
+		LogError("Error while allocating memory for struct "
+			"lvm2_io_queue: %d", err);
+		return err;
+	}
+
+	memset(queue, 0, sizeof(struct lvm2_io_queue));
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->submitted_cond, NULL);
+	pthread_cond_init(&queue->completed_cond, NULL);
+
+	for(; queue->threads_len < LVM2_UNIX_IO_QUEUE_THREADS;
+		++queue->threads_len)
+	{
+		err = pthread_create(&queue->threads[queue->threads_len], NULL,
+			lvm2_unix_io_queue_worker, queue);
+		if(err) {
+			LogError("Error while starting I/O thread: %d (%s)",
+				err, strerror(err));
+			break;
+		}
+	}
+
+	if(!queue->threads_len) {
+		lvm2_io_queue_destroy(&queue);
+		return err;
+	}
+
+	*out_queue = queue;
+
+	return 0;
+}
+
+void lvm2_io_queue_destroy(struct lvm2_io_queue **const queue)
+{
+	size_t i;
+
+	pthread_mutex_lock(&(*queue)->lock);
+	(*queue)->stopping = LVM2_TRUE;
+	pthread_cond_broadcast(&(*queue)->submitted_cond);
+	pthread_mutex_unlock(&(*queue)->lock);
+
+	/* The workers finish all submitted reads before they exit. */
+	for(i = 0; i < (*queue)->threads_len; ++i)
+		pthread_join((*queue)->threads[i], NULL);
+
+	lvm2_unix_io_list_free(&(*queue)->completed);
+
+	pthread_cond_destroy(&(*queue)->completed_cond);
+	pthread_cond_destroy(&(*queue)->submitted_cond);
+	pthread_mutex_destroy(&(*queue)->lock);
+	lvm2_free((void**) queue, sizeof(struct lvm2_io_queue));
+}
+
+int lvm2_device_read_async(struct lvm2_io_queue *const queue,
+		struct lvm2_device *const dev, const u64 pos,
+		const size_t count, struct lvm2_io_buffer *const buf,
+		const lvm2_device_read_callback completion,
+		void *const context)
+{
+	int err;
+	struct lvm2_unix_io_request *req;
+
+	err = lvm2_malloc(sizeof(struct lvm2_unix_io_request), (void**) &req);
+	if(err) {
+		LogError("Error while allocating memory for I/O request: %d",
+			err);
+		return err;
+	}
+
+	memset(req, 0, sizeof(struct lvm2_unix_io_request));
+	req->dev = dev;
+	req->pos = pos;
+	req->count = count;
+	req->buf = buf;
+	req->completion = completion;
+	req->context = context;
+
+	pthread_mutex_lock(&queue->lock);
+	lvm2_unix_io_list_append(&queue->submitted, req);
+	++queue->in_flight;
+	pthread_cond_signal(&queue->submitted_cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+size_t lvm2_io_queue_poll(struct lvm2_io_queue *const queue,
+		const lvm2_bool wait)
+{
+	struct lvm2_unix_io_request *req;
+	size_t completed_len = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	while(wait && !queue->completed.head && queue->in_flight)
+		pthread_cond_wait(&queue->completed_cond, &queue->lock);
+
+	req = queue->completed.head;
+	queue->completed.head = NULL;
+	queue->completed.tail = NULL;
+	pthread_mutex_unlock(&queue->lock);
+
+	/* Callbacks run without the lock held, so that they can start new
+	 * reads. */
+	while(req) {
+		struct lvm2_unix_io_request *const next = req->next;
+
+		pthread_mutex_lock(&queue->lock);
+		--queue->in_flight;
+		pthread_mutex_unlock(&queue->lock);
+
+		req->completion(req->context, req->err);
+		lvm2_free((void**) &req, sizeof(struct lvm2_unix_io_request));
+
+		req = next;
+		++completed_len;
+	}
+
+	return completed_len;
+}
+
+/* Batched reads. */
+
+static lvm2_bool lvm2_unix_read_is_aligned(
+		const struct lvm2_unix_device *const dev,
+		const struct lvm2_unix_read_request *const req)
+{
+	return (req->pos % dev->block_size) == 0 &&
+		(req->count % dev->block_size) == 0 &&
+		lvm2_unix_device_can_read_into(dev, req->buf->data) &&
+		req->count <= req->buf->size &&
+		req->count <= SSIZE_MAX;
+}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+/*
+ * io_uring backend, driven through the raw system calls so that we don't
+ * depend on liburing.
+ */
+
+struct lvm2_unix_uring {
+	int fd;
+	u32 entries;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	u32 *sq_head;
+	u32 *sq_tail;
+	u32 *sq_mask;
+	u32 *sq_array;
+
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	u32 *cq_head;
+	u32 *cq_tail;
+	u32 *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static int lvm2_unix_uring_enter(const int fd, const u32 to_submit,
+		const u32 min_complete, const u32 flags)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+int lvm2_unix_uring_create(const u32 entries,
+		struct lvm2_unix_uring **const out_ring)
+{
+	int err;
+	struct io_uring_params params;
+	struct lvm2_unix_uring *ring = NULL;
+	char *sq_ring;
+	char *cq_ring;
+
+	err = lvm2_malloc(sizeof(struct lvm2_unix_uring), (void**) &ring);
+	if(err)
+		return err;
+
+	memset(ring, 0, sizeof(struct lvm2_unix_uring));
+	ring->sq_ring = MAP_FAILED;
+	ring->cq_ring = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+
+	memset(&params, 0, sizeof(struct io_uring_params));
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd == -1) {
+		err = errno ? errno : ENOSYS;
+		LogDebug("io_uring_setup failed: %d (%s)", err, strerror(err));
+		lvm2_free((void**) &ring, sizeof(struct lvm2_unix_uring));
+		return err;
+	}
+
+	ring->entries = params.sq_entries;
+
+	ring->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(u32);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED) {
+		err = errno ? errno : ENOMEM;
+		goto err_out;
+	}
+
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	}
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ring == MAP_FAILED) {
+			err = errno ? errno : ENOMEM;
+			goto err_out;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED) {
+		err = errno ? errno : ENOMEM;
+		goto err_out;
+	}
+
+	sq_ring = (char*) ring->sq_ring;
+	ring->sq_head = (u32*) &sq_ring[params.sq_off.head];
+	ring->sq_tail = (u32*) &sq_ring[params.sq_off.tail];
+	ring->sq_mask = (u32*) &sq_ring[params.sq_off.ring_mask];
+	ring->sq_array = (u32*) &sq_ring[params.sq_off.array];
+
+	cq_ring = (char*) ring->cq_ring;
+	ring->cq_head = (u32*) &cq_ring[params.cq_off.head];
+	ring->cq_tail = (u32*) &cq_ring[params.cq_off.tail];
+	ring->cq_mask = (u32*) &cq_ring[params.cq_off.ring_mask];
+	ring->cqes = (struct io_uring_cqe*) &cq_ring[params.cq_off.cqes];
+
+	*out_ring = ring;
+
+	return 0;
+err_out:
+	LogError("Error while mapping io_uring: %d (%s)", err, strerror(err));
+	lvm2_unix_uring_destroy(&ring);
+
+	return err;
+}
+
+void lvm2_unix_uring_destroy(struct lvm2_unix_uring **const ring)
+{
+	if((*ring)->sqes != MAP_FAILED)
+		munmap((*ring)->sqes, (*ring)->sqes_size);
+	if((*ring)->cq_ring != MAP_FAILED && (*ring)->cq_ring !=
+		(*ring)->sq_ring)
+	{
+		munmap((*ring)->cq_ring, (*ring)->cq_ring_size);
+	}
+	if((*ring)->sq_ring != MAP_FAILED)
+		munmap((*ring)->sq_ring, (*ring)->sq_ring_size);
+
+	close((*ring)->fd);
+
+	lvm2_free((void**) ring, sizeof(struct lvm2_unix_uring));
+}
+
+/**
+ * Reap the completions in the ring, storing their results in 'reqs'. Returns
+ * the number of completions reaped.
+ */
+static u32 lvm2_unix_uring_reap(struct lvm2_unix_uring *const ring,
+		struct lvm2_unix_read_request *const reqs, const u64 start_us)
+{
+	u32 head;
+	u32 reaped = 0;
+
+	head = *ring->cq_head;
+	while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		const struct io_uring_cqe *const cqe =
+			&ring->cqes[head & *ring->cq_mask];
+		struct lvm2_unix_read_request *const req =
+			&reqs[cqe->user_data];
+
+		if(cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+			/* Kernel without IORING_OP_READ. */
+			req->err = ENOSYS;
+		}
+		else if(cqe->res < 0) {
+			req->err = -cqe->res;
+		}
+		else if((size_t) cqe->res != req->count) {
+			/* Same as pread: all or nothing. */
+			req->err = EIO;
+		}
+		else {
+			req->err = 0;
+			lvm2_unix_device_account(lvm2_unix_device_get(req->dev),
+				req->count, req->count, start_us);
+		}
+
+		++head;
+		++reaped;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return reaped;
+}
+
+/**
+ * Submit up to ring->entries reads and wait for all of them to complete.
+ * Requests that io_uring can't handle are left with err set to ENOSYS so that
+ * the caller can fall back to pread. If the ring fails, the reads that were
+ * submitted are still waited for before returning the error, since the kernel
+ * may be writing into their buffers, and the reads that didn't complete are
+ * left with ENOSYS as well.
+ */
+static int lvm2_unix_uring_read_chunk(struct lvm2_unix_uring *const ring,
+		struct lvm2_unix_read_request *const reqs, const size_t reqs_len)
+{
+	int err = 0;
+	u32 tail;
+	u32 to_submit = 0;
+	u32 in_flight = 0;
+	u64 start_us;
+	size_t i;
+
+	tail = *ring->sq_tail;
+	for(i = 0; i < reqs_len; ++i) {
+		struct lvm2_unix_read_request *const req = &reqs[i];
+		const u32 index = tail & *ring->sq_mask;
+		struct io_uring_sqe *const sqe = &ring->sqes[index];
+		struct lvm2_unix_device *dev;
+
+		if(!req->buf)
+			continue;
+
+		/* Until its completion says otherwise, a request is left to
+		 * the fallback. */
+		req->err = ENOSYS;
+
+		/* Only file descriptor backed devices can be read through the
+		 * ring. Mapped devices are faster served by memcpy. */
+		dev = lvm2_unix_device_get(req->dev);
+		if(!dev || dev->map || !lvm2_unix_read_is_aligned(dev, req))
+			continue;
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = dev->fd;
+		sqe->addr = (u64) (uintptr_t) req->buf->data;
+		sqe->len = (u32) req->count;
+		sqe->off = req->pos;
+		sqe->user_data = i;
+
+		ring->sq_array[index] = index;
+		++tail;
+		++to_submit;
+	}
+
+	/* Publish the new entries to the kernel. */
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	start_us = lvm2_unix_now_us();
+
+	while(to_submit || in_flight) {
+		int res;
+
+		res = lvm2_unix_uring_enter(ring->fd, to_submit, 1,
+			IORING_ENTER_GETEVENTS);
+		if(res == -1) {
+			if(errno != EINTR && errno != EAGAIN &&
+				errno != EBUSY)
+			{
+				err = errno ? errno : EIO;
+				break;
+			}
+
+			/* Retry once the completions that are there have
+			 * been reaped, which makes room if the completion
+			 * queue is full (EBUSY). */
+			res = 0;
+		}
+
+		to_submit -= (u32) res;
+		in_flight += (u32) res;
+		in_flight -= lvm2_unix_uring_reap(ring, reqs, start_us);
+	}
+
+	if(err) {
+		/* Take back the entries that the kernel hasn't consumed, so
+		 * that they aren't submitted along with a later chunk. */
+		__atomic_store_n(ring->sq_tail,
+			__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE),
+			__ATOMIC_RELEASE);
+
+		/* The submitted reads complete regardless of the error, so
+		 * wait for them, polling if the ring can't wait for us. */
+		while(in_flight) {
+			if(lvm2_unix_uring_enter(ring->fd, 0, 1,
+				IORING_ENTER_GETEVENTS) == -1)
+			{
+				sched_yield();
+			}
+
+			in_flight -= lvm2_unix_uring_reap(ring, reqs,
+				start_us);
+		}
+	}
+
+	return err;
+}
+
+int lvm2_unix_read_batch(struct lvm2_unix_uring *const ring,
+		struct lvm2_unix_read_request *const reqs, const size_t reqs_len)
+{
+	int err;
+	size_t i;
+
+	if(ring) {
+		for(i = 0; i < reqs_len; i += ring->entries) {
+			const size_t chunk_len =
+				(reqs_len - i < ring->entries) ?
+				reqs_len - i : ring->entries;
+
+			err = lvm2_unix_uring_read_chunk(ring, &reqs[i],
+				chunk_len);
+			if(err) {
+				LogError("Error while submitting reads to "
+					"io_uring, falling back to pread: "
+					"%d (%s)", err, strerror(err));
+				break;
+			}
+		}
+
+		/* Leave the chunks after a failed one to the fallback. */
+		for(i += ring->entries; i < reqs_len; ++i) {
+			if(reqs[i].buf)
+				reqs[i].err = ENOSYS;
+		}
+	}
+	else {
+		for(i = 0; i < reqs_len; ++i) {
+			if(reqs[i].buf)
+				reqs[i].err = ENOSYS;
+		}
+	}
+
+	/* Fall back to pread for whatever io_uring didn't handle. */
+	for(i = 0; i < reqs_len; ++i) {
+		if(reqs[i].buf && reqs[i].err == ENOSYS) {
+			reqs[i].err = lvm2_device_read(reqs[i].dev,
+				reqs[i].pos, reqs[i].count, reqs[i].buf);
+		}
+	}
+
+	return 0;
+}
+
+#else
+
+int lvm2_unix_uring_create(const u32 entries __attribute__((unused)),
+		struct lvm2_unix_uring **const out_ring __attribute__((unused)))
+{
+	return ENOSYS;
+}
+
+void lvm2_unix_uring_destroy(
+		struct lvm2_unix_uring **const ring __attribute__((unused)))
+{
+}
+
+int lvm2_unix_read_batch(
+		struct lvm2_unix_uring *const ring __attribute__((unused)),
+		struct lvm2_unix_read_request *const reqs, const size_t reqs_len)
+{
+	size_t i;
+
+	for(i = 0; i < reqs_len; ++i) {
+		if(reqs[i].buf) {
+			reqs[i].err = lvm2_device_read(reqs[i].dev,
+				reqs[i].pos, reqs[i].count, reqs[i].buf);
+		}
+	}
+
+	return 0;
+}
+
+#endif /* defined(__linux__) && defined(__NR_io_uring_setup) */
@@ -110,7 +110,52 @@
 #define LogDebug(...) do {} while(0)
 #endif /* defined(DEBUG) */
 
+/** Alignment of the data of all lvm2_io_buffers. */
+#define LVM2_UNIX_IO_BUFFER_ALIGNMENT 4096
+
+/** Flags for lvm2_unix_device_create_ex. */
+#define LVM2_UNIX_DEVICE_DIRECT 0x1	/**< Bypass the page cache. */
+#define LVM2_UNIX_DEVICE_STATS 0x2	/**< Collect I/O statistics. */
+
 int lvm2_unix_device_create(const char *name, struct lvm2_device **out_dev);
+
+/**
+ * Open a device. With LVM2_UNIX_DEVICE_DIRECT, reads bypass the page cache
+ * (O_DIRECT, or F_NOCACHE on Darwin) so that scanning doesn't evict the pages
+ * of applications using the same devices. Reads are then aligned to the block
+ * size reported by lvm2_device_get_alignment.
+ */
+int lvm2_unix_device_create_ex(const char *name, u32 flags,
+		struct lvm2_device **out_dev);
+
 void lvm2_unix_device_destroy(struct lvm2_device **dev);
 
+/**
+ * io_uring instance for batched reads. Only available on Linux; elsewhere, or
+ * if the kernel doesn't support io_uring, lvm2_unix_uring_create fails and
+ * batches are served with pread.
+ */
+struct lvm2_unix_uring;
+
+int lvm2_unix_uring_create(u32 entries, struct lvm2_unix_uring **out_ring);
+void lvm2_unix_uring_destroy(struct lvm2_unix_uring **ring);
+
+struct lvm2_unix_read_request {
+	struct lvm2_device *dev;
+	u64 pos;
+	size_t count;
+	struct lvm2_io_buffer *buf;
+	int err;		/**< Result of the read. */
+};
+
+/**
+ * Perform a batch of reads, possibly from different devices, keeping as many
+ * of them in flight at once as 'ring' allows. 'ring' may be NULL, in which
+ * case the reads are done one at a time with pread. The result of each read
+ * is stored in its request, and an error is returned only if the batch as a
+ * whole failed. Requests without a buffer are skipped.
+ */
+int lvm2_unix_read_batch(struct lvm2_unix_uring *ring,
+		struct lvm2_unix_read_request *reqs, size_t reqs_len);
+
 #endif /* !defined(_LVM2_OSAL_UNIX_H) */
@@ -0,0 +1,266 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_parallel_scan.h"
+#include "lvm2_osal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+/** Upper bound for the number of worker threads. */
+#define LVM2_PARALLEL_SCAN_MAX_THREADS 256
+
+struct lvm2_parallel_scan {
+	const char *const *paths;
+	size_t paths_len;
+	u32 device_flags;
+	struct lvm2_scan_result *results;
+	size_t next;		/**< Index of the next path to scan. */
+
+	/* Layouts parsed so far, shared by all workers so that the text of a
+	 * VG is parsed only once. Layout references aren't thread safe, so
+	 * all retains and releases during the scan happen under cache_lock. */
+	pthread_mutex_t cache_lock;
+	struct lvm2_layout_cache *cache;	/**< May be NULL. */
+};
+
+/**
+ * Scan one device into 'result'. Like lvm2_parse_device_ex, all mda_headers
+ * are read first and one copy of each distinct text is parsed, keeping the
+ * layout with the highest seqno. Other copies of a text are only read if the
+ * ones before them fail.
+ */
+static void lvm2_parallel_scan_device(struct lvm2_parallel_scan *const scan,
+		const char *const path, struct lvm2_scan_result *const result)
+{
+	int err;
+	struct lvm2_device *dev = NULL;
+	struct lvm2_mda_info mda_infos[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool have_mda[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	lvm2_bool parsed[LVM2_PV_INFO_MAX_METADATA_AREAS];
+	int mda_err = 0;
+	size_t i;
+
+	memset(have_mda, 0, sizeof(have_mda));
+	memset(parsed, 0, sizeof(parsed));
+
+	err = lvm2_unix_device_create_ex(path, scan->device_flags, &dev);
+	if(err) {
+		LogDebug("Error while opening \"%s\": %d", path, err);
+		result->err = err;
+		return;
+	}
+
+	err = lvm2_read_pv_info(dev, &result->pv_info);
+	if(err) {
+		LogDebug("Error while reading PV label of \"%s\": %d", path,
+			err);
+		result->err = err;
+		goto out;
+	}
+
+	for(i = 0; i < result->pv_info.metadata_areas_len; ++i) {
+		err = lvm2_read_mda_info(dev,
+			&result->pv_info.metadata_areas[i], &mda_infos[i]);
+		if(err) {
+			LogDebug("Error while reading mda_header %" FMTzu " of "
+				"\"%s\": %d", ARGzu(i), path, err);
+			mda_err = err;
+			continue;
+		}
+
+		have_mda[i] = LVM2_TRUE;
+	}
+
+	for(i = 0; i < result->pv_info.metadata_areas_len; ++i) {
+		struct lvm2_mda_info *const mda_info = &mda_infos[i];
+		struct lvm2_layout *layout = NULL;
+		size_t j;
+
+		if(!have_mda[i] || !mda_info->valid)
+			continue;
+
+		for(j = 0; j < i; ++j) {
+			if(parsed[j] && lvm2_mda_info_same_text(&mda_infos[j],
+				mda_info))
+			{
+				break;
+			}
+		}
+
+		if(j < i)
+			continue;
+
+		pthread_mutex_lock(&scan->cache_lock);
+		if(scan->cache) {
+			layout = lvm2_layout_cache_lookup(scan->cache,
+				&result->pv_info, &mda_info->locn);
+		}
+		pthread_mutex_unlock(&scan->cache_lock);
+
+		if(!layout) {
+			err = lvm2_read_text(dev, mda_info->offset,
+				mda_info->size, &mda_info->locn, &layout);
+			if(err) {
+				LogDebug("Error while reading metadata text "
+					"%" FMTzu " of \"%s\": %d", ARGzu(i),
+					path, err);
+				continue;
+			}
+
+			/* Not fatal, the layout just won't be shared. */
+			pthread_mutex_lock(&scan->cache_lock);
+			if(scan->cache && lvm2_layout_cache_insert(scan->cache,
+				&mda_info->locn, layout))
+			{
+				LogError("Error while caching layout.");
+			}
+			pthread_mutex_unlock(&scan->cache_lock);
+		}
+
+		parsed[i] = LVM2_TRUE;
+
+		pthread_mutex_lock(&scan->cache_lock);
+		if(result->layout &&
+			layout->vg->seqno <= result->layout->vg->seqno)
+		{
+			lvm2_layout_release(&layout);
+		}
+		else {
+			if(result->layout)
+				lvm2_layout_release(&result->layout);
+
+			result->layout = layout;
+		}
+		pthread_mutex_unlock(&scan->cache_lock);
+	}
+
+	/* An unreadable mda_header only fails the scan if no other area
+	 * yielded a layout. */
+	if(!result->layout && mda_err)
+		result->err = mda_err;
+
+out:
+	lvm2_unix_device_destroy(&dev);
+}
+
+static void* lvm2_parallel_scan_worker(void *const arg)
+{
+	struct lvm2_parallel_scan *const scan =
+		(struct lvm2_parallel_scan*) arg;
+
+	for(;;) {
+		const size_t index = __atomic_fetch_add(&scan->next, 1,
+			__ATOMIC_RELAXED);
+
+		if(index >= scan->paths_len)
+			break;
+
+		lvm2_parallel_scan_device(scan, scan->paths[index],
+			&scan->results[index]);
+	}
+
+	return NULL;
+}
+
+int lvm2_parallel_scan(const char *const *const paths,
+		const size_t paths_len, size_t threads_len,
+		const u32 device_flags,
+		struct lvm2_scan_result **const out_results)
+{
+	int err;
+	struct lvm2_parallel_scan scan;
+	pthread_t threads[LVM2_PARALLEL_SCAN_MAX_THREADS];
+	size_t started_len = 0;
+	size_t i;
+
+	if(threads_len > paths_len)
+		threads_len = paths_len;
+	if(threads_len > LVM2_PARALLEL_SCAN_MAX_THREADS)
+		threads_len = LVM2_PARALLEL_SCAN_MAX_THREADS;
+	if(!threads_len)
+		threads_len = 1;
+
+	memset(&scan, 0, sizeof(struct lvm2_parallel_scan));
+	scan.paths = paths;
+	scan.paths_len = paths_len;
+	scan.device_flags = device_flags;
+
+	err = lvm2_malloc((paths_len ? paths_len : 1) *
+		sizeof(struct lvm2_scan_result), (void**) &scan.results);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " scan "
+			"results: %d", ARGzu(paths_len), err);
+		return err;
+	}
+
+	memset(scan.results, 0, paths_len * sizeof(struct lvm2_scan_result));
+	for(i = 0; i < paths_len; ++i)
+		scan.results[i].path = paths[i];
+
+	pthread_mutex_init(&scan.cache_lock, NULL);
+	if(lvm2_layout_cache_create(&scan.cache)) {
+		LogError("Error while creating layout cache, layouts won't be "
+			"shared.");
+		scan.cache = NULL;
+	}
+
+	for(; started_len < threads_len; ++started_len) {
+		err = pthread_create(&threads[started_len], NULL,
+			lvm2_parallel_scan_worker, &scan);
+		if(err) {
+			LogError("Error while starting scan thread: %d (%s)",
+				err, strerror(err));
+			break;
+		}
+	}
+
+	/* If no thread could be started, scan everything right here. */
+	if(!started_len)
+		lvm2_parallel_scan_worker(&scan);
+
+	for(i = 0; i < started_len; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* The results hold references of their own. */
+	if(scan.cache)
+		lvm2_layout_cache_destroy(&scan.cache);
+	pthread_mutex_destroy(&scan.cache_lock);
+
+	*out_results = scan.results;
+
+	return 0;
+}
+
+void lvm2_parallel_scan_results_destroy(struct lvm2_scan_result **results,
+		const size_t results_len)
+{
+	size_t i;
+
+	for(i = 0; i < results_len; ++i) {
+		if((*results)[i].layout)
+			lvm2_layout_release(&(*results)[i].layout);
+	}
+
+	lvm2_free((void**) results,
+		(results_len ? results_len : 1) *
+		sizeof(struct lvm2_scan_result));
+}
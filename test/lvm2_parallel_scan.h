@@ -0,0 +1,60 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_parallel_scan.h - Scanning many devices on a pool of threads.
+ *
+ * The devices are handed out one at a time to a fixed number of worker
+ * threads, so that the time a scan takes is bounded by its slowest devices
+ * rather than by the sum of all of them. Each result is stored at the index of
+ * its device, so the results don't depend on which worker scanned what or in
+ * which order the scans finished.
+ */
+
+#if !defined(_LVM2_PARALLEL_SCAN_H)
+#define _LVM2_PARALLEL_SCAN_H
+
+#include "lvm2_text.h"
+
+struct lvm2_scan_result {
+	const char *path;		/**< As passed to the scan. */
+	int err;			/**< 0, or why the scan failed. */
+	struct lvm2_pv_info pv_info;	/**< Valid if 'err' is 0. */
+
+	/**
+	 * Layout with the highest seqno of all metadata areas of the PV, or
+	 * NULL if none verified and parsed. Holds a reference of its own.
+	 */
+	struct lvm2_layout *layout;
+};
+
+/**
+ * Scan the devices at 'paths' on 'threads_len' worker threads, opening them
+ * with lvm2_unix_device_create_ex and 'device_flags'. On success,
+ * '*out_results' holds one result per path, in the order of 'paths'. Errors
+ * scanning individual devices are stored in their results. Only failures of
+ * the scan as a whole are returned.
+ */
+int lvm2_parallel_scan(const char *const *paths, size_t paths_len,
+		size_t threads_len, u32 device_flags,
+		struct lvm2_scan_result **out_results);
+
+void lvm2_parallel_scan_results_destroy(struct lvm2_scan_result **results,
+		size_t results_len);
+
+#endif /* !defined(_LVM2_PARALLEL_SCAN_H) */
@@ -0,0 +1,745 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "lvm2_scan_pipeline.h"
+#include "lvm2_endians.h"
+#include "lvm2_osal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+/** Upper bound for the number of worker threads. */
+#define LVM2_SCAN_PIPELINE_MAX_THREADS 256
+
+/** Initial capacity of the task deque of a worker. */
+#define LVM2_SCAN_PIPELINE_DEQUE_CAPACITY 64
+
+typedef enum {
+	LVM2_SCAN_STAGE_LABEL_READ,	/**< Open the device, read the label. */
+	LVM2_SCAN_STAGE_PV_DECODE,	/**< Decode the pv_header. */
+	LVM2_SCAN_STAGE_MDA_READ,	/**< Read the mda_header and text. */
+	LVM2_SCAN_STAGE_TEXT_VERIFY,	/**< Verify the checksum of the text. */
+	LVM2_SCAN_STAGE_TEXT_PARSE,	/**< Parse the text into a layout. */
+	LVM2_SCAN_STAGE_ASSEMBLE,	/**< Store the layout in the result. */
+} lvm2_scan_stage;
+
+/**
+ * Per-device state. Once the label has been decoded, the tasks of a device
+ * (one per metadata area) run independently of each other, and the last one
+ * to finish closes the device and picks the layout with the highest seqno.
+ */
+struct lvm2_scan_device {
+	struct lvm2_device *dev;
+	size_t tasks_len;	/**< Unfinished tasks of the device (atomic). */
+
+	/**
+	 * Error of each metadata area. The first one is reported if no area
+	 * yielded a layout.
+	 */
+	int area_errs[LVM2_PV_INFO_MAX_METADATA_AREAS];
+
+	/** Layout of each metadata area, or NULL. */
+	struct lvm2_layout *area_layouts[LVM2_PV_INFO_MAX_METADATA_AREAS];
+};
+
+struct lvm2_scan_task {
+	lvm2_scan_stage stage;
+	size_t device_index;
+	size_t area_index;
+
+	/* Bytes read by the last I/O stage. 'buffer' is NULL if the bytes are
+	 * mapped from the device. */
+	struct lvm2_io_buffer *buffer;
+	const void *bytes;
+	size_t bytes_len;
+
+	struct lvm2_mda_info mda_info;
+	struct lvm2_layout *layout;
+};
+
+/**
+ * Task deque of a worker. The owner pushes and pops at the tail, so it runs
+ * the follow-ups of its own tasks first, while other workers steal from the
+ * head, where the oldest (and usually largest) pieces of work are.
+ */
+struct lvm2_scan_worker {
+	struct lvm2_scan_pipeline *pipeline;
+	size_t index;
+	pthread_t thread;
+
+	pthread_mutex_t lock;
+	struct lvm2_scan_task **tasks;	/**< Ring buffer of 'capacity'. */
+	size_t capacity;
+	size_t head;
+	size_t len;
+};
+
+struct lvm2_scan_pipeline {
+	const char *const *paths;
+	u32 device_flags;
+	struct lvm2_scan_result *results;
+	struct lvm2_scan_device *devices;
+
+	struct lvm2_scan_worker *workers;
+	size_t workers_len;
+
+	/* Tasks sitting in a deque and tasks that haven't finished yet
+	 * (atomic). Workers sleep on 'idle_cond' while there is nothing to
+	 * steal, and leave once nothing is outstanding. */
+	size_t queued;
+	size_t outstanding;
+	size_t idle_len;
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+
+	/* Layouts parsed so far, as in lvm2_parallel_scan. */
+	pthread_mutex_t cache_lock;
+	struct lvm2_layout_cache *cache;	/**< May be NULL. */
+};
+
+static int lvm2_scan_task_create(const size_t device_index,
+		const size_t area_index, struct lvm2_scan_task **const out_task)
+{
+	int err;
+	struct lvm2_scan_task *task = NULL;
+
+	err = lvm2_malloc(sizeof(struct lvm2_scan_task), (void**) &task);
+	if(err) {
+		LogError("Error while allocating memory for scan task: %d",
+			err);
+		return err;
+	}
+
+	memset(task, 0, sizeof(struct lvm2_scan_task));
+	task->device_index = device_index;
+	task->area_index = area_index;
+
+	*out_task = task;
+
+	return 0;
+}
+
+static void lvm2_scan_task_release_bytes(struct lvm2_scan_task *const task)
+{
+	if(task->buffer)
+		lvm2_io_buffer_destroy(&task->buffer);
+
+	task->bytes = NULL;
+	task->bytes_len = 0;
+}
+
+static int lvm2_scan_worker_push(struct lvm2_scan_worker *const worker,
+		struct lvm2_scan_task *const task)
+{
+	struct lvm2_scan_pipeline *const pipeline = worker->pipeline;
+
+	pthread_mutex_lock(&worker->lock);
+	if(worker->len == worker->capacity) {
+		int err;
+		struct lvm2_scan_task **tasks = NULL;
+		const size_t capacity = worker->capacity ?
+			worker->capacity * 2 : LVM2_SCAN_PIPELINE_DEQUE_CAPACITY;
+		size_t i;
+
+		err = lvm2_malloc(capacity * sizeof(struct lvm2_scan_task*),
+			(void**) &tasks);
+		if(err) {
+			pthread_mutex_unlock(&worker->lock);
+			LogError("Error while growing task deque: %d", err);
+			return err;
+		}
+
+		for(i = 0; i < worker->len; ++i) {
+			tasks[i] = worker->tasks[(worker->head + i) %
+				worker->capacity];
+		}
+
+		if(worker->tasks) {
+			lvm2_free((void**) &worker->tasks, worker->capacity *
+				sizeof(struct lvm2_scan_task*));
+		}
+
+		worker->tasks = tasks;
+		worker->capacity = capacity;
+		worker->head = 0;
+	}
+
+	worker->tasks[(worker->head + worker->len) % worker->capacity] = task;
+	++worker->len;
+	pthread_mutex_unlock(&worker->lock);
+
+	/* A worker going to sleep registers in 'idle_len' before it checks
+	 * 'queued', so one of the two sees the other's update. */
+	__atomic_add_fetch(&pipeline->queued, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&pipeline->idle_len, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&pipeline->idle_lock);
+		pthread_cond_signal(&pipeline->idle_cond);
+		pthread_mutex_unlock(&pipeline->idle_lock);
+	}
+
+	return 0;
+}
+
+static struct lvm2_scan_task* lvm2_scan_worker_take(
+		struct lvm2_scan_worker *const worker, const lvm2_bool steal)
+{
+	struct lvm2_scan_task *task = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if(worker->len) {
+		if(steal) {
+			task = worker->tasks[worker->head];
+			worker->head = (worker->head + 1) % worker->capacity;
+		}
+		else {
+			task = worker->tasks[(worker->head + worker->len - 1) %
+				worker->capacity];
+		}
+
+		--worker->len;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	if(task) {
+		__atomic_sub_fetch(&worker->pipeline->queued, 1,
+			__ATOMIC_SEQ_CST);
+	}
+
+	return task;
+}
+
+/**
+ * Read [pos, pos + count) of 'dev' into 'task', mapping the range if the
+ * device allows it.
+ */
+static int lvm2_scan_task_read(struct lvm2_scan_task *const task,
+		struct lvm2_device *const dev, const u64 pos,
+		const size_t count)
+{
+	const u32 alignment = lvm2_device_get_alignment(dev);
+
+	int err;
+	u64 read_pos;
+	size_t read_len;
+	const void *mapped;
+
+	if(!lvm2_device_map_range(dev, pos, count, &mapped)) {
+		task->bytes = mapped;
+		task->bytes_len = count;
+		return 0;
+	}
+
+	read_pos = pos - pos % alignment;
+	read_len = (size_t) ((pos + count + alignment - 1) / alignment *
+		alignment - read_pos);
+
+	err = lvm2_io_buffer_create(read_len, &task->buffer);
+	if(err) {
+		LogError("Error while allocating read buffer (%" FMTzu " "
+			"bytes).", ARGzu(read_len));
+		return err;
+	}
+
+	err = lvm2_device_read(dev, read_pos, read_len, task->buffer);
+	if(err) {
+		lvm2_io_buffer_destroy(&task->buffer);
+		return err;
+	}
+
+	task->bytes = (const char*) lvm2_io_buffer_get_bytes(task->buffer) +
+		(size_t) (pos - read_pos);
+	task->bytes_len = count;
+
+	return 0;
+}
+
+/**
+ * Run one stage of 'task'. Returns LVM2_TRUE if the task moved on to its next
+ * stage and should be queued again, LVM2_FALSE if it is done.
+ */
+static lvm2_bool lvm2_scan_task_run(struct lvm2_scan_worker *const worker,
+		struct lvm2_scan_task *const task)
+{
+	struct lvm2_scan_pipeline *const pipeline = worker->pipeline;
+	struct lvm2_scan_result *const result =
+		&pipeline->results[task->device_index];
+	struct lvm2_scan_device *const device =
+		&pipeline->devices[task->device_index];
+	const struct lvm2_disk_area *const area =
+		&result->pv_info.metadata_areas[task->area_index];
+
+	int err;
+	size_t i;
+	u64 text_offset;
+	u64 text_size;
+
+	switch(task->stage) {
+	case LVM2_SCAN_STAGE_LABEL_READ:
+		err = lvm2_unix_device_create_ex(result->path,
+			pipeline->device_flags, &device->dev);
+		if(err) {
+			LogDebug("Error while opening \"%s\": %d",
+				result->path, err);
+			result->err = err;
+			return LVM2_FALSE;
+		}
+
+		err = lvm2_scan_task_read(task, device->dev, 0,
+			LVM_LABEL_SCAN_SECTORS * LVM_SECTOR_SIZE);
+		if(err) {
+			LogError("Error while reading label scan sectors.");
+			result->err = err;
+			return LVM2_FALSE;
+		}
+
+		task->stage = LVM2_SCAN_STAGE_PV_DECODE;
+		return LVM2_TRUE;
+	case LVM2_SCAN_STAGE_PV_DECODE:
+		err = lvm2_parse_pv_info(task->bytes, task->bytes_len,
+			&result->pv_info);
+		lvm2_scan_task_release_bytes(task);
+		if(err) {
+			LogDebug("Error while reading PV label of \"%s\": %d",
+				result->path, err);
+			result->err = err;
+			return LVM2_FALSE;
+		}
+
+		if(!result->pv_info.metadata_areas_len)
+			return LVM2_FALSE;
+
+		/* This task carries on with the first area, the others get
+		 * tasks of their own that idle workers can pick up. */
+		for(i = 1; i < result->pv_info.metadata_areas_len; ++i) {
+			struct lvm2_scan_task *area_task = NULL;
+
+			if(lvm2_scan_task_create(task->device_index, i,
+				&area_task))
+			{
+				device->area_errs[i] = ENOMEM;
+				continue;
+			}
+
+			area_task->stage = LVM2_SCAN_STAGE_MDA_READ;
+			__atomic_add_fetch(&device->tasks_len, 1,
+				__ATOMIC_RELAXED);
+			__atomic_add_fetch(&pipeline->outstanding, 1,
+				__ATOMIC_SEQ_CST);
+			if(lvm2_scan_worker_push(worker, area_task)) {
+				__atomic_sub_fetch(&pipeline->outstanding, 1,
+					__ATOMIC_SEQ_CST);
+				__atomic_sub_fetch(&device->tasks_len, 1,
+					__ATOMIC_RELAXED);
+				lvm2_free((void**) &area_task,
+					sizeof(struct lvm2_scan_task));
+				device->area_errs[i] = ENOMEM;
+			}
+		}
+
+		task->stage = LVM2_SCAN_STAGE_MDA_READ;
+		return LVM2_TRUE;
+	case LVM2_SCAN_STAGE_MDA_READ:
+		err = lvm2_scan_task_read(task, device->dev, area->offset,
+			LVM_MDA_HEADER_SIZE);
+		if(err) {
+			LogDebug("Error while reading mda_header %" FMTzu " of "
+				"\"%s\": %d", ARGzu(task->area_index),
+				result->path, err);
+			device->area_errs[task->area_index] = err;
+			return LVM2_FALSE;
+		}
+
+		lvm2_parse_mda_info(task->bytes, area, &task->mda_info);
+		lvm2_scan_task_release_bytes(task);
+		if(!task->mda_info.valid)
+			return LVM2_FALSE;
+
+		pthread_mutex_lock(&pipeline->cache_lock);
+		if(pipeline->cache) {
+			task->layout = lvm2_layout_cache_lookup(
+				pipeline->cache, &result->pv_info,
+				&task->mda_info.locn);
+		}
+		pthread_mutex_unlock(&pipeline->cache_lock);
+
+		if(task->layout) {
+			task->stage = LVM2_SCAN_STAGE_ASSEMBLE;
+			return LVM2_TRUE;
+		}
+
+		text_offset = le64_to_cpu(task->mda_info.locn.offset);
+		text_size = le64_to_cpu(task->mda_info.locn.size);
+		if(text_offset >= area->size ||
+			text_size > area->size - text_offset)
+		{
+			LogError("Metadata text %" FMTzu " of \"%s\" out of "
+				"range for its metadata area.",
+				ARGzu(task->area_index), result->path);
+			return LVM2_FALSE;
+		}
+
+		err = lvm2_scan_task_read(task, device->dev,
+			area->offset + text_offset, (size_t) text_size);
+		if(err) {
+			LogDebug("Error while reading metadata text %" FMTzu
+				" of \"%s\": %d", ARGzu(task->area_index),
+				result->path, err);
+			return LVM2_FALSE;
+		}
+
+		task->stage = LVM2_SCAN_STAGE_TEXT_VERIFY;
+		return LVM2_TRUE;
+	case LVM2_SCAN_STAGE_TEXT_VERIFY:
+		if(!lvm2_text_checksum_matches((const char*) task->bytes,
+			task->bytes_len, &task->mda_info.locn))
+		{
+			LogError("Checksum mismatch in metadata text %" FMTzu
+				" of \"%s\".", ARGzu(task->area_index),
+				result->path);
+			lvm2_scan_task_release_bytes(task);
+			return LVM2_FALSE;
+		}
+
+		task->stage = LVM2_SCAN_STAGE_TEXT_PARSE;
+		return LVM2_TRUE;
+	case LVM2_SCAN_STAGE_TEXT_PARSE:
+		err = lvm2_parse_layout_text((const char*) task->bytes,
+			task->bytes_len, &task->layout);
+		lvm2_scan_task_release_bytes(task);
+		if(err) {
+			LogDebug("Error while parsing metadata text %" FMTzu
+				" of \"%s\": %d", ARGzu(task->area_index),
+				result->path, err);
+			return LVM2_FALSE;
+		}
+
+		task->stage = LVM2_SCAN_STAGE_ASSEMBLE;
+		return LVM2_TRUE;
+	case LVM2_SCAN_STAGE_ASSEMBLE:
+		/* Another task may have parsed the same text in the meantime,
+		 * in which case its layout is kept and this one dropped. */
+		pthread_mutex_lock(&pipeline->cache_lock);
+		if(pipeline->cache) {
+			struct lvm2_layout *const cached =
+				lvm2_layout_cache_lookup(pipeline->cache,
+				&result->pv_info, &task->mda_info.locn);
+
+			if(!cached) {
+				/* Not fatal, the layout just won't be
+				 * shared. */
+				if(lvm2_layout_cache_insert(pipeline->cache,
+					&task->mda_info.locn, task->layout))
+				{
+					LogError("Error while caching "
+						"layout.");
+				}
+			}
+			else {
+				lvm2_layout_release(&task->layout);
+				task->layout = cached;
+			}
+		}
+		pthread_mutex_unlock(&pipeline->cache_lock);
+
+		device->area_layouts[task->area_index] = task->layout;
+		task->layout = NULL;
+		return LVM2_FALSE;
+	}
+
+	return LVM2_FALSE;
+}
+
+/** Finish the device of a task that is done. */
+static void lvm2_scan_device_finish(struct lvm2_scan_pipeline *const pipeline,
+		const size_t device_index)
+{
+	struct lvm2_scan_result *const result =
+		&pipeline->results[device_index];
+	struct lvm2_scan_device *const device =
+		&pipeline->devices[device_index];
+	size_t i;
+
+	if(__atomic_sub_fetch(&device->tasks_len, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	/* Keep the layout with the highest seqno, the first of equal ones,
+	 * as lvm2_parallel_scan does. Copies of the same text that were
+	 * parsed by concurrent tasks are dropped here. */
+	pthread_mutex_lock(&pipeline->cache_lock);
+	for(i = 0; i < result->pv_info.metadata_areas_len; ++i) {
+		struct lvm2_layout *layout = device->area_layouts[i];
+
+		if(!layout)
+			continue;
+
+		device->area_layouts[i] = NULL;
+		if(result->layout &&
+			layout->vg->seqno <= result->layout->vg->seqno)
+		{
+			lvm2_layout_release(&layout);
+			continue;
+		}
+
+		if(result->layout)
+			lvm2_layout_release(&result->layout);
+
+		result->layout = layout;
+	}
+	pthread_mutex_unlock(&pipeline->cache_lock);
+
+	/* A failing area only fails the scan if no other area yielded a
+	 * layout. */
+	if(!result->layout) {
+		for(i = 0; i < result->pv_info.metadata_areas_len; ++i) {
+			if(device->area_errs[i]) {
+				result->err = device->area_errs[i];
+				break;
+			}
+		}
+	}
+
+	if(device->dev)
+		lvm2_unix_device_destroy(&device->dev);
+}
+
+static void* lvm2_scan_pipeline_worker(void *const arg)
+{
+	struct lvm2_scan_worker *const worker = (struct lvm2_scan_worker*) arg;
+	struct lvm2_scan_pipeline *const pipeline = worker->pipeline;
+
+	for(;;) {
+		struct lvm2_scan_task *task;
+		size_t i;
+
+		task = lvm2_scan_worker_take(worker, LVM2_FALSE);
+		for(i = 1; !task && i < pipeline->workers_len; ++i) {
+			task = lvm2_scan_worker_take(&pipeline->workers[
+				(worker->index + i) % pipeline->workers_len],
+				LVM2_TRUE);
+		}
+
+		if(task) {
+			if(lvm2_scan_task_run(worker, task) &&
+				!lvm2_scan_worker_push(worker, task))
+			{
+				continue;
+			}
+
+			lvm2_scan_task_release_bytes(task);
+			if(task->layout) {
+				pthread_mutex_lock(&pipeline->cache_lock);
+				lvm2_layout_release(&task->layout);
+				pthread_mutex_unlock(&pipeline->cache_lock);
+			}
+
+			lvm2_scan_device_finish(pipeline, task->device_index);
+			lvm2_free((void**) &task, sizeof(struct lvm2_scan_task));
+
+			if(!__atomic_sub_fetch(&pipeline->outstanding, 1,
+				__ATOMIC_SEQ_CST))
+			{
+				pthread_mutex_lock(&pipeline->idle_lock);
+				pthread_cond_broadcast(&pipeline->idle_cond);
+				pthread_mutex_unlock(&pipeline->idle_lock);
+			}
+
+			continue;
+		}
+
+		pthread_mutex_lock(&pipeline->idle_lock);
+		__atomic_add_fetch(&pipeline->idle_len, 1, __ATOMIC_SEQ_CST);
+		while(!__atomic_load_n(&pipeline->queued, __ATOMIC_SEQ_CST) &&
+			__atomic_load_n(&pipeline->outstanding,
+			__ATOMIC_SEQ_CST))
+		{
+			pthread_cond_wait(&pipeline->idle_cond,
+				&pipeline->idle_lock);
+		}
+		__atomic_sub_fetch(&pipeline->idle_len, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pipeline->idle_lock);
+
+		if(!__atomic_load_n(&pipeline->outstanding, __ATOMIC_SEQ_CST))
+			break;
+	}
+
+	return NULL;
+}
+
+int lvm2_pipeline_scan(const char *const *const paths,
+		const size_t paths_len, size_t threads_len,
+		const u32 device_flags,
+		struct lvm2_scan_result **const out_results)
+{
+	int err;
+	struct lvm2_scan_pipeline pipeline;
+	size_t started_len = 0;
+	size_t i;
+
+	if(threads_len > paths_len)
+		threads_len = paths_len;
+	if(threads_len > LVM2_SCAN_PIPELINE_MAX_THREADS)
+		threads_len = LVM2_SCAN_PIPELINE_MAX_THREADS;
+	if(!threads_len)
+		threads_len = 1;
+
+	memset(&pipeline, 0, sizeof(struct lvm2_scan_pipeline));
+	pipeline.paths = paths;
+	pipeline.device_flags = device_flags;
+	pipeline.workers_len = threads_len;
+
+	err = lvm2_malloc((paths_len ? paths_len : 1) *
+		sizeof(struct lvm2_scan_result), (void**) &pipeline.results);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " scan "
+			"results: %d", ARGzu(paths_len), err);
+		goto err_out;
+	}
+
+	memset(pipeline.results, 0,
+		paths_len * sizeof(struct lvm2_scan_result));
+	for(i = 0; i < paths_len; ++i)
+		pipeline.results[i].path = paths[i];
+
+	err = lvm2_malloc((paths_len ? paths_len : 1) *
+		sizeof(struct lvm2_scan_device), (void**) &pipeline.devices);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " scan "
+			"devices: %d", ARGzu(paths_len), err);
+		goto err_out;
+	}
+
+	memset(pipeline.devices, 0,
+		paths_len * sizeof(struct lvm2_scan_device));
+
+	err = lvm2_malloc(threads_len * sizeof(struct lvm2_scan_worker),
+		(void**) &pipeline.workers);
+	if(err) {
+		LogError("Error while allocating memory for %" FMTzu " scan "
+			"workers: %d", ARGzu(threads_len), err);
+		goto err_out;
+	}
+
+	memset(pipeline.workers, 0,
+		threads_len * sizeof(struct lvm2_scan_worker));
+	for(i = 0; i < threads_len; ++i) {
+		pipeline.workers[i].pipeline = &pipeline;
+		pipeline.workers[i].index = i;
+		pthread_mutex_init(&pipeline.workers[i].lock, NULL);
+	}
+
+	pthread_mutex_init(&pipeline.idle_lock, NULL);
+	pthread_cond_init(&pipeline.idle_cond, NULL);
+	pthread_mutex_init(&pipeline.cache_lock, NULL);
+	if(lvm2_layout_cache_create(&pipeline.cache)) {
+		LogError("Error while creating layout cache, layouts won't be "
+			"shared.");
+		pipeline.cache = NULL;
+	}
+
+	/* Deal the label reads out round robin, the workers balance the rest
+	 * among themselves. */
+	for(i = 0; i < paths_len; ++i) {
+		struct lvm2_scan_task *task = NULL;
+
+		if(!lvm2_scan_task_create(i, 0, &task)) {
+			task->stage = LVM2_SCAN_STAGE_LABEL_READ;
+			pipeline.devices[i].tasks_len = 1;
+			++pipeline.outstanding;
+			if(!lvm2_scan_worker_push(
+				&pipeline.workers[i % threads_len], task))
+			{
+				continue;
+			}
+
+			--pipeline.outstanding;
+			pipeline.devices[i].tasks_len = 0;
+			lvm2_free((void**) &task,
+				sizeof(struct lvm2_scan_task));
+		}
+
+		pipeline.results[i].err = ENOMEM;
+	}
+
+	for(; started_len < threads_len; ++started_len) {
+		err = pthread_create(&pipeline.workers[started_len].thread,
+			NULL, lvm2_scan_pipeline_worker,
+			&pipeline.workers[started_len]);
+		if(err) {
+			LogError("Error while starting scan thread: %d (%s)",
+				err, strerror(err));
+			break;
+		}
+	}
+
+	/* If no thread could be started, run everything right here. Tasks in
+	 * the deques of workers that didn't start are stolen by the others. */
+	if(!started_len)
+		lvm2_scan_pipeline_worker(&pipeline.workers[0]);
+
+	for(i = 0; i < started_len; ++i)
+		pthread_join(pipeline.workers[i].thread, NULL);
+
+	/* The results hold references of their own. */
+	if(pipeline.cache)
+		lvm2_layout_cache_destroy(&pipeline.cache);
+	pthread_mutex_destroy(&pipeline.cache_lock);
+	pthread_cond_destroy(&pipeline.idle_cond);
+	pthread_mutex_destroy(&pipeline.idle_lock);
+
+	for(i = 0; i < threads_len; ++i) {
+		struct lvm2_scan_worker *const worker = &pipeline.workers[i];
+
+		if(worker->tasks) {
+			lvm2_free((void**) &worker->tasks, worker->capacity *
+				sizeof(struct lvm2_scan_task*));
+		}
+
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	lvm2_free((void**) &pipeline.workers,
+		threads_len * sizeof(struct lvm2_scan_worker));
+	lvm2_free((void**) &pipeline.devices,
+		(paths_len ? paths_len : 1) * sizeof(struct lvm2_scan_device));
+
+	*out_results = pipeline.results;
+
+	return 0;
+err_out:
+	if(pipeline.workers) {
+		lvm2_free((void**) &pipeline.workers,
+			threads_len * sizeof(struct lvm2_scan_worker));
+	}
+
+	if(pipeline.devices) {
+		lvm2_free((void**) &pipeline.devices,
+			(paths_len ? paths_len : 1) *
+			sizeof(struct lvm2_scan_device));
+	}
+
+	if(pipeline.results) {
+		lvm2_free((void**) &pipeline.results,
+			(paths_len ? paths_len : 1) *
+			sizeof(struct lvm2_scan_result));
+	}
+
+	return err;
+}
@@ -0,0 +1,47 @@
+/*-
+ * Copyright (C) 2012 Erik Larsson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * lvm2_scan_pipeline.h - Scanning many devices as a pipeline of small tasks.
+ *
+ * Where lvm2_parallel_scan hands out whole devices, the pipeline splits the
+ * scan of each device into stages (label read, pv_header decode, mda read,
+ * text checksum, text parse and assembly of the results) and runs every stage
+ * as a task of its own on a work-stealing scheduler. A worker runs the tasks it
+ * spawns itself first, so a device tends to stay on one worker, while idle
+ * workers steal the oldest pending tasks of busy ones. A device with a large
+ * metadata text thus only holds up the worker parsing it, and reads are issued
+ * while other workers parse.
+ */
+
+#if !defined(_LVM2_SCAN_PIPELINE_H)
+#define _LVM2_SCAN_PIPELINE_H
+
+#include "lvm2_parallel_scan.h"
+
+/**
+ * Same as lvm2_parallel_scan, but scheduled as a pipeline on 'threads_len'
+ * workers. The results are destroyed with
+ * lvm2_parallel_scan_results_destroy. Unlike lvm2_parallel_scan, texts
+ * whose checksum doesn't match are skipped.
+ */
+int lvm2_pipeline_scan(const char *const *paths, size_t paths_len,
+		size_t threads_len, u32 device_flags,
+		struct lvm2_scan_result **out_results);
+
+#endif /* !defined(_LVM2_SCAN_PIPELINE_H) */